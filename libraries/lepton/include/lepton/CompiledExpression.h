@@ -52,16 +52,27 @@ class ParsedExpression;
  * it many times as quickly as possible.  You should treat it as an opaque object; none of the internal representation
  * is visible.
  * 
- * A CompiledExpression is created by calling createCompiledExpression() on a ParsedExpression.
+ * A CompiledExpression is created by calling createCompiledExpression() on a ParsedExpression.  Alternatively, you
+ * can create one from a list of ParsedExpressions.  In that case every call to evaluate() computes all of them at
+ * once, sharing any subexpressions they have in common, and you retrieve the results with getOutput().
  * 
  * WARNING: CompiledExpression is NOT thread safe.  You should never access a CompiledExpression from two threads at
- * the same time.
+ * the same time.  Instead, give each thread its own copy.  Copying is cheap: when JIT compilation is enabled, the
+ * generated machine code is immutable and is shared by all copies, as well as by any other CompiledExpressions
+ * that compile to an identical program.
  */
 
 class LEPTON_EXPORT CompiledExpression {
 public:
     CompiledExpression();
     CompiledExpression(const CompiledExpression& expression);
+    /**
+     * Create a CompiledExpression that evaluates several expressions together.  Subexpressions that appear
+     * in more than one of them are only computed once.
+     *
+     * @param expressions   the expressions to evaluate.  The value of expressions[i] is returned by getOutput(i).
+     */
+    CompiledExpression(const std::vector<ParsedExpression>& expressions);
     ~CompiledExpression();
     CompiledExpression& operator=(const CompiledExpression& expression);
     /**
@@ -74,16 +85,33 @@ public:
      */
     double& getVariableReference(const std::string& name);
     /**
-     * Evaluate the expression.  The values of all variables should have been set before calling this.
+     * Evaluate the expression.  The values of all variables should have been set before calling this.  If this
+     * object was created from several expressions, all of them are evaluated, and the value of the first one is
+     * returned.
      */
     double evaluate() const;
+    /**
+     * Get the number of expressions that are computed by evaluate().
+     */
+    int getNumOutputs() const;
+    /**
+     * Get the value of one of the expressions, as computed by the most recent call to evaluate().
+     *
+     * @param index   the index of the expression to get the value of
+     */
+    double getOutput(int index) const {
+        return outputs[index];
+    }
 private:
     friend class ParsedExpression;
     CompiledExpression(const ParsedExpression& expression);
+    void compileExpressions(const std::vector<ParsedExpression>& expressions);
     void compileExpression(const ExpressionTreeNode& node, std::vector<std::pair<ExpressionTreeNode, int> >& temps);
     int findTempIndex(const ExpressionTreeNode& node, std::vector<std::pair<ExpressionTreeNode, int> >& temps);
     std::vector<std::vector<int> > arguments;
     std::vector<int> target;
+    std::vector<int> outputIndex;
+    mutable std::vector<double> outputs;
     std::vector<Operation*> operation;
     std::map<std::string, int> variableIndices;
     std::set<std::string> variableNames;
@@ -92,10 +120,14 @@ private:
     std::map<std::string, double> dummyVariables;
     void* jitCode;
 #ifdef LEPTON_USE_JIT
+    class JitCode;
+    std::string createJitKey() const;
     void generateJitCode();
-    void generateSingleArgCall(asmjit::X86Compiler& c, asmjit::X86XmmVar& dest, asmjit::X86XmmVar& arg, double (*function)(double));
-    std::vector<double> constants;
-    asmjit::JitRuntime runtime;
+    void generateJitCode(JitCode& code) const;
+    void releaseJitCode();
+    void generateSingleArgCall(asmjit::X86Compiler& c, asmjit::X86XmmVar& dest, asmjit::X86XmmVar& arg, double (*function)(double)) const;
+    void generateSplineEvaluation(asmjit::X86Compiler& c, asmjit::X86XmmVar& dest, asmjit::X86XmmVar& arg, std::vector<double>& table) const;
+    JitCode* sharedJitCode;
 #endif
 };
 
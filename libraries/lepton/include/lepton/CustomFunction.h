@@ -33,6 +33,7 @@
  * -------------------------------------------------------------------------- */
 
 #include "windowsIncludes.h"
+#include <vector>
 
 namespace Lepton {
 
@@ -72,6 +73,30 @@ public:
     virtual CustomFunction* clone() const = 0;
 };
 
+/**
+ * This is a CustomFunction of one variable that is defined by a cubic spline through uniformly spaced points.
+ * CompiledExpression recognizes functions of this type and evaluates them (and their first derivatives) with
+ * inline code, computing the interval containing the argument directly rather than calling evaluate().
+ */
+
+class LEPTON_EXPORT UniformSplineFunction : public CustomFunction {
+public:
+    int getNumArguments() const {
+        return 1;
+    }
+    /**
+     * Get the parameters defining the spline.  The function is zero outside the range [min, max].  Inside it,
+     * the range is divided into coeff.size()/4 intervals of equal width.  Within interval i the function equals
+     * c0 + c1*f + c2*f^2 + c3*f^3, where ck = coeff[4*i+k] and f is the fractional position within the interval
+     * (0 at its start and 1 at its end).
+     *
+     * @param min     on exit, the lower end of the range over which the spline is defined
+     * @param max     on exit, the upper end of the range over which the spline is defined
+     * @param coeff   on exit, the polynomial coefficients for each interval
+     */
+    virtual void getSplineParameters(double& min, double& max, std::vector<double>& coeff) const = 0;
+};
+
 } // namespace Lepton
 
 #endif /*LEPTON_CUSTOM_FUNCTION_H_*/
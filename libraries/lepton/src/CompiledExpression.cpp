@@ -32,7 +32,11 @@
 #include "lepton/CompiledExpression.h"
 #include "lepton/Operation.h"
 #include "lepton/ParsedExpression.h"
+#include <sstream>
 #include <utility>
+#ifdef LEPTON_USE_JIT
+    #include <pthread.h>
+#endif
 
 using namespace Lepton;
 using namespace std;
@@ -40,13 +44,74 @@ using namespace std;
     using namespace asmjit;
 #endif
 
+#ifdef LEPTON_USE_JIT
+/**
+ * This holds the machine code generated for a CompiledExpression, along with the constants, lookup tables,
+ * and Operations it refers to.  None of it changes after it is created, and the mutable workspace is passed
+ * in when the function is called, so one JitCode can be shared by any number of CompiledExpressions on any
+ * number of threads.  Every JitCode whose key is not empty is also recorded in a global cache, so
+ * expressions that compile to identical programs reuse the same code instead of generating it again.
+ */
+class CompiledExpression::JitCode {
+public:
+    JitCode(const string& key, const vector<Operation*>& ops) : key(key), function(NULL), refCount(1) {
+        for (int i = 0; i < (int) ops.size(); i++)
+            operation.push_back(ops[i]->clone());
+    }
+    ~JitCode() {
+        for (int i = 0; i < (int) operation.size(); i++)
+            delete operation[i];
+    }
+    static map<string, JitCode*>& getCache() {
+        static map<string, JitCode*> cache;
+        return cache;
+    }
+    static pthread_mutex_t lock;
+    string key;
+    void* function;
+    int refCount;
+    vector<Operation*> operation;
+    vector<double> constants;
+    vector<vector<double> > splineTables;
+    JitRuntime runtime;
+};
+
+pthread_mutex_t CompiledExpression::JitCode::lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 CompiledExpression::CompiledExpression() : jitCode(NULL) {
+#ifdef LEPTON_USE_JIT
+    sharedJitCode = NULL;
+#endif
 }
 
 CompiledExpression::CompiledExpression(const ParsedExpression& expression) : jitCode(NULL) {
-    ParsedExpression expr = expression.optimize(); // Just in case it wasn't already optimized.
+#ifdef LEPTON_USE_JIT
+    sharedJitCode = NULL;
+#endif
+    compileExpressions(vector<ParsedExpression>(1, expression));
+}
+
+CompiledExpression::CompiledExpression(const vector<ParsedExpression>& expressions) : jitCode(NULL) {
+#ifdef LEPTON_USE_JIT
+    sharedJitCode = NULL;
+#endif
+    if (expressions.size() == 0)
+        throw Exception("CompiledExpression: No expressions specified");
+    compileExpressions(expressions);
+}
+
+void CompiledExpression::compileExpressions(const vector<ParsedExpression>& expressions) {
+    // All the expressions share one list of temporaries, so any subexpression that appears in
+    // more than one of them is only computed once.
+
     vector<pair<ExpressionTreeNode, int> > temps;
-    compileExpression(expr.getRootNode(), temps);
+    for (int i = 0; i < (int) expressions.size(); i++) {
+        ParsedExpression expr = expressions[i].optimize(); // Just in case it wasn't already optimized.
+        compileExpression(expr.getRootNode(), temps);
+        outputIndex.push_back(temps[findTempIndex(expr.getRootNode(), temps)].second);
+    }
+    outputs.resize(outputIndex.size());
     int maxArguments = 1;
     for (int i = 0; i < (int) operation.size(); i++)
         if (operation[i]->getNumArguments() > maxArguments)
@@ -61,15 +126,28 @@ CompiledExpression::~CompiledExpression() {
     for (int i = 0; i < (int) operation.size(); i++)
         if (operation[i] != NULL)
             delete operation[i];
+#ifdef LEPTON_USE_JIT
+    releaseJitCode();
+#endif
 }
 
 CompiledExpression::CompiledExpression(const CompiledExpression& expression) : jitCode(NULL) {
+#ifdef LEPTON_USE_JIT
+    sharedJitCode = NULL;
+#endif
     *this = expression;
 }
 
 CompiledExpression& CompiledExpression::operator=(const CompiledExpression& expression) {
+    if (&expression == this)
+        return *this;
+    for (int i = 0; i < (int) operation.size(); i++)
+        if (operation[i] != NULL)
+            delete operation[i];
     arguments = expression.arguments;
     target = expression.target;
+    outputIndex = expression.outputIndex;
+    outputs.resize(expression.outputs.size());
     variableIndices = expression.variableIndices;
     variableNames = expression.variableNames;
     workspace.resize(expression.workspace.size());
@@ -78,7 +156,16 @@ CompiledExpression& CompiledExpression::operator=(const CompiledExpression& expr
     for (int i = 0; i < (int) operation.size(); i++)
         operation[i] = expression.operation[i]->clone();
 #ifdef LEPTON_USE_JIT
-    generateJitCode();
+    // The machine code is identical for every copy, so just share it.
+
+    releaseJitCode();
+    sharedJitCode = expression.sharedJitCode;
+    jitCode = expression.jitCode;
+    if (sharedJitCode != NULL) {
+        pthread_mutex_lock(&JitCode::lock);
+        sharedJitCode->refCount++;
+        pthread_mutex_unlock(&JitCode::lock);
+    }
 #endif
     return *this;
 }
@@ -143,9 +230,13 @@ double& CompiledExpression::getVariableReference(const string& name) {
     return workspace[index->second];
 }
 
+int CompiledExpression::getNumOutputs() const {
+    return outputIndex.size();
+}
+
 double CompiledExpression::evaluate() const {
 #ifdef LEPTON_USE_JIT
-    return ((double (*)()) jitCode)();
+    return ((double (*)(double*, double*, double*)) jitCode)(&workspace[0], &argValues[0], &outputs[0]);
 #else
     // Loop over the operations and evaluate each one.
     
@@ -159,7 +250,9 @@ double CompiledExpression::evaluate() const {
             workspace[target[step]] = operation[step]->evaluate(&argValues[0], dummyVariables);
         }
     }
-    return workspace[workspace.size()-1];
+    for (int i = 0; i < (int) outputIndex.size(); i++)
+        outputs[i] = workspace[outputIndex[i]];
+    return outputs[0];
 #endif
 }
 
@@ -169,21 +262,175 @@ static double evaluateOperation(Operation* op, double* args) {
     return op->evaluate(args, *dummyVariables);
 }
 
+/**
+ * Build the table used by generateSplineEvaluation().  It contains min, max, the inverse of the interval
+ * width, the number of intervals, and 0, followed by four polynomial coefficients for each interval.  An
+ * extra interval is appended so that the argument max can be evaluated without a bounds check.  If
+ * derivative is true, the coefficients describe the first derivative instead of the function itself.
+ */
+static void createSplineTable(const UniformSplineFunction& spline, bool derivative, vector<double>& table) {
+    double min, max;
+    vector<double> coeff;
+    spline.getSplineParameters(min, max, coeff);
+    int numIntervals = coeff.size()/4;
+    double scale = numIntervals/(max-min);
+    table.resize(5+4*(numIntervals+1), 0.0);
+    table[0] = min;
+    table[1] = max;
+    table[2] = scale;
+    table[3] = numIntervals;
+    for (int i = 0; i < numIntervals; i++) {
+        const double* c = &coeff[4*i];
+        double* dest = &table[5+4*i];
+        if (derivative) {
+            dest[0] = c[1]*scale;
+            dest[1] = 2.0*c[2]*scale;
+            dest[2] = 3.0*c[3]*scale;
+        }
+        else {
+            dest[0] = c[0];
+            dest[1] = c[1];
+            dest[2] = c[2];
+            dest[3] = c[3];
+        }
+    }
+    const double* last = &table[5+4*(numIntervals-1)];
+    table[5+4*numIntervals] = last[0]+last[1]+last[2]+last[3];
+}
+
+/**
+ * Create a string that uniquely identifies the program generateJitCode() would produce for this expression.
+ * Variable names do not matter, only the workspace locations they occupy.  If the expression uses custom
+ * functions whose behavior cannot be identified, this returns an empty string and the code is not cached.
+ */
+string CompiledExpression::createJitKey() const {
+    stringstream key;
+    key.precision(17);
+    key << workspace.size() << "v";
+    for (map<string, int>::const_iterator iter = variableIndices.begin(); iter != variableIndices.end(); ++iter)
+        key << ' ' << iter->second;
+    key << "o";
+    for (int i = 0; i < (int) outputIndex.size(); i++)
+        key << ' ' << outputIndex[i];
+    for (int step = 0; step < (int) operation.size(); step++) {
+        const Operation& op = *operation[step];
+        key << ";" << op.getId() << ' ' << target[step] << "a";
+        for (int i = 0; i < (int) arguments[step].size(); i++)
+            key << ' ' << arguments[step][i];
+        switch (op.getId()) {
+            case Operation::CONSTANT:
+                key << 'c' << dynamic_cast<const Operation::Constant&>(op).getValue();
+                break;
+            case Operation::ADD_CONSTANT:
+                key << 'c' << dynamic_cast<const Operation::AddConstant&>(op).getValue();
+                break;
+            case Operation::MULTIPLY_CONSTANT:
+                key << 'c' << dynamic_cast<const Operation::MultiplyConstant&>(op).getValue();
+                break;
+            case Operation::POWER_CONSTANT:
+                key << 'c' << dynamic_cast<const Operation::PowerConstant&>(op).getValue();
+                break;
+            case Operation::CUSTOM: {
+                // A spline function is completely described by its parameters.  Any other function might
+                // be anything, so the code can't be shared.
+
+                const Operation::Custom& custom = dynamic_cast<const Operation::Custom&>(op);
+                const UniformSplineFunction* spline = dynamic_cast<const UniformSplineFunction*>(&custom.getFunction());
+                if (spline == NULL)
+                    return "";
+                double min, max;
+                vector<double> coeff;
+                spline->getSplineParameters(min, max, coeff);
+                key << 'd';
+                for (int i = 0; i < (int) custom.getDerivOrder().size(); i++)
+                    key << ' ' << custom.getDerivOrder()[i];
+                key << 's' << min << ' ' << max;
+                for (int i = 0; i < (int) coeff.size(); i++)
+                    key << ' ' << coeff[i];
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return key.str();
+}
+
 void CompiledExpression::generateJitCode() {
-    X86Compiler c(&runtime);
-    c.addFunc(kFuncConvHost, FuncBuilder0<double>());
+    // See if identical code has already been generated.
+
+    string key = createJitKey();
+    map<string, JitCode*>& cache = JitCode::getCache();
+    if (key.size() > 0) {
+        pthread_mutex_lock(&JitCode::lock);
+        map<string, JitCode*>::iterator cached = cache.find(key);
+        if (cached != cache.end()) {
+            sharedJitCode = cached->second;
+            sharedJitCode->refCount++;
+        }
+        pthread_mutex_unlock(&JitCode::lock);
+        if (sharedJitCode != NULL) {
+            jitCode = sharedJitCode->function;
+            return;
+        }
+    }
+
+    // Generate new code.  This is done without holding the lock, so if another thread generated the same
+    // code in the meantime, use that one and discard ours.
+
+    JitCode* code = new JitCode(key, operation);
+    generateJitCode(*code);
+    if (key.size() > 0) {
+        pthread_mutex_lock(&JitCode::lock);
+        map<string, JitCode*>::iterator cached = cache.find(key);
+        if (cached == cache.end())
+            cache[key] = code;
+        else {
+            delete code;
+            code = cached->second;
+            code->refCount++;
+        }
+        pthread_mutex_unlock(&JitCode::lock);
+    }
+    sharedJitCode = code;
+    jitCode = code->function;
+}
+
+void CompiledExpression::releaseJitCode() {
+    if (sharedJitCode == NULL)
+        return;
+    pthread_mutex_lock(&JitCode::lock);
+    sharedJitCode->refCount--;
+    bool deleteCode = (sharedJitCode->refCount == 0);
+    if (deleteCode && sharedJitCode->key.size() > 0)
+        JitCode::getCache().erase(sharedJitCode->key);
+    pthread_mutex_unlock(&JitCode::lock);
+    if (deleteCode)
+        delete sharedJitCode;
+    sharedJitCode = NULL;
+    jitCode = NULL;
+}
+
+void CompiledExpression::generateJitCode(JitCode& code) const {
+    vector<Operation*>& operation = code.operation;
+    vector<double>& constants = code.constants;
+    vector<vector<double> >& splineTables = code.splineTables;
+    X86Compiler c(&code.runtime);
+    c.addFunc(kFuncConvHost, FuncBuilder3<double, double*, double*, double*>());
     vector<X86XmmVar> workspaceVar(workspace.size());
     for (int i = 0; i < (int) workspaceVar.size(); i++)
         workspaceVar[i] = c.newXmmVar(kX86VarTypeXmmSd);
     X86GpVar workspacePointer(c);
     X86GpVar argsPointer(c);
-    c.mov(workspacePointer, imm_ptr(&workspace[0]));
-    c.mov(argsPointer, imm_ptr(&argValues[0]));
+    X86GpVar outputsPointer(c);
+    c.setArg(0, workspacePointer);
+    c.setArg(1, argsPointer);
+    c.setArg(2, outputsPointer);
     
     // Load the arguments into variables.
     
     for (set<string>::const_iterator iter = variableNames.begin(); iter != variableNames.end(); ++iter) {
-        map<string, int>::iterator index = variableIndices.find(*iter);
+        map<string, int>::const_iterator index = variableIndices.find(*iter);
         c.movsd(workspaceVar[index->second], x86::ptr(workspacePointer, 8*index->second, 0));
     }
 
@@ -223,6 +470,23 @@ void CompiledExpression::generateJitCode() {
         }
     }
     
+    // Build lookup tables for any spline functions, which are evaluated with inline code.  Only
+    // take pointers to the tables once all of them have been created.
+
+    splineTables.clear();
+    vector<int> operationSplineIndex(operation.size(), -1);
+    for (int step = 0; step < (int) operation.size(); step++) {
+        if (operation[step]->getId() != Operation::CUSTOM)
+            continue;
+        const Operation::Custom& op = dynamic_cast<const Operation::Custom&>(*operation[step]);
+        const UniformSplineFunction* spline = dynamic_cast<const UniformSplineFunction*>(&op.getFunction());
+        if (spline == NULL || op.getDerivOrder()[0] > 1)
+            continue;
+        operationSplineIndex[step] = splineTables.size();
+        splineTables.push_back(vector<double>());
+        createSplineTable(*spline, op.getDerivOrder()[0] == 1, splineTables.back());
+    }
+
     // Load constants into variables.
     
     vector<X86XmmVar> constantVar(constants.size());
@@ -249,6 +513,10 @@ void CompiledExpression::generateJitCode() {
         
         // Generate instructions to execute this operation.
         
+        if (operationSplineIndex[step] != -1) {
+            generateSplineEvaluation(c, workspaceVar[target[step]], workspaceVar[args[0]], splineTables[operationSplineIndex[step]]);
+            continue;
+        }
         switch (op.getId()) {
             case Operation::CONSTANT:
                 c.movsd(workspaceVar[target[step]], constantVar[operationConstantIndex[step]]);
@@ -358,16 +626,61 @@ void CompiledExpression::generateJitCode() {
                 c.mov(fn, imm_ptr((void*) evaluateOperation));
                 X86CallNode* call = c.call(fn, kFuncConvHost, FuncBuilder2<double, Operation*, double*>());
                 call->setArg(0, imm_ptr(&op));
-                call->setArg(1, imm_ptr(&argValues[0]));
+                call->setArg(1, argsPointer);
                 call->setRet(0, workspaceVar[target[step]]);
         }
     }
-    c.ret(workspaceVar[workspace.size()-1]);
+
+    // Store all the outputs and return the first one.
+
+    for (int i = 0; i < (int) outputIndex.size(); i++)
+        c.movsd(x86::ptr(outputsPointer, 8*i, 0), workspaceVar[outputIndex[i]]);
+    c.ret(workspaceVar[outputIndex[0]]);
     c.endFunc();
-    jitCode = c.make();
+    code.function = c.make();
+}
+
+void CompiledExpression::generateSplineEvaluation(X86Compiler& c, X86XmmVar& dest, X86XmmVar& arg, vector<double>& table) const {
+    X86GpVar tablePointer(c);
+    X86GpVar index(c, kVarTypeIntPtr);
+    X86XmmVar mask = c.newXmmVar(kX86VarTypeXmmSd);
+    X86XmmVar temp = c.newXmmVar(kX86VarTypeXmmSd);
+    X86XmmVar t = c.newXmmVar(kX86VarTypeXmmSd);
+    c.mov(tablePointer, imm_ptr(&table[0]));
+
+    // Create a mask that is set if min <= arg <= max.  The comparisons are false for NaN.
+
+    c.movsd(mask, x86::ptr(tablePointer, 0, 0));
+    c.cmpsd(mask, arg, imm(2)); // Comparison mode is _CMP_LE_OS = 2
+    c.movsd(temp, arg);
+    c.cmpsd(temp, x86::ptr(tablePointer, 8, 0), imm(2));
+    c.andpd(mask, temp);
+
+    // Compute the index of the interval directly, clamping it so the table lookup is always valid.
+
+    c.movsd(t, arg);
+    c.subsd(t, x86::ptr(tablePointer, 0, 0));
+    c.mulsd(t, x86::ptr(tablePointer, 16, 0));
+    c.maxsd(t, x86::ptr(tablePointer, 32, 0));
+    c.minsd(t, x86::ptr(tablePointer, 24, 0));
+    c.cvttsd2si(index, t);
+    c.cvtsi2sd(temp, index);
+    c.subsd(t, temp);
+    c.shl(index, imm(2));
+
+    // Evaluate the polynomial and apply the mask.
+
+    c.movsd(dest, x86::ptr(tablePointer, index, 3, 64, 0));
+    c.mulsd(dest, t);
+    c.addsd(dest, x86::ptr(tablePointer, index, 3, 56, 0));
+    c.mulsd(dest, t);
+    c.addsd(dest, x86::ptr(tablePointer, index, 3, 48, 0));
+    c.mulsd(dest, t);
+    c.addsd(dest, x86::ptr(tablePointer, index, 3, 40, 0));
+    c.andpd(dest, mask);
 }
 
-void CompiledExpression::generateSingleArgCall(X86Compiler& c, X86XmmVar& dest, X86XmmVar& arg, double (*function)(double)) {
+void CompiledExpression::generateSingleArgCall(X86Compiler& c, X86XmmVar& dest, X86XmmVar& arg, double (*function)(double)) const {
     X86GpVar fn(c, kVarTypeIntPtr);
     c.mov(fn, imm_ptr((void*) function));
     X86CallNode* call = c.call(fn, kFuncConvHost, FuncBuilder1<double, double>());
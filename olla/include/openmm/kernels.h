@@ -61,6 +61,7 @@
 #include "openmm/VariableVerletIntegrator.h"
 #include "openmm/VerletIntegrator.h"
 #include <iosfwd>
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
@@ -154,6 +155,21 @@ public:
      * @param positions  a vector containing the particle positions
      */
     virtual void setPositions(ContextImpl& context, const std::vector<Vec3>& positions) = 0;
+    /**
+     * Get the positions of a subset of particles.  The default implementation retrieves the positions
+     * of all particles and then selects the requested ones.  Platforms that can access individual
+     * particles more efficiently should override it.
+     *
+     * @param particles  the indices of the particles to retrieve
+     * @param positions  on exit, element i contains the position of particle particles[i]
+     */
+    virtual void getPositionSubset(ContextImpl& context, const std::vector<int>& particles, std::vector<Vec3>& positions) {
+        std::vector<Vec3> allPositions;
+        getPositions(context, allPositions);
+        positions.resize(particles.size());
+        for (int i = 0; i < (int) particles.size(); i++)
+            positions[i] = allPositions[particles[i]];
+    }
     /**
      * Get the velocities of all particles.
      *
@@ -166,6 +182,21 @@ public:
      * @param velocities  a vector containing the particle velocities
      */
     virtual void setVelocities(ContextImpl& context, const std::vector<Vec3>& velocities) = 0;
+    /**
+     * Get the velocities of a subset of particles.  The default implementation retrieves the velocities
+     * of all particles and then selects the requested ones.  Platforms that can access individual
+     * particles more efficiently should override it.
+     *
+     * @param particles   the indices of the particles to retrieve
+     * @param velocities  on exit, element i contains the velocity of particle particles[i]
+     */
+    virtual void getVelocitySubset(ContextImpl& context, const std::vector<int>& particles, std::vector<Vec3>& velocities) {
+        std::vector<Vec3> allVelocities;
+        getVelocities(context, allVelocities);
+        velocities.resize(particles.size());
+        for (int i = 0; i < (int) particles.size(); i++)
+            velocities[i] = allVelocities[particles[i]];
+    }
     /**
      * Get the current forces on all particles.
      *
@@ -620,6 +651,20 @@ public:
      * @param force      the CustomNonbondedForce to copy the parameters from
      */
     virtual void copyParametersToContext(ContextImpl& context, const CustomNonbondedForce& force) = 0;
+    /**
+     * Compute the energy for each of several sets of global parameter values.  The default implementation
+     * returns false to indicate it is not supported.  Platforms that can evaluate many parameter sets in a
+     * single pass over the interactions should override it.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param parameterSets  each element maps the names of global parameters to the values to use.  Parameters
+     *                       that are not listed keep their current values.
+     * @param energies       on exit, element i contains the energy for parameterSets[i]
+     * @return true if the energies were computed, false if this is not supported
+     */
+    virtual bool computeEnergiesForParameterSets(ContextImpl& context, const std::vector<std::map<std::string, double> >& parameterSets, std::vector<double>& energies) {
+        return false;
+    }
 };
 
 /**
@@ -1238,6 +1283,19 @@ public:
      * @param includeEnergy       true if potential energy should be computed
      */
     virtual void beginComputation(IO& io, const Vec3* periodicBoxVectors, bool includeEnergy) = 0;
+    /**
+     * Begin computing the energy, and optionally the force.  Implementations that can skip the force
+     * calculation may override this.  The default implementation calls the version above, so forces are
+     * always computed and IO::setForce() may be called even if includeForces is false.
+     *
+     * @param io                  an object that coordinates data transfer
+     * @param periodicBoxVectors  the vectors defining the periodic box (measured in nm)
+     * @param includeForces       true if forces should be computed
+     * @param includeEnergy       true if potential energy should be computed
+     */
+    virtual void beginComputation(IO& io, const Vec3* periodicBoxVectors, bool includeForces, bool includeEnergy) {
+        beginComputation(io, periodicBoxVectors, includeEnergy);
+    }
     /**
      * Finish computing the force and energy.
      * 
@@ -133,6 +133,12 @@ protected:
      * Compute the kinetic energy of the system at the current time.
      */
     double computeKineticEnergy();
+    /**
+     * Brownian dynamics does not use the forces to compute the kinetic energy.
+     */
+    bool kineticEnergyRequiresForce() const {
+        return false;
+    }
 private:
     double temperature, friction;
     int randomNumberSeed;
@@ -125,6 +125,42 @@ public:
      * and energies.  Group i will be included if (groups&(1<<i)) != 0.  The default value includes all groups.
      */
     State getState(int types, bool enforcePeriodicBox=false, int groups=0xFFFFFFFF) const;
+    /**
+     * Get the positions of some or all particles, writing them directly into a buffer provided by the
+     * caller.  This is much faster than getState() when only a small subset of the particles is needed,
+     * since only those particles (and, if enforcePeriodicBox is true, the molecules containing them)
+     * are retrieved and processed.
+     *
+     * @param particles           the indices of the particles to retrieve.  If this is empty, all particles
+     *                            are retrieved.
+     * @param positions           on exit, elements 3*i, 3*i+1, and 3*i+2 contain the x, y, and z coordinates
+     *                            of particle particles[i] (or of particle i if particles is empty).  It must be
+     *                            large enough to hold all of them.
+     * @param enforcePeriodicBox  if true, the positions are adjusted so atoms are inside the main periodic box,
+     *                            exactly as in getState()
+     */
+    void getPositions(const std::vector<int>& particles, double* positions, bool enforcePeriodicBox=false) const;
+    /**
+     * Get the positions of some or all particles in single precision, writing them directly into a buffer
+     * provided by the caller.  This is identical to the double precision version except for the type of
+     * the buffer.
+     */
+    void getPositions(const std::vector<int>& particles, float* positions, bool enforcePeriodicBox=false) const;
+    /**
+     * Get the velocities of some or all particles, writing them directly into a buffer provided by the caller.
+     *
+     * @param particles   the indices of the particles to retrieve.  If this is empty, all particles are retrieved.
+     * @param velocities  on exit, elements 3*i, 3*i+1, and 3*i+2 contain the x, y, and z components of the
+     *                    velocity of particle particles[i] (or of particle i if particles is empty).  It must be
+     *                    large enough to hold all of them.
+     */
+    void getVelocities(const std::vector<int>& particles, double* velocities) const;
+    /**
+     * Get the velocities of some or all particles in single precision, writing them directly into a buffer
+     * provided by the caller.  This is identical to the double precision version except for the type of
+     * the buffer.
+     */
+    void getVelocities(const std::vector<int>& particles, float* velocities) const;
     /**
      * Copy information from a State object into this Context.  This restores the Context to
      * approximately the same state it was in when the State was created.  If the State does not include
@@ -211,6 +247,22 @@ public:
      * constraints.
      */
     void computeVirtualSites();
+    /**
+     * Compute the potential energy (in kJ/mol) for each of several sets of global parameter values.
+     * This gives the same result as calling setParameter() and then getState(State::Energy) for each
+     * set in turn, but is much faster.  Forces that do not depend on any of the parameters being varied
+     * are computed only once, and some platforms can evaluate several parameter sets in a single pass
+     * over the interactions.  This is useful for free energy calculations that need the energy of the
+     * current conformation in many thermodynamic states.  On return, all parameters have their original
+     * values.
+     *
+     * @param parameterSets  each element maps the names of global parameters to the values to use.  Parameters
+     *                       that are not listed keep their current values.
+     * @param groups         a set of bit flags for which force groups to include.  Group i will be included
+     *                       if (groups&(1<<i)) != 0.  The default value includes all groups.
+     * @return the potential energy for each parameter set
+     */
+    std::vector<double> computePotentialEnergies(const std::vector<std::map<std::string, double> >& parameterSets, int groups=0xFFFFFFFF);
     /**
      * When a Context is created, it may cache information about the System being simulated
      * and the Force objects contained in it.  This means that, if the System or Forces are then
@@ -229,7 +281,25 @@ public:
      */
     void createCheckpoint(std::ostream& stream);
     /**
-     * Load a checkpoint that was written by createCheckpoint().
+     * Create a checkpoint recording the current state of the Context, and write it to a stream
+     * on a background thread.  The state is copied into a memory buffer before this method returns,
+     * so the simulation can continue while the data is being written.  The stream must not be
+     * accessed or destroyed until waitForCheckpoint() has been called.  The checkpoint can be loaded
+     * with loadCheckpoint(), regardless of whether it was compressed.
+     * 
+     * @param stream    an output stream the checkpoint data should be written to
+     * @param compress  if true, the checkpoint is compressed with a lossless compression algorithm
+     *                  before being written
+     */
+    void createCheckpointAsync(std::ostream& stream, bool compress=false);
+    /**
+     * Block until any checkpoint started by createCheckpointAsync() has been completely written to
+     * its stream.  If an error occurred while writing it, an exception is thrown.  This is called
+     * automatically before creating or loading another checkpoint and when the Context is deleted.
+     */
+    void waitForCheckpoint();
+    /**
+     * Load a checkpoint that was written by createCheckpoint() or createCheckpointAsync().
      * 
      * A checkpoint contains not only publicly visible data such as the particle positions and
      * velocities, but also internal data such as the states of random number generators.  Ideally,
@@ -248,6 +318,47 @@ public:
      * @param stream    an input stream the checkpoint data should be read from
      */
     void loadCheckpoint(std::istream& stream);
+    /**
+     * Set whether to collect profiling data describing where time is spent during a simulation.
+     * Profiling is disabled by default.  When it is enabled, the overhead is a few timer calls per
+     * force evaluation, so it is usually safe to leave it on.  To have it enabled from the moment
+     * a Context is created, set the environment variable OPENMM_PROFILE to a nonzero value.
+     *
+     * @param enabled    true if profiling data should be collected
+     */
+    void setProfilingEnabled(bool enabled);
+    /**
+     * Get whether profiling data is being collected.
+     */
+    bool getProfilingEnabled() const;
+    /**
+     * Get the profiling data that has been collected since profiling was enabled or
+     * resetProfilingData() was last called.  Each key identifies something that was measured,
+     * and the value is either a total time in seconds or a count.  The following entries are
+     * recorded on all platforms:
+     *
+     * <ul>
+     * <li>force.N.Kernel: the time spent computing Force N (its index within the System), where
+     * Kernel is the name of the first kernel it uses (for example, "force.2.CalcNonbondedForce")</li>
+     * <li>force_evaluations: the number of times forces and/or energies were computed</li>
+     * <li>startup.Phase: the time spent in each phase of creating the Context (validate,
+     * create_force_impls, create_platform_data, create_kernels, force.N.Kernel, and
+     * initialize_integrator).  These are recorded when the Context is created with OPENMM_PROFILE
+     * set, or when reinitialize() is called while profiling is enabled, and replace the values from
+     * any earlier initialization.</li>
+     * </ul>
+     *
+     * Platforms may record other entries for the phases of a calculation.  The CPU platform records
+     * neighbor_list, direct, reciprocal, reduction, constraints, and integration times, along with
+     * neighbor_list_builds and constraint_iterations counts.  On platforms that execute kernels
+     * asynchronously, times measure how long the host spent launching work rather than how long the
+     * device took to execute it.
+     */
+    const std::map<std::string, double>& getProfilingData() const;
+    /**
+     * Discard all profiling data that has been collected so far.
+     */
+    void resetProfilingData();
     /**
      * Get a description of how the particles in the system are grouped into molecules.  Two particles are in the
      * same molecule if they are connected by constraints or bonds, where every Force object can define bonds
@@ -259,6 +370,7 @@ public:
     const std::vector<std::vector<int> >& getMolecules() const;
 private:
     friend class Force;
+    friend class LocalEnergyMinimizer;
     friend class Platform;
     ContextImpl& getImpl();
     ContextImpl* impl;
@@ -129,6 +129,14 @@ protected:
      * but the kinetic energy should be computed at the current time, not delayed by half a step.
      */
     virtual double computeKineticEnergy() = 0;
+    /**
+     * Get whether computeKineticEnergy() expects forces to have been computed.  If this returns
+     * false, the Context can compute the potential energy without also computing forces when
+     * the caller only requests energies.  The default implementation returns true.
+     */
+    virtual bool kineticEnergyRequiresForce() const {
+        return true;
+    }
 private:
     double stepSize, constraintTol;
 };
@@ -43,10 +43,27 @@ namespace OpenMM {
  * force to the potential function.  The strength of the restraining force is steadily increased
  * until the minimum energy configuration satisfies all constraints to within the tolerance
  * specified by the Context's Integrator.
+ *
+ * As an alternative to L-BFGS, the FIRE (Fast Inertial Relaxation Engine) algorithm can be selected.
+ * It performs damped dynamics with an adaptive step size and needs no line search, which makes it
+ * robust for structures with severe steric clashes.
  */
 
 class OPENMM_EXPORT LocalEnergyMinimizer {
 public:
+    /**
+     * This is an enumeration of the algorithms that can be used for minimization.
+     */
+    enum Algorithm {
+        /**
+         * Use the limited memory Broyden-Fletcher-Goldfarb-Shanno algorithm with a line search.
+         */
+        LBFGS = 0,
+        /**
+         * Use the Fast Inertial Relaxation Engine algorithm.
+         */
+        FIRE = 1
+    };
     /**
      * Search for a new set of particle positions that represent a local potential energy minimum.
      * On exit, the Context will have been updated with the new positions.
@@ -58,8 +75,9 @@ public:
      * @param maxIterations  the maximum number of iterations to perform.  If this is 0, minimation is continued
      *                       until the results converge without regard to how many iterations it takes.  The
      *                       default value is 0.
+     * @param algorithm      the algorithm to use for minimization.  The default value is LBFGS.
      */
-    static void minimize(Context& context, double tolerance = 10, int maxIterations = 0);
+    static void minimize(Context& context, double tolerance = 10, int maxIterations = 0, Algorithm algorithm = LBFGS);
 };
 
 } // namespace OpenMM
@@ -37,11 +37,13 @@
 #include "openmm/Vec3.h"
 #include <iosfwd>
 #include <map>
+#include <utility>
 #include <vector>
 
 namespace OpenMM {
 
 class ForceImpl;
+class ThreadPool;
 class Integrator;
 class Context;
 class System;
@@ -54,8 +56,12 @@ class OPENMM_EXPORT ContextImpl {
 public:
     /**
      * Create an ContextImpl for a Context;
+     *
+     * @param profilingEnabled   whether profiling is enabled from the start.  If so, the time spent in each
+     *                           phase of creating it is recorded.
      */
-    ContextImpl(Context& owner, const System& system, Integrator& integrator, Platform* platform, const std::map<std::string, std::string>& properties);
+    ContextImpl(Context& owner, const System& system, Integrator& integrator, Platform* platform, const std::map<std::string, std::string>& properties,
+            bool profilingEnabled=false);
     ~ContextImpl();
     /**
      * Get the Context for which this is the implementation.
@@ -101,6 +107,15 @@ public:
      * @param positions  a vector containg the particle positions
      */
     void setPositions(const std::vector<Vec3>& positions);
+    /**
+     * Get the positions of a subset of particles.
+     *
+     * @param particles           the indices of the particles to retrieve
+     * @param positions           on exit, element i contains the position of particle particles[i]
+     * @param enforcePeriodicBox  if true, every molecule containing a requested particle is translated
+     *                            so its center lies in the first periodic box
+     */
+    void getPositions(const std::vector<int>& particles, std::vector<Vec3>& positions, bool enforcePeriodicBox);
     /**
      * Get the velocities of all particles.
      *
@@ -113,6 +128,13 @@ public:
      * @param velocities  a vector containg the particle velocities
      */
     void setVelocities(const std::vector<Vec3>& velocities);
+    /**
+     * Get the velocities of a subset of particles.
+     *
+     * @param particles   the indices of the particles to retrieve
+     * @param velocities  on exit, element i contains the velocity of particle particles[i]
+     */
+    void getVelocities(const std::vector<int>& particles, std::vector<Vec3>& velocities);
     /**
      * Get the current forces on all particles.
      *
@@ -195,6 +217,19 @@ public:
      * Get the set of force group flags that were passed to the most recent call to calcForcesAndEnergy().
      */
     int getLastForceGroups() const;
+    /**
+     * Compute the potential energy of the system (in kJ/mol) for each of several sets of global parameter
+     * values.  Forces that do not depend on any of the parameters being varied are only computed once, and
+     * forces that support it evaluate all the parameter sets together.  The parameters are restored to
+     * their original values before this returns.
+     *
+     * @param parameterSets  each element maps the names of global parameters to the values to use.  Parameters
+     *                       that are not listed keep their current values.
+     * @param groups         a set of bit flags for which force groups to include.  Group i will be included
+     *                       if (groups&(1<<i)) != 0.  The default value includes all groups.
+     * @return the potential energy for each parameter set
+     */
+    std::vector<double> calcEnergiesForParameterSets(const std::vector<std::map<std::string, double> >& parameterSets, int groups=0xFFFFFFFF);
     /**
      * Calculate the kinetic energy of the system (in kJ/mol).
      */
@@ -229,6 +264,12 @@ public:
      * same molecule if they are connected by constraints or bonds.
      */
     const std::vector<std::vector<int> >& getMolecules() const;
+    /**
+     * Translate each molecule so its center lies in the first periodic box.
+     *
+     * @param positions  the positions of all particles.  They are modified in place.
+     */
+    void wrapMolecules(std::vector<Vec3>& positions);
     /**
      * Create a checkpoint recording the current state of the Context.
      * 
@@ -236,11 +277,52 @@ public:
      */
     void createCheckpoint(std::ostream& stream);
     /**
-     * Load a checkpoint that was written by createCheckpoint().
+     * Create a checkpoint recording the current state of the Context, and write it to a stream
+     * on a background thread.
+     * 
+     * @param stream    an output stream the checkpoint data should be written to
+     * @param compress  whether to compress the checkpoint
+     */
+    void createCheckpointAsync(std::ostream& stream, bool compress);
+    /**
+     * Block until any checkpoint started by createCheckpointAsync() has been completely written.
+     */
+    void waitForCheckpoint();
+    /**
+     * Load a checkpoint that was written by createCheckpoint() or createCheckpointAsync().
      * 
      * @param stream    an input stream the checkpoint data should be read from
      */
     void loadCheckpoint(std::istream& stream);
+    /**
+     * Get whether profiling data is currently being collected.  Kernels should check this before
+     * measuring anything, so profiling costs nothing when it is disabled.
+     */
+    bool getProfilingEnabled() const {
+        return profilingEnabled;
+    }
+    /**
+     * Set whether profiling data should be collected.
+     */
+    void setProfilingEnabled(bool enabled);
+    /**
+     * Get the profiling data that has been collected so far.  Each entry is either a time in seconds
+     * or a count, depending on its name.  See Context::getProfilingData() for details.
+     */
+    const std::map<std::string, double>& getProfilingData() const;
+    /**
+     * Discard all profiling data that has been collected so far.
+     */
+    void resetProfilingData();
+    /**
+     * Add a value to an entry in the profiling data.  Platforms call this to report the time spent in
+     * each phase of a calculation, or the number of times an event occurred.  If there is no entry
+     * with the specified name, one is created.
+     *
+     * @param name     the name of the entry to add to
+     * @param value    the elapsed time (in seconds) or count to add
+     */
+    void addProfilingData(const std::string& name, double value);
     /**
      * This is invoked by the Integrator when it is deleted.  This is needed to ensure the cleanup process
      * is done correctly, since we don't know whether the Integrator or Context will be deleted first.
@@ -253,19 +335,53 @@ public:
      * you should never call it.  It is exposed here because the same logic is useful to other classes too.
      */
     static std::vector<std::vector<int> > findMolecules(int numParticles, std::vector<std::vector<int> >& particleBonds);
+    /**
+     * Compute the list of molecules from a list of bonded particle pairs.  This is equivalent to the version
+     * above, but does not require building a list of neighbors for every particle.
+     *
+     * @param numParticles  the number of particles in the System
+     * @param bonds         each element is a pair of particles that belong to the same molecule
+     */
+    static std::vector<std::vector<int> > findMolecules(int numParticles, const std::vector<std::pair<int, int> >& bonds);
 private:
     friend class Context;
+    class CheckpointWriter;
+    class WrapMoleculesTask;
+    /**
+     * Record which molecule each particle belongs to, and store the molecules in a flat array
+     * so they can be processed without following pointers.
+     */
+    void findMoleculeOffsets();
+    /**
+     * Translate molecules into the first periodic box.  Molecule i consists of the particles whose
+     * positions are positions[atoms[start[i]]] through positions[atoms[start[i+1]-1]].
+     */
+    void wrapMolecules(std::vector<Vec3>& positions, const std::vector<int>& atoms, const std::vector<int>& start);
+    /**
+     * Record the time taken by one phase of creating the Context, and reset phaseStart to the current time.
+     * This does nothing if profiling is disabled.
+     */
+    void recordStartupTime(const std::string& phase, double& phaseStart);
+    /**
+     * Compute the energy of a single force, recording profiling data if it is enabled.
+     */
+    double calcEnergyOfForce(int index, int groups);
     Context& owner;
     const System& system;
     Integrator& integrator;
     std::vector<ForceImpl*> forceImpls;
     std::map<std::string, double> parameters;
+    std::map<std::string, double> profilingData;
+    std::vector<std::string> forceProfilingNames;
     mutable std::vector<std::vector<int> > molecules;
-    bool hasInitializedForces, hasSetPositions, integratorIsDeleted;
+    std::vector<int> moleculeStart, moleculeAtoms, particleMolecule, particleOffset;
+    bool hasInitializedForces, hasSetPositions, integratorIsDeleted, profilingEnabled;
     int lastForceGroups;
     Platform* platform;
     Kernel initializeForcesKernel, updateStateDataKernel, applyConstraintsKernel, virtualSitesKernel;
     void* platformData;
+    CheckpointWriter* checkpointWriter;
+    ThreadPool* threads;
 };
 
 } // namespace OpenMM
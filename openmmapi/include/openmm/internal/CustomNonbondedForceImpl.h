@@ -35,7 +35,9 @@
 #include "ForceImpl.h"
 #include "openmm/CustomNonbondedForce.h"
 #include "openmm/Kernel.h"
+#include "openmm/internal/ThreadPool.h"
 #include "lepton/CompiledExpression.h"
+#include "lepton/ParsedExpression.h"
 #include <utility>
 #include <map>
 #include <string>
@@ -58,21 +60,73 @@ public:
         // This force field doesn't update the state directly.
     }
     double calcForcesAndEnergy(ContextImpl& context, bool includeForces, bool includeEnergy, int groups);
+    bool calcEnergiesForParameterSets(ContextImpl& context, const std::vector<std::map<std::string, double> >& parameterSets, std::vector<double>& energies);
     std::map<std::string, double> getDefaultParameters();
     std::vector<std::string> getKernelNames();
     void updateParametersInContext(ContextImpl& context);
+    class LongRangeCorrectionData;
     /**
      * Compute the coefficient which, when divided by the periodic box volume, gives the
      * long range correction to the energy.
      */
     static double calcLongRangeCorrection(const CustomNonbondedForce& force, const Context& context);
+    /**
+     * Precompute the parts of the long range correction that do not depend on global parameters.
+     * The result can be passed to calcLongRangeCorrection() any number of times, as long as the
+     * force's particle parameters and energy expression do not change.
+     */
+    static LongRangeCorrectionData prepareLongRangeCorrection(const CustomNonbondedForce& force);
+    /**
+     * Compute the coefficient which, when divided by the periodic box volume, gives the
+     * long range correction to the energy.  This uses information precomputed by prepareLongRangeCorrection().
+     * The integrals for each pair of particle classes are divided between the threads in a ThreadPool,
+     * and the result is cached for each set of global parameter values, so switching back to values that
+     * were already used (for example, when cycling through a fixed set of lambda values) is inexpensive.
+     */
+    static double calcLongRangeCorrection(const CustomNonbondedForce& force, LongRangeCorrectionData& data, const Context& context, ThreadPool& threads);
+    /**
+     * This is identical to the above method, except that it performs the computation on a single thread.
+     */
+    static double calcLongRangeCorrection(const CustomNonbondedForce& force, LongRangeCorrectionData& data, const Context& context);
 private:
+    class IntegrateTask;
+    static double calcLongRangeCorrection(const CustomNonbondedForce& force, LongRangeCorrectionData& data, const Context& context, ThreadPool* threads);
     static double integrateInteraction(Lepton::CompiledExpression& expression, const std::vector<double>& params1, const std::vector<double>& params2,
             const CustomNonbondedForce& force, const Context& context);
     const CustomNonbondedForce& owner;
     Kernel kernel;
 };
 
+/**
+ * This holds the information used by calcLongRangeCorrection() that does not depend on the values of
+ * global parameters.
+ */
+class CustomNonbondedForceImpl::LongRangeCorrectionData {
+public:
+    /**
+     * The energy expression.
+     */
+    Lepton::ParsedExpression expression;
+    /**
+     * The per-particle parameters defining each class of particles.
+     */
+    std::vector<std::vector<double> > classes;
+    /**
+     * The pairs of classes that interact with each other, and the number of interactions for each one.
+     */
+    std::vector<std::pair<int, int> > classPairs;
+    std::vector<long long int> pairCounts;
+    /**
+     * The names of the global parameters the energy depends on.
+     */
+    std::vector<std::string> globalParameters;
+    /**
+     * Previously computed coefficients, indexed by the values of the global parameters.
+     */
+    std::map<std::vector<double>, double> cachedCoefficients;
+    int numParticles;
+};
+
 } // namespace OpenMM
 
 #endif /*OPENMM_CUSTOMNONBONDEDFORCEIMPL_H_*/
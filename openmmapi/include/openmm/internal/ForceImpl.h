@@ -104,6 +104,22 @@ public:
     virtual std::vector<std::pair<int, int> > getBondedParticles() const {
         return std::vector<std::pair<int, int> >(0);
     }
+    /**
+     * Compute this ForceImpl's contribution to the potential energy for each of several sets of global
+     * parameter values.  This is used by ContextImpl::calcEnergiesForParameterSets().  A ForceImpl that can
+     * evaluate many parameter sets more efficiently than by computing the energy once for each one should
+     * override it.  The default implementation does nothing and returns false, in which case the energy is
+     * computed separately for each parameter set instead.
+     *
+     * @param context        the context in which the system is being simulated
+     * @param parameterSets  each element maps the names of global parameters to the values to use.  Parameters
+     *                       that are not listed should keep their current values.
+     * @param energies       on exit, element i should contain the energy for parameterSets[i]
+     * @return true if the energies were computed, false if this ForceImpl does not support it
+     */
+    virtual bool calcEnergiesForParameterSets(ContextImpl& context, const std::vector<std::map<std::string, double> >& parameterSets, std::vector<double>& energies) {
+        return false;
+    }
 };
 
 } // namespace OpenMM
@@ -121,4 +121,63 @@ static int getNumProcessors() {
     #endif
 #endif
 
+/**
+ * Get a description of the CPU's capabilities for a leaf that has multiple subleaves, such as leaf 7
+ * which reports AVX2 and AVX-512 support.
+ */
+#ifdef WIN32
+#define cpuidex __cpuidex
+#else
+#if !defined(__ANDROID__) && !defined(__PNACL__)
+    static inline void cpuidex(int cpuInfo[4], int infoType, int subType){
+    #ifdef __LP64__
+        __asm__ __volatile__ (
+            "cpuid":
+            "=a" (cpuInfo[0]),
+            "=b" (cpuInfo[1]),
+            "=c" (cpuInfo[2]),
+            "=d" (cpuInfo[3]) :
+            "a" (infoType),
+            "c" (subType)
+        );
+    #else
+        __asm__ __volatile__ (
+            "pushl %%ebx\n"
+            "cpuid\n"
+            "movl %%ebx, %1\n"
+            "popl %%ebx\n" :
+            "=a" (cpuInfo[0]),
+            "=r" (cpuInfo[1]),
+            "=c" (cpuInfo[2]),
+            "=d" (cpuInfo[3]) :
+            "a" (infoType),
+            "c" (subType)
+        );
+    #endif
+    }
+    #endif
+#endif
+
+/**
+ * Get which register states the operating system saves on context switches.  This is needed in addition
+ * to cpuid to determine whether AVX-512 instructions can be used.  Only call this if cpuid reports that
+ * the OSXSAVE feature is enabled.
+ */
+#if !defined(__ANDROID__) && !defined(__PNACL__)
+    static inline unsigned long long getEnabledRegisterStates() {
+    #ifdef WIN32
+        return _xgetbv(0);
+    #else
+        unsigned int eax, edx;
+        __asm__ __volatile__ (
+            "xgetbv":
+            "=a" (eax),
+            "=d" (edx) :
+            "c" (0)
+        );
+        return eax | (((unsigned long long) edx) << 32);
+    #endif
+    }
+#endif
+
 #endif // OPENMM_HARDWARE_H_
@@ -36,20 +36,30 @@
 #include "SimTKOpenMMRealType.h"
 #include "sfmt/SFMT.h"
 #include <cmath>
+#include <cstdlib>
 
 using namespace OpenMM;
 using namespace std;
 
+/**
+ * Profiling can be enabled from the moment a Context is created by setting the OPENMM_PROFILE
+ * environment variable to a nonzero value.
+ */
+static bool isProfilingRequested() {
+    char* profileEnv = getenv("OPENMM_PROFILE");
+    return (profileEnv != NULL && atoi(profileEnv) != 0);
+}
+
 Context::Context(const System& system, Integrator& integrator) : properties(map<string, string>()) {
-    impl = new ContextImpl(*this, system, integrator, 0, properties);
+    impl = new ContextImpl(*this, system, integrator, 0, properties, isProfilingRequested());
 }
 
 Context::Context(const System& system, Integrator& integrator, Platform& platform) : properties(map<string, string>()) {
-    impl = new ContextImpl(*this, system, integrator, &platform, properties);
+    impl = new ContextImpl(*this, system, integrator, &platform, properties, isProfilingRequested());
 }
 
 Context::Context(const System& system, Integrator& integrator, Platform& platform, const map<string, string>& properties) : properties(properties) {
-    impl = new ContextImpl(*this, system, integrator, &platform, properties);
+    impl = new ContextImpl(*this, system, integrator, &platform, properties, isProfilingRequested());
 }
 
 Context::~Context() {
@@ -85,7 +95,8 @@ State Context::getState(int types, bool enforcePeriodicBox, int groups) const {
     bool includeForces = types&State::Forces;
     bool includeEnergy = types&State::Energy;
     if (includeForces || includeEnergy) {
-        double energy = impl->calcForcesAndEnergy(includeForces || includeEnergy, includeEnergy, groups);
+        bool computeForces = includeForces || (includeEnergy && impl->getIntegrator().kineticEnergyRequiresForce());
+        double energy = impl->calcForcesAndEnergy(computeForces, includeEnergy, groups);
         if (includeEnergy)
             builder.setEnergy(impl->calcKineticEnergy(), energy);
         if (includeForces) {
@@ -103,35 +114,8 @@ State Context::getState(int types, bool enforcePeriodicBox, int groups) const {
     if (types&State::Positions) {
         vector<Vec3> positions;
         impl->getPositions(positions);
-        if (enforcePeriodicBox) {
-            const vector<vector<int> >& molecules = impl->getMolecules();
-            for (int i = 0; i < (int) molecules.size(); i++) {
-                // Find the molecule center.
-
-                Vec3 center;
-                for (int j = 0; j < (int) molecules[i].size(); j++)
-                    center += positions[molecules[i][j]];
-                center *= 1.0/molecules[i].size();
-
-                // Find the displacement to move it into the first periodic box.
-
-                int xcell = (int) floor(center[0]/periodicBoxSize[0][0]);
-                int ycell = (int) floor(center[1]/periodicBoxSize[1][1]);
-                int zcell = (int) floor(center[2]/periodicBoxSize[2][2]);
-                double dx = xcell*periodicBoxSize[0][0];
-                double dy = ycell*periodicBoxSize[1][1];
-                double dz = zcell*periodicBoxSize[2][2];
-
-                // Translate all the particles in the molecule.
-                
-                for (int j = 0; j < (int) molecules[i].size(); j++) {
-                    Vec3& pos = positions[molecules[i][j]];
-                    pos[0] -= dx;
-                    pos[1] -= dy;
-                    pos[2] -= dz;
-                }
-            }
-        }
+        if (enforcePeriodicBox)
+            impl->wrapMolecules(positions);
         builder.setPositions(positions);
     }
     if (types&State::Velocities) {
@@ -142,6 +126,67 @@ State Context::getState(int types, bool enforcePeriodicBox, int groups) const {
     return builder.getState();
 }
 
+/**
+ * Copy a set of vectors into a flat array of coordinates.
+ */
+template <class T>
+static void copyVectors(const vector<Vec3>& vectors, T* buffer) {
+    for (int i = 0; i < (int) vectors.size(); i++) {
+        buffer[3*i] = (T) vectors[i][0];
+        buffer[3*i+1] = (T) vectors[i][1];
+        buffer[3*i+2] = (T) vectors[i][2];
+    }
+}
+
+template <class T>
+static void getPositionData(ContextImpl& impl, const vector<int>& particles, T* positions, bool enforcePeriodicBox) {
+    int numParticles = impl.getSystem().getNumParticles();
+    vector<Vec3> data;
+    if (particles.size() == 0) {
+        impl.getPositions(data);
+        if (enforcePeriodicBox)
+            impl.wrapMolecules(data);
+    }
+    else {
+        for (int i = 0; i < (int) particles.size(); i++)
+            if (particles[i] < 0 || particles[i] >= numParticles)
+                throw OpenMMException("Called getPositions() with an illegal particle index");
+        impl.getPositions(particles, data, enforcePeriodicBox);
+    }
+    copyVectors(data, positions);
+}
+
+template <class T>
+static void getVelocityData(ContextImpl& impl, const vector<int>& particles, T* velocities) {
+    int numParticles = impl.getSystem().getNumParticles();
+    vector<Vec3> data;
+    if (particles.size() == 0)
+        impl.getVelocities(data);
+    else {
+        for (int i = 0; i < (int) particles.size(); i++)
+            if (particles[i] < 0 || particles[i] >= numParticles)
+                throw OpenMMException("Called getVelocities() with an illegal particle index");
+        impl.getVelocities(particles, data);
+    }
+    copyVectors(data, velocities);
+}
+
+void Context::getPositions(const vector<int>& particles, double* positions, bool enforcePeriodicBox) const {
+    getPositionData(*impl, particles, positions, enforcePeriodicBox);
+}
+
+void Context::getPositions(const vector<int>& particles, float* positions, bool enforcePeriodicBox) const {
+    getPositionData(*impl, particles, positions, enforcePeriodicBox);
+}
+
+void Context::getVelocities(const vector<int>& particles, double* velocities) const {
+    getVelocityData(*impl, particles, velocities);
+}
+
+void Context::getVelocities(const vector<int>& particles, float* velocities) const {
+    getVelocityData(*impl, particles, velocities);
+}
+
 void Context::setState(const State& state) {
     setTime(state.getTime());
     Vec3 a, b, c;
@@ -231,19 +276,39 @@ void Context::computeVirtualSites() {
     impl->computeVirtualSites();
 }
 
+vector<double> Context::computePotentialEnergies(const vector<map<string, double> >& parameterSets, int groups) {
+    return impl->calcEnergiesForParameterSets(parameterSets, groups);
+}
+
 void Context::reinitialize() {
     const System& system = impl->getSystem();
     Integrator& integrator = impl->getIntegrator();
     Platform& platform = impl->getPlatform();
+    bool profilingEnabled = impl->getProfilingEnabled();
+    map<string, double> profilingData = impl->getProfilingData();
     integrator.cleanup();
     delete impl;
-    impl = new ContextImpl(*this, system, integrator, &platform, properties);
+    impl = new ContextImpl(*this, system, integrator, &platform, properties, profilingEnabled);
+
+    // Keep the profiling data, except that the new startup times replace the old ones.
+
+    for (map<string, double>::const_iterator iter = profilingData.begin(); iter != profilingData.end(); ++iter)
+        if (iter->first.compare(0, 8, "startup.") != 0)
+            impl->addProfilingData(iter->first, iter->second);
 }
 
 void Context::createCheckpoint(ostream& stream) {
     impl->createCheckpoint(stream);
 }
 
+void Context::createCheckpointAsync(ostream& stream, bool compress) {
+    impl->createCheckpointAsync(stream, compress);
+}
+
+void Context::waitForCheckpoint() {
+    impl->waitForCheckpoint();
+}
+
 void Context::loadCheckpoint(istream& stream) {
     impl->loadCheckpoint(stream);
 }
@@ -252,6 +317,22 @@ ContextImpl& Context::getImpl() {
     return *impl;
 }
 
+void Context::setProfilingEnabled(bool enabled) {
+    impl->setProfilingEnabled(enabled);
+}
+
+bool Context::getProfilingEnabled() const {
+    return impl->getProfilingEnabled();
+}
+
+const map<string, double>& Context::getProfilingData() const {
+    return impl->getProfilingData();
+}
+
+void Context::resetProfilingData() {
+    impl->resetProfilingData();
+}
+
 const vector<vector<int> >& Context::getMolecules() const {
     return impl->getMolecules();
 }
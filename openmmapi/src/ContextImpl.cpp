@@ -36,6 +36,8 @@
 #include "openmm/kernels.h"
 #include "openmm/internal/ForceImpl.h"
 #include "openmm/internal/ContextImpl.h"
+#include "openmm/internal/ThreadPool.h"
+#include "openmm/internal/timer.h"
 #include "openmm/State.h"
 #include "openmm/VirtualSite.h"
 #include "openmm/Context.h"
@@ -43,20 +45,26 @@
 #include <cmath>
 #include <iostream>
 #include <map>
+#include <set>
+#include <sstream>
 #include <utility>
 #include <vector>
+#include <pthread.h>
 #include <string.h>
 
 using namespace OpenMM;
 using namespace std;
 const static char CHECKPOINT_MAGIC_BYTES[] = "OpenMM Binary Checkpoint\n";
+const static char COMPRESSED_CHECKPOINT_MAGIC_BYTES[] = "OpenMM Packed Checkpoint\n";
+const static int COMPRESSED_CHECKPOINT_VERSION = 1;
 
 
-ContextImpl::ContextImpl(Context& owner, const System& system, Integrator& integrator, Platform* platform, const map<string, string>& properties) :
-        owner(owner), system(system), integrator(integrator), hasInitializedForces(false), hasSetPositions(false), integratorIsDeleted(false),
-        lastForceGroups(-1), platform(platform), platformData(NULL) {
+ContextImpl::ContextImpl(Context& owner, const System& system, Integrator& integrator, Platform* platform, const map<string, string>& properties,
+            bool profilingEnabled) : owner(owner), system(system), integrator(integrator), hasInitializedForces(false), hasSetPositions(false),
+        integratorIsDeleted(false), profilingEnabled(profilingEnabled), lastForceGroups(-1), platform(platform), platformData(NULL), checkpointWriter(NULL), threads(NULL) {
     if (system.getNumParticles() == 0)
         throw OpenMMException("Cannot create a Context for a System with no particles");
+    double phaseStart = (profilingEnabled ? getCurrentTime() : 0.0);
     
     // Check for errors in virtual sites and massless particles.
     
@@ -94,6 +102,8 @@ ContextImpl::ContextImpl(Context& owner, const System& system, Integrator& integ
             throw OpenMMException("Illegal property name: "+iter->first);
     }
     
+    recordStartupTime("validate", phaseStart);
+    
     // Find the list of kernels required.
     
     vector<string> kernelNames;
@@ -107,8 +117,14 @@ ContextImpl::ContextImpl(Context& owner, const System& system, Integrator& integ
         parameters.insert(forceParameters.begin(), forceParameters.end());
         vector<string> forceKernels = forceImpls[forceImpls.size()-1]->getKernelNames();
         kernelNames.insert(kernelNames.begin(), forceKernels.begin(), forceKernels.end());
+        stringstream profilingName;
+        profilingName << "force." << i;
+        if (forceKernels.size() > 0)
+            profilingName << "." << forceKernels[0];
+        forceProfilingNames.push_back(profilingName.str());
     }
     hasInitializedForces = true;
+    recordStartupTime("create_force_impls", phaseStart);
     vector<string> integratorKernels = integrator.getKernelNames();
     kernelNames.insert(kernelNames.begin(), integratorKernels.begin(), integratorKernels.end());
     
@@ -143,6 +159,8 @@ ContextImpl::ContextImpl(Context& owner, const System& system, Integrator& integ
         }
     }
     
+    recordStartupTime("create_platform_data", phaseStart);
+    
     // Create and initialize kernels and other objects.
     
     initializeForcesKernel = platform->createKernel(CalcForcesAndEnergyKernel::Name(), *this);
@@ -156,15 +174,27 @@ ContextImpl::ContextImpl(Context& owner, const System& system, Integrator& integ
     Vec3 periodicBoxVectors[3];
     system.getDefaultPeriodicBoxVectors(periodicBoxVectors[0], periodicBoxVectors[1], periodicBoxVectors[2]);
     updateStateDataKernel.getAs<UpdateStateDataKernel>().setPeriodicBoxVectors(*this, periodicBoxVectors[0], periodicBoxVectors[1], periodicBoxVectors[2]);
-    for (size_t i = 0; i < forceImpls.size(); ++i)
+    recordStartupTime("create_kernels", phaseStart);
+    for (size_t i = 0; i < forceImpls.size(); ++i) {
         forceImpls[i]->initialize(*this);
+        recordStartupTime(forceProfilingNames[i], phaseStart);
+    }
     integrator.initialize(*this);
     updateStateDataKernel.getAs<UpdateStateDataKernel>().setVelocities(*this, vector<Vec3>(system.getNumParticles()));
+    recordStartupTime("initialize_integrator", phaseStart);
 }
 
 ContextImpl::~ContextImpl() {
+    try {
+        waitForCheckpoint();
+    }
+    catch (...) {
+        // We can't throw exceptions from a destructor.
+    }
     for (int i = 0; i < (int) forceImpls.size(); ++i)
         delete forceImpls[i];
+    if (threads != NULL)
+        delete threads;
     
     // Make sure all kernels get properly deleted before contextDestroyed() is called.
     
@@ -199,10 +229,57 @@ void ContextImpl::setPositions(const std::vector<Vec3>& positions) {
     integrator.stateChanged(State::Positions);
 }
 
+void ContextImpl::getPositions(const vector<int>& particles, vector<Vec3>& positions, bool enforcePeriodicBox) {
+    UpdateStateDataKernel& kernel = updateStateDataKernel.getAs<UpdateStateDataKernel>();
+    if (!enforcePeriodicBox) {
+        kernel.getPositionSubset(*this, particles, positions);
+        return;
+    }
+
+    // Find the molecules containing the requested particles.
+
+    findMoleculeOffsets();
+    int numParticles = particles.size();
+    vector<int> subsetMolecules(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        subsetMolecules[i] = particleMolecule[particles[i]];
+    sort(subsetMolecules.begin(), subsetMolecules.end());
+    subsetMolecules.erase(unique(subsetMolecules.begin(), subsetMolecules.end()), subsetMolecules.end());
+
+    // Retrieve the positions of every particle in those molecules, grouped by molecule, and wrap them.
+
+    vector<int> atoms, start(1, 0);
+    for (int i = 0; i < (int) subsetMolecules.size(); i++) {
+        int molecule = subsetMolecules[i];
+        atoms.insert(atoms.end(), moleculeAtoms.begin()+moleculeStart[molecule], moleculeAtoms.begin()+moleculeStart[molecule+1]);
+        start.push_back(atoms.size());
+    }
+    vector<Vec3> moleculePositions;
+    kernel.getPositionSubset(*this, atoms, moleculePositions);
+    vector<int> order(atoms.size());
+    for (int i = 0; i < (int) order.size(); i++)
+        order[i] = i;
+    wrapMolecules(moleculePositions, order, start);
+
+    // Select the requested particles.
+
+    positions.resize(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        int particle = particles[i];
+        int molecule = particleMolecule[particle];
+        int index = lower_bound(subsetMolecules.begin(), subsetMolecules.end(), molecule)-subsetMolecules.begin();
+        positions[i] = moleculePositions[start[index]+particleOffset[particle]-moleculeStart[molecule]];
+    }
+}
+
 void ContextImpl::getVelocities(std::vector<Vec3>& velocities) {
     updateStateDataKernel.getAs<UpdateStateDataKernel>().getVelocities(*this, velocities);
 }
 
+void ContextImpl::getVelocities(const vector<int>& particles, vector<Vec3>& velocities) {
+    updateStateDataKernel.getAs<UpdateStateDataKernel>().getVelocitySubset(*this, particles, velocities);
+}
+
 void ContextImpl::setVelocities(const std::vector<Vec3>& velocities) {
     updateStateDataKernel.getAs<UpdateStateDataKernel>().setVelocities(*this, velocities);
     integrator.stateChanged(State::Velocities);
@@ -259,12 +336,28 @@ double ContextImpl::calcForcesAndEnergy(bool includeForces, bool includeEnergy,
     if (!hasSetPositions)
         throw OpenMMException("Particle positions have not been set");
     lastForceGroups = groups;
+    if (!includeForces) {
+        // Some platforms do not preserve the previous forces when computing only the energy,
+        // so the Integrator must not assume the forces it last computed are still valid.
+
+        integrator.stateChanged(State::Forces);
+    }
     CalcForcesAndEnergyKernel& kernel = initializeForcesKernel.getAs<CalcForcesAndEnergyKernel>();
     while (true) {
         double energy = 0.0;
         kernel.beginComputation(*this, includeForces, includeEnergy, groups);
-        for (int i = 0; i < (int) forceImpls.size(); ++i)
-            energy += forceImpls[i]->calcForcesAndEnergy(*this, includeForces, includeEnergy, groups);
+        if (profilingEnabled) {
+            for (int i = 0; i < (int) forceImpls.size(); ++i) {
+                double start = getCurrentTime();
+                energy += forceImpls[i]->calcForcesAndEnergy(*this, includeForces, includeEnergy, groups);
+                addProfilingData(forceProfilingNames[i], getCurrentTime()-start);
+            }
+            addProfilingData("force_evaluations", 1);
+        }
+        else {
+            for (int i = 0; i < (int) forceImpls.size(); ++i)
+                energy += forceImpls[i]->calcForcesAndEnergy(*this, includeForces, includeEnergy, groups);
+        }
         bool valid = true;
         energy += kernel.finishComputation(*this, includeForces, includeEnergy, groups, valid);
         if (valid)
@@ -272,6 +365,119 @@ double ContextImpl::calcForcesAndEnergy(bool includeForces, bool includeEnergy,
     }
 }
 
+double ContextImpl::calcEnergyOfForce(int index, int groups) {
+    if (!profilingEnabled)
+        return forceImpls[index]->calcForcesAndEnergy(*this, false, true, groups);
+    double start = getCurrentTime();
+    double energy = forceImpls[index]->calcForcesAndEnergy(*this, false, true, groups);
+    addProfilingData(forceProfilingNames[index], getCurrentTime()-start);
+    return energy;
+}
+
+vector<double> ContextImpl::calcEnergiesForParameterSets(const vector<map<string, double> >& parameterSets, int groups) {
+    if (!hasSetPositions)
+        throw OpenMMException("Particle positions have not been set");
+    int numSets = parameterSets.size();
+    vector<double> energies(numSets, 0.0);
+    if (numSets == 0)
+        return energies;
+
+    // Find which forces depend on the parameters being varied.  A force can only depend on
+    // the global parameters it defines.
+
+    set<string> variedParameters;
+    for (int i = 0; i < numSets; i++)
+        for (map<string, double>::const_iterator iter = parameterSets[i].begin(); iter != parameterSets[i].end(); ++iter) {
+            if (parameters.find(iter->first) == parameters.end())
+                throw OpenMMException("Called computePotentialEnergies() with invalid parameter name: "+iter->first);
+            variedParameters.insert(iter->first);
+        }
+    vector<int> fixedForces, variedForces;
+    for (int i = 0; i < (int) forceImpls.size(); i++) {
+        if ((groups&(1<<forceImpls[i]->getOwner().getForceGroup())) == 0)
+            continue;
+        map<string, double> forceParameters = forceImpls[i]->getDefaultParameters();
+        bool dependsOnParameters = false;
+        for (map<string, double>::const_iterator iter = forceParameters.begin(); iter != forceParameters.end(); ++iter)
+            if (variedParameters.find(iter->first) != variedParameters.end())
+                dependsOnParameters = true;
+        if (dependsOnParameters)
+            variedForces.push_back(i);
+        else
+            fixedForces.push_back(i);
+    }
+    lastForceGroups = groups;
+    integrator.stateChanged(State::Forces);
+    CalcForcesAndEnergyKernel& kernel = initializeForcesKernel.getAs<CalcForcesAndEnergyKernel>();
+    map<string, double> originalParameters = parameters;
+    try {
+        // Compute the forces that do not depend on the parameters, and give every other force a chance
+        // to process all the parameter sets at once.
+
+        vector<int> remainingForces;
+        double fixedEnergy;
+        while (true) {
+            fixedEnergy = 0.0;
+            energies.assign(numSets, 0.0);
+            remainingForces.clear();
+            kernel.beginComputation(*this, false, true, groups);
+            for (int i = 0; i < (int) fixedForces.size(); i++)
+                fixedEnergy += calcEnergyOfForce(fixedForces[i], groups);
+            for (int i = 0; i < (int) variedForces.size(); i++) {
+                int index = variedForces[i];
+                double start = (profilingEnabled ? getCurrentTime() : 0.0);
+                vector<double> forceEnergies;
+                if (forceImpls[index]->calcEnergiesForParameterSets(*this, parameterSets, forceEnergies)) {
+                    for (int j = 0; j < numSets; j++)
+                        energies[j] += forceEnergies[j];
+                    if (profilingEnabled)
+                        addProfilingData(forceProfilingNames[index], getCurrentTime()-start);
+                }
+                else
+                    remainingForces.push_back(index);
+            }
+            if (profilingEnabled)
+                addProfilingData("force_evaluations", 1);
+            bool valid = true;
+            fixedEnergy += kernel.finishComputation(*this, false, true, groups, valid);
+            if (valid)
+                break;
+        }
+
+        // Compute the remaining forces separately for each parameter set.
+
+        if (remainingForces.size() > 0) {
+            for (int i = 0; i < numSets; i++) {
+                parameters = originalParameters;
+                for (map<string, double>::const_iterator iter = parameterSets[i].begin(); iter != parameterSets[i].end(); ++iter)
+                    parameters[iter->first] = iter->second;
+                while (true) {
+                    double energy = 0.0;
+                    kernel.beginComputation(*this, false, true, groups);
+                    for (int j = 0; j < (int) remainingForces.size(); j++)
+                        energy += calcEnergyOfForce(remainingForces[j], groups);
+                    if (profilingEnabled)
+                        addProfilingData("force_evaluations", 1);
+                    bool valid = true;
+                    energy += kernel.finishComputation(*this, false, true, groups, valid);
+                    if (valid) {
+                        energies[i] += energy;
+                        break;
+                    }
+                }
+            }
+        }
+        parameters = originalParameters;
+        for (int i = 0; i < numSets; i++)
+            energies[i] += fixedEnergy;
+    }
+    catch (...) {
+        parameters = originalParameters;
+        throw;
+    }
+    return energies;
+}
+
 int ContextImpl::getLastForceGroups() const {
     return lastForceGroups;
 }
@@ -285,6 +491,30 @@ void ContextImpl::updateContextState() {
         forceImpls[i]->updateContextState(*this);
 }
 
+void ContextImpl::setProfilingEnabled(bool enabled) {
+    profilingEnabled = enabled;
+}
+
+const map<string, double>& ContextImpl::getProfilingData() const {
+    return profilingData;
+}
+
+void ContextImpl::resetProfilingData() {
+    profilingData.clear();
+}
+
+void ContextImpl::addProfilingData(const string& name, double value) {
+    profilingData[name] += value;
+}
+
+void ContextImpl::recordStartupTime(const string& phase, double& phaseStart) {
+    if (!profilingEnabled)
+        return;
+    double time = getCurrentTime();
+    profilingData["startup."+phase] += time-phaseStart;
+    phaseStart = time;
+}
+
 const vector<ForceImpl*>& ContextImpl::getForceImpls() const {
     return forceImpls;
 }
@@ -332,65 +562,85 @@ const vector<vector<int> >& ContextImpl::getMolecules() const {
         }
     }
 
-    // Make a list of every other particle to which each particle is connected
-
-    int numParticles = system.getNumParticles();
-    vector<vector<int> > particleBonds(numParticles);
-    for (int i = 0; i < (int) bonds.size(); i++) {
-        particleBonds[bonds[i].first].push_back(bonds[i].second);
-        particleBonds[bonds[i].second].push_back(bonds[i].first);
-    }
-
     // Now identify particles by which molecule they belong to.
 
-    molecules = findMolecules(numParticles, particleBonds);
+    molecules = findMolecules(system.getNumParticles(), bonds);
     return molecules;
 }
 
-vector<vector<int> > ContextImpl::findMolecules(int numParticles, vector<vector<int> >& particleBonds) {
-    // This is essentially a recursive algorithm, but it is reformulated as a loop to avoid
-    // stack overflows.  It selects a particle, marks it as a new molecule, then recursively
-    // marks every particle bonded to it as also being in that molecule.
-    
-    vector<int> particleMolecule(numParticles, -1);
+/**
+ * Find the representative of the set containing a particle, compressing the path as we go.
+ */
+static int findRoot(vector<int>& parent, int particle) {
+    int root = particle;
+    while (parent[root] != root)
+        root = parent[root];
+    while (parent[particle] != root) {
+        int next = parent[particle];
+        parent[particle] = root;
+        particle = next;
+    }
+    return root;
+}
+
+/**
+ * Merge the sets containing two particles.  The lower index always becomes the root, so the
+ * root of every set is its lowest numbered particle.
+ */
+static void mergeSets(vector<int>& parent, int particle1, int particle2) {
+    int root1 = findRoot(parent, particle1);
+    int root2 = findRoot(parent, particle2);
+    if (root1 < root2)
+        parent[root2] = root1;
+    else if (root2 < root1)
+        parent[root1] = root2;
+}
+
+/**
+ * Convert the disjoint sets into a list of molecules.  Molecules are ordered by their lowest
+ * numbered particle, and the particles within each molecule are in increasing order.
+ */
+static vector<vector<int> > buildMolecules(vector<int>& parent) {
+    int numParticles = parent.size();
+    vector<int> particleMolecule(numParticles);
     int numMolecules = 0;
+    for (int i = 0; i < numParticles; i++) {
+        int root = findRoot(parent, i);
+        particleMolecule[i] = (root == i ? numMolecules++ : particleMolecule[root]);
+    }
+    vector<int> moleculeSize(numMolecules, 0);
     for (int i = 0; i < numParticles; i++)
-        if (particleMolecule[i] == -1) {
-            // Start a new molecule.
-            
-            vector<int> particleStack;
-            vector<int> neighborStack;
-            particleStack.push_back(i);
-            neighborStack.push_back(0);
-            int molecule = numMolecules++;
-            
-            // Recursively tag all the bonded particles.
-            
-            while (particleStack.size() > 0) {
-                int particle = particleStack.back();
-                particleMolecule[particle] = molecule;
-                int& neighbor = neighborStack.back();
-                while (neighbor < particleBonds[particle].size() && particleMolecule[particleBonds[particle][neighbor]] != -1)
-                    neighbor++;
-                if (neighbor < particleBonds[particle].size()) {
-                    particleStack.push_back(particleBonds[particle][neighbor]);
-                    neighborStack.push_back(0);
-                }
-                else {
-                    particleStack.pop_back();
-                    neighborStack.pop_back();
-                }
-            }
-        }
-    
-    // Build the final output vector.
-    
+        moleculeSize[particleMolecule[i]]++;
     vector<vector<int> > molecules(numMolecules);
+    for (int i = 0; i < numMolecules; i++)
+        molecules[i].reserve(moleculeSize[i]);
     for (int i = 0; i < numParticles; i++)
         molecules[particleMolecule[i]].push_back(i);
     return molecules;
 }
 
+vector<vector<int> > ContextImpl::findMolecules(int numParticles, const vector<pair<int, int> >& bonds) {
+    // Use a union-find structure, which takes nearly linear time and avoids building
+    // per-particle neighbor lists.
+
+    vector<int> parent(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        parent[i] = i;
+    for (int i = 0; i < (int) bonds.size(); i++)
+        mergeSets(parent, bonds[i].first, bonds[i].second);
+    return buildMolecules(parent);
+}
+
+vector<vector<int> > ContextImpl::findMolecules(int numParticles, vector<vector<int> >& particleBonds) {
+    vector<int> parent(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        parent[i] = i;
+    for (int i = 0; i < numParticles; i++)
+        for (int j = 0; j < (int) particleBonds[i].size(); j++)
+            mergeSets(parent, i, particleBonds[i][j]);
+    return buildMolecules(parent);
+}
+
 static void writeString(ostream& stream, string str) {
     int length = str.size();
     stream.write((char*) &length, sizeof(int));
@@ -405,7 +655,247 @@ static string readString(istream& stream) {
     return str;
 }
 
+/**
+ * Compress checkpoint data.  Most of a checkpoint consists of 8 byte double precision values, so the data
+ * is treated as a sequence of 8 byte words.  Each word is XORed with the previous one, which clears the sign,
+ * exponent, and leading mantissa bits shared by neighboring values.  The bytes are then grouped by their
+ * position within the word so the cleared bytes form long runs, and finally runs of zeros are run length encoded.
+ */
+static void compressCheckpoint(const string& input, string& output) {
+    long long size = input.size();
+    long long numWords = (size+7)/8;
+    vector<unsigned char> shuffled(8*numWords);
+    unsigned long long previous = 0;
+    for (long long i = 0; i < numWords; i++) {
+        unsigned long long word = 0;
+        memcpy(&word, &input[8*i], (size_t) min(8LL, size-8*i));
+        unsigned long long delta = word^previous;
+        previous = word;
+        for (int j = 0; j < 8; j++)
+            shuffled[j*numWords+i] = (unsigned char) (delta>>(8*j));
+    }
+    
+    // Each block begins with a control byte.  Values 0-127 indicate 1-128 literal bytes follow, while
+    // values 128-255 indicate a run of 1-128 zeros.
+    
+    output.clear();
+    long long n = shuffled.size();
+    long long i = 0;
+    while (i < n) {
+        int run = 0;
+        while (i+run < n && run < 128 && shuffled[i+run] == 0)
+            run++;
+        if (run > 1) {
+            output.push_back((char) (127+run));
+            i += run;
+            continue;
+        }
+        long long start = i;
+        while (i < n && i-start < 128 && !(shuffled[i] == 0 && i+1 < n && shuffled[i+1] == 0))
+            i++;
+        output.push_back((char) (i-start-1));
+        output.append((char*) &shuffled[start], i-start);
+    }
+}
+
+/**
+ * Decompress data that was compressed by compressCheckpoint().
+ */
+static void decompressCheckpoint(const string& input, long long size, string& output) {
+    // Each control byte expands to at most 128 bytes, which limits the size the input can produce.
+    // Check the size against that before allocating anything.
+
+    long long n = input.size();
+    if (size < 0 || size/8+(size%8 == 0 ? 0 : 1) > 16*n)
+        throw OpenMMException("loadCheckpoint: Compressed checkpoint data is corrupt");
+    long long numWords = size/8+(size%8 == 0 ? 0 : 1);
+    size_t shuffledSize = (size_t) (8*numWords);
+    vector<unsigned char> shuffled;
+    shuffled.reserve(shuffledSize);
+    long long pos = 0;
+    while (pos < n) {
+        int control = (unsigned char) input[pos++];
+        size_t length = (control > 127 ? control-127 : control+1);
+        if (shuffled.size()+length > shuffledSize)
+            throw OpenMMException("loadCheckpoint: Compressed checkpoint data is corrupt");
+        if (control > 127)
+            shuffled.resize(shuffled.size()+length, 0);
+        else {
+            if (pos+control+1 > n)
+                break;
+            shuffled.insert(shuffled.end(), input.begin()+pos, input.begin()+pos+control+1);
+            pos += control+1;
+        }
+    }
+    if (shuffled.size() != shuffledSize)
+        throw OpenMMException("loadCheckpoint: Compressed checkpoint data is corrupt");
+    output.resize(8*numWords);
+    unsigned long long previous = 0;
+    for (long long i = 0; i < numWords; i++) {
+        unsigned long long delta = 0;
+        for (int j = 0; j < 8; j++)
+            delta |= ((unsigned long long) shuffled[j*numWords+i])<<(8*j);
+        unsigned long long word = delta^previous;
+        previous = word;
+        memcpy(&output[8*i], &word, 8);
+    }
+    output.resize(size);
+}
+
+/**
+ * This task translates molecules so that their centers lie in the first periodic box.
+ */
+class ContextImpl::WrapMoleculesTask : public ThreadPool::Task {
+public:
+    WrapMoleculesTask(vector<Vec3>& positions, const vector<int>& atoms, const vector<int>& start, const Vec3* boxVectors) :
+            positions(positions), atoms(atoms), start(start), boxVectors(boxVectors) {
+    }
+    void execute(ThreadPool& threads, int threadIndex) {
+        int numMolecules = start.size()-1;
+        int numThreads = threads.getNumThreads();
+        wrap(threadIndex*numMolecules/numThreads, (threadIndex+1)*numMolecules/numThreads);
+    }
+    void wrap(int firstMolecule, int lastMolecule) {
+        for (int i = firstMolecule; i < lastMolecule; i++) {
+            // Find the molecule center.
+
+            Vec3 center;
+            for (int j = start[i]; j < start[i+1]; j++)
+                center += positions[atoms[j]];
+            center *= 1.0/(start[i+1]-start[i]);
+
+            // Find the displacement to move it into the first periodic box.
+
+            double dx = floor(center[0]/boxVectors[0][0])*boxVectors[0][0];
+            double dy = floor(center[1]/boxVectors[1][1])*boxVectors[1][1];
+            double dz = floor(center[2]/boxVectors[2][2])*boxVectors[2][2];
+            if (dx == 0.0 && dy == 0.0 && dz == 0.0)
+                continue;
+
+            // Translate all the particles in the molecule.
+
+            for (int j = start[i]; j < start[i+1]; j++) {
+                Vec3& pos = positions[atoms[j]];
+                pos[0] -= dx;
+                pos[1] -= dy;
+                pos[2] -= dz;
+            }
+        }
+    }
+    vector<Vec3>& positions;
+    const vector<int>& atoms;
+    const vector<int>& start;
+    const Vec3* boxVectors;
+};
+
+void ContextImpl::findMoleculeOffsets() {
+    if (moleculeStart.size() > 0)
+        return;
+    const vector<vector<int> >& mols = getMolecules();
+    particleMolecule.resize(system.getNumParticles());
+    particleOffset.resize(system.getNumParticles());
+    moleculeStart.push_back(0);
+    for (int i = 0; i < (int) mols.size(); i++) {
+        for (int j = 0; j < (int) mols[i].size(); j++) {
+            particleMolecule[mols[i][j]] = i;
+            particleOffset[mols[i][j]] = moleculeAtoms.size();
+            moleculeAtoms.push_back(mols[i][j]);
+        }
+        moleculeStart.push_back(moleculeAtoms.size());
+    }
+}
+
+void ContextImpl::wrapMolecules(vector<Vec3>& positions) {
+    findMoleculeOffsets();
+    wrapMolecules(positions, moleculeAtoms, moleculeStart);
+}
+
+void ContextImpl::wrapMolecules(vector<Vec3>& positions, const vector<int>& atoms, const vector<int>& start) {
+    Vec3 boxVectors[3];
+    getPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+    WrapMoleculesTask task(positions, atoms, start, boxVectors);
+
+    // Small systems are faster to process on a single thread.
+
+    if (atoms.size() < 20000)
+        task.wrap(0, start.size()-1);
+    else {
+        if (threads == NULL)
+            threads = new ThreadPool();
+        threads->execute(task);
+        threads->waitForThreads();
+    }
+}
+
+/**
+ * This class writes a checkpoint that has already been created in memory to a stream on a background thread.
+ */
+class ContextImpl::CheckpointWriter {
+public:
+    CheckpointWriter(ostream& stream, const string& data, bool compress) : stream(stream), data(data), compress(compress), failed(false) {
+        if (pthread_create(&thread, NULL, threadBody, this) != 0)
+            throw OpenMMException("createCheckpointAsync: Failed to create thread for writing checkpoint");
+    }
+    /**
+     * Wait for the thread to finish, and return whether the checkpoint was written successfully.
+     */
+    bool wait() {
+        pthread_join(thread, NULL);
+        return !failed;
+    }
+private:
+    static void* threadBody(void* args) {
+        CheckpointWriter& writer = *reinterpret_cast<CheckpointWriter*>(args);
+        writer.write();
+        return 0;
+    }
+    void write() {
+        try {
+            if (compress) {
+                string compressed;
+                compressCheckpoint(data, compressed);
+                long long size = data.size();
+                long long compressedSize = compressed.size();
+                stream.write(COMPRESSED_CHECKPOINT_MAGIC_BYTES, sizeof(COMPRESSED_CHECKPOINT_MAGIC_BYTES)/sizeof(COMPRESSED_CHECKPOINT_MAGIC_BYTES[0]));
+                stream.write((char*) &COMPRESSED_CHECKPOINT_VERSION, sizeof(int));
+                stream.write((char*) &size, sizeof(long long));
+                stream.write((char*) &compressedSize, sizeof(long long));
+                stream.write(&compressed[0], compressedSize);
+            }
+            else
+                stream.write(&data[0], data.size());
+            stream.flush();
+            failed = stream.fail();
+        }
+        catch (...) {
+            failed = true;
+        }
+    }
+    ostream& stream;
+    string data;
+    bool compress, failed;
+    pthread_t thread;
+};
+
+void ContextImpl::createCheckpointAsync(ostream& stream, bool compress) {
+    waitForCheckpoint();
+    stringstream buffer(ios_base::out | ios_base::binary);
+    createCheckpoint(buffer);
+    checkpointWriter = new CheckpointWriter(stream, buffer.str(), compress);
+}
+
+void ContextImpl::waitForCheckpoint() {
+    if (checkpointWriter == NULL)
+        return;
+    bool success = checkpointWriter->wait();
+    delete checkpointWriter;
+    checkpointWriter = NULL;
+    if (!success)
+        throw OpenMMException("createCheckpointAsync: Error writing checkpoint to stream");
+}
+
 void ContextImpl::createCheckpoint(ostream& stream) {
+    waitForCheckpoint();
     stream.write(CHECKPOINT_MAGIC_BYTES, sizeof(CHECKPOINT_MAGIC_BYTES)/sizeof(CHECKPOINT_MAGIC_BYTES[0]));
     writeString(stream, getPlatform().getName());
     int numParticles = getSystem().getNumParticles();
@@ -423,7 +913,37 @@ void ContextImpl::createCheckpoint(ostream& stream) {
 void ContextImpl::loadCheckpoint(istream& stream) {
     static const int magiclength = sizeof(CHECKPOINT_MAGIC_BYTES)/sizeof(CHECKPOINT_MAGIC_BYTES[0]);
     char magicbytes[magiclength];
+    waitForCheckpoint();
     stream.read(magicbytes, magiclength);
+    if (memcmp(magicbytes, COMPRESSED_CHECKPOINT_MAGIC_BYTES, magiclength) == 0) {
+        // Decompress the checkpoint, then load it.
+        
+        int version;
+        long long size, compressedSize;
+        stream.read((char*) &version, sizeof(int));
+        if (version != COMPRESSED_CHECKPOINT_VERSION)
+            throw OpenMMException("loadCheckpoint: Compressed checkpoint was created with a different version of OpenMM");
+        stream.read((char*) &size, sizeof(long long));
+        stream.read((char*) &compressedSize, sizeof(long long));
+        if (!stream || size < 0 || compressedSize < 0)
+            throw OpenMMException("loadCheckpoint: Compressed checkpoint header was not correct");
+        // Read the data in blocks, so a corrupt size cannot trigger a huge allocation.
+
+        string compressed;
+        vector<char> block(1<<20);
+        while ((long long) compressed.size() < compressedSize) {
+            long long length = min((long long) block.size(), compressedSize-(long long) compressed.size());
+            stream.read(&block[0], length);
+            if (!stream)
+                throw OpenMMException("loadCheckpoint: Compressed checkpoint data is truncated");
+            compressed.append(&block[0], length);
+        }
+        string data;
+        decompressCheckpoint(compressed, size, data);
+        stringstream buffer(data, ios_base::in | ios_base::binary);
+        loadCheckpoint(buffer);
+        return;
+    }
     if (memcmp(magicbytes, CHECKPOINT_MAGIC_BYTES, magiclength) != 0)
         throw OpenMMException("loadCheckpoint: Checkpoint header was not correct");
 
@@ -33,11 +33,17 @@
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/internal/CustomGBForceImpl.h"
 #include "openmm/kernels.h"
+#include <algorithm>
 #include <sstream>
+#include <utility>
 
 using namespace OpenMM;
+using std::make_pair;
 using std::map;
+using std::max;
+using std::min;
 using std::pair;
+using std::sort;
 using std::vector;
 using std::set;
 using std::string;
@@ -57,7 +63,7 @@ void CustomGBForceImpl::initialize(ContextImpl& context) {
     const System& system = context.getSystem();
     if (owner.getNumParticles() != system.getNumParticles())
         throw OpenMMException("CustomGBForce must have exactly as many particles as the System it belongs to.");
-    vector<set<int> > exclusions(owner.getNumParticles());
+    vector<pair<int, int> > exclusionPairs;
     vector<double> parameters;
     int numParameters = owner.getNumPerParticleParameters();
     for (int i = 0; i < owner.getNumParticles(); i++) {
@@ -84,17 +90,21 @@ void CustomGBForceImpl::initialize(ContextImpl& context) {
             msg << particle2;
             throw OpenMMException(msg.str());
         }
-        if (exclusions[particle1].count(particle2) > 0 || exclusions[particle2].count(particle1) > 0) {
+        exclusionPairs.push_back(make_pair(min(particle1, particle2), max(particle1, particle2)));
+    }
+
+    // Sorting the list brings any duplicates next to each other.
+
+    sort(exclusionPairs.begin(), exclusionPairs.end());
+    for (int i = 1; i < (int) exclusionPairs.size(); i++)
+        if (exclusionPairs[i] == exclusionPairs[i-1]) {
             stringstream msg;
             msg << "CustomGBForce: Multiple exclusions are specified for particles ";
-            msg << particle1;
+            msg << exclusionPairs[i].first;
             msg << " and ";
-            msg << particle2;
+            msg << exclusionPairs[i].second;
             throw OpenMMException(msg.str());
         }
-        exclusions[particle1].insert(particle2);
-        exclusions[particle2].insert(particle1);
-    }
     if (owner.getNonbondedMethod() == CustomGBForce::CutoffPeriodic) {
         Vec3 boxVectors[3];
         system.getDefaultPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
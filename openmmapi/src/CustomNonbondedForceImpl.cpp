@@ -66,7 +66,7 @@ void CustomNonbondedForceImpl::initialize(ContextImpl& context) {
         if (owner.getSwitchingDistance() < 0 || owner.getSwitchingDistance() >= owner.getCutoffDistance())
             throw OpenMMException("CustomNonbondedForce: Switching distance must satisfy 0 <= r_switch < r_cutoff");
     }
-    vector<set<int> > exclusions(owner.getNumParticles());
+    vector<pair<int, int> > exclusionPairs;
     vector<double> parameters;
     int numParameters = owner.getNumPerParticleParameters();
     for (int i = 0; i < owner.getNumParticles(); i++) {
@@ -93,17 +93,21 @@ void CustomNonbondedForceImpl::initialize(ContextImpl& context) {
             msg << particle2;
             throw OpenMMException(msg.str());
         }
-        if (exclusions[particle1].count(particle2) > 0 || exclusions[particle2].count(particle1) > 0) {
+        exclusionPairs.push_back(make_pair(min(particle1, particle2), max(particle1, particle2)));
+    }
+
+    // Sorting the list brings any duplicates next to each other.
+
+    sort(exclusionPairs.begin(), exclusionPairs.end());
+    for (int i = 1; i < (int) exclusionPairs.size(); i++)
+        if (exclusionPairs[i] == exclusionPairs[i-1]) {
             stringstream msg;
             msg << "CustomNonbondedForce: Multiple exclusions are specified for particles ";
-            msg << particle1;
+            msg << exclusionPairs[i].first;
             msg << " and ";
-            msg << particle2;
+            msg << exclusionPairs[i].second;
             throw OpenMMException(msg.str());
         }
-        exclusions[particle1].insert(particle2);
-        exclusions[particle2].insert(particle1);
-    }
     if (owner.getNonbondedMethod() == CustomNonbondedForce::CutoffPeriodic) {
         Vec3 boxVectors[3];
         system.getDefaultPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
@@ -120,6 +124,10 @@ double CustomNonbondedForceImpl::calcForcesAndEnergy(ContextImpl& context, bool
     return 0.0;
 }
 
+bool CustomNonbondedForceImpl::calcEnergiesForParameterSets(ContextImpl& context, const vector<map<string, double> >& parameterSets, vector<double>& energies) {
+    return kernel.getAs<CalcCustomNonbondedForceKernel>().computeEnergiesForParameterSets(context, parameterSets, energies);
+}
+
 vector<string> CustomNonbondedForceImpl::getKernelNames() {
     vector<string> names;
     names.push_back(CalcCustomNonbondedForceKernel::Name());
@@ -137,21 +145,70 @@ void CustomNonbondedForceImpl::updateParametersInContext(ContextImpl& context) {
     kernel.getAs<CalcCustomNonbondedForceKernel>().copyParametersToContext(context, owner);
 }
 
+/**
+ * This task computes the integrals for a subset of the class pairs.
+ */
+class CustomNonbondedForceImpl::IntegrateTask : public ThreadPool::Task {
+public:
+    IntegrateTask(const CustomNonbondedForce& force, const CustomNonbondedForceImpl::LongRangeCorrectionData& data, const Context& context, int numThreads) :
+            force(force), data(data), context(context), numThreads(numThreads), integrals(data.classPairs.size()), errors(numThreads) {
+    }
+    void execute(ThreadPool& threads, int threadIndex) {
+        integrate(threadIndex);
+    }
+    void integrate(int threadIndex) {
+        try {
+            Lepton::CompiledExpression expression = data.expression.createCompiledExpression();
+            for (int i = threadIndex; i < (int) data.classPairs.size(); i += numThreads) {
+                const pair<int, int>& classPair = data.classPairs[i];
+                integrals[i] = integrateInteraction(expression, data.classes[classPair.first], data.classes[classPair.second], force, context);
+            }
+        }
+        catch (exception& ex) {
+            errors[threadIndex] = ex.what();
+        }
+    }
+    const CustomNonbondedForce& force;
+    const CustomNonbondedForceImpl::LongRangeCorrectionData& data;
+    const Context& context;
+    int numThreads;
+    vector<double> integrals;
+    vector<string> errors;
+};
+
 double CustomNonbondedForceImpl::calcLongRangeCorrection(const CustomNonbondedForce& force, const Context& context) {
     if (force.getNonbondedMethod() == CustomNonbondedForce::NoCutoff || force.getNonbondedMethod() == CustomNonbondedForce::CutoffNonPeriodic)
         return 0.0;
+    LongRangeCorrectionData data = prepareLongRangeCorrection(force);
+    return calcLongRangeCorrection(force, data, context, NULL);
+}
+
+CustomNonbondedForceImpl::LongRangeCorrectionData CustomNonbondedForceImpl::prepareLongRangeCorrection(const CustomNonbondedForce& force) {
+    LongRangeCorrectionData data;
+    data.numParticles = force.getNumParticles();
+    if (force.getNonbondedMethod() == CustomNonbondedForce::NoCutoff || force.getNonbondedMethod() == CustomNonbondedForce::CutoffNonPeriodic)
+        return data;
     
     // Parse the energy expression.
     
     map<string, Lepton::CustomFunction*> functions;
     for (int i = 0; i < force.getNumFunctions(); i++)
         functions[force.getTabulatedFunctionName(i)] = createReferenceTabulatedFunction(force.getTabulatedFunction(i));
-    Lepton::CompiledExpression expression = Lepton::Parser::parse(force.getEnergyFunction(), functions).createCompiledExpression();
+    data.expression = Lepton::Parser::parse(force.getEnergyFunction(), functions).optimize();
+    for (map<string, Lepton::CustomFunction*>::iterator iter = functions.begin(); iter != functions.end(); iter++)
+        delete iter->second;
+    Lepton::CompiledExpression expression = data.expression.createCompiledExpression();
+    const set<string>& variables = expression.getVariables();
+    if (variables.find("r") == variables.end())
+        throw OpenMMException("CustomNonbondedForce: Cannot use long range correction with a force that does not depend on r.");
+    for (int i = 0; i < force.getNumGlobalParameters(); i++)
+        if (variables.find(force.getGlobalParameterName(i)) != variables.end())
+            data.globalParameters.push_back(force.getGlobalParameterName(i));
     
     // Identify all particle classes (defined by parameters), and record the class of each particle.
     
     int numParticles = force.getNumParticles();
-    vector<vector<double> > classes;
+    vector<vector<double> >& classes = data.classes;
     map<vector<double>, int> classIndex;
     vector<int> atomClass(numParticles);
     for (int i = 0; i < numParticles; i++) {
@@ -203,17 +260,69 @@ double CustomNonbondedForceImpl::calcLongRangeCorrection(const CustomNonbondedFo
                 }
         }
     }
+    
+    // Record the pairs of classes that actually interact, so the integrals only need to be computed for them.
+    
+    for (map<pair<int, int>, long long int>::const_iterator iter = interactionCount.begin(); iter != interactionCount.end(); ++iter)
+        if (iter->second > 0) {
+            data.classPairs.push_back(iter->first);
+            data.pairCounts.push_back(iter->second);
+        }
+    return data;
+}
+
+double CustomNonbondedForceImpl::calcLongRangeCorrection(const CustomNonbondedForce& force, LongRangeCorrectionData& data, const Context& context, ThreadPool& threads) {
+    return calcLongRangeCorrection(force, data, context, &threads);
+}
 
-    // Loop over all pairs of classes to compute the coefficient.
+double CustomNonbondedForceImpl::calcLongRangeCorrection(const CustomNonbondedForce& force, LongRangeCorrectionData& data, const Context& context) {
+    return calcLongRangeCorrection(force, data, context, NULL);
+}
+
+double CustomNonbondedForceImpl::calcLongRangeCorrection(const CustomNonbondedForce& force, LongRangeCorrectionData& data, const Context& context, ThreadPool* threads) {
+    if (force.getNonbondedMethod() == CustomNonbondedForce::NoCutoff || force.getNonbondedMethod() == CustomNonbondedForce::CutoffNonPeriodic)
+        return 0.0;
+    
+    // See whether we have already computed the coefficient for the current global parameter values.
+    
+    vector<double> globalValues;
+    for (int i = 0; i < (int) data.globalParameters.size(); i++)
+        globalValues.push_back(context.getParameter(data.globalParameters[i]));
+    map<vector<double>, double>::const_iterator cached = data.cachedCoefficients.find(globalValues);
+    if (cached != data.cachedCoefficients.end())
+        return cached->second;
+    
+    // Compute the integral for each pair of classes.
+    
+    int numThreads = (threads == NULL ? 1 : threads->getNumThreads());
+    IntegrateTask task(force, data, context, numThreads);
+    if (threads == NULL)
+        task.integrate(0);
+    else {
+        threads->execute(task);
+        threads->waitForThreads();
+    }
+    for (int i = 0; i < numThreads; i++)
+        if (task.errors[i].size() > 0)
+            throw OpenMMException(task.errors[i]);
+
+    // Sum the contributions from all pairs of classes to compute the coefficient.
 
     double sum = 0;
-    for (int i = 0; i < numClasses; i++)
-        for (int j = i; j < numClasses; j++)
-            sum += interactionCount[make_pair(i, j)]*integrateInteraction(expression, classes[i], classes[j], force, context);
-    double nPart = (double) numParticles;
+    for (int i = 0; i < (int) data.classPairs.size(); i++)
+        sum += data.pairCounts[i]*task.integrals[i];
+    double nPart = (double) data.numParticles;
     double numInteractions = (nPart*(nPart+1))/2;
     sum /= numInteractions;
-    return 2*M_PI*nPart*nPart*sum;
+    double coefficient = 2*M_PI*nPart*nPart*sum;
+    
+    // Cache the result.  If the global parameters vary continuously, the cache would grow without
+    // limit, so discard it once it becomes large.
+    
+    if (data.cachedCoefficients.size() >= 1000)
+        data.cachedCoefficients.clear();
+    data.cachedCoefficients[globalValues] = coefficient;
+    return coefficient;
 }
 
 double CustomNonbondedForceImpl::integrateInteraction(Lepton::CompiledExpression& expression, const vector<double>& params1, const vector<double>& params2,
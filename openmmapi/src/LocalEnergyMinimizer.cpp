@@ -6,7 +6,7 @@
  * Biological Structures at Stanford, funded under the NIH Roadmap for        *
  * Medical Research, grant U54 GM072970. See https://simtk.org.               *
  *                                                                            *
- * Portions copyright (c) 2010-2012 Stanford University and the Authors.      *
+ * Portions copyright (c) 2010-2015 Stanford University and the Authors.      *
  * Authors: Peter Eastman                                                     *
  * Contributors:                                                              *
  *                                                                            *
@@ -31,8 +31,12 @@
 
 #include "openmm/LocalEnergyMinimizer.h"
 #include "openmm/OpenMMException.h"
+#include "openmm/internal/ContextImpl.h"
+#include "openmm/internal/ThreadPool.h"
+#include "openmm/internal/hardware.h"
 #include "lbfgs.h"
 #include "openmm/Platform.h"
+#include <algorithm>
 #include <cmath>
 #include <sstream>
 #include <vector>
@@ -40,68 +44,266 @@
 using namespace OpenMM;
 using namespace std;
 
+/**
+ * This holds everything needed to evaluate the objective function.  All buffers are allocated once
+ * when minimization starts, and the Context is accessed through its ContextImpl, so evaluating the
+ * function does not allocate memory or create State objects.
+ *
+ * The constraint penalty is computed on a ThreadPool when there are enough constraints to make that
+ * worthwhile.  Otherwise no threads are created, which matters when the forces are computed on a GPU.
+ */
 struct MinimizerData {
-    Context& context;
+    class GradientTask;
+    class ConstraintErrorTask;
+    static const int MinConstraintsForThreads = 10000;
+    ContextImpl& context;
     double k;
-    MinimizerData(Context& context, double k)
-        : context(context), k(k) {}
+    int numParticles, numConstraints;
+    vector<Vec3> positions, forces;
+    vector<char> isMassless;
+    vector<int> constraintAtom1, constraintAtom2;
+    vector<double> constraintDistance;
+    // For each particle, particleConstraints[particleConstraintStart[i]...particleConstraintStart[i+1]-1]
+    // lists the constraints it is involved in.  Values are encoded as 2*constraint+(0 if it is the first
+    // particle, 1 if it is the second).
+    vector<int> particleConstraintStart, particleConstraints;
+    vector<Vec3> constraintForce;
+    vector<double> threadEnergy, threadMaxError;
+    ThreadPool* threads;
+    // This is used to make the gradient array accessible to the individual threads.
+    lbfgsfloatval_t* g;
+    MinimizerData(ContextImpl& context, double k);
+    ~MinimizerData();
+    double evaluate(const lbfgsfloatval_t* x, lbfgsfloatval_t* g);
+    double computeMaxConstraintError();
+    double computeConstraintForces(int start, int end);
+    void computeGradient(int start, int end);
+    double computeConstraintError(int start, int end);
+    void threadComputeGradient(int threadIndex);
 };
 
-static lbfgsfloatval_t evaluate(void *instance, const lbfgsfloatval_t *x, lbfgsfloatval_t *g, const int n, const lbfgsfloatval_t step) {
-    MinimizerData* data = reinterpret_cast<MinimizerData*>(instance);
-    Context& context = data->context;
+class MinimizerData::GradientTask : public ThreadPool::Task {
+public:
+    GradientTask(MinimizerData& owner) : owner(owner) {
+    }
+    void execute(ThreadPool& threads, int threadIndex) {
+        owner.threadComputeGradient(threadIndex);
+    }
+    MinimizerData& owner;
+};
+
+class MinimizerData::ConstraintErrorTask : public ThreadPool::Task {
+public:
+    ConstraintErrorTask(MinimizerData& owner) : owner(owner) {
+    }
+    void execute(ThreadPool& threads, int threadIndex) {
+        int numThreads = threads.getNumThreads();
+        owner.threadMaxError[threadIndex] = owner.computeConstraintError(threadIndex*owner.numConstraints/numThreads, (threadIndex+1)*owner.numConstraints/numThreads);
+    }
+    MinimizerData& owner;
+};
+
+MinimizerData::MinimizerData(ContextImpl& context, double k) : context(context), k(k), threads(NULL) {
     const System& system = context.getSystem();
-    int numParticles = system.getNumParticles();
+    numParticles = system.getNumParticles();
+    numConstraints = system.getNumConstraints();
+    positions.resize(numParticles);
+    forces.resize(numParticles);
+    isMassless.resize(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        isMassless[i] = (system.getParticleMass(i) == 0);
+    constraintAtom1.resize(numConstraints);
+    constraintAtom2.resize(numConstraints);
+    constraintDistance.resize(numConstraints);
+    particleConstraintStart.resize(numParticles+1, 0);
+    for (int i = 0; i < numConstraints; i++) {
+        system.getConstraintParameters(i, constraintAtom1[i], constraintAtom2[i], constraintDistance[i]);
+        particleConstraintStart[constraintAtom1[i]+1]++;
+        particleConstraintStart[constraintAtom2[i]+1]++;
+    }
+    for (int i = 0; i < numParticles; i++)
+        particleConstraintStart[i+1] += particleConstraintStart[i];
+    particleConstraints.resize(2*numConstraints);
+    vector<int> next(particleConstraintStart.begin(), particleConstraintStart.end()-1);
+    for (int i = 0; i < numConstraints; i++) {
+        particleConstraints[next[constraintAtom1[i]]++] = 2*i;
+        particleConstraints[next[constraintAtom2[i]]++] = 2*i+1;
+    }
+    constraintForce.resize(numConstraints);
+    if (numConstraints >= MinConstraintsForThreads && getNumProcessors() > 1) {
+        threads = new ThreadPool();
+        threadEnergy.resize(threads->getNumThreads());
+        threadMaxError.resize(threads->getNumThreads());
+    }
+}
+
+MinimizerData::~MinimizerData() {
+    if (threads != NULL)
+        delete threads;
+}
 
+double MinimizerData::evaluate(const lbfgsfloatval_t* x, lbfgsfloatval_t* g) {
     // Compute the force and energy for this configuration.
 
-    vector<Vec3> positions(numParticles);
     for (int i = 0; i < numParticles; i++)
         positions[i] = Vec3(x[3*i], x[3*i+1], x[3*i+2]);
     context.setPositions(positions);
     context.computeVirtualSites();
-    State state = context.getState(State::Forces | State::Energy);
-    const vector<Vec3>& forces = state.getForces();
-    for (int i = 0; i < numParticles; i++) {
-        if (system.getParticleMass(i) == 0) {
-            g[3*i] = 0.0;
-            g[3*i+1] = 0.0;
-            g[3*i+2] = 0.0;
-        }
-        else {
-            g[3*i] = -forces[i][0];
-            g[3*i+1] = -forces[i][1];
-            g[3*i+2] = -forces[i][2];
-        }
-    }
-    double energy = state.getPotentialEnergy();
+    double energy = context.calcForcesAndEnergy(true, true);
+    context.getForces(forces);
 
-    // Add harmonic forces for any constraints.
+    // Build the gradient and add harmonic forces for any constraints.  The force from each constraint
+    // is computed first, then they are summed for each particle.
 
-    int numConstraints = system.getNumConstraints();
-    double k = data->k;
-    for (int i = 0; i < numConstraints; i++) {
-        int particle1, particle2;
-        double distance;
-        system.getConstraintParameters(i, particle1, particle2, distance);
-        Vec3 delta = positions[particle2]-positions[particle1];
-        double r2 = delta.dot(delta);
-        double r = sqrt(r2);
-        delta *= 1/r;
-        double dr = r-distance;
+    this->g = g;
+    if (threads == NULL) {
+        energy += computeConstraintForces(0, numConstraints);
+        computeGradient(0, numParticles);
+        return energy;
+    }
+    GradientTask task(*this);
+    threads->execute(task);
+    threads->waitForThreads();
+    threads->resumeThreads();
+    threads->waitForThreads();
+    for (int i = 0; i < (int) threadEnergy.size(); i++)
+        energy += threadEnergy[i];
+    return energy;
+}
+
+double MinimizerData::computeConstraintForces(int start, int end) {
+    double energy = 0.0;
+    for (int i = start; i < end; i++) {
+        Vec3 delta = positions[constraintAtom2[i]]-positions[constraintAtom1[i]];
+        double r = sqrt(delta.dot(delta));
+        double dr = r-constraintDistance[i];
         double kdr = k*dr;
         energy += 0.5*kdr*dr;
-        g[3*particle1] -= kdr*delta[0];
-        g[3*particle1+1] -= kdr*delta[1];
-        g[3*particle1+2] -= kdr*delta[2];
-        g[3*particle2] += kdr*delta[0];
-        g[3*particle2+1] += kdr*delta[1];
-        g[3*particle2+2] += kdr*delta[2];
+        constraintForce[i] = delta*(kdr/r);
     }
     return energy;
 }
 
-void LocalEnergyMinimizer::minimize(Context& context, double tolerance, int maxIterations) {
+void MinimizerData::computeGradient(int start, int end) {
+    for (int i = start; i < end; i++) {
+        Vec3 grad = (isMassless[i] ? Vec3() : -forces[i]);
+        for (int j = particleConstraintStart[i]; j < particleConstraintStart[i+1]; j++) {
+            int index = particleConstraints[j];
+            if (index&1)
+                grad += constraintForce[index/2];
+            else
+                grad -= constraintForce[index/2];
+        }
+        g[3*i] = grad[0];
+        g[3*i+1] = grad[1];
+        g[3*i+2] = grad[2];
+    }
+}
+
+double MinimizerData::computeConstraintError(int start, int end) {
+    double maxError = 0.0;
+    for (int i = start; i < end; i++) {
+        Vec3 delta = positions[constraintAtom2[i]]-positions[constraintAtom1[i]];
+        double r = sqrt(delta.dot(delta));
+        double error = fabs(r-constraintDistance[i]);
+        if (error > maxError)
+            maxError = error;
+    }
+    return maxError;
+}
+
+void MinimizerData::threadComputeGradient(int threadIndex) {
+    int numThreads = threads->getNumThreads();
+    threadEnergy[threadIndex] = computeConstraintForces(threadIndex*numConstraints/numThreads, (threadIndex+1)*numConstraints/numThreads);
+    threads->syncThreads();
+    computeGradient(threadIndex*numParticles/numThreads, (threadIndex+1)*numParticles/numThreads);
+}
+
+double MinimizerData::computeMaxConstraintError() {
+    context.getPositions(positions);
+    if (threads == NULL)
+        return computeConstraintError(0, numConstraints);
+    ConstraintErrorTask task(*this);
+    threads->execute(task);
+    threads->waitForThreads();
+    return *max_element(threadMaxError.begin(), threadMaxError.end());
+}
+
+static lbfgsfloatval_t evaluate(void *instance, const lbfgsfloatval_t *x, lbfgsfloatval_t *g, const int n, const lbfgsfloatval_t step) {
+    return reinterpret_cast<MinimizerData*>(instance)->evaluate(x, g);
+}
+
+/**
+ * Minimize the energy with the FIRE algorithm (Bitzek et al., Phys. Rev. Lett. 97, 170201 (2006)).
+ * All particles are given unit mass.  Minimization stops when |g|/max(1, |x|) falls below epsilon
+ * (the same test L-BFGS uses), when maxIterations is reached, or when the step size collapses
+ * because no further progress can be made.
+ */
+static void minimizeFIRE(MinimizerData& data, lbfgsfloatval_t* x, vector<double>& g, vector<double>& v, double epsilon, int maxIterations) {
+    const double initialStepSize = 0.001;
+    const double maxStepSize = 0.01;
+    const double minStepSize = 1e-3*initialStepSize;
+    const double maxDisplacement = 0.02;
+    const double initialAlpha = 0.1;
+    const int minStepsBeforeIncrease = 5;
+    int n = g.size();
+    int numParticles = n/3;
+    double dt = initialStepSize;
+    double alpha = initialAlpha;
+    int stepsSinceNegative = 0;
+    fill(v.begin(), v.end(), 0.0);
+    data.evaluate(x, &g[0]);
+    for (int iteration = 0; maxIterations == 0 || iteration < maxIterations; iteration++) {
+        double power = 0.0, vnorm2 = 0.0, gnorm2 = 0.0, xnorm2 = 0.0;
+        for (int i = 0; i < n; i++) {
+            power -= v[i]*g[i];
+            vnorm2 += v[i]*v[i];
+            gnorm2 += g[i]*g[i];
+            xnorm2 += x[i]*x[i];
+        }
+        if (sqrt(gnorm2) <= epsilon*max(1.0, sqrt(xnorm2)))
+            break;
+
+        // Mix the velocity toward the force direction, or stop if we are moving uphill.
+
+        if (power > 0) {
+            double scale = alpha*sqrt(vnorm2/gnorm2);
+            for (int i = 0; i < n; i++)
+                v[i] = (1-alpha)*v[i] - scale*g[i];
+            if (++stepsSinceNegative > minStepsBeforeIncrease) {
+                dt = min(dt*1.1, maxStepSize);
+                alpha *= 0.99;
+            }
+        }
+        else {
+            fill(v.begin(), v.end(), 0.0);
+            dt *= 0.5;
+            alpha = initialAlpha;
+            stepsSinceNegative = 0;
+            if (dt < minStepSize)
+                break;
+        }
+
+        // Take a step, limiting how far any particle can move.
+
+        for (int i = 0; i < numParticles; i++) {
+            Vec3 dx;
+            for (int j = 0; j < 3; j++) {
+                v[3*i+j] -= dt*g[3*i+j];
+                dx[j] = dt*v[3*i+j];
+            }
+            double dist2 = dx.dot(dx);
+            if (dist2 > maxDisplacement*maxDisplacement)
+                dx *= maxDisplacement/sqrt(dist2);
+            for (int j = 0; j < 3; j++)
+                x[3*i+j] += dx[j];
+        }
+        data.evaluate(x, &g[0]);
+    }
+}
+
+void LocalEnergyMinimizer::minimize(Context& context, double tolerance, int maxIterations, Algorithm algorithm) {
+    ContextImpl& impl = context.getImpl();
     const System& system = context.getSystem();
     int numParticles = system.getNumParticles();
     lbfgsfloatval_t *x = lbfgs_malloc(numParticles*3);
@@ -109,6 +311,12 @@ void LocalEnergyMinimizer::minimize(Context& context, double tolerance, int maxI
         throw OpenMMException("LocalEnergyMinimizer: Failed to allocate memory");
     double constraintTol = context.getIntegrator().getConstraintTolerance();
     double k = tolerance/constraintTol;
+    MinimizerData data(impl, k);
+    vector<double> fireGradient, fireVelocity;
+    if (algorithm == FIRE) {
+        fireGradient.resize(numParticles*3);
+        fireVelocity.resize(numParticles*3);
+    }
 
     // Initialize the minimizer.
 
@@ -125,7 +333,8 @@ void LocalEnergyMinimizer::minimize(Context& context, double tolerance, int maxI
 
     // Record the initial positions and determine a normalization constant for scaling the tolerance.
 
-    vector<Vec3> initialPos = context.getState(State::Positions).getPositions();
+    vector<Vec3> initialPos;
+    impl.getPositions(initialPos);
     double norm = 0.0;
     for (int i = 0; i < numParticles; i++) {
         x[3*i] = initialPos[i][0];
@@ -143,28 +352,22 @@ void LocalEnergyMinimizer::minimize(Context& context, double tolerance, int maxI
     while (true) {
         // Perform the minimization.
 
-        lbfgsfloatval_t fx;
-        MinimizerData data(context, k);
-        lbfgs(numParticles*3, x, &fx, evaluate, NULL, &data, &param);
+        data.k = k;
+        if (algorithm == FIRE)
+            minimizeFIRE(data, x, fireGradient, fireVelocity, param.epsilon, maxIterations);
+        else {
+            lbfgsfloatval_t fx;
+            lbfgs(numParticles*3, x, &fx, evaluate, NULL, &data, &param);
+        }
 
         // Check whether all constraints are satisfied.
 
-        vector<Vec3> positions = context.getState(State::Positions).getPositions();
-        int numConstraints = system.getNumConstraints();
-        double maxError = 0.0;
-        for (int i = 0; i < numConstraints; i++) {
-            int particle1, particle2;
-            double distance;
-            system.getConstraintParameters(i, particle1, particle2, distance);
-            Vec3 delta = positions[particle2]-positions[particle1];
-            double r = sqrt(delta.dot(delta));
-            double error = fabs(r-distance);
-            if (error > maxError)
-                maxError = error;
-        }
+        if (data.numConstraints == 0)
+            break;
+        double maxError = data.computeMaxConstraintError();
         if (maxError <= constraintTol)
             break; // All constraints are satisfied.
-        context.setPositions(initialPos);
+        impl.setPositions(initialPos);
         if (maxError >= prevMaxError)
             break; // Further tightening the springs doesn't seem to be helping, so just give up.
         prevMaxError = maxError;
@@ -182,4 +385,3 @@ void LocalEnergyMinimizer::minimize(Context& context, double tolerance, int maxI
     }
     lbfgs_free(x);
 }
-
@@ -62,7 +62,7 @@ void NonbondedForceImpl::initialize(ContextImpl& context) {
         if (owner.getSwitchingDistance() < 0 || owner.getSwitchingDistance() >= owner.getCutoffDistance())
             throw OpenMMException("NonbondedForce: Switching distance must satisfy 0 <= r_switch < r_cutoff");
     }
-    vector<set<int> > exceptions(owner.getNumParticles());
+    vector<pair<int, int> > exceptionPairs;
     for (int i = 0; i < owner.getNumExceptions(); i++) {
         int particle1, particle2;
         double chargeProd, sigma, epsilon;
@@ -79,17 +79,21 @@ void NonbondedForceImpl::initialize(ContextImpl& context) {
             msg << particle2;
             throw OpenMMException(msg.str());
         }
-        if (exceptions[particle1].count(particle2) > 0 || exceptions[particle2].count(particle1) > 0) {
+        exceptionPairs.push_back(make_pair(min(particle1, particle2), max(particle1, particle2)));
+    }
+
+    // Sorting the list brings any duplicates next to each other.
+
+    sort(exceptionPairs.begin(), exceptionPairs.end());
+    for (int i = 1; i < (int) exceptionPairs.size(); i++)
+        if (exceptionPairs[i] == exceptionPairs[i-1]) {
             stringstream msg;
             msg << "NonbondedForce: Multiple exceptions are specified for particles ";
-            msg << particle1;
+            msg << exceptionPairs[i].first;
             msg << " and ";
-            msg << particle2;
+            msg << exceptionPairs[i].second;
             throw OpenMMException(msg.str());
         }
-        exceptions[particle1].insert(particle2);
-        exceptions[particle2].insert(particle1);
-    }
     if (owner.getNonbondedMethod() == NonbondedForce::CutoffPeriodic ||
             owner.getNonbondedMethod() == NonbondedForce::Ewald ||
             owner.getNonbondedMethod() == NonbondedForce::PME) {
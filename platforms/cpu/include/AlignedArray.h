@@ -36,8 +36,9 @@ namespace OpenMM {
 
 /**
  * This class represents an array in memory whose starting point is guaranteed to
- * be aligned with a 16 byte boundary.  This can improve the performance of vectorized
- * code, since loads and stores are more efficient.
+ * be aligned with a 64 byte boundary.  This can improve the performance of vectorized
+ * code, since loads and stores are more efficient, and it lets data structures that are
+ * a multiple of 64 bytes in size line up with cache lines.
  */
 template <class T>
 class AlignedArray {
@@ -88,9 +89,9 @@ public:
 private:
     void allocate(int size) {
         dataSize = size;
-        baseData = new char[size*sizeof(T)+16];
-        char* offsetData = baseData+15;
-        offsetData -= (long long)offsetData&0xF;
+        baseData = new char[size*sizeof(T)+64];
+        char* offsetData = baseData+63;
+        offsetData -= (long long)offsetData&0x3F;
         data = (T*) offsetData;
     }
     int dataSize;
@@ -0,0 +1,119 @@
+#ifndef OPENMM_CPU_ATOMREORDERER_H_
+#define OPENMM_CPU_ATOMREORDERER_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2015 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "windowsExportCpu.h"
+#include "openmm/internal/ContextImpl.h"
+#include <vector>
+
+namespace OpenMM {
+
+/**
+ * This class periodically sorts the per-particle arrays of a Context into spatial order, so that
+ * particles that are close together in space are also close together in memory.  To keep every
+ * kernel's particle indices valid, it only exchanges molecules that are identical in every respect:
+ * masses, constraints, virtual sites, and the parameters of every force.  The original order is
+ * recorded so it can be restored at the boundary with the public API.
+ *
+ * Reordering is only applied when it is known to be safe.  If the System contains a force or virtual
+ * site type this class does not know how to compare, or the integrator keeps per-particle state of
+ * its own, particles are left in their original order.
+ */
+
+class OPENMM_EXPORT_CPU CpuAtomReorderer {
+public:
+    /**
+     * Create a CpuAtomReorderer.
+     *
+     * @param numAtoms    the number of atoms in the System
+     * @param enabled     whether reordering has been requested
+     */
+    CpuAtomReorderer(int numAtoms, bool enabled);
+    /**
+     * Get whether the atoms are currently stored in a different order from the System.
+     */
+    bool getAtomsAreReordered() const {
+        return atomsAreReordered;
+    }
+    /**
+     * Get the index in the System of the atom stored at each position.
+     */
+    const std::vector<int>& getAtomIndex() const {
+        return atomIndex;
+    }
+    /**
+     * Get the position at which each atom in the System is stored.
+     */
+    const std::vector<int>& getStorageIndex() const {
+        return storageIndex;
+    }
+    /**
+     * This is called at the start of every force computation.  If the parameters have changed it restores
+     * the original order, and every so often it sorts molecules into spatial order.  Reordering only happens
+     * when forces are being computed, since energy evaluations may be nested inside operations that have saved
+     * copies of the positions.
+     *
+     * @param context       the context whose data should be reordered
+     * @param includeForce  true if forces are being computed
+     */
+    void reorderAtoms(ContextImpl& context, bool includeForce);
+    /**
+     * Record that parameters of a force have changed, so molecules that used to be identical may no longer be.
+     * The original order is restored at the start of the next force computation.
+     */
+    void invalidateMolecules();
+    /**
+     * Put all atoms back in the order they appear in the System.
+     */
+    void restoreOriginalOrder(ContextImpl& context);
+private:
+    /**
+     * A set of identical molecules.  atoms contains the index of each atom relative to the first one, and
+     * offsets contains the index of the first atom in each instance.
+     */
+    struct MoleculeGroup {
+        std::vector<int> atoms;
+        std::vector<int> offsets;
+    };
+    bool findMoleculeGroups(ContextImpl& context);
+    void sortMolecules(ContextImpl& context);
+    void applyOrder(ContextImpl& context, const std::vector<int>& newAtomIndex);
+    int numAtoms, stepsSinceReorder;
+    bool enabled, atomsAreReordered, hasFoundGroups, isPeriodic, needRestore;
+    std::vector<int> atomIndex, storageIndex;
+    std::vector<MoleculeGroup> moleculeGroups;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_CPU_ATOMREORDERER_H_*/
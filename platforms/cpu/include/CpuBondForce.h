@@ -62,6 +62,19 @@ public:
      */
     void threadComputeForce(ThreadPool& threads, int threadIndex, std::vector<OpenMM::RealVec>& atomCoordinates, RealOpenMM** parameters,
             std::vector<OpenMM::RealVec>& forces, RealOpenMM* totalEnergy, ReferenceBondIxn& referenceBondIxn);
+    /**
+     * Get the bonds assigned to a thread.  No two threads are assigned bonds that involve the same atom.
+     */
+    const std::vector<int>& getThreadBonds(int thread) const {
+        return threadBonds[thread];
+    }
+    /**
+     * Get the bonds that could not be assigned to any thread.  These must be computed serially after
+     * the threads have finished.
+     */
+    const std::vector<int>& getExtraBonds() const {
+        return extraBonds;
+    }
 private:
     bool canAssignBond(int bond, int thread, std::vector<int>& atomThread);
     void assignBond(int bond, int thread, std::vector<int>& atomThread, std::vector<int>& bondThread, std::vector<std::set<int> >& atomBonds, std::list<int>& candidateBonds);
@@ -0,0 +1,102 @@
+#ifndef OPENMM_CPUCMAPTORSIONFORCE_H_
+#define OPENMM_CPUCMAPTORSIONFORCE_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2015 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "AlignedArray.h"
+#include "CpuBondForce.h"
+#include "RealVec.h"
+#include "windowsExportCpu.h"
+#include "openmm/internal/ThreadPool.h"
+#include <vector>
+
+namespace OpenMM {
+
+/**
+ * This class computes CMAP torsion forces.  Torsions are divided between threads using the
+ * conflict free assignment from CpuBondForce, and each thread evaluates its torsions four
+ * at a time with SIMD operations.
+ */
+class OPENMM_EXPORT_CPU CpuCMAPTorsionForce {
+public:
+    class ComputeForceTask;
+    CpuCMAPTorsionForce();
+    /**
+     * Set the torsions to compute, and decide which ones to compute with each thread.
+     *
+     * @param numAtoms       the number of atoms in the system
+     * @param torsionMaps    the index of the map used by each torsion
+     * @param torsionAtoms   the eight atoms forming each torsion
+     * @param threads        the ThreadPool to use for the computation
+     */
+    void initialize(int numAtoms, const std::vector<int>& torsionMaps, const std::vector<std::vector<int> >& torsionAtoms, ThreadPool& threads);
+    /**
+     * Set the bicubic patch coefficients for all maps.
+     *
+     * @param coeff    coeff[i][j] contains the 16 coefficients for patch j of map i, as computed by
+     *                 CMAPTorsionForceImpl::calcMapDerivatives().  The number of patches in each map
+     *                 must be a perfect square.
+     */
+    void setMapCoefficients(const std::vector<std::vector<std::vector<double> > >& coeff);
+    /**
+     * Set the map used by each torsion.
+     */
+    void setTorsionMaps(const std::vector<int>& torsionMaps);
+    /**
+     * Compute the forces from all torsions.
+     */
+    void calculateForce(std::vector<OpenMM::RealVec>& atomCoordinates, std::vector<OpenMM::RealVec>& forces, RealOpenMM* totalEnergy);
+    /**
+     * This routine contains the code executed by each thread.
+     */
+    void threadComputeForce(ThreadPool& threads, int threadIndex);
+private:
+    /**
+     * Compute a list of torsions, processing them in groups of four.
+     */
+    void computeTorsions(const std::vector<int>& torsions, double& energy);
+    int numTorsions;
+    std::vector<int> torsionMaps, torsionAtoms, mapSize, mapStart;
+    std::vector<int*> torsionAtomPointers;
+    AlignedArray<float> coefficients;
+    CpuBondForce bondForce;
+    ThreadPool* threads;
+    std::vector<double> threadEnergy;
+    // The following variables are used to make information accessible to the individual threads.
+    OpenMM::RealVec* atomCoordinates;
+    OpenMM::RealVec* forces;
+    bool includeEnergy;
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_CPUCMAPTORSIONFORCE_H_*/
@@ -47,7 +47,7 @@ private:
     const CpuNeighborList* neighborList;
     float periodicBoxSize[3];
     float cutoffDistance, cutoffDistance2;
-    const std::vector<std::set<int> > exclusions;
+    const CpuExclusionList exclusions;
     std::vector<std::string> valueNames;
     std::vector<CustomGBForce::ComputationType> valueTypes;
     std::vector<std::string> paramNames;
@@ -57,6 +57,7 @@ private:
     std::vector<double> threadEnergy;
     // Workspace vectors
     std::vector<std::vector<float> > values, dEdV;
+    std::vector<float> chainFactor;
     // The following variables are used to make information accessible to the individual threads.
     int numberOfAtoms;
     float* posq;
@@ -72,128 +73,99 @@ private:
     void threadComputeForce(ThreadPool& threads, int threadIndex);
 
     /**
-     * Calculate a computed value that is based on particle pairs
+     * Append all pairs within the cutoff between the atoms of one neighbor list block and
+     * their neighbors to the thread's list of pairs.
      * 
-     * @param index            the index of the value to compute
+     * @param blockIndex       the index of the block to process
      * @param data             workspace for the current thread
-     * @param numAtoms         number of atoms
-     * @param posq             atom coordinates
-     * @param atomParameters   atomParameters[atomIndex][paramterIndex]
-     * @param useExclusions    specifies whether to use exclusions
      */
-
-    void calculateParticlePairValue(int index, ThreadData& data, int numAtoms, float* posq, RealOpenMM** atomParameters,
-                                    bool useExclusions, const fvec4& boxSize, const fvec4& invBoxSize);
+    void findBlockPairs(int blockIndex, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize);
 
     /**
-     * Evaluate a single atom pair as part of calculating a computed value
+     * Append all pairs (atom, j) with j > atom to the thread's list of pairs.  This is used
+     * when there is no cutoff.
      * 
-     * @param index            the index of the value to compute
-     * @param atom1            the index of the first atom in the pair
-     * @param atom2            the index of the second atom in the pair
+     * @param atom             the index of the first atom in every pair
      * @param data             workspace for the current thread
-     * @param posq             atom coordinates
-     * @param atomParameters   atomParameters[atomIndex][paramterIndex]
      */
-
-    void calculateOnePairValue(int index, int atom1, int atom2, ThreadData& data, float* posq, RealOpenMM** atomParameters,
-                               std::vector<float>& valueArray, const fvec4& boxSize, const fvec4& invBoxSize);
+    void findRowPairs(int atom, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize);
 
     /**
-     * Calculate an energy term of type SingleParticle
+     * Evaluate the first computed value for a range of the thread's pairs, covering both
+     * orderings of each pair.
      * 
-     * @param index            the index of the value to compute
      * @param data             workspace for the current thread
-     * @param numAtoms         number of atoms
-     * @param posq             atom coordinates
-     * @param atomParameters   atomParameters[atomIndex][paramterIndex]
-     * @param forces           forces on atoms are added to this
-     * @param totalEnergy      the energy contribution is added to this
+     * @param start            the index of the first pair to process
+     * @param includeValue     if true, the value is added to data.value0
+     * @param includeDeriv     if true, the derivatives with respect to r are stored in data.pairValueDeriv
      */
-
-    void calculateSingleParticleEnergyTerm(int index, ThreadData& data, int numAtoms, float* posq, RealOpenMM** atomParameters, float* forces, double& totalEnergy);
+    void calculatePairValues(ThreadData& data, int start, bool includeValue, bool includeDeriv);
 
     /**
-     * Calculate an energy term that is based on particle pairs
+     * Calculate all energy terms of type SingleParticle for the thread's atoms.
      * 
-     * @param index            the index of the term to compute
      * @param data             workspace for the current thread
-     * @param numAtoms         number of atoms
-     * @param posq             atom coordinates
-     * @param atomParameters   atomParameters[atomIndex][paramterIndex]
-     * @param useExclusions    specifies whether to use exclusions
      * @param forces           forces on atoms are added to this
      * @param totalEnergy      the energy contribution is added to this
      */
-
-    void calculateParticlePairEnergyTerm(int index, ThreadData& data, int numAtoms, float* posq, RealOpenMM** atomParameters,
-                                    bool useExclusions, float* forces, double& totalEnergy, const fvec4& boxSize, const fvec4& invBoxSize);
+    void calculateSingleParticleEnergyTerms(ThreadData& data, float* forces, double& totalEnergy);
 
     /**
-     * Evaluate a single atom pair as part of calculating an energy term
+     * Calculate all energy terms that are based on particle pairs for the thread's list of pairs.
      * 
-     * @param index            the index of the term to compute
-     * @param atom1            the index of the first atom in the pair
-     * @param atom2            the index of the second atom in the pair
      * @param data             workspace for the current thread
-     * @param posq             atom coordinates
-     * @param atomParameters   atomParameters[atomIndex][paramterIndex]
      * @param forces           forces on atoms are added to this
      * @param totalEnergy      the energy contribution is added to this
      */
-
-    void calculateOnePairEnergyTerm(int index, int atom1, int atom2, ThreadData& data, float* posq, RealOpenMM** atomParameters,
-                               float* forces, double& totalEnergy, const fvec4& boxSize, const fvec4& invBoxSize);
+    void calculateParticlePairEnergyTerms(ThreadData& data, float* forces, double& totalEnergy);
 
     /**
-     * Apply the chain rule to compute forces on atoms
+     * Sum the energy derivatives for the thread's atoms, apply the forces from computed values that
+     * depend explicitly on particle coordinates, and record the factor by which the derivative of the
+     * first computed value must be multiplied to give the derivative of the energy.
      * 
      * @param data             workspace for the current thread
-     * @param numAtoms         number of atoms
-     * @param posq             atom coordinates
-     * @param atomParameters   atomParameters[atomIndex][paramterIndex]
      * @param forces           forces on atoms are added to this
      */
-
-    void calculateChainRuleForces(ThreadData& data, int numAtoms, float* posq, RealOpenMM** atomParameters,
-                                    float* forces, const fvec4& boxSize, const fvec4& invBoxSize);
+    void calculateChainRuleFactors(ThreadData& data, float* forces);
 
     /**
-     * Evaluate a single atom pair as part of applying the chain rule
+     * Apply the chain rule to compute forces on the atoms in the thread's list of pairs.
      * 
-     * @param atom1            the index of the first atom in the pair
-     * @param atom2            the index of the second atom in the pair
      * @param data             workspace for the current thread
-     * @param posq             atom coordinates
-     * @param atomParameters   atomParameters[atomIndex][paramterIndex]
      * @param forces           forces on atoms are added to this
-     * @param isExcluded       specifies whether this is an excluded pair
      */
-
-    void calculateOnePairChainRule(int atom1, int atom2, ThreadData& data, float* posq, RealOpenMM** atomParameters,
-                               float* forces, bool isExcluded, const fvec4& boxSize, const fvec4& invBoxSize);
+    void calculateChainRuleForces(ThreadData& data, float* forces);
 
     /**
-     * Compute the displacement and squared distance between two points, optionally using
+     * Compute the displacements and squared distances from one point to four others, optionally using
      * periodic boundary conditions.
      */
-    void getDeltaR(const fvec4& posI, const fvec4& posJ, fvec4& deltaR, float& r2, bool periodic, const fvec4& boxSize, const fvec4& invBoxSize) const;
+    void getDeltaR(const fvec4& posI, const fvec4& x, const fvec4& y, const fvec4& z, fvec4& dx, fvec4& dy, fvec4& dz, fvec4& r2,
+                   const fvec4& boxSize, const fvec4& invBoxSize) const;
 
 public:
 
     /**
-     * Construct a new CpuCustomGBForce.
+     * Construct a new CpuCustomGBForce.  Related quantities are combined into expressions with multiple
+     * outputs so they can be computed together:
+     * 
+     * valueExpressions[0] has two outputs: the value for the pair (atom1, atom2) and for the pair (atom2, atom1).
+     * valueDerivExpressions[0] has the same two outputs, followed by the derivatives of each one with respect to r.
+     * For i > 0, valueExpressions[i] computes the value, and valueDerivExpressions[i] has the derivatives of it with
+     * respect to each of the previous values, then with respect to x, y, and z.
+     * 
+     * For a SingleParticle term, energyExpressions[i] has the energy, its derivatives with respect to every value,
+     * then its derivatives with respect to x, y, and z.  For a pair term it has the energy, its derivative with
+     * respect to r, then the derivatives with respect to each value of the first and second atom in turn.
      */
 
-     CpuCustomGBForce(int numAtoms, const std::vector<std::set<int> >& exclusions,
+     CpuCustomGBForce(int numAtoms, const CpuExclusionList& exclusions,
                         const std::vector<Lepton::CompiledExpression>& valueExpressions,
-                        const std::vector<std::vector<Lepton::CompiledExpression> >& valueDerivExpressions,
-                        const std::vector<std::vector<Lepton::CompiledExpression> >& valueGradientExpressions,
+                        const std::vector<Lepton::CompiledExpression>& valueDerivExpressions,
                         const std::vector<std::string>& valueNames,
                         const std::vector<CustomGBForce::ComputationType>& valueTypes,
                         const std::vector<Lepton::CompiledExpression>& energyExpressions,
-                        const std::vector<std::vector<Lepton::CompiledExpression> >& energyDerivExpressions,
-                        const std::vector<std::vector<Lepton::CompiledExpression> >& energyGradientExpressions,
                         const std::vector<CustomGBForce::ComputationType>& energyTypes,
                         const std::vector<std::string>& parameterNames, ThreadPool& threads);
 
@@ -237,28 +209,27 @@ class CpuCustomGBForce::ThreadData {
 public:
     ThreadData(int numAtoms, int numThreads, int threadIndex,
                const std::vector<Lepton::CompiledExpression>& valueExpressions,
-               const std::vector<std::vector<Lepton::CompiledExpression> >& valueDerivExpressions,
-               const std::vector<std::vector<Lepton::CompiledExpression> >& valueGradientExpressions,
+               const std::vector<Lepton::CompiledExpression>& valueDerivExpressions,
                const std::vector<std::string>& valueNames,
                const std::vector<Lepton::CompiledExpression>& energyExpressions,
-               const std::vector<std::vector<Lepton::CompiledExpression> >& energyDerivExpressions,
-               const std::vector<std::vector<Lepton::CompiledExpression> >& energyGradientExpressions,
                const std::vector<std::string>& parameterNames);
     CompiledExpressionSet expressionSet;
     std::vector<Lepton::CompiledExpression> valueExpressions;
-    std::vector<std::vector<Lepton::CompiledExpression> > valueDerivExpressions;
-    std::vector<std::vector<Lepton::CompiledExpression> > valueGradientExpressions;
+    std::vector<Lepton::CompiledExpression> valueDerivExpressions;
     std::vector<int> valueIndex;
     std::vector<Lepton::CompiledExpression> energyExpressions;
-    std::vector<std::vector<Lepton::CompiledExpression> > energyDerivExpressions;
-    std::vector<std::vector<Lepton::CompiledExpression> > energyGradientExpressions;
     std::vector<int> paramIndex;
     std::vector<int> particleParamIndex;
     std::vector<int> particleValueIndex;
     int xindex, yindex, zindex, rindex;
     int firstAtom, lastAtom;
+    // The pairs to process.  With a cutoff, these are found once and reused by every pass.
+    // pairDelta holds the displacement from atom1 to atom2 followed by the distance.
+    std::vector<int> pairAtom1, pairAtom2;
+    std::vector<char> pairExcluded;
+    std::vector<float> pairDelta, pairValueDeriv;
     // Workspace vectors
-    std::vector<float> value0, dVdR1, dVdR2, dVdX, dVdY, dVdZ;
+    std::vector<float> value0, coeff, dVdX, dVdY, dVdZ;
     std::vector<std::vector<float> > dEdV;
 };
 
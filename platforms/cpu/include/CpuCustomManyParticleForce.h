@@ -27,7 +27,9 @@
 
 #include "ReferenceForce.h"
 #include "ReferenceBondIxn.h"
-#include "CpuNeighborList.h"
+#include "AlignedArray.h"
+#include "CpuExclusionList.h"
+#include "RealVec.h"
 #include "openmm/CustomManyParticleForce.h"
 #include "openmm/internal/CompiledExpressionSet.h"
 #include "openmm/internal/ThreadPool.h"
@@ -56,13 +58,18 @@ private:
     float recipBoxSize[3];
     RealVec periodicBoxVectors[3];
     AlignedArray<fvec4> periodicBoxVec4;
-    CpuNeighborList* neighborList;
     ThreadPool& threads;
-    std::vector<std::set<int> > exclusions;
+    CpuExclusionList exclusions;
     std::vector<int> particleTypes;
     std::vector<int> orderIndex;
     std::vector<std::vector<int> > particleOrder;
+    // allowedTypePrefix[i][code] is true if the types of the first i+1 particles in a set (encoded the same
+    // way as for orderIndex) can be completed to a set that passes the type filters.
+    std::vector<std::vector<char> > allowedTypePrefix;
     std::vector<std::vector<int> > particleNeighbors;
+    // The cell list used to build particleNeighbors.
+    int numCells[3];
+    std::vector<int> particleCell, cellStart, cellParticles;
     std::vector<ThreadData*> threadData;
     // The following variables are used to make information accessible to the individual threads.
     float* posq;
@@ -78,34 +85,55 @@ private:
     void threadComputeForce(ThreadPool& threads, int threadIndex);
 
     /**
-     * This is called recursively to loop over all possible combination of a set of particles and evaluate the
-     * interaction for each one.
+     * Sort the particles into cells whose width is at least the cutoff distance.
      */
-    void loopOverInteractions(std::vector<int>& availableParticles, std::vector<int>& particleSet, int loopIndex, int startIndex,
-                              RealOpenMM** particleParameters, float* forces, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize);
+    void buildCellList();
 
-    /**---------------------------------------------------------------------------------------
-
-       Calculate custom interaction for one set of particles
+    /**
+     * Find all particles within the cutoff distance of one particle and record them in particleNeighbors.
+     * Except in UniqueCentralParticle mode, only particles with a higher index are recorded.
+     */
+    void findNeighbors(int particle, const fvec4& boxSize, const fvec4& invBoxSize);
 
-       @param particleSet        the indices of the particles
-       @param posq               atom coordinates in float format
-       @param particleParameters particle parameter values (particleParameters[particleIndex][parameterIndex])
-       @param forces             force array (forces added)
-       @param totalEnergy        total energy
+    /**
+     * This is called recursively to loop over all possible combination of a set of particles.  Every set
+     * that can interact is added to the thread's list of sets.  Candidates are rejected as soon as they
+     * fail a cutoff, exclusion, or type filter check, before any larger set containing them is considered.
+     */
+    void loopOverInteractions(const std::vector<int>& availableParticles, std::vector<int>& particleSet, int loopIndex, int startIndex,
+                              int typeCode, int typeScale, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize);
 
-       --------------------------------------------------------------------------------------- */
+    /**
+     * Put a set of particles into the order required by the type filters and add it to the thread's list of sets.
+     */
+    void addInteraction(const std::vector<int>& particleSet, ThreadData& data);
 
     /**
-     * Calculate the interaction for one set of particles
+     * Calculate the interactions for all sets of particles in the thread's list, four at a time.
      * 
-     * @param particleSet        the indices of the particles
      * @param particleParameters particle parameter values (particleParameters[particleIndex][parameterIndex])
+     * @param forces             force array (forces added)
      * @param data               information and workspace for the current thread
      * @param boxSize            the size of the periodic box
      * @param invBoxSize         the inverse size of the periodic box
      */
-    void calculateOneIxn(std::vector<int>& particleSet, RealOpenMM** particleParameters, float* forces, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize);
+    void calculateIxns(RealOpenMM** particleParameters, float* forces, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize);
+
+    /**
+     * Compute the displacements, distances, and angles needed by four sets of particles at once.
+     */
+    void computeGeometry(const int* const* particleSets, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize);
+
+    /**
+     * Calculate the interaction for one set of particles.  computeGeometry() must already have been called.
+     * 
+     * @param permutedParticles  the indices of the particles, in the order required by the type filters
+     * @param lane               the position of this set among the four passed to computeGeometry()
+     * @param particleParameters particle parameter values (particleParameters[particleIndex][parameterIndex])
+     * @param forces             force array (forces added)
+     * @param data               information and workspace for the current thread
+     */
+    void calculateOneIxn(const int* permutedParticles, int lane, RealOpenMM** particleParameters, float* forces, ThreadData& data);
 
     /**
      * Compute the displacement and squared distance between two points, optionally using
@@ -163,53 +191,60 @@ class CpuCustomManyParticleForce::ParticleTermInfo {
 public:
     std::string name;
     int atom, component, variableIndex;
-    Lepton::CompiledExpression forceExpression;
-    ParticleTermInfo(const std::string& name, int atom, int component, const Lepton::CompiledExpression& forceExpression, ThreadData& data);
+    int forceIndex;
+    ParticleTermInfo(const std::string& name, int atom, int component, int forceIndex, ThreadData& data);
 };
 
 class CpuCustomManyParticleForce::DistanceTermInfo {
 public:
     std::string name;
     int p1, p2, variableIndex;
-    Lepton::CompiledExpression forceExpression;
+    int forceIndex;
     int delta;
     float deltaSign;
-    DistanceTermInfo(const std::string& name, const std::vector<int>& atoms, const Lepton::CompiledExpression& forceExpression, ThreadData& data);
+    DistanceTermInfo(const std::string& name, const std::vector<int>& atoms, int forceIndex, ThreadData& data);
 };
 
 class CpuCustomManyParticleForce::AngleTermInfo {
 public:
     std::string name;
     int p1, p2, p3, variableIndex;
-    Lepton::CompiledExpression forceExpression;
+    int forceIndex;
     int delta1, delta2;
     float delta1Sign, delta2Sign;
-    AngleTermInfo(const std::string& name, const std::vector<int>& atoms, const Lepton::CompiledExpression& forceExpression, ThreadData& data);
+    AngleTermInfo(const std::string& name, const std::vector<int>& atoms, int forceIndex, ThreadData& data);
 };
 
 class CpuCustomManyParticleForce::DihedralTermInfo {
 public:
     std::string name;
     int p1, p2, p3, p4, variableIndex;
-    Lepton::CompiledExpression forceExpression;
+    int forceIndex;
     int delta1, delta2, delta3;
-    DihedralTermInfo(const std::string& name, const std::vector<int>& atoms, const Lepton::CompiledExpression& forceExpression, ThreadData& data);
+    DihedralTermInfo(const std::string& name, const std::vector<int>& atoms, int forceIndex, ThreadData& data);
 };
 
 class CpuCustomManyParticleForce::ThreadData {
 public:
     CompiledExpressionSet expressionSet;
     Lepton::CompiledExpression energyExpression;
+    // Computes the energy (output 0) together with its derivative for every term (output forceIndex).
+    Lepton::CompiledExpression forceExpression;
     std::vector<std::vector<int> > particleParamIndices;
-    std::vector<int> permutedParticles;
     std::vector<std::pair<int, int> > deltaPairs;
     std::vector<ParticleTermInfo> particleTerms;
     std::vector<DistanceTermInfo> distanceTerms;
     std::vector<AngleTermInfo> angleTerms;
     std::vector<DihedralTermInfo> dihedralTerms;
-    AlignedArray<fvec4> delta, cross1, cross2;
+    // The sets of particles to compute, numParticlesPerSet indices for each one.
+    std::vector<int> interactions;
+    // Geometry of four sets computed together.  delta[j*numDeltas+i] is the displacement for delta pair i of
+    // set j, and likewise for normDelta and norm2Delta.  deltaX, deltaY, deltaZ, and deltaR2 hold the same
+    // values with the four sets packed into each vector.  angleValue[4*i+j] is angle term i of set j.
+    AlignedArray<fvec4> delta, deltaX, deltaY, deltaZ, deltaR2, cross1, cross2;
     std::vector<float> normDelta;
     std::vector<float> norm2Delta;
+    std::vector<float> angleValue;
     AlignedArray<fvec4> f;
     double energy;
     ThreadData(const CustomManyParticleForce& force, Lepton::ParsedExpression& energyExpr,
@@ -47,7 +47,8 @@ class CpuCustomNonbondedForce {
          --------------------------------------------------------------------------------------- */
 
        CpuCustomNonbondedForce(const Lepton::CompiledExpression& energyExpression, const Lepton::CompiledExpression& forceExpression,
-                                   const std::vector<std::string>& parameterNames, const std::vector<std::set<int> >& exclusions, ThreadPool& threads);
+                                   const Lepton::CompiledExpression& energyAndForceExpression, const std::vector<std::string>& parameterNames,
+                                   const CpuExclusionList& exclusions, ThreadPool& threads);
 
       /**---------------------------------------------------------------------------------------
 
@@ -120,6 +121,29 @@ class CpuCustomNonbondedForce {
     void calculatePairIxn(int numberOfAtoms, float* posq, std::vector<OpenMM::RealVec>& atomCoordinates, RealOpenMM** atomParameters,
                           RealOpenMM* fixedParameters, const std::map<std::string, double>& globalParameters,
                           std::vector<AlignedArray<float> >& threadForce, bool includeForce, bool includeEnergy, double& totalEnergy);
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate the energy for several sets of global parameter values in a single pass
+         over the interactions.  The distance and per-particle parameters for each pair are
+         computed once, and only the energy expression is evaluated for each set.
+
+         @param numberOfAtoms        number of atoms
+         @param posq                 atom coordinates in float format
+         @param atomCoordinates      atom coordinates
+         @param atomParameters       atom parameters             atomParameters[atomIndex][paramterIndex]
+         @param globalParameters     the values of global parameters that are the same for all sets
+         @param variedParameters     the names of the global parameters that differ between sets
+         @param parameterSetValues   parameterSetValues[i][j] is the value of variedParameters[j] in set i
+         @param threadForce          per-thread force arrays (used as scratch space)
+         @param energies             on exit, element i contains the energy for set i
+
+         --------------------------------------------------------------------------------------- */
+
+    void calculatePairIxnForParameterSets(int numberOfAtoms, float* posq, std::vector<OpenMM::RealVec>& atomCoordinates, RealOpenMM** atomParameters,
+                          const std::map<std::string, double>& globalParameters, const std::vector<std::string>& variedParameters,
+                          const std::vector<std::vector<double> >& parameterSetValues, std::vector<AlignedArray<float> >& threadForce,
+                          std::vector<double>& energies);
 private:
     class ComputeForceTask;
     class ThreadData;
@@ -134,7 +158,7 @@ private:
     AlignedArray<fvec4> periodicBoxVec4;
     RealOpenMM cutoffDistance, switchingDistance;
     ThreadPool& threads;
-    const std::vector<std::set<int> > exclusions;
+    const CpuExclusionList exclusions;
     std::vector<ThreadData*> threadData;
     std::vector<std::string> paramNames;
     std::vector<std::pair<int, int> > groupInteractions;
@@ -147,6 +171,8 @@ private:
     const std::map<std::string, double>* globalParameters;
     std::vector<AlignedArray<float> >* threadForce;
     bool includeForce, includeEnergy;
+    const std::vector<std::string>* variedParameters;
+    const std::vector<std::vector<double> >* parameterSetValues;
     void* atomicCounter;
 
     /**
@@ -167,6 +193,12 @@ private:
      */
     void calculateOneIxn(int atom1, int atom2, ThreadData& data, float* forces, double& totalEnergy, const fvec4& boxSize, const fvec4& invBoxSize);
 
+    /**
+     * Calculate the energy of the interaction between two atoms for every parameter set, adding
+     * each one to the thread's parameterSetEnergy.  This is used by calculatePairIxnForParameterSets().
+     */
+    void calculateOneIxnForParameterSets(int atom1, int atom2, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize);
+
     /**
      * Compute the displacement and squared distance between two points, optionally using
      * periodic boundary conditions.
@@ -176,13 +208,23 @@ private:
 
 class CpuCustomNonbondedForce::ThreadData {
 public:
-    ThreadData(const Lepton::CompiledExpression& energyExpression, const Lepton::CompiledExpression& forceExpression, const std::vector<std::string>& parameterNames);
+    ThreadData(const Lepton::CompiledExpression& energyExpression, const Lepton::CompiledExpression& forceExpression,
+               const Lepton::CompiledExpression& energyAndForceExpression, const std::vector<std::string>& parameterNames);
+    /**
+     * Select which expression to evaluate for each interaction, depending on whether the energy, the force,
+     * or both are needed.  This sets expression, particleParams, r, energyOutput, and forceOutput.
+     */
+    void selectExpression(bool includeForce, bool includeEnergy);
     Lepton::CompiledExpression energyExpression;
     Lepton::CompiledExpression forceExpression;
-    std::vector<double*> energyParticleParams;
-    std::vector<double*> forceParticleParams;
-    double* energyR;
-    double* forceR;
+    Lepton::CompiledExpression energyAndForceExpression;
+    std::vector<std::string> parameterNames;
+    Lepton::CompiledExpression* expression;
+    std::vector<double*> particleParams;
+    std::vector<double*> energyVariedParams;
+    std::vector<double> parameterSetEnergy;
+    double* r;
+    int energyOutput, forceOutput;
 };
 
 } // namespace OpenMM
@@ -0,0 +1,214 @@
+/* Portions copyright (c) 2006-2015 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef OPENMM_CPU_DOUBLE_NONBONDED_FORCE_H__
+#define OPENMM_CPU_DOUBLE_NONBONDED_FORCE_H__
+
+#include "CpuExclusionList.h"
+#include "CpuNeighborList.h"
+#include "RealVec.h"
+#include "openmm/internal/ThreadPool.h"
+#include <utility>
+#include <vector>
+
+// ---------------------------------------------------------------------------------------
+
+namespace OpenMM {
+
+/**
+ * This class computes the same interactions as CpuNonbondedForce, but does all arithmetic and
+ * force accumulation in double precision.  It is used when the CpuPrecision property is "double".
+ * It shares the neighbor list with the single precision kernels, since that only needs to decide
+ * which pairs might be within the cutoff.
+ */
+class CpuDoubleNonbondedForce {
+    public:
+        class ComputeDirectTask;
+        class ReduceForcesTask;
+
+      /**---------------------------------------------------------------------------------------
+
+         Constructor
+
+         --------------------------------------------------------------------------------------- */
+
+       CpuDoubleNonbondedForce();
+
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to use a cutoff.
+
+         @param distance            the cutoff distance
+         @param neighbors           the neighbor list to use
+         @param solventDielectric   the dielectric constant of the bulk solvent
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseCutoff(double distance, const CpuNeighborList& neighbors, double solventDielectric);
+
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to use a switching function on the Lennard-Jones interaction.
+
+         @param distance            the switching distance
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseSwitchingFunction(double distance);
+
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to use periodic boundary conditions.  This requires that a cutoff has
+         already been set, and the smallest side of the periodic box is at least twice the cutoff
+         distance.
+
+         @param periodicBoxVectors    the vectors defining the periodic box
+
+         --------------------------------------------------------------------------------------- */
+
+      void setPeriodic(RealVec* periodicBoxVectors);
+
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to use Ewald summation.
+
+         @param alpha  the Ewald separation parameter
+         @param kmaxx  the largest wave vector in the x direction
+         @param kmaxy  the largest wave vector in the y direction
+         @param kmaxz  the largest wave vector in the z direction
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUseEwald(double alpha, int kmaxx, int kmaxy, int kmaxz);
+
+
+      /**---------------------------------------------------------------------------------------
+
+         Set the force to use Particle-Mesh Ewald (PME) summation.
+
+         @param alpha    the Ewald separation parameter
+         @param meshSize the dimensions of the mesh
+
+         --------------------------------------------------------------------------------------- */
+
+      void setUsePME(double alpha, int meshSize[3]);
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate the reciprocal space part of an Ewald or PME calculation.  This is done on
+         the calling thread.
+
+         @param numberOfAtoms    number of atoms
+         @param atomCoordinates  atom coordinates
+         @param charges          atom charges
+         @param forces           force array (forces added)
+         @param includeForces    whether to compute forces
+         @param totalEnergy      total energy
+
+         --------------------------------------------------------------------------------------- */
+
+      void calculateReciprocalIxn(int numberOfAtoms, const std::vector<RealVec>& atomCoordinates, const std::vector<double>& charges,
+                            std::vector<RealVec>& forces, bool includeForces, double* totalEnergy) const;
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate LJ Coulomb pair ixn
+
+         @param numberOfAtoms    number of atoms
+         @param atomCoordinates  atom coordinates (periodic boundary conditions not applied)
+         @param charges          atom charges
+         @param atomParameters   atom parameters (sigma/2, 2*sqrt(epsilon))
+         @param exclusions       the atoms excluded from interacting with each atom
+         @param forces           force array (forces added)
+         @param includeForces    whether to compute forces
+         @param totalEnergy      total energy
+         @param threads          the thread pool to use
+
+         --------------------------------------------------------------------------------------- */
+
+      void calculateDirectIxn(int numberOfAtoms, const std::vector<RealVec>& atomCoordinates, const std::vector<double>& charges,
+            const std::vector<std::pair<double, double> >& atomParameters, const CpuExclusionList& exclusions, std::vector<RealVec>& forces,
+            bool includeForces, double* totalEnergy, ThreadPool& threads);
+
+    /**
+     * This routine contains the code executed by each thread to compute its share of the interactions.
+     */
+    void threadComputeDirect(ThreadPool& threads, int threadIndex);
+
+    /**
+     * This routine contains the code executed by each thread to add the per-thread forces together.
+     */
+    void threadReduceForces(ThreadPool& threads, int threadIndex);
+
+private:
+        bool cutoff;
+        bool useSwitch;
+        bool periodic;
+        bool ewald;
+        bool pme;
+        const CpuNeighborList* neighborList;
+        double recipBoxSize[3];
+        RealVec periodicBoxVectors[3];
+        double cutoffDistance, switchingDistance;
+        double krf, crf;
+        double alphaEwald;
+        int numRx, numRy, numRz;
+        int meshDim[3];
+        std::vector<std::vector<RealVec> > threadForce;
+        std::vector<double> threadEnergy;
+        // The following variables are used to make information accessible to the individual threads.
+        int numberOfAtoms;
+        RealVec const* atomCoordinates;
+        double const* charges;
+        std::pair<double, double> const* atomParameters;
+        const CpuExclusionList* exclusions;
+        std::vector<RealVec>* forces;
+        bool includeForces, includeEnergy;
+
+        static const double TWO_OVER_SQRT_PI;
+
+      /**---------------------------------------------------------------------------------------
+
+         Calculate LJ Coulomb pair ixn between two atoms
+
+         @param atom1            the index of the first atom
+         @param atom2            the index of the second atom
+         @param forces           force array (forces added), or NULL if forces should not be computed
+         @param totalEnergy      total energy, or NULL if energy should not be computed
+
+         --------------------------------------------------------------------------------------- */
+
+      void calculateOneIxn(int atom1, int atom2, RealVec* forces, double* totalEnergy) const;
+
+      /**
+       * Compute the displacement and squared distance between two points, optionally using
+       * periodic boundary conditions.
+       */
+      void getDeltaR(const RealVec& posI, const RealVec& posJ, RealVec& deltaR, double& r2, bool periodic) const;
+};
+
+} // namespace OpenMM
+
+// ---------------------------------------------------------------------------------------
+
+#endif // OPENMM_CPU_DOUBLE_NONBONDED_FORCE_H__
@@ -0,0 +1,105 @@
+#ifndef OPENMM_CPU_EXCLUSIONLIST_H_
+#define OPENMM_CPU_EXCLUSIONLIST_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2016 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "windowsExportCpu.h"
+#include <cstddef>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace OpenMM {
+
+/**
+ * This class stores the exclusions for a set of atoms in compressed sparse row format.
+ * The atoms excluded from each atom are stored in one contiguous array, sorted by index,
+ * which takes far less memory than a set for each atom and can be scanned sequentially.
+ */
+class OPENMM_EXPORT_CPU CpuExclusionList {
+public:
+    /**
+     * Create an empty exclusion list.
+     */
+    CpuExclusionList();
+    /**
+     * Create an exclusion list in which no atoms are excluded.
+     *
+     * @param numAtoms      the number of atoms
+     */
+    CpuExclusionList(int numAtoms);
+    /**
+     * Create an exclusion list from a list of excluded pairs.  Each pair is added in both directions,
+     * and duplicate pairs are ignored.
+     *
+     * @param numAtoms      the number of atoms
+     * @param excludedPairs the pairs of atoms to exclude
+     */
+    CpuExclusionList(int numAtoms, const std::vector<std::pair<int, int> >& excludedPairs);
+    /**
+     * Create an exclusion list from a set of excluded atoms for each atom.
+     *
+     * @param exclusions    exclusions[i] contains the indices of all atoms excluded from atom i
+     */
+    CpuExclusionList(const std::vector<std::set<int> >& exclusions);
+    /**
+     * Get the number of atoms.
+     */
+    int getNumAtoms() const {
+        return atomStart.size()-1;
+    }
+    /**
+     * Get the number of atoms excluded from an atom.
+     */
+    int getNumExclusions(int atom) const {
+        return atomStart[atom+1]-atomStart[atom];
+    }
+    /**
+     * Get a pointer to the sorted indices of the atoms excluded from an atom.  It contains
+     * getNumExclusions(atom) elements.
+     */
+    const int* getExclusions(int atom) const {
+        return (excludedAtoms.size() == 0 ? NULL : &excludedAtoms[0]+atomStart[atom]);
+    }
+    /**
+     * Get whether the interaction between two atoms is excluded.
+     */
+    bool isExcluded(int atom1, int atom2) const;
+private:
+    void initialize(int numAtoms, std::vector<std::pair<int, int> >& pairs);
+    std::vector<int> atomStart;
+    std::vector<int> excludedAtoms;
+};
+
+} // namespace OpenMM
+
+#endif // OPENMM_CPU_EXCLUSIONLIST_H_
@@ -26,6 +26,7 @@
 #define OPENMM_CPU_GBSAOBC_FORCE_H__
 
 #include "AlignedArray.h"
+#include "CpuNeighborList.h"
 #include "openmm/internal/ThreadPool.h"
 #include "openmm/internal/vectorize.h"
 #include <set>
@@ -34,17 +35,31 @@
 
 namespace OpenMM {
 
+/**
+ * This class computes the GBSA/OBC implicit solvent force.  Atoms are processed in blocks.  When a cutoff
+ * is used, the interactions of each block are taken from a CpuNeighborList, so the cost scales linearly
+ * with the number of atoms.  Otherwise every block interacts with all atoms that come before it.  Subclasses
+ * implement the per-block calculations using vectors of the appropriate width.
+ */
 class CpuGBSAOBCForce {
 public:
     class ComputeTask;
-    CpuGBSAOBCForce();
+    CpuGBSAOBCForce(int blockSize);
+    virtual ~CpuGBSAOBCForce();
+
+    /**
+     * Get the number of atoms in each block.  When a cutoff is used, the neighbor list must be built
+     * with this block size.
+     */
+    int getBlockSize() const;
 
     /**
      * Set the force to use a cutoff.
      * 
      * @param distance    the cutoff distance
+     * @param neighbors   the neighbor list to use
      */
-    void setUseCutoff(float distance);
+    void setUseCutoff(float distance, const CpuNeighborList& neighbors);
 
     /**
      * 
@@ -97,38 +112,78 @@ public:
      */
     void threadComputeForce(ThreadPool& threads, int threadIndex);
 
-private:
+protected:
+    /**
+     * Add the contributions of one block's interactions to the sums used for computing Born radii.
+     * Both the block atoms and their neighbors receive contributions.
+     *
+     * @param blockAtom      the indices of the atoms in the block
+     * @param neighbors      the indices of the atoms the block interacts with
+     * @param exclusions     for each neighbor, a bit mask of block atoms it should not interact with
+     * @param numNeighbors   the number of neighbors
+     * @param bornSum        the sums are added to this array
+     */
+    virtual void calculateBlockBornSum(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float* bornSum, const fvec4& boxSize, const fvec4& invBoxSize) = 0;
+
+    /**
+     * Compute the pairwise polarization energy for one block, adding to the forces, the derivatives with
+     * respect to the Born radii, and the energy.
+     */
+    virtual void calculateBlockFirstLoop(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float preFactor, float* forces, float* bornForces, double& energy, const fvec4& boxSize, const fvec4& invBoxSize) = 0;
+
+    /**
+     * Compute the forces resulting from the dependence of the Born radii on atom positions for one block.
+     */
+    virtual void calculateBlockSecondLoop(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float* forces, const fvec4& boxSize, const fvec4& invBoxSize) = 0;
+
+    /**
+     * Compute the displacement and squared distance between a collection of points, optionally using
+     * periodic boundary conditions.
+     */
+    void getDeltaR(const fvec4& posI, const fvec4& x, const fvec4& y, const fvec4& z, fvec4& dx, fvec4& dy, fvec4& dz, fvec4& r2, bool periodic, const fvec4& boxSize, const fvec4& invBoxSize) const;
+    
+    /**
+     * Evaluate log(x) using a lookup table for speed.
+     */
+    fvec4 fastLog(const fvec4& x);
+
+    int blockSize;
     bool cutoff;
     bool periodic;
     float periodicBoxSize[3];
     float cutoffDistance, soluteDielectric, solventDielectric, surfaceAreaFactor;
     std::vector<std::pair<float, float> > particleParams;        
     AlignedArray<float> bornRadii;
+    AlignedArray<float> bornForce;
     std::vector<AlignedArray<float> > threadBornForces;
     AlignedArray<float> obcChain;
     std::vector<double> threadEnergy;
     std::vector<float> logTable;
     float logDX, logDXInv;
     // The following variables are used to make information accessible to the individual threads.
+    const CpuNeighborList* neighborList;
     float const* posq;
     std::vector<AlignedArray<float> >* threadForce;
     bool includeEnergy;
-    void* atomicCounter;
   
     static const int NUM_TABLE_POINTS;
     static const float TABLE_MIN;
     static const float TABLE_MAX;
 
+private:
     /**
-     * Compute the displacement and squared distance between a collection of points, optionally using
-     * periodic boundary conditions.
+     * Get the atoms in a block and the neighbors it interacts with.  Without a cutoff, the neighbors are all
+     * atoms up to the end of the block, and the exclusions are generated in the thread's scratch array.
      */
-    void getDeltaR(const fvec4& posI, const fvec4& x, const fvec4& y, const fvec4& z, fvec4& dx, fvec4& dy, fvec4& dz, fvec4& r2, bool periodic, const fvec4& boxSize, const fvec4& invBoxSize) const;
-    
+    void getBlockNeighbors(int blockIndex, int threadIndex, const int*& blockAtom, const int*& neighbors, const short*& exclusions, int& numNeighbors);
+
     /**
-     * Evaluate log(x) using a lookup table for speed.
+     * Clear any exclusions that getBlockNeighbors() recorded in the thread's scratch array.
      */
-    fvec4 fastLog(const fvec4& x);
+    void clearBlockExclusions(int blockIndex, int threadIndex);
+
+    std::vector<int> allAtoms;
+    std::vector<std::vector<short> > threadExclusions;
 };
 
 } // namespace OpenMM
@@ -0,0 +1,70 @@
+
+/* Portions copyright (c) 2006-2016 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef OPENMM_CPU_GBSAOBC_FORCE_VEC4_H__
+#define OPENMM_CPU_GBSAOBC_FORCE_VEC4_H__
+
+#include "CpuGBSAOBCForce.h"
+
+namespace OpenMM {
+
+/**
+ * This class computes the GBSA/OBC force using 4 component vectors.
+ */
+class CpuGBSAOBCForceVec4 : public CpuGBSAOBCForce {
+public:
+    CpuGBSAOBCForceVec4();
+
+protected:
+    void calculateBlockBornSum(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float* bornSum, const fvec4& boxSize, const fvec4& invBoxSize);
+    void calculateBlockFirstLoop(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float preFactor, float* forces, float* bornForces, double& energy, const fvec4& boxSize, const fvec4& invBoxSize);
+    void calculateBlockSecondLoop(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float* forces, const fvec4& boxSize, const fvec4& invBoxSize);
+
+private:
+    /**
+     * Load the positions of the atoms in a block.
+     */
+    void loadBlockPositions(const int* blockAtom, fvec4& x, fvec4& y, fvec4& z, fvec4& q) const;
+
+    /**
+     * Convert a neighbor's exclusion flags into a mask of block atoms to include.
+     */
+    static ivec4 getIncludeMask(short exclusions);
+
+    /**
+     * Compute the contribution of atom J to the Born sum of atom I.
+     */
+    fvec4 computeBornSumTerm(const fvec4& radiusI, const fvec4& scaledRadiusJ, const fvec4& r, const fvec4& rInverse);
+
+    /**
+     * Compute the derivative of atom I's Born sum with respect to its distance from atom J, divided by r.
+     */
+    fvec4 computeBornForceTerm(const fvec4& radiusI, const fvec4& scaledRadiusJ, const fvec4& r, const fvec4& r2Inverse);
+};
+
+} // namespace OpenMM
+
+// ---------------------------------------------------------------------------------------
+
+#endif // OPENMM_CPU_GBSAOBC_FORCE_VEC4_H__
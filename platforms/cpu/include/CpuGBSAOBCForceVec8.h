@@ -0,0 +1,92 @@
+
+/* Portions copyright (c) 2006-2016 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef OPENMM_CPU_GBSAOBC_FORCE_VEC8_H__
+#define OPENMM_CPU_GBSAOBC_FORCE_VEC8_H__
+
+#include "CpuGBSAOBCForce.h"
+
+#ifdef __AVX__
+
+#include "openmm/internal/vectorize8.h"
+
+namespace OpenMM {
+
+/**
+ * This class computes the GBSA/OBC force using 8 component vectors.
+ */
+class CpuGBSAOBCForceVec8 : public CpuGBSAOBCForce {
+public:
+    CpuGBSAOBCForceVec8();
+
+protected:
+    void calculateBlockBornSum(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float* bornSum, const fvec4& boxSize, const fvec4& invBoxSize);
+    void calculateBlockFirstLoop(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float preFactor, float* forces, float* bornForces, double& energy, const fvec4& boxSize, const fvec4& invBoxSize);
+    void calculateBlockSecondLoop(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float* forces, const fvec4& boxSize, const fvec4& invBoxSize);
+
+private:
+    /**
+     * Load the positions of the atoms in a block.
+     */
+    void loadBlockPositions(const int* blockAtom, fvec8& x, fvec8& y, fvec8& z, fvec8& q) const;
+
+    /**
+     * Load a per-atom value for the atoms in a block.
+     */
+    static fvec8 loadBlockValues(const int* blockAtom, const float* values);
+
+    /**
+     * Convert a neighbor's exclusion flags into a mask of block atoms to include.
+     */
+    static ivec8 getIncludeMask(short exclusions);
+
+    /**
+     * Compute the displacement and squared distance between a collection of points, optionally using
+     * periodic boundary conditions.
+     */
+    void getDeltaR(const fvec4& posI, const fvec8& x, const fvec8& y, const fvec8& z, fvec8& dx, fvec8& dy, fvec8& dz, fvec8& r2, bool periodic, const fvec4& boxSize, const fvec4& invBoxSize) const;
+
+    /**
+     * Evaluate log(x) using a lookup table for speed.
+     */
+    fvec8 fastLog(const fvec8& x);
+
+    /**
+     * Compute the contribution of atom J to the Born sum of atom I.
+     */
+    fvec8 computeBornSumTerm(const fvec8& radiusI, const fvec8& scaledRadiusJ, const fvec8& r, const fvec8& rInverse);
+
+    /**
+     * Compute the derivative of atom I's Born sum with respect to its distance from atom J, divided by r.
+     */
+    fvec8 computeBornForceTerm(const fvec8& radiusI, const fvec8& scaledRadiusJ, const fvec8& r, const fvec8& r2Inverse);
+};
+
+} // namespace OpenMM
+
+// ---------------------------------------------------------------------------------------
+
+#endif // __AVX__
+
+#endif // OPENMM_CPU_GBSAOBC_FORCE_VEC8_H__
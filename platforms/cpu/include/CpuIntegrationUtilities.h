@@ -0,0 +1,63 @@
+#ifndef OPENMM_CPU_INTEGRATION_UTILITIES_H_
+#define OPENMM_CPU_INTEGRATION_UTILITIES_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2015 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "RealVec.h"
+
+namespace OpenMM {
+
+/**
+ * This class contains utility functions shared by the CPU implementations of variable step size integrators.
+ */
+class CpuIntegrationUtilities {
+public:
+    /**
+     * The error norm is summed over fixed size blocks of atoms, so the result does not depend on
+     * the number of threads.
+     */
+    static const int ErrorBlockSize;
+    /**
+     * Compute the sum of (f/m)^2 over a block of atoms.  This is done in single precision, falling
+     * back to double precision if any value overflows.
+     *
+     * @param forces         the force on each atom
+     * @param inverseMasses  the inverse mass of each atom
+     * @param start          the index of the first atom in the block
+     * @param end            the index after the last atom in the block
+     */
+    static double computeBlockError(const RealVec* forces, const RealOpenMM* inverseMasses, int start, int end);
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_CPU_INTEGRATION_UTILITIES_H_*/
@@ -33,16 +33,22 @@
  * -------------------------------------------------------------------------- */
 
 #include "CpuBondForce.h"
+#include "CpuCMAPTorsionForce.h"
 #include "CpuCustomGBForce.h"
 #include "CpuCustomManyParticleForce.h"
 #include "CpuCustomNonbondedForce.h"
+#include "CpuDoubleNonbondedForce.h"
 #include "CpuGBSAOBCForce.h"
 #include "CpuLangevinDynamics.h"
 #include "CpuNeighborList.h"
 #include "CpuNonbondedForce.h"
 #include "CpuPlatform.h"
+#include "CpuVariableLangevinDynamics.h"
+#include "CpuVariableVerletDynamics.h"
+#include "ReferenceKernels.h"
 #include "openmm/kernels.h"
 #include "openmm/System.h"
+#include "openmm/internal/CustomNonbondedForceImpl.h"
 
 namespace OpenMM {
 
@@ -92,6 +98,116 @@ private:
     Kernel referenceKernel;
 };
 
+/**
+ * This kernel provides methods for setting and retrieving various state data.  It uses the Reference
+ * implementation, but translates between the order of particles in the System and the order in which
+ * they are stored when CpuAtomReorderer has moved them.
+ */
+class CpuUpdateStateDataKernel : public ReferenceUpdateStateDataKernel {
+public:
+    CpuUpdateStateDataKernel(std::string name, const Platform& platform, ReferencePlatform::PlatformData& referenceData, CpuPlatform::PlatformData& data) :
+            ReferenceUpdateStateDataKernel(name, platform, referenceData), data(data) {
+    }
+    /**
+     * Get the positions of all particles.
+     *
+     * @param positions  on exit, this contains the particle positions
+     */
+    void getPositions(ContextImpl& context, std::vector<Vec3>& positions);
+    /**
+     * Set the positions of all particles.
+     *
+     * @param positions  a vector containg the particle positions
+     */
+    void setPositions(ContextImpl& context, const std::vector<Vec3>& positions);
+    /**
+     * Get the positions of a subset of particles.
+     *
+     * @param particles  the indices of the particles to retrieve
+     * @param positions  on exit, element i contains the position of particle particles[i]
+     */
+    void getPositionSubset(ContextImpl& context, const std::vector<int>& particles, std::vector<Vec3>& positions);
+    /**
+     * Get the velocities of all particles.
+     *
+     * @param velocities  on exit, this contains the particle velocities
+     */
+    void getVelocities(ContextImpl& context, std::vector<Vec3>& velocities);
+    /**
+     * Set the velocities of all particles.
+     *
+     * @param velocities  a vector containg the particle velocities
+     */
+    void setVelocities(ContextImpl& context, const std::vector<Vec3>& velocities);
+    /**
+     * Get the velocities of a subset of particles.
+     *
+     * @param particles   the indices of the particles to retrieve
+     * @param velocities  on exit, element i contains the velocity of particle particles[i]
+     */
+    void getVelocitySubset(ContextImpl& context, const std::vector<int>& particles, std::vector<Vec3>& velocities);
+    /**
+     * Get the current forces on all particles.
+     *
+     * @param forces  on exit, this contains the forces
+     */
+    void getForces(ContextImpl& context, std::vector<Vec3>& forces);
+    /**
+     * Create a checkpoint recording the current state of the Context.
+     * 
+     * @param stream    an output stream the checkpoint data should be written to
+     */
+    void createCheckpoint(ContextImpl& context, std::ostream& stream);
+    /**
+     * Load a checkpoint that was written by createCheckpoint().
+     * 
+     * @param stream    an input stream the checkpoint data should be read from
+     */
+    void loadCheckpoint(ContextImpl& context, std::istream& stream);
+private:
+    CpuPlatform::PlatformData& data;
+};
+
+/**
+ * This kernel is invoked by HarmonicBondForce to calculate the forces acting on the system and the energy of the system.
+ * It uses the Reference implementation, but lets CpuAtomReorderer know when parameters change.
+ */
+class CpuCalcHarmonicBondForceKernel : public ReferenceCalcHarmonicBondForceKernel {
+public:
+    CpuCalcHarmonicBondForceKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data) :
+            ReferenceCalcHarmonicBondForceKernel(name, platform), data(data) {
+    }
+    /**
+     * Copy changed parameters over to a context.
+     *
+     * @param context    the context to copy parameters to
+     * @param force      the HarmonicBondForce to copy the parameters from
+     */
+    void copyParametersToContext(ContextImpl& context, const HarmonicBondForce& force);
+private:
+    CpuPlatform::PlatformData& data;
+};
+
+/**
+ * This kernel is invoked by HarmonicAngleForce to calculate the forces acting on the system and the energy of the system.
+ * It uses the Reference implementation, but lets CpuAtomReorderer know when parameters change.
+ */
+class CpuCalcHarmonicAngleForceKernel : public ReferenceCalcHarmonicAngleForceKernel {
+public:
+    CpuCalcHarmonicAngleForceKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data) :
+            ReferenceCalcHarmonicAngleForceKernel(name, platform), data(data) {
+    }
+    /**
+     * Copy changed parameters over to a context.
+     *
+     * @param context    the context to copy parameters to
+     * @param force      the HarmonicAngleForce to copy the parameters from
+     */
+    void copyParametersToContext(ContextImpl& context, const HarmonicAngleForce& force);
+private:
+    CpuPlatform::PlatformData& data;
+};
+
 /**
  * This kernel is invoked by PeriodicTorsionForce to calculate the forces acting on the system and the energy of the system.
  */
@@ -172,6 +288,45 @@ private:
     CpuBondForce bondForce;
 };
 
+/**
+ * This kernel is invoked by CMAPTorsionForce to calculate the forces acting on the system and the energy of the system.
+ */
+class CpuCalcCMAPTorsionForceKernel : public CalcCMAPTorsionForceKernel {
+public:
+    CpuCalcCMAPTorsionForceKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data) : CalcCMAPTorsionForceKernel(name, platform),
+            data(data) {
+    }
+    /**
+     * Initialize the kernel.
+     *
+     * @param system     the System this kernel will be applied to
+     * @param force      the CMAPTorsionForce this kernel will be used for
+     */
+    void initialize(const System& system, const CMAPTorsionForce& force);
+    /**
+     * Execute the kernel to calculate the forces and/or energy.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @return the potential energy due to the force
+     */
+    double execute(ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Copy changed parameters over to a context.
+     *
+     * @param context    the context to copy parameters to
+     * @param force      the CMAPTorsionForce to copy the parameters from
+     */
+    void copyParametersToContext(ContextImpl& context, const CMAPTorsionForce& force);
+private:
+    void computeMapCoefficients(const CMAPTorsionForce& force, std::vector<std::vector<std::vector<double> > >& coeff);
+    CpuPlatform::PlatformData& data;
+    std::vector<int> mapSizes;
+    std::vector<std::vector<int> > torsionIndices;
+    CpuCMAPTorsionForce cmap;
+};
+
 /**
  * This kernel is invoked by NonbondedForce to calculate the forces acting on the system.
  */
@@ -206,6 +361,13 @@ public:
     void copyParametersToContext(ContextImpl& context, const NonbondedForce& force);
 private:
     class PmeIO;
+    class ParticleParamsTask;
+    /**
+     * Copy the per-particle parameters from the force, dividing the work between threads.
+     *
+     * @return the sum of the squared charges
+     */
+    double recordParticleParameters(const NonbondedForce& force);
     CpuPlatform::PlatformData& data;
     int numParticles, num14;
     int **bonded14IndexArray;
@@ -213,12 +375,15 @@ private:
     double nonbondedCutoff, switchingDistance, rfDielectric, ewaldAlpha, ewaldSelfEnergy, dispersionCoefficient;
     int kmax[3], gridSize[3];
     bool useSwitchingFunction, useOptimizedPme, hasInitializedPme;
-    std::vector<std::set<int> > exclusions;
+    CpuExclusionList exclusions;
     std::vector<std::pair<float, float> > particleParams;
+    std::vector<std::pair<double, double> > doubleParticleParams;
+    std::vector<double> charges;
     std::vector<RealVec> lastPositions;
     NonbondedMethod nonbondedMethod;
     CpuNeighborList* neighborList;
     CpuNonbondedForce* nonbonded;
+    CpuDoubleNonbondedForce* doubleNonbonded;
     Kernel optimizedPme;
 };
 
@@ -252,15 +417,30 @@ public:
      * @param force      the CustomNonbondedForce to copy the parameters from
      */
     void copyParametersToContext(ContextImpl& context, const CustomNonbondedForce& force);
+    /**
+     * Compute the energy for each of several sets of global parameter values in a single pass
+     * over the neighbor list.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param parameterSets  each element maps the names of global parameters to the values to use
+     * @param energies       on exit, element i contains the energy for parameterSets[i]
+     * @return true, since this is always supported
+     */
+    bool computeEnergiesForParameterSets(ContextImpl& context, const std::vector<std::map<std::string, double> >& parameterSets, std::vector<double>& energies);
 private:
+    /**
+     * Build the neighbor list and configure the periodic box and switching function before computing interactions.
+     */
+    void prepareInteractions(ContextImpl& context);
     CpuPlatform::PlatformData& data;
     int numParticles;
     double **particleParamArray;
     double nonbondedCutoff, switchingDistance, periodicBoxSize[3], longRangeCoefficient;
     bool useSwitchingFunction, hasInitializedLongRangeCorrection;
     CustomNonbondedForce* forceCopy;
+    CustomNonbondedForceImpl::LongRangeCorrectionData longRangeCorrectionData;
     std::map<std::string, double> globalParamValues;
-    std::vector<std::set<int> > exclusions;
+    CpuExclusionList exclusions;
     std::vector<std::string> parameterNames, globalParameterNames;
     std::vector<std::pair<std::set<int>, std::set<int> > > interactionGroups;
     NonbondedMethod nonbondedMethod;
@@ -273,9 +453,7 @@ private:
  */
 class CpuCalcGBSAOBCForceKernel : public CalcGBSAOBCForceKernel {
 public:
-    CpuCalcGBSAOBCForceKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data) : CalcGBSAOBCForceKernel(name, platform),
-            data(data) {
-    }
+    CpuCalcGBSAOBCForceKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data);
     ~CpuCalcGBSAOBCForceKernel();
     /**
      * Initialize the kernel.
@@ -303,7 +481,10 @@ public:
 private:
     CpuPlatform::PlatformData& data;
     std::vector<std::pair<float, float> > particleParams;
-    CpuGBSAOBCForce obc;
+    CpuExclusionList exclusions;
+    float cutoff;
+    CpuNeighborList* neighborList;
+    CpuGBSAOBCForce* obc;
 };
 
 /**
@@ -345,7 +526,7 @@ private:
     RealOpenMM **particleParamArray;
     RealOpenMM nonbondedCutoff;
     CpuCustomGBForce* ixn;
-    std::vector<std::set<int> > exclusions;
+    CpuExclusionList exclusions;
     std::vector<std::string> particleParameterNames, globalParameterNames, valueNames;
     std::vector<OpenMM::CustomGBForce::ComputationType> valueTypes;
     std::vector<OpenMM::CustomGBForce::ComputationType> energyTypes;
@@ -432,6 +613,84 @@ private:
     double prevTemp, prevFriction, prevStepSize;
 };
 
+/**
+ * This kernel is invoked by VariableLangevinIntegrator to take one time step.
+ */
+class CpuIntegrateVariableLangevinStepKernel : public IntegrateVariableLangevinStepKernel {
+public:
+    CpuIntegrateVariableLangevinStepKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data) : IntegrateVariableLangevinStepKernel(name, platform),
+            data(data), dynamics(NULL) {
+    }
+    ~CpuIntegrateVariableLangevinStepKernel();
+    /**
+     * Initialize the kernel, setting up the particle masses.
+     * 
+     * @param system     the System this kernel will be applied to
+     * @param integrator the VariableLangevinIntegrator this kernel will be used for
+     */
+    void initialize(const System& system, const VariableLangevinIntegrator& integrator);
+    /**
+     * Execute the kernel.
+     * 
+     * @param context    the context in which to execute this kernel
+     * @param integrator the VariableLangevinIntegrator this kernel is being used for
+     * @param maxTime    the maximum time beyond which the simulation should not be advanced
+     * @return the size of the step that was taken
+     */
+    double execute(ContextImpl& context, const VariableLangevinIntegrator& integrator, double maxTime);
+    /**
+     * Compute the kinetic energy.
+     * 
+     * @param context    the context in which to execute this kernel
+     * @param integrator the VariableLangevinIntegrator this kernel is being used for
+     */
+    double computeKineticEnergy(ContextImpl& context, const VariableLangevinIntegrator& integrator);
+private:
+    CpuPlatform::PlatformData& data;
+    CpuVariableLangevinDynamics* dynamics;
+    std::vector<RealOpenMM> masses;
+    double prevTemp, prevFriction, prevErrorTol;
+};
+
+/**
+ * This kernel is invoked by VariableVerletIntegrator to take one time step.
+ */
+class CpuIntegrateVariableVerletStepKernel : public IntegrateVariableVerletStepKernel {
+public:
+    CpuIntegrateVariableVerletStepKernel(std::string name, const Platform& platform, CpuPlatform::PlatformData& data) : IntegrateVariableVerletStepKernel(name, platform),
+            data(data), dynamics(NULL) {
+    }
+    ~CpuIntegrateVariableVerletStepKernel();
+    /**
+     * Initialize the kernel, setting up the particle masses.
+     * 
+     * @param system     the System this kernel will be applied to
+     * @param integrator the VariableVerletIntegrator this kernel will be used for
+     */
+    void initialize(const System& system, const VariableVerletIntegrator& integrator);
+    /**
+     * Execute the kernel.
+     * 
+     * @param context    the context in which to execute this kernel
+     * @param integrator the VariableVerletIntegrator this kernel is being used for
+     * @param maxTime    the maximum time beyond which the simulation should not be advanced
+     * @return the size of the step that was taken
+     */
+    double execute(ContextImpl& context, const VariableVerletIntegrator& integrator, double maxTime);
+    /**
+     * Compute the kinetic energy.
+     * 
+     * @param context    the context in which to execute this kernel
+     * @param integrator the VariableVerletIntegrator this kernel is being used for
+     */
+    double computeKineticEnergy(ContextImpl& context, const VariableVerletIntegrator& integrator);
+private:
+    CpuPlatform::PlatformData& data;
+    CpuVariableVerletDynamics* dynamics;
+    std::vector<RealOpenMM> masses;
+    double prevErrorTol;
+};
+
 } // namespace OpenMM
 
 #endif /*OPENMM_CPUKERNELS_H_*/
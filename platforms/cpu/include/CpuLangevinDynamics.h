@@ -86,6 +86,8 @@ private:
     OpenMM::ThreadPool& threads;
     OpenMM::CpuRandom& random;
     std::vector<OpenMM_SFMT::SFMT> threadRandom;
+    std::vector<std::vector<float> > threadNoise;
+    unsigned long long randomCounter;
     // The following variables are used to make information accessible to the individual threads.
     int numberOfAtoms;
     OpenMM::RealVec* atomCoordinates;
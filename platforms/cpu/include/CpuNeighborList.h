@@ -33,10 +33,10 @@
  * -------------------------------------------------------------------------- */
 
 #include "AlignedArray.h"
+#include "CpuExclusionList.h"
 #include "RealVec.h"
 #include "windowsExportCpu.h"
 #include "openmm/internal/ThreadPool.h"
-#include <set>
 #include <utility>
 #include <vector>
 
@@ -47,12 +47,12 @@ public:
     class ThreadTask;
     class Voxels;
     CpuNeighborList(int blockSize);
-    void computeNeighborList(int numAtoms, const AlignedArray<float>& atomLocations, const std::vector<std::set<int> >& exclusions,
+    void computeNeighborList(int numAtoms, const AlignedArray<float>& atomLocations, const CpuExclusionList& exclusions,
             const RealVec* periodicBoxVectors, bool usePeriodic, float maxDistance, ThreadPool& threads);
     int getNumBlocks() const;
     const std::vector<int>& getSortedAtoms() const;
     const std::vector<int>& getBlockNeighbors(int blockIndex) const;
-    const std::vector<char>& getBlockExclusions(int blockIndex) const;
+    const std::vector<short>& getBlockExclusions(int blockIndex) const;
     /**
      * This routine contains the code executed by each thread.
      */
@@ -63,12 +63,13 @@ private:
     std::vector<int> sortedAtoms;
     std::vector<float> sortedPositions;
     std::vector<std::vector<int> > blockNeighbors;
-    std::vector<std::vector<char> > blockExclusions;
+    std::vector<std::vector<short> > blockExclusions;
+    std::vector<std::vector<int> > threadNeighborIndex;
     // The following variables are used to make information accessible to the individual threads.
     float minx, maxx, miny, maxy, minz, maxz;
     std::vector<std::pair<int, int> > atomBins;
     Voxels* voxels;
-    const std::vector<std::set<int> >* exclusions;
+    const CpuExclusionList* exclusions;
     const float* atomLocations;
     RealVec periodicBoxVectors[3];
     int numAtoms;
@@ -30,7 +30,6 @@
 #include "ReferencePairIxn.h"
 #include "openmm/internal/ThreadPool.h"
 #include "openmm/internal/vectorize.h"
-#include <set>
 #include <utility>
 #include <vector>
 // ---------------------------------------------------------------------------------------
@@ -122,16 +121,16 @@ class CpuNonbondedForce {
          @param posq             atom coordinates and charges
          @param atomCoordinates  atom coordinates (in format needed by PME)
          @param atomParameters   atom parameters (sigma/2, 2*sqrt(epsilon))
-         @param exclusions       atom exclusion indices
-                                 exclusions[atomIndex] contains the list of exclusions for that atom
+         @param exclusions       the atoms excluded from interacting with each atom
          @param forces           force array (forces added)
+         @param includeForces    whether to compute forces
          @param totalEnergy      total energy
             
          --------------------------------------------------------------------------------------- */
           
       void calculateReciprocalIxn(int numberOfAtoms, float* posq, const std::vector<RealVec>& atomCoordinates,
-                            const std::vector<std::pair<float, float> >& atomParameters, const std::vector<std::set<int> >& exclusions,
-                            std::vector<RealVec>& forces, double* totalEnergy) const;
+                            const std::vector<std::pair<float, float> >& atomParameters, const CpuExclusionList& exclusions,
+                            std::vector<RealVec>& forces, bool includeForces, double* totalEnergy) const;
       
       /**---------------------------------------------------------------------------------------
       
@@ -141,16 +140,16 @@ class CpuNonbondedForce {
          @param posq             atom coordinates and charges
          @param atomCoordinates  atom coordinates (periodic boundary conditions not applied)
          @param atomParameters   atom parameters (sigma/2, 2*sqrt(epsilon))
-         @param exclusions       atom exclusion indices
-                                 exclusions[atomIndex] contains the list of exclusions for that atom
+         @param exclusions       the atoms excluded from interacting with each atom
          @param forces           force array (forces added)
+         @param includeForces    whether to compute forces
          @param totalEnergy      total energy
          @param threads          the thread pool to use
       
          --------------------------------------------------------------------------------------- */
           
       void calculateDirectIxn(int numberOfAtoms, float* posq, const std::vector<RealVec>& atomCoordinates, const std::vector<std::pair<float, float> >& atomParameters,
-            const std::vector<std::set<int> >& exclusions, std::vector<AlignedArray<float> >& threadForce, double* totalEnergy, ThreadPool& threads);
+            const CpuExclusionList& exclusions, std::vector<AlignedArray<float> >& threadForce, bool includeForces, double* totalEnergy, ThreadPool& threads);
 
     /**
      * This routine contains the code executed by each thread.
@@ -182,9 +181,9 @@ protected:
         float* posq;
         RealVec const* atomCoordinates;
         std::pair<float, float> const* atomParameters;        
-        std::set<int> const* exclusions;
+        const CpuExclusionList* exclusions;
         std::vector<AlignedArray<float> >* threadForce;
-        bool includeEnergy;
+        bool includeForces, includeEnergy;
         void* atomicCounter;
 
         static const float TWO_OVER_SQRT_PI;
@@ -196,7 +195,7 @@ protected:
       
          @param atom1            the index of the first atom
          @param atom2            the index of the second atom
-         @param forces           force array (forces added)
+         @param forces           force array (forces added), or NULL if forces should not be computed
          @param totalEnergy      total energy
             
          --------------------------------------------------------------------------------------- */
@@ -208,7 +207,7 @@ protected:
          Calculate all the interactions for one atom block.
       
          @param blockIndex       the index of the atom block
-         @param forces           force array (forces added)
+         @param forces           force array (forces added), or NULL if forces should not be computed
          @param totalEnergy      total energy
             
          --------------------------------------------------------------------------------------- */
@@ -220,7 +219,7 @@ protected:
          Calculate all the interactions for one atom block.
       
          @param blockIndex       the index of the atom block
-         @param forces           force array (forces added)
+         @param forces           force array (forces added), or NULL if forces should not be computed
          @param totalEnergy      total energy
             
          --------------------------------------------------------------------------------------- */
@@ -33,6 +33,7 @@
  * -------------------------------------------------------------------------- */
 
 #include "AlignedArray.h"
+#include "CpuAtomReorderer.h"
 #include "CpuRandom.h"
 #include "ReferencePlatform.h"
 #include "openmm/internal/ContextImpl.h"
@@ -67,6 +68,24 @@ public:
         static const std::string key = "CpuThreads";
         return key;
     }
+    /**
+     * This is the name of the parameter for selecting what numerical precision to use.  "mixed" computes
+     * nonbonded forces in single precision, while "double" computes all forces in double precision.  In double
+     * precision, NonbondedForce uses a threaded but not vectorized implementation, and the other nonbonded
+     * style forces use the single threaded Reference implementations.
+     */
+    static const std::string& CpuPrecision() {
+        static const std::string key = "CpuPrecision";
+        return key;
+    }
+    /**
+     * This is the name of the parameter for selecting whether to periodically sort particles into spatial
+     * order in memory.  The allowed values are "true" and "false".
+     */
+    static const std::string& CpuReorderAtoms() {
+        static const std::string key = "CpuReorderAtoms";
+        return key;
+    }
     /**
      * We cannot use the standard mechanism for platform data, because that is already used by the superclass.
      * Instead, we maintain a table of ContextImpls to PlatformDatas.
@@ -79,12 +98,13 @@ private:
 
 class CpuPlatform::PlatformData {
 public:
-    PlatformData(int numParticles, int numThreads);
+    PlatformData(int numParticles, int numThreads, bool useDoublePrecision, bool reorderAtoms);
     AlignedArray<float> posq;
     std::vector<AlignedArray<float> > threadForce;
     ThreadPool threads;
-    bool isPeriodic;
+    bool isPeriodic, useDoublePrecision;
     CpuRandom random;
+    CpuAtomReorderer atomReorderer;
     std::map<std::string, std::string> propertyValues;
 };
 
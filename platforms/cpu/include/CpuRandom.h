@@ -34,12 +34,18 @@
 
 #include "sfmt/SFMT.h"
 #include "windowsExportCpu.h"
+#include <iosfwd>
 #include <vector>
 
 namespace OpenMM {
 
 /**
- * This class provides a multithreaded random number generator.
+ * This class provides a multithreaded random number generator.  It offers two kinds of generators.
+ * getGaussianRandom() and getUniformRandom() draw from an independent stream for each thread, so the
+ * values produced depend on how work is divided between threads.  getGaussianRandoms() instead uses a
+ * counter based generator (Philox4x32-10), where every value is a pure function of the seed, a counter,
+ * and an index.  It generates values in SIMD batches, and the results are independent of the number
+ * of threads.
  */
 class OPENMM_EXPORT_CPU CpuRandom {
 public:
@@ -48,9 +54,45 @@ public:
     void initialize(int seed, int numThreads);
     float getGaussianRandom(int threadIndex);
     float getUniformRandom(int threadIndex);
+    /**
+     * Get a new counter value to pass to getGaussianRandoms().  Every call returns a different value.
+     * This is not thread safe, and should be called once from the main thread before the values are
+     * generated (for example, once per time step).
+     */
+    unsigned long long getNextCounter();
+    /**
+     * Generate Gaussian distributed random numbers with the counter based generator.  Four values are
+     * generated for each index.  They depend only on the random seed, the counter, and the index, so any
+     * range of indices may be generated by any thread.
+     *
+     * @param counter    a value returned by getNextCounter()
+     * @param start      the first index to generate values for
+     * @param end        the index after the last one to generate values for
+     * @param values     on exit, values[4*(i-start)+j] contains the j'th value for index i.  This must
+     *                   have room for 4*(end-start) elements.
+     */
+    void getGaussianRandoms(unsigned long long counter, int start, int end, float* values) const;
+    /**
+     * Evaluate the Philox4x32-10 function.  This is exposed mainly for testing.
+     *
+     * @param counter    the four counter words
+     * @param key        the two key words
+     * @param result     on exit, contains the four output words
+     */
+    static void philox(const unsigned int* counter, const unsigned int* key, unsigned int* result);
+    /**
+     * Write the state of the counter based generator to a checkpoint.
+     */
+    void createCheckpoint(std::ostream& stream) const;
+    /**
+     * Load the state of the counter based generator from a checkpoint.
+     */
+    void loadCheckpoint(std::istream& stream);
 private:
     bool hasInitialized;
     int randomSeed;
+    unsigned int philoxKey[2];
+    unsigned long long nextCounter;
     std::vector<OpenMM_SFMT::SFMT*> threadRandom;
     std::vector<float> nextGaussian;
     std::vector<int> nextGaussianIsValid;
@@ -33,6 +33,7 @@
  * -------------------------------------------------------------------------- */
 
 #include "ReferenceSETTLEAlgorithm.h"
+#include "CpuSETTLESolver.h"
 #include "windowsExportCpu.h"
 #include "openmm/System.h"
 #include "openmm/internal/ThreadPool.h"
@@ -41,14 +42,24 @@
 namespace OpenMM {
 
 /**
- * This class uses multiple ReferenceSETTLEAlgorithm objects to execute the algorithm in parallel.
+ * This class applies the SETTLE algorithm in parallel.  The clusters are stored in blocks, and each
+ * block is processed with vector instructions in double precision, so the results match those of
+ * ReferenceSETTLEAlgorithm.  Blocks contain 8 clusters if the CPU supports AVX, and 4 otherwise.
+ * The blocks are divided evenly between threads.
  */
 class OPENMM_EXPORT_CPU CpuSETTLE : public ReferenceConstraintAlgorithm {
 public:
     class ApplyToPositionsTask;
     class ApplyToVelocitiesTask;
-    CpuSETTLE(const System& system, const ReferenceSETTLEAlgorithm& settle, ThreadPool& threads);
-    ~CpuSETTLE();
+    /**
+     * Create a CpuSETTLE.
+     *
+     * @param system      the System being simulated
+     * @param settle      the clusters to constrain
+     * @param threads     the thread pool to use
+     * @param allowVec8   if false, always process blocks of 4 clusters even if AVX is supported
+     */
+    CpuSETTLE(const System& system, const ReferenceSETTLEAlgorithm& settle, ThreadPool& threads, bool allowVec8=true);
 
     /**
      * Apply the constraint algorithm.
@@ -69,8 +80,15 @@ public:
      * @param tolerance        the constraint tolerance
      */
     void applyToVelocities(std::vector<OpenMM::RealVec>& atomCoordinates, std::vector<OpenMM::RealVec>& velocities, std::vector<RealOpenMM>& inverseMasses, RealOpenMM tolerance);
+
+    /**
+     * Get the number of clusters that are processed together in each block.
+     */
+    int getBlockSize() const {
+        return clusters.blockSize;
+    }
 private:
-    std::vector<ReferenceSETTLEAlgorithm*> threadSettle;
+    CpuSETTLEClusters clusters;
     ThreadPool& threads;
 };
 
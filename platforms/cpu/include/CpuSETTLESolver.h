@@ -0,0 +1,302 @@
+#ifndef OPENMM_CPUSETTLESOLVER_H_
+#define OPENMM_CPUSETTLESOLVER_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2015 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "RealVec.h"
+#include <vector>
+
+namespace OpenMM {
+
+/**
+ * This holds the parameters of the clusters processed by CpuSETTLE, stored as a structure of arrays
+ * so that a block of clusters can be loaded into vectors with one element per cluster.  If the number
+ * of clusters is not a multiple of the block size, the final block is padded by repeating the last
+ * cluster.  The padding lanes compute exactly the same values as the cluster they duplicate, so
+ * writing their results back is harmless.
+ */
+class CpuSETTLEClusters {
+public:
+    int blockSize, numBlocks;
+    std::vector<int> atom1, atom2, atom3;
+    std::vector<double> distance1, distance2, mass1, mass2, mass3;
+};
+
+/**
+ * Apply SETTLE to the positions of every cluster in the blocks from startBlock to endBlock-1.
+ * DVEC is a vector type holding WIDTH doubles, one for each cluster in a block.  It must support
+ * construction from a double, loading and storing from arrays, arithmetic operators, and sqrt().
+ * This performs exactly the same operations as ReferenceSETTLEAlgorithm::apply(), so the results
+ * agree with it to within rounding error.
+ */
+template <class DVEC, int WIDTH>
+void settlePositionsInBlocks(const CpuSETTLEClusters& clusters, int startBlock, int endBlock, const RealVec* atomCoordinates, RealVec* atomCoordinatesP) {
+    double apos[9][WIDTH], xp[9][WIDTH];
+    for (int block = startBlock; block < endBlock; block++) {
+        // Gather the positions into structure of arrays form.
+
+        int base = block*WIDTH;
+        for (int lane = 0; lane < WIDTH; lane++) {
+            int atoms[3] = {clusters.atom1[base+lane], clusters.atom2[base+lane], clusters.atom3[base+lane]};
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++) {
+                    apos[3*i+j][lane] = atomCoordinates[atoms[i]][j];
+                    xp[3*i+j][lane] = atomCoordinatesP[atoms[i]][j]-apos[3*i+j][lane];
+                }
+        }
+        DVEC m0(&clusters.mass1[base]);
+        DVEC m1(&clusters.mass2[base]);
+        DVEC m2(&clusters.mass3[base]);
+        DVEC xp00(xp[0]), xp01(xp[1]), xp02(xp[2]);
+        DVEC xp10(xp[3]), xp11(xp[4]), xp12(xp[5]);
+        DVEC xp20(xp[6]), xp21(xp[7]), xp22(xp[8]);
+        DVEC apos00(apos[0]), apos01(apos[1]), apos02(apos[2]);
+
+        // Apply the SETTLE algorithm.
+
+        DVEC xb0 = DVEC(apos[3])-apos00;
+        DVEC yb0 = DVEC(apos[4])-apos01;
+        DVEC zb0 = DVEC(apos[5])-apos02;
+        DVEC xc0 = DVEC(apos[6])-apos00;
+        DVEC yc0 = DVEC(apos[7])-apos01;
+        DVEC zc0 = DVEC(apos[8])-apos02;
+
+        DVEC invTotalMass = DVEC(1.0)/(m0+m1+m2);
+        DVEC xcom = (xp00*m0 + (xb0+xp10)*m1 + (xc0+xp20)*m2) * invTotalMass;
+        DVEC ycom = (xp01*m0 + (yb0+xp11)*m1 + (yc0+xp21)*m2) * invTotalMass;
+        DVEC zcom = (xp02*m0 + (zb0+xp12)*m1 + (zc0+xp22)*m2) * invTotalMass;
+
+        DVEC xa1 = xp00 - xcom;
+        DVEC ya1 = xp01 - ycom;
+        DVEC za1 = xp02 - zcom;
+        DVEC xb1 = xb0 + xp10 - xcom;
+        DVEC yb1 = yb0 + xp11 - ycom;
+        DVEC zb1 = zb0 + xp12 - zcom;
+        DVEC xc1 = xc0 + xp20 - xcom;
+        DVEC yc1 = yc0 + xp21 - ycom;
+        DVEC zc1 = zc0 + xp22 - zcom;
+
+        DVEC xaksZd = yb0*zc0 - zb0*yc0;
+        DVEC yaksZd = zb0*xc0 - xb0*zc0;
+        DVEC zaksZd = xb0*yc0 - yb0*xc0;
+        DVEC xaksXd = ya1*zaksZd - za1*yaksZd;
+        DVEC yaksXd = za1*xaksZd - xa1*zaksZd;
+        DVEC zaksXd = xa1*yaksZd - ya1*xaksZd;
+        DVEC xaksYd = yaksZd*zaksXd - zaksZd*yaksXd;
+        DVEC yaksYd = zaksZd*xaksXd - xaksZd*zaksXd;
+        DVEC zaksYd = xaksZd*yaksXd - yaksZd*xaksXd;
+
+        DVEC axlng = sqrt(xaksXd*xaksXd + yaksXd*yaksXd + zaksXd*zaksXd);
+        DVEC aylng = sqrt(xaksYd*xaksYd + yaksYd*yaksYd + zaksYd*zaksYd);
+        DVEC azlng = sqrt(xaksZd*xaksZd + yaksZd*yaksZd + zaksZd*zaksZd);
+        DVEC trns11 = xaksXd / axlng;
+        DVEC trns21 = yaksXd / axlng;
+        DVEC trns31 = zaksXd / axlng;
+        DVEC trns12 = xaksYd / aylng;
+        DVEC trns22 = yaksYd / aylng;
+        DVEC trns32 = zaksYd / aylng;
+        DVEC trns13 = xaksZd / azlng;
+        DVEC trns23 = yaksZd / azlng;
+        DVEC trns33 = zaksZd / azlng;
+
+        DVEC xb0d = trns11*xb0 + trns21*yb0 + trns31*zb0;
+        DVEC yb0d = trns12*xb0 + trns22*yb0 + trns32*zb0;
+        DVEC xc0d = trns11*xc0 + trns21*yc0 + trns31*zc0;
+        DVEC yc0d = trns12*xc0 + trns22*yc0 + trns32*zc0;
+        DVEC za1d = trns13*xa1 + trns23*ya1 + trns33*za1;
+        DVEC xb1d = trns11*xb1 + trns21*yb1 + trns31*zb1;
+        DVEC yb1d = trns12*xb1 + trns22*yb1 + trns32*zb1;
+        DVEC zb1d = trns13*xb1 + trns23*yb1 + trns33*zb1;
+        DVEC xc1d = trns11*xc1 + trns21*yc1 + trns31*zc1;
+        DVEC yc1d = trns12*xc1 + trns22*yc1 + trns32*zc1;
+        DVEC zc1d = trns13*xc1 + trns23*yc1 + trns33*zc1;
+
+        //                                        --- Step2  A2' ---
+
+        DVEC distance1(&clusters.distance1[base]);
+        DVEC distance2(&clusters.distance2[base]);
+        DVEC rc = DVEC(0.5)*distance2;
+        DVEC rb = sqrt(distance1*distance1-rc*rc);
+        DVEC ra = rb*(m1+m2)*invTotalMass;
+        rb = rb-ra;
+        DVEC sinphi = za1d / ra;
+        DVEC cosphi = sqrt(DVEC(1.0) - sinphi*sinphi);
+        DVEC sinpsi = (zb1d - zc1d) / (DVEC(2.0)*rc*cosphi);
+        DVEC cospsi = sqrt(DVEC(1.0) - sinpsi*sinpsi);
+
+        DVEC ya2d =   ra*cosphi;
+        DVEC xb2d = DVEC(0.0) - rc*cospsi;
+        DVEC yb2d = DVEC(0.0) - rb*cosphi - rc*sinpsi*sinphi;
+        DVEC yc2d = DVEC(0.0) - rb*cosphi + rc*sinpsi*sinphi;
+        DVEC xb2d2 = xb2d*xb2d;
+        DVEC hh2 = DVEC(4.0)*xb2d2 + (yb2d-yc2d)*(yb2d-yc2d) + (zb1d-zc1d)*(zb1d-zc1d);
+        DVEC deltx = DVEC(2.0)*xb2d + sqrt(DVEC(4.0)*xb2d2 - hh2 + distance2*distance2);
+        xb2d = xb2d - deltx*DVEC(0.5);
+
+        //                                        --- Step3  al,be,ga ---
+
+        DVEC alpha = (xb2d*(xb0d-xc0d) + yb0d*yb2d + yc0d*yc2d);
+        DVEC beta = (xb2d*(yc0d-yb0d) + xb0d*yb2d + xc0d*yc2d);
+        DVEC gamma = xb0d*yb1d - xb1d*yb0d + xc0d*yc1d - xc1d*yc0d;
+
+        DVEC al2be2 = alpha*alpha + beta*beta;
+        DVEC sintheta = (alpha*gamma - beta*sqrt(al2be2 - gamma*gamma)) / al2be2;
+
+        //                                        --- Step4  A3' ---
+
+        DVEC costheta = sqrt(DVEC(1.0) - sintheta*sintheta);
+        DVEC xa3d = DVEC(0.0) - ya2d*sintheta;
+        DVEC ya3d =   ya2d*costheta;
+        DVEC za3d = za1d;
+        DVEC xb3d =   xb2d*costheta - yb2d*sintheta;
+        DVEC yb3d =   xb2d*sintheta + yb2d*costheta;
+        DVEC zb3d = zb1d;
+        DVEC xc3d = DVEC(0.0) - xb2d*costheta - yc2d*sintheta;
+        DVEC yc3d = DVEC(0.0) - xb2d*sintheta + yc2d*costheta;
+        DVEC zc3d = zc1d;
+
+        //                                        --- Step5  A3 ---
+
+        DVEC xa3 = trns11*xa3d + trns12*ya3d + trns13*za3d;
+        DVEC ya3 = trns21*xa3d + trns22*ya3d + trns23*za3d;
+        DVEC za3 = trns31*xa3d + trns32*ya3d + trns33*za3d;
+        DVEC xb3 = trns11*xb3d + trns12*yb3d + trns13*zb3d;
+        DVEC yb3 = trns21*xb3d + trns22*yb3d + trns23*zb3d;
+        DVEC zb3 = trns31*xb3d + trns32*yb3d + trns33*zb3d;
+        DVEC xc3 = trns11*xc3d + trns12*yc3d + trns13*zc3d;
+        DVEC yc3 = trns21*xc3d + trns22*yc3d + trns23*zc3d;
+        DVEC zc3 = trns31*xc3d + trns32*yc3d + trns33*zc3d;
+
+        (xcom + xa3).store(xp[0]);
+        (ycom + ya3).store(xp[1]);
+        (zcom + za3).store(xp[2]);
+        (xcom + xb3 - xb0).store(xp[3]);
+        (ycom + yb3 - yb0).store(xp[4]);
+        (zcom + zb3 - zb0).store(xp[5]);
+        (xcom + xc3 - xc0).store(xp[6]);
+        (ycom + yc3 - yc0).store(xp[7]);
+        (zcom + zc3 - zc0).store(xp[8]);
+
+        // Record the new positions.
+
+        for (int lane = 0; lane < WIDTH; lane++) {
+            int atoms[3] = {clusters.atom1[base+lane], clusters.atom2[base+lane], clusters.atom3[base+lane]};
+            for (int i = 0; i < 3; i++)
+                atomCoordinatesP[atoms[i]] = RealVec(xp[3*i][lane]+apos[3*i][lane], xp[3*i+1][lane]+apos[3*i+1][lane], xp[3*i+2][lane]+apos[3*i+2][lane]);
+        }
+    }
+}
+
+/**
+ * Apply SETTLE to the velocities of every cluster in the blocks from startBlock to endBlock-1.  This
+ * performs exactly the same operations as ReferenceSETTLEAlgorithm::applyToVelocities().
+ */
+template <class DVEC, int WIDTH>
+void settleVelocitiesInBlocks(const CpuSETTLEClusters& clusters, int startBlock, int endBlock, const RealVec* atomCoordinates, RealVec* velocities, const RealOpenMM* inverseMasses) {
+    double apos[9][WIDTH], vel[9][WIDTH], invMass[3][WIDTH];
+    for (int block = startBlock; block < endBlock; block++) {
+        // Gather the positions and velocities into structure of arrays form.
+
+        int base = block*WIDTH;
+        for (int lane = 0; lane < WIDTH; lane++) {
+            int atoms[3] = {clusters.atom1[base+lane], clusters.atom2[base+lane], clusters.atom3[base+lane]};
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) {
+                    apos[3*i+j][lane] = atomCoordinates[atoms[i]][j];
+                    vel[3*i+j][lane] = velocities[atoms[i]][j];
+                }
+                invMass[i][lane] = inverseMasses[atoms[i]];
+            }
+        }
+        DVEC mA(&clusters.mass1[base]);
+        DVEC mB(&clusters.mass2[base]);
+        DVEC mC(&clusters.mass3[base]);
+        DVEC x0(apos[0]), y0(apos[1]), z0(apos[2]);
+        DVEC x1(apos[3]), y1(apos[4]), z1(apos[5]);
+        DVEC x2(apos[6]), y2(apos[7]), z2(apos[8]);
+        DVEC v0x(vel[0]), v0y(vel[1]), v0z(vel[2]);
+        DVEC v1x(vel[3]), v1y(vel[4]), v1z(vel[5]);
+        DVEC v2x(vel[6]), v2y(vel[7]), v2z(vel[8]);
+
+        // Compute intermediate quantities: the atom masses, the bond directions, the relative velocities,
+        // and the angle cosines and sines.
+
+        DVEC eABx = x1-x0, eABy = y1-y0, eABz = z1-z0;
+        DVEC eBCx = x2-x1, eBCy = y2-y1, eBCz = z2-z1;
+        DVEC eCAx = x0-x2, eCAy = y0-y2, eCAz = z0-z2;
+        DVEC scaleAB = DVEC(1.0)/sqrt(eABx*eABx + eABy*eABy + eABz*eABz);
+        DVEC scaleBC = DVEC(1.0)/sqrt(eBCx*eBCx + eBCy*eBCy + eBCz*eBCz);
+        DVEC scaleCA = DVEC(1.0)/sqrt(eCAx*eCAx + eCAy*eCAy + eCAz*eCAz);
+        eABx = eABx*scaleAB; eABy = eABy*scaleAB; eABz = eABz*scaleAB;
+        eBCx = eBCx*scaleBC; eBCy = eBCy*scaleBC; eBCz = eBCz*scaleBC;
+        eCAx = eCAx*scaleCA; eCAy = eCAy*scaleCA; eCAz = eCAz*scaleCA;
+        DVEC vAB = (v1x-v0x)*eABx + (v1y-v0y)*eABy + (v1z-v0z)*eABz;
+        DVEC vBC = (v2x-v1x)*eBCx + (v2y-v1y)*eBCy + (v2z-v1z)*eBCz;
+        DVEC vCA = (v0x-v2x)*eCAx + (v0y-v2y)*eCAy + (v0z-v2z)*eCAz;
+        DVEC cA = DVEC(0.0)-(eABx*eCAx + eABy*eCAy + eABz*eCAz);
+        DVEC cB = DVEC(0.0)-(eABx*eBCx + eABy*eBCy + eABz*eBCz);
+        DVEC cC = DVEC(0.0)-(eBCx*eCAx + eBCy*eCAy + eBCz*eCAz);
+        DVEC s2A = DVEC(1.0)-cA*cA;
+        DVEC s2B = DVEC(1.0)-cB*cB;
+        DVEC s2C = DVEC(1.0)-cC*cC;
+
+        // Solve the equations.  See ReferenceSETTLEAlgorithm::applyToVelocities() for details.
+
+        DVEC mABCinv = DVEC(1.0)/(mA*mB*mC);
+        DVEC denom = (((s2A*mB+s2B*mA)*mC+(s2A*mB*mB+DVEC(2.0)*(cA*cB*cC+DVEC(1.0))*mA*mB+s2B*mA*mA))*mC+s2C*mA*mB*(mA+mB))*mABCinv;
+        DVEC tab = ((cB*cC*mA-cA*mB-cA*mC)*vCA + (cA*cC*mB-cB*mC-cB*mA)*vBC + (s2C*mA*mA*mB*mB*mABCinv+(mA+mB+mC))*vAB)/denom;
+        DVEC tbc = ((cA*cB*mC-cC*mB-cC*mA)*vCA + (s2A*mB*mB*mC*mC*mABCinv+(mA+mB+mC))*vBC + (cA*cC*mB-cB*mA-cB*mC)*vAB)/denom;
+        DVEC tca = ((s2B*mA*mA*mC*mC*mABCinv+(mA+mB+mC))*vCA + (cA*cB*mC-cC*mB-cC*mA)*vBC + (cB*cC*mA-cA*mB-cA*mC)*vAB)/denom;
+        DVEC invMass0(invMass[0]), invMass1(invMass[1]), invMass2(invMass[2]);
+        (v0x + (eABx*tab - eCAx*tca)*invMass0).store(vel[0]);
+        (v0y + (eABy*tab - eCAy*tca)*invMass0).store(vel[1]);
+        (v0z + (eABz*tab - eCAz*tca)*invMass0).store(vel[2]);
+        (v1x + (eBCx*tbc - eABx*tab)*invMass1).store(vel[3]);
+        (v1y + (eBCy*tbc - eABy*tab)*invMass1).store(vel[4]);
+        (v1z + (eBCz*tbc - eABz*tab)*invMass1).store(vel[5]);
+        (v2x + (eCAx*tca - eBCx*tbc)*invMass2).store(vel[6]);
+        (v2y + (eCAy*tca - eBCy*tbc)*invMass2).store(vel[7]);
+        (v2z + (eCAz*tca - eBCz*tbc)*invMass2).store(vel[8]);
+
+        // Record the new velocities.
+
+        for (int lane = 0; lane < WIDTH; lane++) {
+            int atoms[3] = {clusters.atom1[base+lane], clusters.atom2[base+lane], clusters.atom3[base+lane]};
+            for (int i = 0; i < 3; i++)
+                velocities[atoms[i]] = RealVec(vel[3*i][lane], vel[3*i+1][lane], vel[3*i+2][lane]);
+        }
+    }
+}
+
+} // namespace OpenMM
+
+#endif /*OPENMM_CPUSETTLESOLVER_H_*/
@@ -0,0 +1,459 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2015 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "CpuAtomReorderer.h"
+#include "ReferencePlatform.h"
+#include "RealVec.h"
+#include "openmm/AndersenThermostat.h"
+#include "openmm/BrownianIntegrator.h"
+#include "openmm/CMAPTorsionForce.h"
+#include "openmm/CMMotionRemover.h"
+#include "openmm/GBSAOBCForce.h"
+#include "openmm/HarmonicAngleForce.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/LangevinIntegrator.h"
+#include "openmm/MonteCarloAnisotropicBarostat.h"
+#include "openmm/MonteCarloBarostat.h"
+#include "openmm/MonteCarloMembraneBarostat.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/PeriodicTorsionForce.h"
+#include "openmm/RBTorsionForce.h"
+#include "openmm/VariableLangevinIntegrator.h"
+#include "openmm/VariableVerletIntegrator.h"
+#include "openmm/VerletIntegrator.h"
+#include "openmm/VirtualSite.h"
+#include "hilbert.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace OpenMM;
+using namespace std;
+
+/**
+ * This is the number of force computations between successive reorderings.
+ */
+static const int ReorderInterval = 100;
+
+/**
+ * This records the information a force (or the constraints, or the virtual sites) uses to compute
+ * interactions: parameters for individual particles, and groups of particles that interact with
+ * each other together with the parameters of each group.  Two molecules are interchangeable if
+ * these agree for every description.
+ */
+class ReorderDescription {
+public:
+    void addGroup(const int* particles, int numParticles, const double* params, int numParams) {
+        groupParticles.push_back(vector<int>(particles, particles+numParticles));
+        groupParams.push_back(vector<double>(params, params+numParams));
+    }
+    vector<vector<double> > particleParams;
+    vector<vector<int> > groupParticles;
+    vector<vector<double> > groupParams;
+};
+
+/**
+ * Build the description of a force.  This returns false if the force is of a type whose parameters
+ * cannot be compared, in which case the atoms must not be reordered.
+ */
+static bool describeForce(const Force& force, ReorderDescription& desc, bool& usesCutoff) {
+    if (dynamic_cast<const HarmonicBondForce*>(&force) != NULL) {
+        const HarmonicBondForce& f = dynamic_cast<const HarmonicBondForce&>(force);
+        for (int i = 0; i < f.getNumBonds(); i++) {
+            int particles[2];
+            double params[2];
+            f.getBondParameters(i, particles[0], particles[1], params[0], params[1]);
+            desc.addGroup(particles, 2, params, 2);
+        }
+        return true;
+    }
+    if (dynamic_cast<const HarmonicAngleForce*>(&force) != NULL) {
+        const HarmonicAngleForce& f = dynamic_cast<const HarmonicAngleForce&>(force);
+        for (int i = 0; i < f.getNumAngles(); i++) {
+            int particles[3];
+            double params[2];
+            f.getAngleParameters(i, particles[0], particles[1], particles[2], params[0], params[1]);
+            desc.addGroup(particles, 3, params, 2);
+        }
+        return true;
+    }
+    if (dynamic_cast<const PeriodicTorsionForce*>(&force) != NULL) {
+        const PeriodicTorsionForce& f = dynamic_cast<const PeriodicTorsionForce&>(force);
+        for (int i = 0; i < f.getNumTorsions(); i++) {
+            int particles[4], periodicity;
+            double params[3];
+            f.getTorsionParameters(i, particles[0], particles[1], particles[2], particles[3], periodicity, params[1], params[2]);
+            params[0] = periodicity;
+            desc.addGroup(particles, 4, params, 3);
+        }
+        return true;
+    }
+    if (dynamic_cast<const RBTorsionForce*>(&force) != NULL) {
+        const RBTorsionForce& f = dynamic_cast<const RBTorsionForce&>(force);
+        for (int i = 0; i < f.getNumTorsions(); i++) {
+            int particles[4];
+            double params[6];
+            f.getTorsionParameters(i, particles[0], particles[1], particles[2], particles[3], params[0], params[1], params[2], params[3], params[4], params[5]);
+            desc.addGroup(particles, 4, params, 6);
+        }
+        return true;
+    }
+    if (dynamic_cast<const CMAPTorsionForce*>(&force) != NULL) {
+        const CMAPTorsionForce& f = dynamic_cast<const CMAPTorsionForce&>(force);
+        for (int i = 0; i < f.getNumTorsions(); i++) {
+            int particles[8], map;
+            f.getTorsionParameters(i, map, particles[0], particles[1], particles[2], particles[3], particles[4], particles[5], particles[6], particles[7]);
+            double params[1] = {(double) map};
+            desc.addGroup(particles, 8, params, 1);
+        }
+        return true;
+    }
+    if (dynamic_cast<const NonbondedForce*>(&force) != NULL) {
+        const NonbondedForce& f = dynamic_cast<const NonbondedForce&>(force);
+        desc.particleParams.resize(f.getNumParticles(), vector<double>(3));
+        for (int i = 0; i < f.getNumParticles(); i++)
+            f.getParticleParameters(i, desc.particleParams[i][0], desc.particleParams[i][1], desc.particleParams[i][2]);
+        for (int i = 0; i < f.getNumExceptions(); i++) {
+            int particles[2];
+            double params[3];
+            f.getExceptionParameters(i, particles[0], particles[1], params[0], params[1], params[2]);
+            desc.addGroup(particles, 2, params, 3);
+        }
+        if (f.getNonbondedMethod() != NonbondedForce::NoCutoff)
+            usesCutoff = true;
+        return true;
+    }
+    if (dynamic_cast<const GBSAOBCForce*>(&force) != NULL) {
+        const GBSAOBCForce& f = dynamic_cast<const GBSAOBCForce&>(force);
+        desc.particleParams.resize(f.getNumParticles(), vector<double>(3));
+        for (int i = 0; i < f.getNumParticles(); i++)
+            f.getParticleParameters(i, desc.particleParams[i][0], desc.particleParams[i][1], desc.particleParams[i][2]);
+        if (f.getNonbondedMethod() != GBSAOBCForce::NoCutoff)
+            usesCutoff = true;
+        return true;
+    }
+
+    // These forces do not have per-particle parameters.
+
+    if (dynamic_cast<const CMMotionRemover*>(&force) != NULL || dynamic_cast<const AndersenThermostat*>(&force) != NULL ||
+            dynamic_cast<const MonteCarloBarostat*>(&force) != NULL || dynamic_cast<const MonteCarloAnisotropicBarostat*>(&force) != NULL ||
+            dynamic_cast<const MonteCarloMembraneBarostat*>(&force) != NULL)
+        return true;
+    return false;
+}
+
+/**
+ * Build the description of the virtual sites in a System.  This returns false if there is a type of
+ * virtual site it does not recognize.
+ */
+static bool describeVirtualSites(const System& system, ReorderDescription& desc) {
+    for (int i = 0; i < system.getNumParticles(); i++) {
+        if (!system.isVirtualSite(i))
+            continue;
+        const VirtualSite& site = system.getVirtualSite(i);
+        vector<int> particles(1, i);
+        for (int j = 0; j < site.getNumParticles(); j++)
+            particles.push_back(site.getParticle(j));
+        vector<double> params;
+        if (dynamic_cast<const TwoParticleAverageSite*>(&site) != NULL) {
+            const TwoParticleAverageSite& s = dynamic_cast<const TwoParticleAverageSite&>(site);
+            params.push_back(0);
+            params.push_back(s.getWeight(0));
+            params.push_back(s.getWeight(1));
+        }
+        else if (dynamic_cast<const ThreeParticleAverageSite*>(&site) != NULL) {
+            const ThreeParticleAverageSite& s = dynamic_cast<const ThreeParticleAverageSite&>(site);
+            params.push_back(1);
+            params.push_back(s.getWeight(0));
+            params.push_back(s.getWeight(1));
+            params.push_back(s.getWeight(2));
+        }
+        else if (dynamic_cast<const OutOfPlaneSite*>(&site) != NULL) {
+            const OutOfPlaneSite& s = dynamic_cast<const OutOfPlaneSite&>(site);
+            params.push_back(2);
+            params.push_back(s.getWeight12());
+            params.push_back(s.getWeight13());
+            params.push_back(s.getWeightCross());
+        }
+        else if (dynamic_cast<const LocalCoordinatesSite*>(&site) != NULL) {
+            const LocalCoordinatesSite& s = dynamic_cast<const LocalCoordinatesSite&>(site);
+            params.push_back(3);
+            const Vec3* vectors[] = {&s.getOriginWeights(), &s.getXWeights(), &s.getYWeights(), &s.getLocalPosition()};
+            for (int j = 0; j < 4; j++)
+                for (int k = 0; k < 3; k++)
+                    params.push_back((*vectors[j])[k]);
+        }
+        else
+            return false;
+        desc.addGroup(&particles[0], particles.size(), &params[0], params.size());
+    }
+    return true;
+}
+
+/**
+ * Determine whether two molecules are identical.  groups1 and groups2 list, for each description, the groups
+ * that belong to each molecule.
+ */
+static bool areMoleculesIdentical(const System& system, const vector<ReorderDescription>& descriptions, const vector<int>& atoms1,
+        const vector<vector<int> >& groups1, const vector<int>& atoms2, const vector<vector<int> >& groups2) {
+    if (atoms1.size() != atoms2.size())
+        return false;
+    int offset = atoms2[0]-atoms1[0];
+    for (int i = 0; i < (int) atoms1.size(); i++) {
+        if (atoms2[i] != atoms1[i]+offset || system.getParticleMass(atoms1[i]) != system.getParticleMass(atoms2[i]))
+            return false;
+        for (int j = 0; j < (int) descriptions.size(); j++) {
+            const vector<vector<double> >& params = descriptions[j].particleParams;
+            if (params.size() > 0 && params[atoms1[i]] != params[atoms2[i]])
+                return false;
+        }
+    }
+    for (int i = 0; i < (int) descriptions.size(); i++) {
+        const ReorderDescription& desc = descriptions[i];
+        if (groups1[i].size() != groups2[i].size())
+            return false;
+        for (int j = 0; j < (int) groups1[i].size(); j++) {
+            const vector<int>& particles1 = desc.groupParticles[groups1[i][j]];
+            const vector<int>& particles2 = desc.groupParticles[groups2[i][j]];
+            if (particles1.size() != particles2.size() || desc.groupParams[groups1[i][j]] != desc.groupParams[groups2[i][j]])
+                return false;
+            for (int k = 0; k < (int) particles1.size(); k++)
+                if (particles2[k] != particles1[k]+offset)
+                    return false;
+        }
+    }
+    return true;
+}
+
+CpuAtomReorderer::CpuAtomReorderer(int numAtoms, bool enabled) : numAtoms(numAtoms), stepsSinceReorder(ReorderInterval), enabled(enabled),
+        atomsAreReordered(false), hasFoundGroups(false), isPeriodic(false), needRestore(false), atomIndex(numAtoms), storageIndex(numAtoms) {
+    for (int i = 0; i < numAtoms; i++)
+        atomIndex[i] = storageIndex[i] = i;
+}
+
+void CpuAtomReorderer::invalidateMolecules() {
+    needRestore = true;
+}
+
+void CpuAtomReorderer::reorderAtoms(ContextImpl& context, bool includeForce) {
+    if (!enabled)
+        return;
+    if (needRestore) {
+        // Parameters have changed, so the list of identical molecules may no longer be valid.  Put the atoms
+        // back in their original order, and identify the molecules again before the next reordering.
+
+        restoreOriginalOrder(context);
+        hasFoundGroups = false;
+        needRestore = false;
+    }
+    if (!includeForce)
+        return;
+    if (!hasFoundGroups) {
+        findMoleculeGroups(context);
+        hasFoundGroups = true;
+    }
+    if (moleculeGroups.size() == 0)
+        return;
+    if (stepsSinceReorder < ReorderInterval) {
+        stepsSinceReorder++;
+        return;
+    }
+    stepsSinceReorder = 0;
+    sortMolecules(context);
+}
+
+void CpuAtomReorderer::restoreOriginalOrder(ContextImpl& context) {
+    stepsSinceReorder = ReorderInterval;
+    if (!atomsAreReordered)
+        return;
+    vector<int> newAtomIndex(numAtoms);
+    for (int i = 0; i < numAtoms; i++)
+        newAtomIndex[i] = i;
+    applyOrder(context, newAtomIndex);
+}
+
+bool CpuAtomReorderer::findMoleculeGroups(ContextImpl& context) {
+    moleculeGroups.clear();
+    const System& system = context.getSystem();
+
+    // Only integrators that keep no per-particle state of their own are supported.
+
+    Integrator& integrator = context.getIntegrator();
+    if (dynamic_cast<VerletIntegrator*>(&integrator) == NULL && dynamic_cast<LangevinIntegrator*>(&integrator) == NULL &&
+            dynamic_cast<BrownianIntegrator*>(&integrator) == NULL && dynamic_cast<VariableVerletIntegrator*>(&integrator) == NULL &&
+            dynamic_cast<VariableLangevinIntegrator*>(&integrator) == NULL)
+        return false;
+
+    // Describe every force, the constraints, and the virtual sites.  Reordering only helps when there
+    // is a cutoff, since that is what makes particles that are close in space interact.
+
+    int numForces = system.getNumForces();
+    vector<ReorderDescription> descriptions(numForces+2);
+    bool usesCutoff = false;
+    isPeriodic = false;
+    for (int i = 0; i < numForces; i++) {
+        if (!describeForce(system.getForce(i), descriptions[i], usesCutoff))
+            return false;
+        if (system.getForce(i).usesPeriodicBoundaryConditions())
+            isPeriodic = true;
+    }
+    if (!usesCutoff)
+        return false;
+    for (int i = 0; i < system.getNumConstraints(); i++) {
+        int particles[2];
+        double distance;
+        system.getConstraintParameters(i, particles[0], particles[1], distance);
+        descriptions[numForces].addGroup(particles, 2, &distance, 1);
+    }
+    if (!describeVirtualSites(system, descriptions[numForces+1]))
+        return false;
+
+    // Identify molecules as sets of atoms connected by groups.
+
+    vector<pair<int, int> > bonds;
+    for (int i = 0; i < (int) descriptions.size(); i++)
+        for (int j = 0; j < (int) descriptions[i].groupParticles.size(); j++) {
+            const vector<int>& particles = descriptions[i].groupParticles[j];
+            for (int k = 1; k < (int) particles.size(); k++)
+                bonds.push_back(make_pair(particles[0], particles[k]));
+        }
+    vector<vector<int> > molecules = ContextImpl::findMolecules(numAtoms, bonds);
+    int numMolecules = molecules.size();
+    vector<int> atomMolecule(numAtoms);
+    for (int i = 0; i < numMolecules; i++)
+        for (int j = 0; j < (int) molecules[i].size(); j++)
+            atomMolecule[molecules[i][j]] = i;
+    vector<vector<vector<int> > > moleculeDescGroups(numMolecules, vector<vector<int> >(descriptions.size()));
+    for (int i = 0; i < (int) descriptions.size(); i++)
+        for (int j = 0; j < (int) descriptions[i].groupParticles.size(); j++)
+            moleculeDescGroups[atomMolecule[descriptions[i].groupParticles[j][0]]][i].push_back(j);
+
+    // Sort them into groups of identical molecules.
+
+    vector<int> uniqueMolecules;
+    vector<vector<int> > instances;
+    for (int i = 0; i < numMolecules; i++) {
+        bool isNew = true;
+        for (int j = 0; j < (int) uniqueMolecules.size() && isNew; j++) {
+            int mol = uniqueMolecules[j];
+            if (areMoleculesIdentical(system, descriptions, molecules[mol], moleculeDescGroups[mol], molecules[i], moleculeDescGroups[i])) {
+                instances[j].push_back(i);
+                isNew = false;
+            }
+        }
+        if (isNew) {
+            uniqueMolecules.push_back(i);
+            instances.push_back(vector<int>(1, i));
+        }
+    }
+    for (int i = 0; i < (int) uniqueMolecules.size(); i++) {
+        if (instances[i].size() < 2)
+            continue;
+        MoleculeGroup group;
+        const vector<int>& atoms = molecules[uniqueMolecules[i]];
+        for (int j = 0; j < (int) atoms.size(); j++)
+            group.atoms.push_back(atoms[j]-atoms[0]);
+        for (int j = 0; j < (int) instances[i].size(); j++)
+            group.offsets.push_back(molecules[instances[i][j]][0]);
+        moleculeGroups.push_back(group);
+    }
+    return (moleculeGroups.size() > 0);
+}
+
+void CpuAtomReorderer::sortMolecules(ContextImpl& context) {
+    ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
+    vector<RealVec>& positions = *((vector<RealVec>*) data->positions);
+    RealVec* boxVectors = (RealVec*) data->periodicBoxVectors;
+
+    // Find the range of positions.
+
+    RealVec minPos, maxPos;
+    if (isPeriodic)
+        maxPos = RealVec(boxVectors[0][0], boxVectors[1][1], boxVectors[2][2]);
+    else {
+        minPos = maxPos = positions[0];
+        for (int i = 1; i < numAtoms; i++)
+            for (int j = 0; j < 3; j++) {
+                minPos[j] = min(minPos[j], positions[i][j]);
+                maxPos[j] = max(maxPos[j], positions[i][j]);
+            }
+    }
+    double binWidth = max(max(maxPos[0]-minPos[0], maxPos[1]-minPos[1]), maxPos[2]-minPos[2])/255.0;
+    double invBinWidth = (binWidth > 0 ? 1.0/binWidth : 0.0);
+
+    // Loop over each group of identical molecules and sort them along a Hilbert curve.
+
+    vector<int> newAtomIndex = atomIndex;
+    for (int group = 0; group < (int) moleculeGroups.size(); group++) {
+        const vector<int>& atoms = moleculeGroups[group].atoms;
+        const vector<int>& offsets = moleculeGroups[group].offsets;
+        int numMolecules = offsets.size();
+        vector<pair<int, int> > molBins(numMolecules);
+        for (int i = 0; i < numMolecules; i++) {
+            RealVec center;
+            for (int j = 0; j < (int) atoms.size(); j++)
+                center += positions[offsets[i]+atoms[j]];
+            center *= 1.0/atoms.size();
+            if (isPeriodic) {
+                center -= boxVectors[2]*floor(center[2]/boxVectors[2][2]);
+                center -= boxVectors[1]*floor(center[1]/boxVectors[1][1]);
+                center -= boxVectors[0]*floor(center[0]/boxVectors[0][0]);
+            }
+            bitmask_t coords[3];
+            for (int j = 0; j < 3; j++)
+                coords[j] = (bitmask_t) max(0, min(255, (int) ((center[j]-minPos[j])*invBinWidth)));
+            molBins[i] = make_pair((int) hilbert_c2i(3, 8, coords), i);
+        }
+        sort(molBins.begin(), molBins.end());
+        for (int i = 0; i < numMolecules; i++)
+            for (int j = 0; j < (int) atoms.size(); j++)
+                newAtomIndex[offsets[i]+atoms[j]] = atomIndex[offsets[molBins[i].second]+atoms[j]];
+    }
+    applyOrder(context, newAtomIndex);
+}
+
+void CpuAtomReorderer::applyOrder(ContextImpl& context, const vector<int>& newAtomIndex) {
+    ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
+    vector<RealVec>* arrays[] = {(vector<RealVec>*) data->positions, (vector<RealVec>*) data->velocities, (vector<RealVec>*) data->forces};
+    vector<RealVec> newValues(numAtoms);
+    for (int i = 0; i < 3; i++) {
+        vector<RealVec>& values = *arrays[i];
+        for (int j = 0; j < numAtoms; j++)
+            newValues[j] = values[storageIndex[newAtomIndex[j]]];
+        values.swap(newValues);
+    }
+    atomsAreReordered = false;
+    for (int i = 0; i < numAtoms; i++) {
+        atomIndex[i] = newAtomIndex[i];
+        storageIndex[atomIndex[i]] = i;
+        if (atomIndex[i] != i)
+            atomsAreReordered = true;
+    }
+}
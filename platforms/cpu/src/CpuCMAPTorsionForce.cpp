@@ -0,0 +1,274 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2015 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "CpuCMAPTorsionForce.h"
+#include "SimTKOpenMMRealType.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/internal/vectorize.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace OpenMM;
+using namespace std;
+
+class CpuCMAPTorsionForce::ComputeForceTask : public ThreadPool::Task {
+public:
+    ComputeForceTask(CpuCMAPTorsionForce& owner) : owner(owner) {
+    }
+    void execute(ThreadPool& threads, int threadIndex) {
+        owner.threadComputeForce(threads, threadIndex);
+    }
+    CpuCMAPTorsionForce& owner;
+};
+
+CpuCMAPTorsionForce::CpuCMAPTorsionForce() : numTorsions(0) {
+}
+
+void CpuCMAPTorsionForce::initialize(int numAtoms, const vector<int>& torsionMaps, const vector<vector<int> >& torsionAtoms, ThreadPool& threads) {
+    this->threads = &threads;
+    numTorsions = torsionMaps.size();
+    this->torsionMaps = torsionMaps;
+    this->torsionAtoms.resize(8*numTorsions);
+    torsionAtomPointers.resize(numTorsions);
+    for (int i = 0; i < numTorsions; i++) {
+        for (int j = 0; j < 8; j++)
+            this->torsionAtoms[8*i+j] = torsionAtoms[i][j];
+        torsionAtomPointers[i] = &this->torsionAtoms[8*i];
+    }
+    threadEnergy.resize(threads.getNumThreads());
+    if (numTorsions > 0)
+        bondForce.initialize(numAtoms, numTorsions, 8, &torsionAtomPointers[0], threads);
+}
+
+void CpuCMAPTorsionForce::setMapCoefficients(const vector<vector<vector<double> > >& coeff) {
+    // Store the patches for all maps in one table.  Each patch has 16 coefficients, so in single
+    // precision it fills exactly one 64 byte cache line.
+
+    int numMaps = coeff.size();
+    mapSize.resize(numMaps);
+    mapStart.resize(numMaps);
+    int numPatches = 0;
+    for (int i = 0; i < numMaps; i++) {
+        mapSize[i] = (int) floor(sqrt((double) coeff[i].size())+0.5);
+        if (mapSize[i]*mapSize[i] != (int) coeff[i].size())
+            throw OpenMMException("CpuCMAPTorsionForce: The number of patches in a map must be a perfect square");
+        mapStart[i] = numPatches;
+        numPatches += coeff[i].size();
+    }
+    coefficients.resize(16*numPatches);
+    for (int i = 0; i < numMaps; i++)
+        for (int j = 0; j < (int) coeff[i].size(); j++)
+            for (int k = 0; k < 16; k++)
+                coefficients[16*(mapStart[i]+j)+k] = (float) coeff[i][j][k];
+}
+
+void CpuCMAPTorsionForce::setTorsionMaps(const vector<int>& torsionMaps) {
+    this->torsionMaps = torsionMaps;
+}
+
+void CpuCMAPTorsionForce::calculateForce(vector<RealVec>& atomCoordinates, vector<RealVec>& forces, RealOpenMM* totalEnergy) {
+    if (numTorsions == 0)
+        return;
+    this->atomCoordinates = &atomCoordinates[0];
+    this->forces = &forces[0];
+    includeEnergy = (totalEnergy != NULL);
+
+    // Have the worker threads compute their forces.
+
+    ComputeForceTask task(*this);
+    threads->execute(task);
+    threads->waitForThreads();
+
+    // Compute any torsions that could not be assigned to a thread.
+
+    double energy = 0;
+    computeTorsions(bondForce.getExtraBonds(), energy);
+    if (includeEnergy) {
+        for (int i = 0; i < (int) threadEnergy.size(); i++)
+            energy += threadEnergy[i];
+        *totalEnergy += energy;
+    }
+}
+
+void CpuCMAPTorsionForce::threadComputeForce(ThreadPool& threads, int threadIndex) {
+    threadEnergy[threadIndex] = 0;
+    computeTorsions(bondForce.getThreadBonds(threadIndex), threadEnergy[threadIndex]);
+}
+
+/**
+ * Load the displacement between two atoms for each of four torsions, and transpose them so x, y,
+ * and z each hold one component for all four torsions.  The subtraction is done in double precision
+ * to avoid losing accuracy when the atoms are far from the origin.
+ */
+static void loadDelta(const RealVec* pos, const int* const* atoms, int atom1, int atom2, fvec4* delta) {
+    fvec4 d[4];
+    for (int lane = 0; lane < 4; lane++) {
+        RealVec v = pos[atoms[lane][atom1]]-pos[atoms[lane][atom2]];
+        d[lane] = fvec4((float) v[0], (float) v[1], (float) v[2], 0.0f);
+    }
+    transpose(d[0], d[1], d[2], d[3]);
+    delta[0] = d[0];
+    delta[1] = d[1];
+    delta[2] = d[2];
+}
+
+static void cross(const fvec4* a, const fvec4* b, fvec4* result) {
+    result[0] = a[1]*b[2]-a[2]*b[1];
+    result[1] = a[2]*b[0]-a[0]*b[2];
+    result[2] = a[0]*b[1]-a[1]*b[0];
+}
+
+static fvec4 dot(const fvec4* a, const fvec4* b) {
+    return a[0]*b[0]+a[1]*b[1]+a[2]*b[2];
+}
+
+/**
+ * Compute four dihedral angles in the range [0, 2*pi).  The deltas are defined as in
+ * ReferenceCMAPTorsionIxn: d0 = p1-p2, d1 = p3-p2, d2 = p3-p4.
+ */
+static void computeDihedrals(const fvec4* d0, const fvec4* d1, const fvec4* d2, fvec4* cp0, fvec4* cp1, float* angle) {
+    cross(d0, d1, cp0);
+    cross(d1, d2, cp1);
+    fvec4 y = sqrt(dot(d1, d1))*dot(d0, cp1);
+    fvec4 x = dot(cp0, cp1);
+    for (int lane = 0; lane < 4; lane++) {
+        angle[lane] = atan2f(y[lane], x[lane]);
+        if (angle[lane] < 0)
+            angle[lane] += (float) (2*M_PI);
+    }
+}
+
+/**
+ * Apply the forces for four dihedrals, given the derivative of the energy with respect to each angle.
+ */
+static void applyDihedralForces(RealVec* forces, const int* const* atoms, int firstAtom, int count, const fvec4* d0, const fvec4* d1,
+        const fvec4* d2, const fvec4* cp0, const fvec4* cp1, fvec4 dEdAngle) {
+    fvec4 r2BC = dot(d1, d1);
+    fvec4 normBC = sqrt(r2BC);
+    fvec4 factor0 = -dEdAngle*normBC/dot(cp0, cp0);
+    fvec4 factor3 = dEdAngle*normBC/dot(cp1, cp1);
+    fvec4 factor1 = dot(d0, d1)/r2BC;
+    fvec4 factor2 = dot(d2, d1)/r2BC;
+    fvec4 atomForce[4][4];
+    for (int i = 0; i < 3; i++) {
+        fvec4 f0 = factor0*cp0[i];
+        fvec4 f3 = factor3*cp1[i];
+        fvec4 s = factor1*f0 - factor2*f3;
+        atomForce[0][i] = f0;
+        atomForce[1][i] = s-f0;
+        atomForce[2][i] = -f3-s;
+        atomForce[3][i] = f3;
+    }
+    for (int j = 0; j < 4; j++) {
+        atomForce[j][3] = fvec4(0.0f);
+        transpose(atomForce[j][0], atomForce[j][1], atomForce[j][2], atomForce[j][3]);
+        for (int lane = 0; lane < count; lane++) {
+            RealVec& f = forces[atoms[lane][firstAtom+j]];
+            fvec4 value = atomForce[j][lane];
+            f[0] += value[0];
+            f[1] += value[1];
+            f[2] += value[2];
+        }
+    }
+}
+
+void CpuCMAPTorsionForce::computeTorsions(const vector<int>& torsions, double& energy) {
+    int numInList = torsions.size();
+    for (int base = 0; base < numInList; base += 4) {
+        // Load the atoms.  If there are fewer than four torsions left, the extra lanes repeat the
+        // last one and their results are discarded.
+
+        int count = min(4, numInList-base);
+        const int* atoms[4];
+        int torsion[4];
+        for (int lane = 0; lane < 4; lane++) {
+            torsion[lane] = torsions[base+min(lane, count-1)];
+            atoms[lane] = torsionAtomPointers[torsion[lane]];
+        }
+        fvec4 deltaA[3][3], deltaB[3][3];
+        loadDelta(atomCoordinates, atoms, 0, 1, deltaA[0]);
+        loadDelta(atomCoordinates, atoms, 2, 1, deltaA[1]);
+        loadDelta(atomCoordinates, atoms, 2, 3, deltaA[2]);
+        loadDelta(atomCoordinates, atoms, 4, 5, deltaB[0]);
+        loadDelta(atomCoordinates, atoms, 6, 5, deltaB[1]);
+        loadDelta(atomCoordinates, atoms, 6, 7, deltaB[2]);
+
+        // Compute the dihedral angles.
+
+        fvec4 cpA[2][3], cpB[2][3];
+        float angleA[4], angleB[4];
+        computeDihedrals(deltaA[0], deltaA[1], deltaA[2], cpA[0], cpA[1], angleA);
+        computeDihedrals(deltaB[0], deltaB[1], deltaB[2], cpB[0], cpB[1], angleB);
+
+        // Identify which patch each one is in, and load the coefficients.
+
+        float da[4], db[4], scale[4];
+        fvec4 c[16];
+        for (int lane = 0; lane < 4; lane++) {
+            int map = torsionMaps[torsion[lane]];
+            int size = mapSize[map];
+            float patchesPerRadian = (float) (size/(2*M_PI));
+            float a = angleA[lane]*patchesPerRadian;
+            float b = angleB[lane]*patchesPerRadian;
+            int s = min((int) a, size-1);
+            int t = min((int) b, size-1);
+            da[lane] = a-s;
+            db[lane] = b-t;
+            scale[lane] = patchesPerRadian;
+            const float* patch = &coefficients[16*(mapStart[map]+s+size*t)];
+            for (int j = 0; j < 4; j++)
+                c[4*j+lane] = fvec4(patch+4*j);
+        }
+        for (int j = 0; j < 4; j++)
+            transpose(c[4*j], c[4*j+1], c[4*j+2], c[4*j+3]);
+
+        // Evaluate the splines to determine the energy and gradients.
+
+        fvec4 a(da), b(db);
+        fvec4 e(0.0f), dEdA(0.0f), dEdB(0.0f);
+        for (int i = 3; i >= 0; i--) {
+            e = a*e + ((c[i*4+3]*b + c[i*4+2])*b + c[i*4+1])*b + c[i*4+0];
+            dEdA = b*dEdA + (3.0f*c[i+3*4]*a + 2.0f*c[i+2*4])*a + c[i+1*4];
+            dEdB = a*dEdB + (3.0f*c[i*4+3]*b + 2.0f*c[i*4+2])*b + c[i*4+1];
+        }
+        fvec4 patchScale(scale);
+        dEdA *= patchScale;
+        dEdB *= patchScale;
+        if (includeEnergy)
+            for (int lane = 0; lane < count; lane++)
+                energy += e[lane];
+
+        // Apply the forces.
+
+        applyDihedralForces(forces, atoms, 0, count, deltaA[0], deltaA[1], deltaA[2], cpA[0], cpA[1], dEdA);
+        applyDihedralForces(forces, atoms, 4, count, deltaB[0], deltaB[1], deltaB[2], cpB[0], cpB[1], dEdB);
+    }
+}
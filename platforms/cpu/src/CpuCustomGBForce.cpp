@@ -45,33 +45,19 @@ public:
 
 CpuCustomGBForce::ThreadData::ThreadData(int numAtoms, int numThreads, int threadIndex,
                       const vector<Lepton::CompiledExpression>& valueExpressions,
-                      const vector<vector<Lepton::CompiledExpression> >& valueDerivExpressions,
-                      const vector<vector<Lepton::CompiledExpression> >& valueGradientExpressions,
+                      const vector<Lepton::CompiledExpression>& valueDerivExpressions,
                       const vector<string>& valueNames,
                       const vector<Lepton::CompiledExpression>& energyExpressions,
-                      const vector<vector<Lepton::CompiledExpression> >& energyDerivExpressions,
-                      const vector<vector<Lepton::CompiledExpression> >& energyGradientExpressions,
                       const vector<string>& parameterNames) :
-            valueExpressions(valueExpressions), valueDerivExpressions(valueDerivExpressions), valueGradientExpressions(valueGradientExpressions),
-            energyExpressions(energyExpressions), energyDerivExpressions(energyDerivExpressions), energyGradientExpressions(energyGradientExpressions) {
+            valueExpressions(valueExpressions), valueDerivExpressions(valueDerivExpressions), energyExpressions(energyExpressions) {
     firstAtom = (threadIndex*(long long) numAtoms)/numThreads;
     lastAtom = ((threadIndex+1)*(long long) numAtoms)/numThreads;
     for (int i = 0; i < (int) valueExpressions.size(); i++)
         expressionSet.registerExpression(this->valueExpressions[i]);
     for (int i = 0; i < (int) valueDerivExpressions.size(); i++)
-        for (int j = 0; j < (int) valueDerivExpressions[i].size(); j++)
-            expressionSet.registerExpression(this->valueDerivExpressions[i][j]);
-    for (int i = 0; i < (int) valueGradientExpressions.size(); i++)
-        for (int j = 0; j < (int) valueGradientExpressions[i].size(); j++)
-            expressionSet.registerExpression(this->valueGradientExpressions[i][j]);
+        expressionSet.registerExpression(this->valueDerivExpressions[i]);
     for (int i = 0; i < (int) energyExpressions.size(); i++)
         expressionSet.registerExpression(this->energyExpressions[i]);
-    for (int i = 0; i < (int) energyDerivExpressions.size(); i++)
-        for (int j = 0; j < (int) energyDerivExpressions[i].size(); j++)
-            expressionSet.registerExpression(this->energyDerivExpressions[i][j]);
-    for (int i = 0; i < (int) energyGradientExpressions.size(); i++)
-        for (int j = 0; j < (int) energyGradientExpressions[i].size(); j++)
-            expressionSet.registerExpression(this->energyGradientExpressions[i][j]);
     xindex = expressionSet.getVariableIndex("x");
     yindex = expressionSet.getVariableIndex("y");
     zindex = expressionSet.getVariableIndex("z");
@@ -96,35 +82,32 @@ CpuCustomGBForce::ThreadData::ThreadData(int numAtoms, int numThreads, int threa
     dEdV.resize(valueNames.size());
     for (int i = 0; i < (int) dEdV.size(); i++)
         dEdV[i].resize(numAtoms);
-    dVdX.resize(valueDerivExpressions.size());
-    dVdY.resize(valueDerivExpressions.size());
-    dVdZ.resize(valueDerivExpressions.size());
-    dVdR1.resize(valueDerivExpressions.size());
-    dVdR2.resize(valueDerivExpressions.size());
+    coeff.resize(valueNames.size());
+    dVdX.resize(valueNames.size());
+    dVdY.resize(valueNames.size());
+    dVdZ.resize(valueNames.size());
 }
 
-CpuCustomGBForce::CpuCustomGBForce(int numAtoms, const std::vector<std::set<int> >& exclusions,
+CpuCustomGBForce::CpuCustomGBForce(int numAtoms, const CpuExclusionList& exclusions,
                      const vector<Lepton::CompiledExpression>& valueExpressions,
-                     const vector<vector<Lepton::CompiledExpression> >& valueDerivExpressions,
-                     const vector<vector<Lepton::CompiledExpression> >& valueGradientExpressions,
+                     const vector<Lepton::CompiledExpression>& valueDerivExpressions,
                      const vector<string>& valueNames,
                      const vector<CustomGBForce::ComputationType>& valueTypes,
                      const vector<Lepton::CompiledExpression>& energyExpressions,
-                     const vector<vector<Lepton::CompiledExpression> >& energyDerivExpressions,
-                     const vector<vector<Lepton::CompiledExpression> >& energyGradientExpressions,
                      const vector<CustomGBForce::ComputationType>& energyTypes,
                      const vector<string>& parameterNames, ThreadPool& threads) :
             exclusions(exclusions), cutoff(false), periodic(false), valueNames(valueNames), valueTypes(valueTypes),
             energyTypes(energyTypes), paramNames(parameterNames), threads(threads) {
     for (int i = 0; i < threads.getNumThreads(); i++)
-        threadData.push_back(new ThreadData(numAtoms, threads.getNumThreads(), i, valueExpressions, valueDerivExpressions, valueGradientExpressions, valueNames,
-                      energyExpressions, energyDerivExpressions, energyGradientExpressions, parameterNames));
+        threadData.push_back(new ThreadData(numAtoms, threads.getNumThreads(), i, valueExpressions, valueDerivExpressions, valueNames,
+                      energyExpressions, parameterNames));
     values.resize(valueNames.size());
     dEdV.resize(valueNames.size());
     for (int i = 0; i < (int) values.size(); i++) {
         values[i].resize(numAtoms);
         dEdV[i].resize(numAtoms);
     }
+    chainFactor.resize(numAtoms);
 }
 
 CpuCustomGBForce::~CpuCustomGBForce() {
@@ -181,23 +164,23 @@ void CpuCustomGBForce::calculateIxn(int numberOfAtoms, float* posq, RealOpenMM**
 
     // Calculate the energy terms.
 
-    for (int i = 0; i < (int) threadData[0]->energyExpressions.size(); i++) {
-        gmx_atomic_set(&counter, 0);
-        threads.execute(task);
-        threads.waitForThreads();
-    }
-
-    // Sum the energy derivatives.
-
-    threads.resumeThreads();
-    threads.waitForThreads();
-    
-    // Apply the chain rule to evaluate forces.
-
     gmx_atomic_set(&counter, 0);
     threads.resumeThreads();
     threads.waitForThreads();
 
+    if (includeForce) {
+        // Sum the energy derivatives and compute the chain rule factors.
+
+        threads.resumeThreads();
+        threads.waitForThreads();
+
+        // Apply the chain rule to evaluate forces.
+
+        gmx_atomic_set(&counter, 0);
+        threads.resumeThreads();
+        threads.waitForThreads();
+    }
+
     // Combine the energies from all the threads.
     
     if (includeEnergy) {
@@ -210,7 +193,6 @@ void CpuCustomGBForce::calculateIxn(int numberOfAtoms, float* posq, RealOpenMM**
 void CpuCustomGBForce::threadComputeForce(ThreadPool& threads, int threadIndex) {
     // Compute this thread's subset of interactions.
 
-    int numThreads = threads.getNumThreads();
     threadEnergy[threadIndex] = 0;
     double& energy = threadEnergy[threadIndex];
     float* forces = &(*threadForce)[threadIndex][0];
@@ -219,21 +201,47 @@ void CpuCustomGBForce::threadComputeForce(ThreadPool& threads, int threadIndex)
     fvec4 invBoxSize((1/periodicBoxSize[0]), (1/periodicBoxSize[1]), (1/periodicBoxSize[2]), 0);
     for (map<string, double>::const_iterator iter = globalParameters->begin(); iter != globalParameters->end(); ++iter)
         data.expressionSet.setVariable(data.expressionSet.getVariableIndex(iter->first), iter->second);
+    int numValues = valueTypes.size();
+    gmx_atomic_t* counter = reinterpret_cast<gmx_atomic_t*>(atomicCounter);
 
-    // Calculate the first computed value.
+    // Calculate the first computed value.  With a cutoff, this pass also finds the pairs that
+    // all later passes use, and records the derivatives needed for the chain rule.
 
     for (int i = 0; i < (int) data.value0.size(); i++)
         data.value0[i] = 0.0f;
-    if (valueTypes[0] == CustomGBForce::ParticlePair)
-        calculateParticlePairValue(0, data, numberOfAtoms, posq, atomParameters, true, boxSize, invBoxSize);
-    else
-        calculateParticlePairValue(0, data, numberOfAtoms, posq, atomParameters, false, boxSize, invBoxSize);
+    data.pairAtom1.clear();
+    data.pairAtom2.clear();
+    data.pairExcluded.clear();
+    data.pairDelta.clear();
+    if (cutoff) {
+        while (true) {
+            int blockIndex = gmx_atomic_fetch_add(counter, 1);
+            if (blockIndex >= neighborList->getNumBlocks())
+                break;
+            int start = data.pairAtom1.size();
+            findBlockPairs(blockIndex, data, boxSize, invBoxSize);
+            if (numValues > 0)
+                calculatePairValues(data, start, true, includeForce);
+        }
+    }
+    else if (numValues > 0) {
+        while (true) {
+            int atom = gmx_atomic_fetch_add(counter, 1);
+            if (atom >= numberOfAtoms)
+                break;
+            data.pairAtom1.clear();
+            data.pairAtom2.clear();
+            data.pairExcluded.clear();
+            data.pairDelta.clear();
+            findRowPairs(atom, data, boxSize, invBoxSize);
+            calculatePairValues(data, 0, true, false);
+        }
+    }
     threads.syncThreads();
 
     // Sum the first computed value and calculate the remaining ones.
 
-    int numValues = valueTypes.size();
-    for (int atom = data.firstAtom; atom < data.lastAtom; atom++) {
+    for (int atom = data.firstAtom; atom < data.lastAtom && numValues > 0; atom++) {
         float sum = 0.0f;
         for (int j = 0; j < (int) threadData.size(); j++)
             sum += threadData[j]->value0[atom];
@@ -255,331 +263,302 @@ void CpuCustomGBForce::threadComputeForce(ThreadPool& threads, int threadIndex)
     for (int i = 0; i < (int) data.dEdV.size(); i++)
         for (int j = 0; j < (int) data.dEdV[i].size(); j++)
             data.dEdV[i][j] = 0.0;
-    for (int termIndex = 0; termIndex < (int) data.energyExpressions.size(); termIndex++) {
-        if (energyTypes[termIndex] == CustomGBForce::SingleParticle)
-            calculateSingleParticleEnergyTerm(termIndex, data, numberOfAtoms, posq, atomParameters, forces, energy);
-        else if (energyTypes[termIndex] == CustomGBForce::ParticlePair)
-            calculateParticlePairEnergyTerm(termIndex, data, numberOfAtoms, posq, atomParameters, true, forces, energy, boxSize, invBoxSize);
-        else
-            calculateParticlePairEnergyTerm(termIndex, data, numberOfAtoms, posq, atomParameters, false, forces, energy, boxSize, invBoxSize);
-        threads.syncThreads();
-    }
-
-    // Sum the energy derivatives.
-
-    for (int atom = data.firstAtom; atom < data.lastAtom; atom++) {
-        for (int i = 0; i < (int) dEdV.size(); i++) {
-            float sum = 0.0f;
-            for (int j = 0; j < (int) threadData.size(); j++)
-                sum += threadData[j]->dEdV[i][atom];
-            dEdV[i][atom] = sum;
+    calculateSingleParticleEnergyTerms(data, forces, energy);
+    if (cutoff)
+        calculateParticlePairEnergyTerms(data, forces, energy);
+    else {
+        while (true) {
+            int atom = gmx_atomic_fetch_add(counter, 1);
+            if (atom >= numberOfAtoms)
+                break;
+            data.pairAtom1.clear();
+            data.pairAtom2.clear();
+            data.pairExcluded.clear();
+            data.pairDelta.clear();
+            findRowPairs(atom, data, boxSize, invBoxSize);
+            calculateParticlePairEnergyTerms(data, forces, energy);
         }
     }
+    if (!includeForce)
+        return;
     threads.syncThreads();
 
-    // Apply the chain rule to evaluate forces.
+    // Sum the energy derivatives and compute the factors for the chain rule.
 
-    calculateChainRuleForces(data, numberOfAtoms, posq, atomParameters, forces, boxSize, invBoxSize);
-}
+    calculateChainRuleFactors(data, forces);
+    threads.syncThreads();
 
-void CpuCustomGBForce::calculateParticlePairValue(int index, ThreadData& data, int numAtoms, float* posq, RealOpenMM** atomParameters,
-        bool useExclusions, const fvec4& boxSize, const fvec4& invBoxSize) {
-    for (int i = 0; i < numAtoms; i++)
-        values[index][i] = 0.0f;
-    vector<float>& valueArray = (index == 0 ? data.value0 : values[index]);
-    if (cutoff) {
-        // Loop over all pairs in the neighbor list.
+    // Apply the chain rule to evaluate forces.
 
-        while (true) {
-            int blockIndex = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 1);
-            if (blockIndex >= neighborList->getNumBlocks())
-                break;
-            const int* blockAtom = &neighborList->getSortedAtoms()[4*blockIndex];
-            const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
-            const vector<char>& blockExclusions = neighborList->getBlockExclusions(blockIndex);
-            for (int i = 0; i < (int) neighbors.size(); i++) {
-                int first = neighbors[i];
-                for (int k = 0; k < 4; k++) {
-                    if ((blockExclusions[i] & (1<<k)) == 0) {
-                        int second = blockAtom[k];
-                        if (useExclusions && exclusions[first].find(second) != exclusions[first].end())
-                            continue;
-                        calculateOnePairValue(index, first, second, data, posq, atomParameters, valueArray, boxSize, invBoxSize);
-                        calculateOnePairValue(index, second, first, data, posq, atomParameters, valueArray, boxSize, invBoxSize);
-                    }
-                }
-            }
-        }
-    }
+    if (numValues == 0)
+        return;
+    if (cutoff)
+        calculateChainRuleForces(data, forces);
     else {
-        // Perform an O(N^2) loop over all atom pairs.
-
         while (true) {
-            int i = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 1);
-            if (i >= numAtoms)
+            int atom = gmx_atomic_fetch_add(counter, 1);
+            if (atom >= numberOfAtoms)
                 break;
-            for (int j = i+1; j < numAtoms; j++) {
-                if (useExclusions && exclusions[i].find(j) != exclusions[i].end())
-                    continue;
-                calculateOnePairValue(index, i, j, data, posq, atomParameters, valueArray, boxSize, invBoxSize);
-                calculateOnePairValue(index, j, i, data, posq, atomParameters, valueArray, boxSize, invBoxSize);
-           }
+            data.pairAtom1.clear();
+            data.pairAtom2.clear();
+            data.pairExcluded.clear();
+            data.pairDelta.clear();
+            findRowPairs(atom, data, boxSize, invBoxSize);
+            calculatePairValues(data, 0, false, true);
+            calculateChainRuleForces(data, forces);
         }
     }
 }
 
-void CpuCustomGBForce::calculateOnePairValue(int index, int atom1, int atom2, ThreadData& data, float* posq, RealOpenMM** atomParameters,
-        vector<float>& valueArray, const fvec4& boxSize, const fvec4& invBoxSize) {
-    fvec4 deltaR;
-    fvec4 pos1(posq+4*atom1);
-    fvec4 pos2(posq+4*atom2);
-    float r2;
-    getDeltaR(pos2, pos1, deltaR, r2, periodic, boxSize, invBoxSize);
-    if (cutoff && r2 >= cutoffDistance2)
-        return;
-    float r = sqrtf(r2);
-    for (int i = 0; i < (int) paramNames.size(); i++) {
-        data.expressionSet.setVariable(data.particleParamIndex[i*2], atomParameters[atom1][i]);
-        data.expressionSet.setVariable(data.particleParamIndex[i*2+1], atomParameters[atom2][i]);
-    }
-    data.expressionSet.setVariable(data.rindex, r);
-    for (int i = 0; i < index; i++) {
-        data.expressionSet.setVariable(data.particleValueIndex[i*2], values[i][atom1]);
-        data.expressionSet.setVariable(data.particleValueIndex[i*2+1], values[i][atom2]);
+void CpuCustomGBForce::findBlockPairs(int blockIndex, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize) {
+    // Load the positions of the atoms in the block.
+
+    const int* blockAtom = &neighborList->getSortedAtoms()[4*blockIndex];
+    fvec4 blockAtomX(posq+4*blockAtom[0]);
+    fvec4 blockAtomY(posq+4*blockAtom[1]);
+    fvec4 blockAtomZ(posq+4*blockAtom[2]);
+    fvec4 blockAtomW(posq+4*blockAtom[3]);
+    transpose(blockAtomX, blockAtomY, blockAtomZ, blockAtomW);
+
+    // Compute the distances to all the neighbors four at a time, and record the ones inside the cutoff.
+
+    const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
+    const vector<short>& blockExclusions = neighborList->getBlockExclusions(blockIndex);
+    for (int i = 0; i < (int) neighbors.size(); i++) {
+        int atom = neighbors[i];
+        fvec4 dx, dy, dz, r2;
+        getDeltaR(fvec4(posq+4*atom), blockAtomX, blockAtomY, blockAtomZ, dx, dy, dz, r2, boxSize, invBoxSize);
+        float r2Array[4];
+        r2.store(r2Array);
+        short excl = blockExclusions[i];
+        fvec4 r = sqrt(r2);
+        transpose(dx, dy, dz, r);
+        fvec4 delta[4] = {dx, dy, dz, r};
+        for (int k = 0; k < 4; k++) {
+            if ((excl & (1<<k)) == 0 && r2Array[k] < cutoffDistance2) {
+                data.pairAtom1.push_back(atom);
+                data.pairAtom2.push_back(blockAtom[k]);
+                data.pairExcluded.push_back(false);
+                int index = data.pairDelta.size();
+                data.pairDelta.resize(index+4);
+                delta[k].store(&data.pairDelta[index]);
+            }
+        }
     }
-    valueArray[atom1] += (float) data.valueExpressions[index].evaluate();
 }
 
-void CpuCustomGBForce::calculateSingleParticleEnergyTerm(int index, ThreadData& data, int numAtoms, float* posq,
-        RealOpenMM** atomParameters, float* forces, double& totalEnergy) {
-    for (int i = data.firstAtom; i < data.lastAtom; i++) {
-        data.expressionSet.setVariable(data.xindex, posq[4*i]);
-        data.expressionSet.setVariable(data.yindex, posq[4*i+1]);
-        data.expressionSet.setVariable(data.zindex, posq[4*i+2]);
-        for (int j = 0; j < (int) paramNames.size(); j++)
-            data.expressionSet.setVariable(data.paramIndex[j], atomParameters[i][j]);
-        for (int j = 0; j < (int) valueNames.size(); j++)
-            data.expressionSet.setVariable(data.valueIndex[j], values[j][i]);
-        if (includeEnergy)
-            totalEnergy += (float) data.energyExpressions[index].evaluate();
-        for (int j = 0; j < (int) valueNames.size(); j++)
-            data.dEdV[j][i] += (float) data.energyDerivExpressions[index][j].evaluate();
-        forces[4*i+0] -= (float) data.energyGradientExpressions[index][0].evaluate();
-        forces[4*i+1] -= (float) data.energyGradientExpressions[index][1].evaluate();
-        forces[4*i+2] -= (float) data.energyGradientExpressions[index][2].evaluate();
+void CpuCustomGBForce::findRowPairs(int atom, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize) {
+    fvec4 posI(posq+4*atom);
+    for (int first = atom+1; first < numberOfAtoms; first += 4) {
+        // Load the positions of the next four atoms, padding past the end of the list.
+
+        int count = min(4, numberOfAtoms-first);
+        fvec4 x(posq+4*first);
+        fvec4 y = (count > 1 ? fvec4(posq+4*first+4) : posI);
+        fvec4 z = (count > 2 ? fvec4(posq+4*first+8) : posI);
+        fvec4 w = (count > 3 ? fvec4(posq+4*first+12) : posI);
+        transpose(x, y, z, w);
+        fvec4 dx, dy, dz, r2;
+        getDeltaR(posI, x, y, z, dx, dy, dz, r2, boxSize, invBoxSize);
+        fvec4 r = sqrt(r2);
+        transpose(dx, dy, dz, r);
+        fvec4 delta[4] = {dx, dy, dz, r};
+        for (int k = 0; k < count; k++) {
+            data.pairAtom1.push_back(atom);
+            data.pairAtom2.push_back(first+k);
+            data.pairExcluded.push_back(exclusions.isExcluded(atom, first+k));
+            int index = data.pairDelta.size();
+            data.pairDelta.resize(index+4);
+            delta[k].store(&data.pairDelta[index]);
+        }
     }
 }
 
-void CpuCustomGBForce::calculateParticlePairEnergyTerm(int index, ThreadData& data, int numAtoms, float* posq, RealOpenMM** atomParameters,
-        bool useExclusions, float* forces, double& totalEnergy, const fvec4& boxSize, const fvec4& invBoxSize) {
-    if (cutoff) {
-        // Loop over all pairs in the neighbor list.
-
-        while (true) {
-            int blockIndex = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 1);
-            if (blockIndex >= neighborList->getNumBlocks())
-                break;
-            const int* blockAtom = &neighborList->getSortedAtoms()[4*blockIndex];
-            const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
-            const vector<char>& blockExclusions = neighborList->getBlockExclusions(blockIndex);
-            for (int i = 0; i < (int) neighbors.size(); i++) {
-                int first = neighbors[i];
-                for (int k = 0; k < 4; k++) {
-                    if ((blockExclusions[i] & (1<<k)) == 0) {
-                        int second = blockAtom[k];
-                        if (useExclusions && exclusions[first].find(second) != exclusions[first].end())
-                            continue;
-                        calculateOnePairEnergyTerm(index, first, second, data, posq, atomParameters, forces, totalEnergy, boxSize, invBoxSize);
-                    }
-                }
-            }
+void CpuCustomGBForce::calculatePairValues(ThreadData& data, int start, bool includeValue, bool includeDeriv) {
+    int numPairs = data.pairAtom1.size();
+    if (includeDeriv)
+        data.pairValueDeriv.resize(2*numPairs);
+    bool useExclusions = (valueTypes[0] == CustomGBForce::ParticlePair);
+    Lepton::CompiledExpression& expression = (includeDeriv ? data.valueDerivExpressions[0] : data.valueExpressions[0]);
+    int lastAtom1 = -1;
+    for (int pair = start; pair < numPairs; pair++) {
+        if (useExclusions && data.pairExcluded[pair])
+            continue;
+        int atom1 = data.pairAtom1[pair];
+        int atom2 = data.pairAtom2[pair];
+        if (atom1 != lastAtom1) {
+            for (int i = 0; i < (int) paramNames.size(); i++)
+                data.expressionSet.setVariable(data.particleParamIndex[i*2], atomParameters[atom1][i]);
+            lastAtom1 = atom1;
         }
-    }
-    else {
-        // Perform an O(N^2) loop over all atom pairs.
-
-        while (true) {
-            int i = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 1);
-            if (i >= numAtoms)
-                break;
-            for (int j = i+1; j < numAtoms; j++) {
-                if (useExclusions && exclusions[i].find(j) != exclusions[i].end())
-                    continue;
-                calculateOnePairEnergyTerm(index, i, j, data, posq, atomParameters, forces, totalEnergy, boxSize, invBoxSize);
-           }
+        for (int i = 0; i < (int) paramNames.size(); i++)
+            data.expressionSet.setVariable(data.particleParamIndex[i*2+1], atomParameters[atom2][i]);
+        data.expressionSet.setVariable(data.rindex, data.pairDelta[4*pair+3]);
+        expression.evaluate();
+        if (includeValue) {
+            data.value0[atom1] += (float) expression.getOutput(0);
+            data.value0[atom2] += (float) expression.getOutput(1);
+        }
+        if (includeDeriv) {
+            data.pairValueDeriv[2*pair] = (float) expression.getOutput(2);
+            data.pairValueDeriv[2*pair+1] = (float) expression.getOutput(3);
         }
     }
 }
 
-void CpuCustomGBForce::calculateOnePairEnergyTerm(int index, int atom1, int atom2, ThreadData& data, float* posq, RealOpenMM** atomParameters,
-        float* forces, double& totalEnergy, const fvec4& boxSize, const fvec4& invBoxSize) {
-    // Compute the displacement.
-
-    fvec4 deltaR;
-    fvec4 pos1(posq+4*atom1);
-    fvec4 pos2(posq+4*atom2);
-    float r2;
-    getDeltaR(pos2, pos1, deltaR, r2, periodic, boxSize, invBoxSize);
-    if (cutoff && r2 >= cutoffDistance2)
-        return;
-    float r = sqrtf(r2);
-
-    // Record variables for evaluating expressions.
-
-    for (int i = 0; i < (int) paramNames.size(); i++) {
-        data.expressionSet.setVariable(data.particleParamIndex[i*2], atomParameters[atom1][i]);
-        data.expressionSet.setVariable(data.particleParamIndex[i*2+1], atomParameters[atom2][i]);
-    }
-    data.expressionSet.setVariable(data.rindex, r);
-    for (int i = 0; i < (int) valueNames.size(); i++) {
-        data.expressionSet.setVariable(data.particleValueIndex[i*2], values[i][atom1]);
-        data.expressionSet.setVariable(data.particleValueIndex[i*2+1], values[i][atom2]);
-    }
-
-    // Evaluate the energy and its derivatives.
-
-    if (includeEnergy)
-        totalEnergy += (float) data.energyExpressions[index].evaluate();
-    float dEdR = (float) data.energyDerivExpressions[index][0].evaluate();
-    dEdR *= 1/r;
-    fvec4 result = deltaR*dEdR;
-    (fvec4(forces+4*atom1)-result).store(forces+4*atom1);
-    (fvec4(forces+4*atom2)+result).store(forces+4*atom2);
-    for (int i = 0; i < (int) valueNames.size(); i++) {
-        data.dEdV[i][atom1] += (float) data.energyDerivExpressions[index][2*i+1].evaluate();
-        data.dEdV[i][atom2] += (float) data.energyDerivExpressions[index][2*i+2].evaluate();
+void CpuCustomGBForce::calculateSingleParticleEnergyTerms(ThreadData& data, float* forces, double& totalEnergy) {
+    int numValues = valueNames.size();
+    for (int termIndex = 0; termIndex < (int) data.energyExpressions.size(); termIndex++) {
+        if (energyTypes[termIndex] != CustomGBForce::SingleParticle)
+            continue;
+        Lepton::CompiledExpression& expression = data.energyExpressions[termIndex];
+        for (int i = data.firstAtom; i < data.lastAtom; i++) {
+            data.expressionSet.setVariable(data.xindex, posq[4*i]);
+            data.expressionSet.setVariable(data.yindex, posq[4*i+1]);
+            data.expressionSet.setVariable(data.zindex, posq[4*i+2]);
+            for (int j = 0; j < (int) paramNames.size(); j++)
+                data.expressionSet.setVariable(data.paramIndex[j], atomParameters[i][j]);
+            for (int j = 0; j < numValues; j++)
+                data.expressionSet.setVariable(data.valueIndex[j], values[j][i]);
+            expression.evaluate();
+            if (includeEnergy)
+                totalEnergy += (float) expression.getOutput(0);
+            for (int j = 0; j < numValues; j++)
+                data.dEdV[j][i] += (float) expression.getOutput(j+1);
+            forces[4*i+0] -= (float) expression.getOutput(numValues+1);
+            forces[4*i+1] -= (float) expression.getOutput(numValues+2);
+            forces[4*i+2] -= (float) expression.getOutput(numValues+3);
+        }
     }
 }
 
-void CpuCustomGBForce::calculateChainRuleForces(ThreadData& data, int numAtoms, float* posq, RealOpenMM** atomParameters,
-        float* forces, const fvec4& boxSize, const fvec4& invBoxSize) {
-    if (cutoff) {
-        // Loop over all pairs in the neighbor list.
-
-        while (true) {
-            int blockIndex = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 1);
-            if (blockIndex >= neighborList->getNumBlocks())
-                break;
-            const int* blockAtom = &neighborList->getSortedAtoms()[4*blockIndex];
-            const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
-            const vector<char>& blockExclusions = neighborList->getBlockExclusions(blockIndex);
-            for (int i = 0; i < (int) neighbors.size(); i++) {
-                int first = neighbors[i];
-                for (int k = 0; k < 4; k++) {
-                    if ((blockExclusions[i] & (1<<k)) == 0) {
-                        int second = blockAtom[k];
-                        bool isExcluded = (exclusions[first].find(second) != exclusions[first].end());
-                        calculateOnePairChainRule(first, second, data, posq, atomParameters, forces, isExcluded, boxSize, invBoxSize);
-                        calculateOnePairChainRule(second, first, data, posq, atomParameters, forces, isExcluded, boxSize, invBoxSize);
-                    }
-                }
+void CpuCustomGBForce::calculateParticlePairEnergyTerms(ThreadData& data, float* forces, double& totalEnergy) {
+    int numPairs = data.pairAtom1.size();
+    int numValues = valueNames.size();
+    int numTerms = data.energyExpressions.size();
+    int lastAtom1 = -1;
+    for (int pair = 0; pair < numPairs; pair++) {
+        int atom1 = data.pairAtom1[pair];
+        int atom2 = data.pairAtom2[pair];
+
+        // Record variables for evaluating expressions.
+
+        if (atom1 != lastAtom1) {
+            for (int i = 0; i < (int) paramNames.size(); i++)
+                data.expressionSet.setVariable(data.particleParamIndex[i*2], atomParameters[atom1][i]);
+            for (int i = 0; i < numValues; i++)
+                data.expressionSet.setVariable(data.particleValueIndex[i*2], values[i][atom1]);
+            lastAtom1 = atom1;
+        }
+        for (int i = 0; i < (int) paramNames.size(); i++)
+            data.expressionSet.setVariable(data.particleParamIndex[i*2+1], atomParameters[atom2][i]);
+        for (int i = 0; i < numValues; i++)
+            data.expressionSet.setVariable(data.particleValueIndex[i*2+1], values[i][atom2]);
+        fvec4 delta(&data.pairDelta[4*pair]);
+        float r = delta[3];
+        data.expressionSet.setVariable(data.rindex, r);
+
+        // Evaluate the energy and its derivatives.
+
+        float dEdR = 0.0f;
+        for (int termIndex = 0; termIndex < numTerms; termIndex++) {
+            if (energyTypes[termIndex] == CustomGBForce::SingleParticle)
+                continue;
+            if (energyTypes[termIndex] == CustomGBForce::ParticlePair && data.pairExcluded[pair])
+                continue;
+            Lepton::CompiledExpression& expression = data.energyExpressions[termIndex];
+            expression.evaluate();
+            if (includeEnergy)
+                totalEnergy += (float) expression.getOutput(0);
+            dEdR += (float) expression.getOutput(1);
+            for (int i = 0; i < numValues; i++) {
+                data.dEdV[i][atom1] += (float) expression.getOutput(2*i+2);
+                data.dEdV[i][atom2] += (float) expression.getOutput(2*i+3);
             }
         }
+        float scale = dEdR/r;
+        fvec4 result = delta*fvec4(scale, scale, scale, 0.0f);
+        (fvec4(forces+4*atom1)+result).store(forces+4*atom1);
+        (fvec4(forces+4*atom2)-result).store(forces+4*atom2);
     }
-    else {
-        // Perform an O(N^2) loop over all atom pairs.
+}
 
-        while (true) {
-            int i = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 1);
-            if (i >= numAtoms)
-                break;
-            for (int j = i+1; j < numAtoms; j++) {
-                bool isExcluded = (exclusions[i].find(j) != exclusions[i].end());
-                calculateOnePairChainRule(i, j, data, posq, atomParameters, forces, isExcluded, boxSize, invBoxSize);
-                calculateOnePairChainRule(j, i, data, posq, atomParameters, forces, isExcluded, boxSize, invBoxSize);
-           }
+void CpuCustomGBForce::calculateChainRuleFactors(ThreadData& data, float* forces) {
+    int numValues = valueNames.size();
+    for (int atom = data.firstAtom; atom < data.lastAtom; atom++) {
+        for (int i = 0; i < numValues; i++) {
+            float sum = 0.0f;
+            for (int j = 0; j < (int) threadData.size(); j++)
+                sum += threadData[j]->dEdV[i][atom];
+            dEdV[i][atom] = sum;
         }
-    }
+        if (numValues == 0)
+            continue;
 
-    // Compute chain rule terms for computed values that depend explicitly on particle coordinates.
+        // coeff[i] is the total derivative of value i with respect to the first value.  The forces
+        // from values that depend explicitly on particle coordinates are applied directly.
 
-    for (int i = data.firstAtom; i < data.lastAtom; i++) {
-        data.expressionSet.setVariable(data.xindex, posq[4*i]);
-        data.expressionSet.setVariable(data.yindex, posq[4*i+1]);
-        data.expressionSet.setVariable(data.zindex, posq[4*i+2]);
+        data.expressionSet.setVariable(data.xindex, posq[4*atom]);
+        data.expressionSet.setVariable(data.yindex, posq[4*atom+1]);
+        data.expressionSet.setVariable(data.zindex, posq[4*atom+2]);
         for (int j = 0; j < (int) paramNames.size(); j++)
-            data.expressionSet.setVariable(data.paramIndex[j], atomParameters[i][j]);
-        for (int j = 1; j < (int) valueNames.size(); j++) {
-            data.expressionSet.setVariable(data.valueIndex[j-1], values[j-1][i]);
-            data.dVdX[j] = 0.0;
-            data.dVdY[j] = 0.0;
-            data.dVdZ[j] = 0.0;
-            for (int k = 1; k < j; k++) {
-                float dVdV = (float) data.valueDerivExpressions[j][k].evaluate();
-                data.dVdX[j] += dVdV*data.dVdX[k];
-                data.dVdY[j] += dVdV*data.dVdY[k];
-                data.dVdZ[j] += dVdV*data.dVdZ[k];
+            data.expressionSet.setVariable(data.paramIndex[j], atomParameters[atom][j]);
+        for (int j = 0; j < numValues-1; j++)
+            data.expressionSet.setVariable(data.valueIndex[j], values[j][atom]);
+        data.coeff[0] = 1.0f;
+        data.dVdX[0] = 0.0f;
+        data.dVdY[0] = 0.0f;
+        data.dVdZ[0] = 0.0f;
+        float factor = dEdV[0][atom];
+        for (int i = 1; i < numValues; i++) {
+            Lepton::CompiledExpression& expression = data.valueDerivExpressions[i];
+            expression.evaluate();
+            data.coeff[i] = 0.0f;
+            data.dVdX[i] = (float) expression.getOutput(i);
+            data.dVdY[i] = (float) expression.getOutput(i+1);
+            data.dVdZ[i] = (float) expression.getOutput(i+2);
+            for (int j = 0; j < i; j++) {
+                float dVdV = (float) expression.getOutput(j);
+                data.coeff[i] += dVdV*data.coeff[j];
+                data.dVdX[i] += dVdV*data.dVdX[j];
+                data.dVdY[i] += dVdV*data.dVdY[j];
+                data.dVdZ[i] += dVdV*data.dVdZ[j];
             }
-            data.dVdX[j] += (float) data.valueGradientExpressions[j][0].evaluate();
-            data.dVdY[j] += (float) data.valueGradientExpressions[j][1].evaluate();
-            data.dVdZ[j] += (float) data.valueGradientExpressions[j][2].evaluate();
-            forces[4*i+0] -= dEdV[j][i]*data.dVdX[j];
-            forces[4*i+1] -= dEdV[j][i]*data.dVdY[j];
-            forces[4*i+2] -= dEdV[j][i]*data.dVdZ[j];
+            forces[4*atom+0] -= dEdV[i][atom]*data.dVdX[i];
+            forces[4*atom+1] -= dEdV[i][atom]*data.dVdY[i];
+            forces[4*atom+2] -= dEdV[i][atom]*data.dVdZ[i];
+            factor += dEdV[i][atom]*data.coeff[i];
         }
+        chainFactor[atom] = factor;
     }
 }
 
-void CpuCustomGBForce::calculateOnePairChainRule(int atom1, int atom2, ThreadData& data, float* posq, RealOpenMM** atomParameters,
-        float* forces, bool isExcluded, const fvec4& boxSize, const fvec4& invBoxSize) {
-    // Compute the displacement.
-
-    fvec4 deltaR;
-    fvec4 pos1(posq+4*atom1);
-    fvec4 pos2(posq+4*atom2);
-    float r2;
-    getDeltaR(pos2, pos1, deltaR, r2, periodic, boxSize, invBoxSize);
-    if (cutoff && r2 >= cutoffDistance2)
-        return;
-    float r = sqrtf(r2);
-
-    // Record variables for evaluating expressions.
-
-    for (int i = 0; i < (int) paramNames.size(); i++) {
-        data.expressionSet.setVariable(data.particleParamIndex[i*2], atomParameters[atom1][i]);
-        data.expressionSet.setVariable(data.particleParamIndex[i*2+1], atomParameters[atom2][i]);
-        data.expressionSet.setVariable(data.paramIndex[i], atomParameters[atom1][i]);
-    }
-    data.expressionSet.setVariable(data.valueIndex[0], values[0][atom1]);
-    data.expressionSet.setVariable(data.xindex, posq[4*atom1]);
-    data.expressionSet.setVariable(data.yindex, posq[4*atom1+1]);
-    data.expressionSet.setVariable(data.zindex, posq[4*atom1+2]);
-    data.expressionSet.setVariable(data.rindex, r);
-    data.expressionSet.setVariable(data.particleValueIndex[0], values[0][atom1]);
-    data.expressionSet.setVariable(data.particleValueIndex[1], values[0][atom2]);
-
-    // Evaluate the derivative of each parameter with respect to position and apply forces.
-
-    float rinv = 1/r;
-    deltaR *= rinv;
-    fvec4 f1(0.0f), f2(0.0f);
-    if (!isExcluded || valueTypes[0] != CustomGBForce::ParticlePair) {
-        data.dVdR1[0] = (float) data.valueDerivExpressions[0][0].evaluate();
-        data.dVdR2[0] = -data.dVdR1[0];
-        f1 -= deltaR*(dEdV[0][atom1]*data.dVdR1[0]);
-        f2 -= deltaR*(dEdV[0][atom1]*data.dVdR2[0]);
-    }
-    for (int i = 1; i < (int) valueNames.size(); i++) {
-        data.expressionSet.setVariable(data.valueIndex[i], values[i][atom1]);
-        data.dVdR1[i] = 0.0;
-        data.dVdR2[i] = 0.0;
-        for (int j = 0; j < i; j++) {
-            float dVdV = (float) data.valueDerivExpressions[i][j].evaluate();
-            data.dVdR1[i] += dVdV*data.dVdR1[j];
-            data.dVdR2[i] += dVdV*data.dVdR2[j];
-        }
-        f1 -= deltaR*(dEdV[i][atom1]*data.dVdR1[i]);
-        f2 -= deltaR*(dEdV[i][atom1]*data.dVdR2[i]);
+void CpuCustomGBForce::calculateChainRuleForces(ThreadData& data, float* forces) {
+    int numPairs = data.pairAtom1.size();
+    bool useExclusions = (valueTypes[0] == CustomGBForce::ParticlePair);
+    for (int pair = 0; pair < numPairs; pair++) {
+        if (useExclusions && data.pairExcluded[pair])
+            continue;
+        int atom1 = data.pairAtom1[pair];
+        int atom2 = data.pairAtom2[pair];
+        fvec4 delta(&data.pairDelta[4*pair]);
+        float dEdR = chainFactor[atom1]*data.pairValueDeriv[2*pair] + chainFactor[atom2]*data.pairValueDeriv[2*pair+1];
+        float scale = dEdR/delta[3];
+        fvec4 result = delta*fvec4(scale, scale, scale, 0.0f);
+        (fvec4(forces+4*atom1)+result).store(forces+4*atom1);
+        (fvec4(forces+4*atom2)-result).store(forces+4*atom2);
     }
-    (fvec4(forces+4*atom1)+f1).store(forces+4*atom1);
-    (fvec4(forces+4*atom2)+f2).store(forces+4*atom2);
 }
 
-void CpuCustomGBForce::getDeltaR(const fvec4& posI, const fvec4& posJ, fvec4& deltaR, float& r2, bool periodic, const fvec4& boxSize, const fvec4& invBoxSize) const {
-    deltaR = posJ-posI;
+void CpuCustomGBForce::getDeltaR(const fvec4& posI, const fvec4& x, const fvec4& y, const fvec4& z, fvec4& dx, fvec4& dy, fvec4& dz, fvec4& r2,
+        const fvec4& boxSize, const fvec4& invBoxSize) const {
+    dx = x-posI[0];
+    dy = y-posI[1];
+    dz = z-posI[2];
     if (periodic) {
-        fvec4 base = round(deltaR*invBoxSize)*boxSize;
-        deltaR = deltaR-base;
+        dx -= round(dx*invBoxSize[0])*boxSize[0];
+        dy -= round(dy*invBoxSize[1])*boxSize[1];
+        dz -= round(dz*invBoxSize[2])*boxSize[2];
     }
-    r2 = dot3(deltaR, deltaR);
+    r2 = dx*dx + dy*dy + dz*dz;
 }
@@ -48,7 +48,7 @@ public:
 };
 
 CpuCustomManyParticleForce::CpuCustomManyParticleForce(const CustomManyParticleForce& force, ThreadPool& threads) :
-            threads(threads), useCutoff(false), usePeriodic(false), neighborList(NULL) {
+            threads(threads), useCutoff(false), usePeriodic(false) {
     numParticles = force.getNumParticles();
     numParticlesPerSet = force.getNumParticlesPerSet();
     numPerParticleParameters = force.getNumPerParticleParameters();
@@ -78,22 +78,40 @@ CpuCustomManyParticleForce::CpuCustomManyParticleForce(const CustomManyParticleF
     
     // Record exclusions.
     
-    exclusions.resize(force.getNumParticles());
+    vector<pair<int, int> > excludedPairs;
     for (int i = 0; i < (int) force.getNumExclusions(); i++) {
         int p1, p2;
         force.getExclusionParticles(i, p1, p2);
-        exclusions[p1].insert(p2);
-        exclusions[p2].insert(p1);
+        excludedPairs.push_back(make_pair(p1, p2));
     }
+    exclusions = CpuExclusionList(force.getNumParticles(), excludedPairs);
     
     // Record information about type filters.
     
     CustomManyParticleForceImpl::buildFilterArrays(force, numTypes, particleTypes, orderIndex, particleOrder);
+    
+    // Record which partial sets of types can lead to an allowed set, so the search can stop early.
+    
+    if (particleOrder.size() > 1) {
+        allowedTypePrefix.resize(numParticlesPerSet);
+        int size = 1;
+        for (int i = 0; i < numParticlesPerSet; i++) {
+            size *= numTypes;
+            allowedTypePrefix[i].resize(size, false);
+        }
+        for (int index = 0; index < (int) orderIndex.size(); index++) {
+            if (orderIndex[index] == -1)
+                continue;
+            int scale = 1;
+            for (int i = 0; i < numParticlesPerSet; i++) {
+                scale *= numTypes;
+                allowedTypePrefix[i][index%scale] = true;
+            }
+        }
+    }
 }
 
 CpuCustomManyParticleForce::~CpuCustomManyParticleForce() {
-    if (neighborList != NULL)
-        delete neighborList;
     for (int i = 0; i < (int) threadData.size(); i++)
         delete threadData[i];
 }
@@ -112,38 +130,20 @@ void CpuCustomManyParticleForce::calculateIxn(AlignedArray<float>& posq, RealOpe
     gmx_atomic_t counter;
     gmx_atomic_set(&counter, 0);
     this->atomicCounter = &counter;
-    if (useCutoff) {
-        // Construct a neighbor list.  We use CpuNeighborList to do this, but then copy the result
-        // into a new data structure.  This is needed because in UniqueCentralParticle mode, the
-        // the neighbor list needs to include symmetric pairs.
-        
-        particleNeighbors.resize(numParticles);
-        for (int i = 0; i < numParticles; i++)
-            particleNeighbors[i].clear();
-        neighborList->computeNeighborList(numParticles, posq, exclusions, periodicBoxVectors, usePeriodic, cutoffDistance, threads);
-        for (int blockIndex = 0; blockIndex < neighborList->getNumBlocks(); blockIndex++) {
-            const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
-            const vector<char>& exclusions = neighborList->getBlockExclusions(blockIndex);
-            int numNeighbors = neighbors.size();
-            for (int i = 0; i < 4; i++) {
-                int p1 = neighborList->getSortedAtoms()[4*blockIndex+i];
-                for (int j = 0; j < numNeighbors; j++) {
-                    if ((exclusions[j] & (1<<i)) == 0) {
-                        int p2 = neighbors[j];
-                        particleNeighbors[p1].push_back(p2);
-                        if (centralParticleMode)
-                            particleNeighbors[p2].push_back(p1);
-                    }
-                }
-            }
-        }
-    }
+    if (useCutoff)
+        buildCellList();
     
-    // Signal the threads to start running and wait for them to finish.
+    // Signal the threads to start running and wait for them to finish.  With a cutoff, they first
+    // build the neighbor lists, then compute interactions.
     
     ComputeForceTask task(*this);
     threads.execute(task);
     threads.waitForThreads();
+    if (useCutoff) {
+        gmx_atomic_set(&counter, 0);
+        threads.resumeThreads();
+        threads.waitForThreads();
+    }
     
     // Combine the energies from all the threads.
     
@@ -163,15 +163,31 @@ void CpuCustomManyParticleForce::threadComputeForce(ThreadPool& threads, int thr
     data.energy = 0;
     for (map<string, double>::const_iterator iter = globalParameters->begin(); iter != globalParameters->end(); ++iter)
         data.expressionSet.setVariable(data.expressionSet.getVariableIndex(iter->first), iter->second);
+    gmx_atomic_t* counter = reinterpret_cast<gmx_atomic_t*>(atomicCounter);
+    bool useFilters = (allowedTypePrefix.size() > 0);
     if (useCutoff) {
+        // Build the neighbor lists.
+        
+        while (true) {
+            int i = gmx_atomic_fetch_add(counter, 1);
+            if (i >= numParticles)
+                break;
+            findNeighbors(i, boxSize, invBoxSize);
+        }
+        threads.syncThreads();
+
         // Loop over interactions from the neighbor list.
         
         while (true) {
-            int i = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 1);
+            int i = gmx_atomic_fetch_add(counter, 1);
             if (i >= numParticles)
                 break;
+            if (useFilters && !allowedTypePrefix[0][particleTypes[i]])
+                continue;
             particleIndices[0] = i;
-            loopOverInteractions(particleNeighbors[i], particleIndices, 1, 0, particleParameters, forces, data, boxSize, invBoxSize);
+            data.interactions.clear();
+            loopOverInteractions(particleNeighbors[i], particleIndices, 1, 0, particleTypes[i], numTypes, data, boxSize, invBoxSize);
+            calculateIxns(particleParameters, forces, data, boxSize, invBoxSize);
         }
     }
     else {
@@ -181,21 +197,142 @@ void CpuCustomManyParticleForce::threadComputeForce(ThreadPool& threads, int thr
         for (int i = 0; i < numParticles; i++)
             particles[i] = i;
         while (true) {
-            int i = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 1);
+            int i = gmx_atomic_fetch_add(counter, 1);
             if (i >= numParticles)
                 break;
+            if (useFilters && !allowedTypePrefix[0][particleTypes[i]])
+                continue;
             particleIndices[0] = i;
             int startIndex = (centralParticleMode ? 0 : i+1);
-            loopOverInteractions(particles, particleIndices, 1, startIndex, particleParameters, forces, data, boxSize, invBoxSize);
+            data.interactions.clear();
+            loopOverInteractions(particles, particleIndices, 1, startIndex, particleTypes[i], numTypes, data, boxSize, invBoxSize);
+            calculateIxns(particleParameters, forces, data, boxSize, invBoxSize);
+        }
+    }
+}
+
+void CpuCustomManyParticleForce::buildCellList() {
+    // Compute the fractional coordinates of every particle within the region to divide into cells,
+    // and the perpendicular width of that region along each axis.
+
+    vector<float> fractional(3*numParticles);
+    double width[3];
+    if (usePeriodic) {
+        const RealVec* box = periodicBoxVectors;
+        double volume = box[0][0]*box[1][1]*box[2][2];
+        width[0] = volume/sqrt(box[1].cross(box[2]).dot(box[1].cross(box[2])));
+        width[1] = volume/sqrt(box[2].cross(box[0]).dot(box[2].cross(box[0])));
+        width[2] = volume/sqrt(box[0].cross(box[1]).dot(box[0].cross(box[1])));
+        for (int i = 0; i < numParticles; i++) {
+            double s2 = posq[4*i+2]/box[2][2];
+            double s1 = (posq[4*i+1]-s2*box[2][1])/box[1][1];
+            double s0 = (posq[4*i]-s2*box[2][0]-s1*box[1][0])/box[0][0];
+            fractional[3*i] = (float) (s0-floor(s0));
+            fractional[3*i+1] = (float) (s1-floor(s1));
+            fractional[3*i+2] = (float) (s2-floor(s2));
+        }
+    }
+    else {
+        float minPos[3], maxPos[3];
+        for (int j = 0; j < 3; j++)
+            minPos[j] = maxPos[j] = (numParticles > 0 ? posq[j] : 0.0f);
+        for (int i = 1; i < numParticles; i++)
+            for (int j = 0; j < 3; j++) {
+                minPos[j] = min(minPos[j], posq[4*i+j]);
+                maxPos[j] = max(maxPos[j], posq[4*i+j]);
+            }
+        for (int j = 0; j < 3; j++) {
+            width[j] = maxPos[j]-minPos[j];
+            float scale = (width[j] > 0 ? (float) (1/width[j]) : 0.0f);
+            for (int i = 0; i < numParticles; i++)
+                fractional[3*i+j] = (posq[4*i+j]-minPos[j])*scale;
         }
     }
+    
+    // Every cell must be at least as wide as the cutoff, so that interacting particles are always in
+    // adjacent cells.  Limit the total number of cells for very sparse systems.
+    
+    for (int j = 0; j < 3; j++)
+        numCells[j] = max(1, (int) floor(width[j]/cutoffDistance));
+    while (numCells[0]*(long long) numCells[1]*numCells[2] > 2*numParticles+8) {
+        int largest = (numCells[0] > numCells[1] ? 0 : 1);
+        if (numCells[2] > numCells[largest])
+            largest = 2;
+        numCells[largest] = (numCells[largest]+1)/2;
+    }
+    
+    // Sort the particles by cell.
+    
+    int totalCells = numCells[0]*numCells[1]*numCells[2];
+    particleCell.resize(numParticles);
+    cellStart.resize(totalCells+1);
+    for (int i = 0; i <= totalCells; i++)
+        cellStart[i] = 0;
+    for (int i = 0; i < numParticles; i++) {
+        int cell[3];
+        for (int j = 0; j < 3; j++)
+            cell[j] = min(numCells[j]-1, max(0, (int) (fractional[3*i+j]*numCells[j])));
+        particleCell[i] = (cell[0]*numCells[1]+cell[1])*numCells[2]+cell[2];
+        cellStart[particleCell[i]+1]++;
+    }
+    for (int i = 0; i < totalCells; i++)
+        cellStart[i+1] += cellStart[i];
+    vector<int> cellEnd(cellStart.begin(), cellStart.end()-1);
+    cellParticles.resize(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        cellParticles[cellEnd[particleCell[i]]++] = i;
+    particleNeighbors.resize(numParticles);
+}
+
+void CpuCustomManyParticleForce::findNeighbors(int particle, const fvec4& boxSize, const fvec4& invBoxSize) {
+    // Find the distinct cells adjacent to this one along each axis.
+    
+    int cell = particleCell[particle];
+    int cellIndex[3] = {cell/(numCells[1]*numCells[2]), (cell/numCells[2])%numCells[1], cell%numCells[2]};
+    int neighborCells[3][3];
+    int numNeighborCells[3];
+    for (int j = 0; j < 3; j++) {
+        numNeighborCells[j] = 0;
+        for (int offset = -1; offset <= 1; offset++) {
+            int c = cellIndex[j]+offset;
+            if (usePeriodic)
+                c = (c+numCells[j])%numCells[j];
+            else if (c < 0 || c >= numCells[j])
+                continue;
+            bool found = false;
+            for (int k = 0; k < numNeighborCells[j]; k++)
+                found |= (neighborCells[j][k] == c);
+            if (!found)
+                neighborCells[j][numNeighborCells[j]++] = c;
+        }
+    }
+    
+    // Check every particle in those cells.
+    
+    vector<int>& neighbors = particleNeighbors[particle];
+    neighbors.clear();
+    float cutoff2 = (float) (cutoffDistance*cutoffDistance);
+    fvec4 pos(posq+4*particle);
+    for (int i = 0; i < numNeighborCells[0]; i++)
+        for (int j = 0; j < numNeighborCells[1]; j++)
+            for (int k = 0; k < numNeighborCells[2]; k++) {
+                int neighborCell = (neighborCells[0][i]*numCells[1]+neighborCells[1][j])*numCells[2]+neighborCells[2][k];
+                for (int m = cellStart[neighborCell]; m < cellStart[neighborCell+1]; m++) {
+                    int other = cellParticles[m];
+                    if (centralParticleMode ? other == particle : other <= particle)
+                        continue;
+                    fvec4 deltaR;
+                    float r2;
+                    computeDelta(pos, fvec4(posq+4*other), deltaR, r2, boxSize, invBoxSize);
+                    if (r2 < cutoff2 && !exclusions.isExcluded(particle, other))
+                        neighbors.push_back(other);
+                }
+            }
 }
 
 void CpuCustomManyParticleForce::setUseCutoff(RealOpenMM distance) {
     useCutoff = true;
     cutoffDistance = distance;
-    if (neighborList == NULL)
-        neighborList = new CpuNeighborList(4);
 }
 
 void CpuCustomManyParticleForce::setPeriodic(RealVec* periodicBoxVectors) {
@@ -219,13 +356,28 @@ void CpuCustomManyParticleForce::setPeriodic(RealVec* periodicBoxVectors) {
                  periodicBoxVectors[2][0] != 0.0 || periodicBoxVectors[2][1] != 0.0);
 }
 
-void CpuCustomManyParticleForce::loopOverInteractions(vector<int>& availableParticles, vector<int>& particleSet, int loopIndex, int startIndex,
-                                                          RealOpenMM** particleParameters, float* forces, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize) {
-    int numParticles = availableParticles.size();
-    double cutoff2 = cutoffDistance*cutoffDistance;
+void CpuCustomManyParticleForce::loopOverInteractions(const vector<int>& availableParticles, vector<int>& particleSet, int loopIndex, int startIndex,
+                                                          int typeCode, int typeScale, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize) {
+    int numAvailable = availableParticles.size();
+    float cutoff2 = (float) (cutoffDistance*cutoffDistance);
+    bool useFilters = (allowedTypePrefix.size() > 0);
+    const char* allowedTypes = (useFilters ? &allowedTypePrefix[loopIndex][0] : NULL);
+
+    // With a cutoff, the available particles all come from the neighbor list of the first particle, so
+    // they are already known to be within the cutoff of it and not excluded from it.
+
+    int firstCheck = (useCutoff ? 1 : 0);
     int checkRange = (centralParticleMode ? 1 : loopIndex);
-    for (int i = startIndex; i < numParticles; i++) {
+    for (int i = startIndex; i < numAvailable; i++) {
         int particle = availableParticles[i];
+        if (loopIndex > 0 && particle == particleSet[0])
+            continue;
+        int code = 0;
+        if (useFilters) {
+            code = typeCode+typeScale*particleTypes[particle];
+            if (!allowedTypes[code])
+                continue;
+        }
         
         // Check whether this particle can actually participate in interactions with the others found so far.
         
@@ -234,34 +386,31 @@ void CpuCustomManyParticleForce::loopOverInteractions(vector<int>& availablePart
             fvec4 deltaR;
             fvec4 pos1(posq+4*particle);
             float r2;
-            for (int j = 0; j < checkRange && include; j++) {
+            for (int j = firstCheck; j < checkRange && include; j++) {
                 fvec4 pos2(posq+4*particleSet[j]);
                 computeDelta(pos1, pos2, deltaR, r2, boxSize, invBoxSize);
                 include &= (r2 < cutoff2);
             }
         }
-        for (int j = 0; j < loopIndex && include; j++)
-            include &= (exclusions[particle].find(particleSet[j]) == exclusions[particle].end());
+        for (int j = firstCheck; j < loopIndex && include; j++)
+            include &= !exclusions.isExcluded(particle, particleSet[j]);
         if (include) {
-            if (loopIndex > 0 && availableParticles[i] == particleSet[0])
-                continue;
-            particleSet[loopIndex] = availableParticles[i];
+            particleSet[loopIndex] = particle;
             if (loopIndex == numParticlesPerSet-1)
-                calculateOneIxn(particleSet, particleParameters, forces, data, boxSize, invBoxSize);
+                addInteraction(particleSet, data);
             else
-                loopOverInteractions(availableParticles, particleSet, loopIndex+1, i+1, particleParameters, forces, data, boxSize, invBoxSize);
+                loopOverInteractions(availableParticles, particleSet, loopIndex+1, i+1, code, typeScale*numTypes, data, boxSize, invBoxSize);
         }
     }
 }
 
-void CpuCustomManyParticleForce::calculateOneIxn(vector<int>& particleSet, RealOpenMM** particleParameters, float* forces, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize) {
+void CpuCustomManyParticleForce::addInteraction(const vector<int>& particleSet, ThreadData& data) {
     // Select the ordering to use for the particles.
     
-    vector<int>& permutedParticles = data.permutedParticles;
     if (particleOrder.size() == 1) {
         // There are no filters, so we don't need to worry about ordering.
         
-        permutedParticles = particleSet;
+        data.interactions.insert(data.interactions.end(), particleSet.begin(), particleSet.end());
     }
     else {
         int index = 0;
@@ -271,9 +420,98 @@ void CpuCustomManyParticleForce::calculateOneIxn(vector<int>& particleSet, RealO
         if (order == -1)
             return;
         for (int i = 0; i < numParticlesPerSet; i++)
-            permutedParticles[i] = particleSet[particleOrder[order][i]];
+            data.interactions.push_back(particleSet[particleOrder[order][i]]);
+    }
+}
+
+void CpuCustomManyParticleForce::calculateIxns(RealOpenMM** particleParameters, float* forces, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize) {
+    int numInteractions = data.interactions.size()/numParticlesPerSet;
+    for (int start = 0; start < numInteractions; start += 4) {
+        // If there are fewer than four sets left, repeat the last one to fill the unused lanes.
+        
+        int count = min(4, numInteractions-start);
+        const int* particleSets[4];
+        for (int i = 0; i < 4; i++)
+            particleSets[i] = &data.interactions[(start+min(i, count-1))*numParticlesPerSet];
+        computeGeometry(particleSets, data, boxSize, invBoxSize);
+        for (int i = 0; i < count; i++)
+            calculateOneIxn(particleSets[i], i, particleParameters, forces, data);
+    }
+}
+
+void CpuCustomManyParticleForce::computeGeometry(const int* const* particleSets, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize) {
+    // Compute inter-particle deltas.
+    
+    int numDeltas = data.deltaPairs.size();
+    for (int i = 0; i < numDeltas; i++) {
+        int first = data.deltaPairs[i].first;
+        int second = data.deltaPairs[i].second;
+        fvec4 x1(posq+4*particleSets[0][first]), y1(posq+4*particleSets[1][first]), z1(posq+4*particleSets[2][first]), w1(posq+4*particleSets[3][first]);
+        fvec4 x2(posq+4*particleSets[0][second]), y2(posq+4*particleSets[1][second]), z2(posq+4*particleSets[2][second]), w2(posq+4*particleSets[3][second]);
+        transpose(x1, y1, z1, w1);
+        transpose(x2, y2, z2, w2);
+        fvec4 dx = x2-x1;
+        fvec4 dy = y2-y1;
+        fvec4 dz = z2-z1;
+        if (usePeriodic) {
+            if (triclinic) {
+                fvec4 scale3 = floor(dz*recipBoxSize[2]+0.5f);
+                dx -= scale3*(float) periodicBoxVectors[2][0];
+                dy -= scale3*(float) periodicBoxVectors[2][1];
+                dz -= scale3*(float) periodicBoxVectors[2][2];
+                fvec4 scale2 = floor(dy*recipBoxSize[1]+0.5f);
+                dx -= scale2*(float) periodicBoxVectors[1][0];
+                dy -= scale2*(float) periodicBoxVectors[1][1];
+                fvec4 scale1 = floor(dx*recipBoxSize[0]+0.5f);
+                dx -= scale1*(float) periodicBoxVectors[0][0];
+            }
+            else {
+                dx -= round(dx*invBoxSize[0])*boxSize[0];
+                dy -= round(dy*invBoxSize[1])*boxSize[1];
+                dz -= round(dz*invBoxSize[2])*boxSize[2];
+            }
+        }
+        fvec4 r2 = dx*dx + dy*dy + dz*dz;
+        fvec4 r = sqrt(r2);
+        data.deltaX[i] = dx;
+        data.deltaY[i] = dy;
+        data.deltaZ[i] = dz;
+        data.deltaR2[i] = r2;
+        fvec4 zero(0.0f);
+        transpose(dx, dy, dz, zero);
+        data.delta[i] = dx;
+        data.delta[numDeltas+i] = dy;
+        data.delta[2*numDeltas+i] = dz;
+        data.delta[3*numDeltas+i] = zero;
+        for (int j = 0; j < 4; j++) {
+            data.norm2Delta[j*numDeltas+i] = r2[j];
+            data.normDelta[j*numDeltas+i] = r[j];
+        }
+    }
+    
+    // Compute angles.  The cosines are computed for all four sets together.
+    
+    for (int i = 0; i < (int) data.angleTerms.size(); i++) {
+        const AngleTermInfo& term = data.angleTerms[i];
+        fvec4 dot = data.deltaX[term.delta1]*data.deltaX[term.delta2] + data.deltaY[term.delta1]*data.deltaY[term.delta2] + data.deltaZ[term.delta1]*data.deltaZ[term.delta2];
+        fvec4 cosine = dot*(term.delta1Sign*term.delta2Sign)/sqrt(data.deltaR2[term.delta1]*data.deltaR2[term.delta2]);
+        float cosines[4];
+        cosine.store(cosines);
+        for (int j = 0; j < 4; j++) {
+            if (cosines[j] > 0.99f || cosines[j] < -0.99f) {
+                // We're close to the singularity in acos(), so let computeAngle() use the cross product instead.
+
+                int offset = j*numDeltas;
+                data.angleValue[4*i+j] = computeAngle(data.delta[offset+term.delta1], data.delta[offset+term.delta2], data.norm2Delta[offset+term.delta1],
+                        data.norm2Delta[offset+term.delta2], term.delta1Sign*term.delta2Sign);
+            }
+            else
+                data.angleValue[4*i+j] = acosf(cosines[j]);
+        }
     }
+}
 
+void CpuCustomManyParticleForce::calculateOneIxn(const int* permutedParticles, int lane, RealOpenMM** particleParameters, float* forces, ThreadData& data) {
     // Record per-particle parameters.
     
     CompiledExpressionSet& expressionSet = data.expressionSet;
@@ -281,20 +519,14 @@ void CpuCustomManyParticleForce::calculateOneIxn(vector<int>& particleSet, RealO
         for (int j = 0; j < numPerParticleParameters; j++)
             expressionSet.setVariable(data.particleParamIndices[i][j], particleParameters[permutedParticles[i]][j]);
     
-    // Compute inter-particle deltas.
+    // Find the geometry for this set.
     
     int numDeltas = data.deltaPairs.size();
-    AlignedArray<fvec4>& delta = data.delta;
+    const fvec4* delta = &data.delta[lane*numDeltas];
+    const float* normDelta = &data.normDelta[lane*numDeltas];
+    const float* norm2Delta = &data.norm2Delta[lane*numDeltas];
     AlignedArray<fvec4>& cross1 = data.cross1;
     AlignedArray<fvec4>& cross2 = data.cross2;
-    vector<float>& normDelta = data.normDelta;
-    vector<float>& norm2Delta = data.norm2Delta;
-    for (int i = 0; i < numDeltas; i++) {
-        int p1 = permutedParticles[data.deltaPairs[i].first];
-        int p2 = permutedParticles[data.deltaPairs[i].second];
-        computeDelta(fvec4(posq+4*p1), fvec4(posq+4*p2), delta[i], norm2Delta[i], boxSize, invBoxSize);
-        normDelta[i] = sqrtf(norm2Delta[i]);
-    }
     
     // Compute all of the variables the energy can depend on.
 
@@ -308,7 +540,7 @@ void CpuCustomManyParticleForce::calculateOneIxn(vector<int>& particleSet, RealO
     }
     for (int i = 0; i < (int) data.angleTerms.size(); i++) {
         const AngleTermInfo& term = data.angleTerms[i];
-        expressionSet.setVariable(term.variableIndex, computeAngle(delta[term.delta1], delta[term.delta2], norm2Delta[term.delta1], norm2Delta[term.delta2], term.delta1Sign*term.delta2Sign));
+        expressionSet.setVariable(term.variableIndex, data.angleValue[4*i+lane]);
     }
     for (int i = 0; i < (int) data.dihedralTerms.size(); i++) {
         const DihedralTermInfo& term = data.dihedralTerms[i];
@@ -316,6 +548,11 @@ void CpuCustomManyParticleForce::calculateOneIxn(vector<int>& particleSet, RealO
     }
     
     if (includeForces) {
+        // Evaluate the energy and all its derivatives together.
+
+        const Lepton::CompiledExpression& forceExpression = data.forceExpression;
+        forceExpression.evaluate();
+
         // Apply forces based on individual particle coordinates.
 
         AlignedArray<fvec4>& f = data.f;
@@ -325,7 +562,7 @@ void CpuCustomManyParticleForce::calculateOneIxn(vector<int>& particleSet, RealO
             const ParticleTermInfo& term = data.particleTerms[i];
             float temp[4];
             f[term.atom].store(temp);
-            temp[term.component] -= term.forceExpression.evaluate();
+            temp[term.component] -= forceExpression.getOutput(term.forceIndex);
             f[term.atom] = fvec4(temp);
         }
 
@@ -333,7 +570,7 @@ void CpuCustomManyParticleForce::calculateOneIxn(vector<int>& particleSet, RealO
 
         for (int i = 0; i < (int) data.distanceTerms.size(); i++) {
             const DistanceTermInfo& term = data.distanceTerms[i];
-            float dEdR = (float) (term.forceExpression.evaluate()*term.deltaSign/(normDelta[term.delta]));
+            float dEdR = (float) (forceExpression.getOutput(term.forceIndex)*term.deltaSign/(normDelta[term.delta]));
             fvec4 force = -dEdR*delta[term.delta];
             f[term.p1] -= force;
             f[term.p2] += force;
@@ -343,7 +580,7 @@ void CpuCustomManyParticleForce::calculateOneIxn(vector<int>& particleSet, RealO
 
         for (int i = 0; i < (int) data.angleTerms.size(); i++) {
             const AngleTermInfo& term = data.angleTerms[i];
-            float dEdTheta = (float) term.forceExpression.evaluate();
+            float dEdTheta = (float) forceExpression.getOutput(term.forceIndex);
             fvec4 thetaCross = cross(delta[term.delta1], delta[term.delta2]);
             float lengthThetaCross = sqrtf(dot3(thetaCross, thetaCross));
             if (lengthThetaCross < 1.0e-6f)
@@ -364,7 +601,7 @@ void CpuCustomManyParticleForce::calculateOneIxn(vector<int>& particleSet, RealO
 
         for (int i = 0; i < (int) data.dihedralTerms.size(); i++) {
             const DihedralTermInfo& term = data.dihedralTerms[i];
-            float dEdTheta = (float) term.forceExpression.evaluate();
+            float dEdTheta = (float) forceExpression.getOutput(term.forceIndex);
             float normCross1 = dot3(cross1[i], cross1[i]);
             float normBC = normDelta[term.delta2];
             float forceFactors[4];
@@ -395,7 +632,7 @@ void CpuCustomManyParticleForce::calculateOneIxn(vector<int>& particleSet, RealO
     // Add the energy
 
     if (includeEnergy)
-        data.energy += data.energyExpression.evaluate();
+        data.energy += (includeForces ? data.forceExpression.getOutput(0) : data.energyExpression.evaluate());
 }
 
 void CpuCustomManyParticleForce::computeDelta(const fvec4& posI, const fvec4& posJ, fvec4& deltaR, float& r2, const fvec4& boxSize, const fvec4& invBoxSize) const {
@@ -440,26 +677,26 @@ float CpuCustomManyParticleForce::getDihedralAngleBetweenThreeVectors(const fvec
     return angle;
 }
 
-CpuCustomManyParticleForce::ParticleTermInfo::ParticleTermInfo(const string& name, int atom, int component, const Lepton::CompiledExpression& forceExpression, ThreadData& data) :
-        name(name), atom(atom), component(component), forceExpression(forceExpression) {
+CpuCustomManyParticleForce::ParticleTermInfo::ParticleTermInfo(const string& name, int atom, int component, int forceIndex, ThreadData& data) :
+        name(name), atom(atom), component(component), forceIndex(forceIndex) {
     variableIndex = data.expressionSet.getVariableIndex(name);
 }
 
-CpuCustomManyParticleForce::DistanceTermInfo::DistanceTermInfo(const string& name, const vector<int>& atoms, const Lepton::CompiledExpression& forceExpression, ThreadData& data) :
-        name(name), p1(atoms[0]), p2(atoms[1]), forceExpression(forceExpression) {
+CpuCustomManyParticleForce::DistanceTermInfo::DistanceTermInfo(const string& name, const vector<int>& atoms, int forceIndex, ThreadData& data) :
+        name(name), p1(atoms[0]), p2(atoms[1]), forceIndex(forceIndex) {
     variableIndex = data.expressionSet.getVariableIndex(name);
     data.requestDeltaPair(p1, p2, delta, deltaSign, true);
 }
 
-CpuCustomManyParticleForce::AngleTermInfo::AngleTermInfo(const string& name, const vector<int>& atoms, const Lepton::CompiledExpression& forceExpression, ThreadData& data) :
-        name(name), p1(atoms[0]), p2(atoms[1]), p3(atoms[2]), forceExpression(forceExpression) {
+CpuCustomManyParticleForce::AngleTermInfo::AngleTermInfo(const string& name, const vector<int>& atoms, int forceIndex, ThreadData& data) :
+        name(name), p1(atoms[0]), p2(atoms[1]), p3(atoms[2]), forceIndex(forceIndex) {
     variableIndex = data.expressionSet.getVariableIndex(name);
     data.requestDeltaPair(p1, p2,delta1, delta1Sign, true);
     data.requestDeltaPair(p3, p2, delta2, delta2Sign, true);
 }
 
-CpuCustomManyParticleForce::DihedralTermInfo::DihedralTermInfo(const string& name, const vector<int>& atoms, const Lepton::CompiledExpression& forceExpression, ThreadData& data) :
-        name(name), p1(atoms[0]), p2(atoms[1]), p3(atoms[2]), p4(atoms[3]), forceExpression(forceExpression) {
+CpuCustomManyParticleForce::DihedralTermInfo::DihedralTermInfo(const string& name, const vector<int>& atoms, int forceIndex, ThreadData& data) :
+        name(name), p1(atoms[0]), p2(atoms[1]), p3(atoms[2]), p4(atoms[3]), forceIndex(forceIndex) {
     variableIndex = data.expressionSet.getVariableIndex(name);
     float sign;
     data.requestDeltaPair(p2, p1, delta1, sign, false);
@@ -467,26 +704,38 @@ CpuCustomManyParticleForce::DihedralTermInfo::DihedralTermInfo(const string& nam
     data.requestDeltaPair(p4, p3, delta3, sign, false);
 }
 
+/**
+ * Add the derivative of the energy with respect to a variable to a list of expressions, and return its index.
+ */
+static int addDerivative(vector<Lepton::ParsedExpression>& expressions, const Lepton::ParsedExpression& energyExpr, const string& variable) {
+    expressions.push_back(energyExpr.differentiate(variable).optimize());
+    return expressions.size()-1;
+}
+
 CpuCustomManyParticleForce::ThreadData::ThreadData(const CustomManyParticleForce& force, Lepton::ParsedExpression& energyExpr,
             map<string, vector<int> >& distances, map<string, vector<int> >& angles, map<string, vector<int> >& dihedrals) {
     int numParticlesPerSet = force.getNumParticlesPerSet();
     int numPerParticleParameters = force.getNumPerParticleParameters();
     particleParamIndices.resize(numParticlesPerSet);
-    permutedParticles.resize(numParticlesPerSet);
     f.resize(numParticlesPerSet);
     energyExpression = energyExpr.createCompiledExpression();
     expressionSet.registerExpression(energyExpression);
 
-    // Differentiate the energy to get expressions for the force.
+    // Differentiate the energy to get expressions for the force.  They are all compiled into a single
+    // expression along with the energy, so subexpressions they share are only evaluated once.  Particle
+    // coordinates only need terms if the energy depends on them directly.
 
+    const set<string>& variables = energyExpression.getVariables();
+    vector<Lepton::ParsedExpression> forceExpressions(1, energyExpr);
     for (int i = 0; i < numParticlesPerSet; i++) {
         stringstream xname, yname, zname;
         xname << 'x' << (i+1);
         yname << 'y' << (i+1);
         zname << 'z' << (i+1);
-        particleTerms.push_back(CpuCustomManyParticleForce::ParticleTermInfo(xname.str(), i, 0, energyExpr.differentiate(xname.str()).optimize().createCompiledExpression(), *this));
-        particleTerms.push_back(CpuCustomManyParticleForce::ParticleTermInfo(yname.str(), i, 1, energyExpr.differentiate(yname.str()).optimize().createCompiledExpression(), *this));
-        particleTerms.push_back(CpuCustomManyParticleForce::ParticleTermInfo(zname.str(), i, 2, energyExpr.differentiate(zname.str()).optimize().createCompiledExpression(), *this));
+        string names[] = {xname.str(), yname.str(), zname.str()};
+        for (int j = 0; j < 3; j++)
+            if (variables.find(names[j]) != variables.end())
+                particleTerms.push_back(CpuCustomManyParticleForce::ParticleTermInfo(names[j], i, j, addDerivative(forceExpressions, energyExpr, names[j]), *this));
         for (int j = 0; j < numPerParticleParameters; j++) {
             stringstream paramname;
             paramname << force.getPerParticleParameterName(j) << (i+1);
@@ -494,26 +743,24 @@ CpuCustomManyParticleForce::ThreadData::ThreadData(const CustomManyParticleForce
         }
     }
     for (map<string, vector<int> >::const_iterator iter = dihedrals.begin(); iter != dihedrals.end(); ++iter)
-        dihedralTerms.push_back(CpuCustomManyParticleForce::DihedralTermInfo(iter->first, iter->second, energyExpr.differentiate(iter->first).optimize().createCompiledExpression(), *this));
+        dihedralTerms.push_back(CpuCustomManyParticleForce::DihedralTermInfo(iter->first, iter->second, addDerivative(forceExpressions, energyExpr, iter->first), *this));
     for (map<string, vector<int> >::const_iterator iter = distances.begin(); iter != distances.end(); ++iter)
-        distanceTerms.push_back(CpuCustomManyParticleForce::DistanceTermInfo(iter->first, iter->second, energyExpr.differentiate(iter->first).optimize().createCompiledExpression(), *this));
+        distanceTerms.push_back(CpuCustomManyParticleForce::DistanceTermInfo(iter->first, iter->second, addDerivative(forceExpressions, energyExpr, iter->first), *this));
     for (map<string, vector<int> >::const_iterator iter = angles.begin(); iter != angles.end(); ++iter)
-        angleTerms.push_back(CpuCustomManyParticleForce::AngleTermInfo(iter->first, iter->second, energyExpr.differentiate(iter->first).optimize().createCompiledExpression(), *this));
-    for (int i = 0; i < particleTerms.size(); i++)
-        expressionSet.registerExpression(particleTerms[i].forceExpression);
-    for (int i = 0; i < distanceTerms.size(); i++)
-        expressionSet.registerExpression(distanceTerms[i].forceExpression);
-    for (int i = 0; i < angleTerms.size(); i++)
-        expressionSet.registerExpression(angleTerms[i].forceExpression);
-    for (int i = 0; i < dihedralTerms.size(); i++)
-        expressionSet.registerExpression(dihedralTerms[i].forceExpression);
+        angleTerms.push_back(CpuCustomManyParticleForce::AngleTermInfo(iter->first, iter->second, addDerivative(forceExpressions, energyExpr, iter->first), *this));
+    forceExpression = Lepton::CompiledExpression(forceExpressions);
+    expressionSet.registerExpression(forceExpression);
     int numDeltas = deltaPairs.size();
-    delta.resize(numDeltas);
-    normDelta.resize(numDeltas);
-    norm2Delta.resize(numDeltas);
+    delta.resize(4*numDeltas);
+    deltaX.resize(numDeltas);
+    deltaY.resize(numDeltas);
+    deltaZ.resize(numDeltas);
+    deltaR2.resize(numDeltas);
+    normDelta.resize(4*numDeltas);
+    norm2Delta.resize(4*numDeltas);
+    angleValue.resize(4*angleTerms.size());
     cross1.resize(numDeltas);
     cross2.resize(numDeltas);
-    
 }
 
 void CpuCustomManyParticleForce::ThreadData::requestDeltaPair(int p1, int p2, int& pairIndex, float& pairSign, bool allowReversed) {
@@ -43,25 +43,50 @@ public:
     CpuCustomNonbondedForce& owner;
 };
 
-CpuCustomNonbondedForce::ThreadData::ThreadData(const Lepton::CompiledExpression& energyExpression, const Lepton::CompiledExpression& forceExpression, const vector<string>& parameterNames) :
-            energyExpression(energyExpression), forceExpression(forceExpression) {
-    energyR = ReferenceForce::getVariablePointer(this->energyExpression, "r");
-    forceR = ReferenceForce::getVariablePointer(this->forceExpression, "r");
+CpuCustomNonbondedForce::ThreadData::ThreadData(const Lepton::CompiledExpression& energyExpression, const Lepton::CompiledExpression& forceExpression,
+            const Lepton::CompiledExpression& energyAndForceExpression, const vector<string>& parameterNames) :
+            energyExpression(energyExpression), forceExpression(forceExpression), energyAndForceExpression(energyAndForceExpression),
+            parameterNames(parameterNames) {
+    selectExpression(true, false);
+}
+
+void CpuCustomNonbondedForce::ThreadData::selectExpression(bool includeForce, bool includeEnergy) {
+    // When both are needed, a single expression computes them together so shared subexpressions are only
+    // evaluated once.
+
+    if (includeForce && includeEnergy) {
+        expression = &energyAndForceExpression;
+        energyOutput = 0;
+        forceOutput = 1;
+    }
+    else if (includeForce) {
+        expression = &forceExpression;
+        energyOutput = -1;
+        forceOutput = 0;
+    }
+    else {
+        expression = &energyExpression;
+        energyOutput = 0;
+        forceOutput = -1;
+    }
+    r = ReferenceForce::getVariablePointer(*expression, "r");
+    particleParams.clear();
     for (int i = 0; i < (int) parameterNames.size(); i++) {
         for (int j = 1; j < 3; j++) {
             stringstream name;
             name << parameterNames[i] << j;
-            energyParticleParams.push_back(ReferenceForce::getVariablePointer(this->energyExpression, name.str()));
-            forceParticleParams.push_back(ReferenceForce::getVariablePointer(this->forceExpression, name.str()));
+            particleParams.push_back(ReferenceForce::getVariablePointer(*expression, name.str()));
         }
     }
 }
 
 CpuCustomNonbondedForce::CpuCustomNonbondedForce(const Lepton::CompiledExpression& energyExpression,
-            const Lepton::CompiledExpression& forceExpression, const vector<string>& parameterNames, const vector<set<int> >& exclusions,ThreadPool& threads) :
-            cutoff(false), useSwitch(false), periodic(false), paramNames(parameterNames), exclusions(exclusions), threads(threads) {
+            const Lepton::CompiledExpression& forceExpression, const Lepton::CompiledExpression& energyAndForceExpression,
+            const vector<string>& parameterNames, const CpuExclusionList& exclusions, ThreadPool& threads) :
+            cutoff(false), useSwitch(false), periodic(false), paramNames(parameterNames), exclusions(exclusions), threads(threads),
+            variedParameters(NULL), parameterSetValues(NULL) {
     for (int i = 0; i < threads.getNumThreads(); i++)
-        threadData.push_back(new ThreadData(energyExpression, forceExpression, parameterNames));
+        threadData.push_back(new ThreadData(energyExpression, forceExpression, energyAndForceExpression, parameterNames));
 }
 
 CpuCustomNonbondedForce::~CpuCustomNonbondedForce() {
@@ -81,7 +106,7 @@ void CpuCustomNonbondedForce::setInteractionGroups(const vector<pair<set<int>, s
         const set<int>& set2 = groups[group].second;
         for (set<int>::const_iterator atom1 = set1.begin(); atom1 != set1.end(); ++atom1) {
             for (set<int>::const_iterator atom2 = set2.begin(); atom2 != set2.end(); ++atom2) {
-                if (*atom1 == *atom2 || exclusions[*atom1].find(*atom2) != exclusions[*atom1].end())
+                if (*atom1 == *atom2 || exclusions.isExcluded(*atom1, *atom2))
                     continue; // This is an excluded interaction.
                 if (*atom1 > *atom2 && set1.find(*atom2) != set1.end() && set2.find(*atom1) != set2.end())
                     continue; // Both atoms are in both sets, so skip duplicate interactions.
@@ -151,6 +176,46 @@ void CpuCustomNonbondedForce::calculatePairIxn(int numberOfAtoms, float* posq, v
     }
 }
 
+void CpuCustomNonbondedForce::calculatePairIxnForParameterSets(int numberOfAtoms, float* posq, vector<RealVec>& atomCoordinates, RealOpenMM** atomParameters,
+                                             const map<string, double>& globalParameters, const vector<string>& variedParameters,
+                                             const vector<vector<double> >& parameterSetValues, vector<AlignedArray<float> >& threadForce,
+                                             vector<double>& energies) {
+    // Record the parameters for the threads.
+
+    this->numberOfAtoms = numberOfAtoms;
+    this->posq = posq;
+    this->atomCoordinates = &atomCoordinates[0];
+    this->atomParameters = atomParameters;
+    this->globalParameters = &globalParameters;
+    this->threadForce = &threadForce;
+    this->includeForce = false;
+    this->includeEnergy = true;
+    this->variedParameters = &variedParameters;
+    this->parameterSetValues = &parameterSetValues;
+    threadEnergy.resize(threads.getNumThreads());
+    gmx_atomic_t counter;
+    gmx_atomic_set(&counter, 0);
+    this->atomicCounter = &counter;
+
+    // Signal the threads to start running and wait for them to finish.
+
+    ComputeForceTask task(*this);
+    threads.execute(task);
+    threads.waitForThreads();
+    this->variedParameters = NULL;
+    this->parameterSetValues = NULL;
+
+    // Combine the energies from all the threads.
+
+    int numSets = parameterSetValues.size();
+    energies.resize(numSets);
+    for (int i = 0; i < numSets; i++) {
+        energies[i] = 0.0;
+        for (int j = 0; j < (int) threadData.size(); j++)
+            energies[i] += threadData[j]->parameterSetEnergy[i];
+    }
+}
+
 void CpuCustomNonbondedForce::threadComputeForce(ThreadPool& threads, int threadIndex) {
     // Compute this thread's subset of interactions.
 
@@ -159,9 +224,14 @@ void CpuCustomNonbondedForce::threadComputeForce(ThreadPool& threads, int thread
     double& energy = threadEnergy[threadIndex];
     float* forces = &(*threadForce)[threadIndex][0];
     ThreadData& data = *threadData[threadIndex];
-    for (map<string, double>::const_iterator iter = globalParameters->begin(); iter != globalParameters->end(); ++iter) {
-        ReferenceForce::setVariable(ReferenceForce::getVariablePointer(data.energyExpression, iter->first), iter->second);
-        ReferenceForce::setVariable(ReferenceForce::getVariablePointer(data.forceExpression, iter->first), iter->second);
+    data.selectExpression(includeForce && parameterSetValues == NULL, includeEnergy || parameterSetValues != NULL);
+    for (map<string, double>::const_iterator iter = globalParameters->begin(); iter != globalParameters->end(); ++iter)
+        ReferenceForce::setVariable(ReferenceForce::getVariablePointer(*data.expression, iter->first), iter->second);
+    if (parameterSetValues != NULL) {
+        data.energyVariedParams.resize(variedParameters->size());
+        for (int i = 0; i < (int) variedParameters->size(); i++)
+            data.energyVariedParams[i] = ReferenceForce::getVariablePointer(data.energyExpression, (*variedParameters)[i]);
+        data.parameterSetEnergy.assign(parameterSetValues->size(), 0.0);
     }
     fvec4 boxSize(periodicBoxVectors[0][0], periodicBoxVectors[1][1], periodicBoxVectors[2][2], 0);
     fvec4 invBoxSize(recipBoxSize[0], recipBoxSize[1], recipBoxSize[2], 0);
@@ -175,12 +245,13 @@ void CpuCustomNonbondedForce::threadComputeForce(ThreadPool& threads, int thread
             int atom1 = groupInteractions[i].first;
             int atom2 = groupInteractions[i].second;
             for (int j = 0; j < (int) paramNames.size(); j++) {
-                ReferenceForce::setVariable(data.energyParticleParams[j*2], atomParameters[atom1][j]);
-                ReferenceForce::setVariable(data.energyParticleParams[j*2+1], atomParameters[atom2][j]);
-                ReferenceForce::setVariable(data.forceParticleParams[j*2], atomParameters[atom1][j]);
-                ReferenceForce::setVariable(data.forceParticleParams[j*2+1], atomParameters[atom2][j]);
+                ReferenceForce::setVariable(data.particleParams[j*2], atomParameters[atom1][j]);
+                ReferenceForce::setVariable(data.particleParams[j*2+1], atomParameters[atom2][j]);
             }
-            calculateOneIxn(atom1, atom2, data, forces, energy, boxSize, invBoxSize);
+            if (parameterSetValues != NULL)
+                calculateOneIxnForParameterSets(atom1, atom2, data, boxSize, invBoxSize);
+            else
+                calculateOneIxn(atom1, atom2, data, forces, energy, boxSize, invBoxSize);
         }
     }
     else if (cutoff) {
@@ -192,21 +263,20 @@ void CpuCustomNonbondedForce::threadComputeForce(ThreadPool& threads, int thread
                 break;
             const int* blockAtom = &neighborList->getSortedAtoms()[4*blockIndex];
             const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
-            const vector<char>& exclusions = neighborList->getBlockExclusions(blockIndex);
+            const vector<short>& exclusions = neighborList->getBlockExclusions(blockIndex);
             for (int i = 0; i < (int) neighbors.size(); i++) {
                 int first = neighbors[i];
-                for (int j = 0; j < (int) paramNames.size(); j++) {
-                    ReferenceForce::setVariable(data.energyParticleParams[j*2], atomParameters[first][j]);
-                    ReferenceForce::setVariable(data.forceParticleParams[j*2], atomParameters[first][j]);
-                }
+                for (int j = 0; j < (int) paramNames.size(); j++)
+                    ReferenceForce::setVariable(data.particleParams[j*2], atomParameters[first][j]);
                 for (int k = 0; k < 4; k++) {
                     if ((exclusions[i] & (1<<k)) == 0) {
                         int second = blockAtom[k];
-                        for (int j = 0; j < (int) paramNames.size(); j++) {
-                            ReferenceForce::setVariable(data.energyParticleParams[j*2+1], atomParameters[second][j]);
-                            ReferenceForce::setVariable(data.forceParticleParams[j*2+1], atomParameters[second][j]);
-                        }
-                        calculateOneIxn(first, second, data, forces, energy, boxSize, invBoxSize);
+                        for (int j = 0; j < (int) paramNames.size(); j++)
+                            ReferenceForce::setVariable(data.particleParams[j*2+1], atomParameters[second][j]);
+                        if (parameterSetValues != NULL)
+                            calculateOneIxnForParameterSets(first, second, data, boxSize, invBoxSize);
+                        else
+                            calculateOneIxn(first, second, data, forces, energy, boxSize, invBoxSize);
                     }
                 }
             }
@@ -219,15 +289,20 @@ void CpuCustomNonbondedForce::threadComputeForce(ThreadPool& threads, int thread
             int ii = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 1);
             if (ii >= numberOfAtoms)
                 break;
+            const int* excluded = exclusions.getExclusions(ii);
+            const int* lastExcluded = excluded+exclusions.getNumExclusions(ii);
             for (int jj = ii+1; jj < numberOfAtoms; jj++) {
-                if (exclusions[jj].find(ii) == exclusions[jj].end()) {
+                while (excluded != lastExcluded && *excluded < jj)
+                    excluded++;
+                if (excluded == lastExcluded || *excluded != jj) {
                     for (int j = 0; j < (int) paramNames.size(); j++) {
-                        ReferenceForce::setVariable(data.energyParticleParams[j*2], atomParameters[ii][j]);
-                        ReferenceForce::setVariable(data.energyParticleParams[j*2+1], atomParameters[jj][j]);
-                        ReferenceForce::setVariable(data.forceParticleParams[j*2], atomParameters[ii][j]);
-                        ReferenceForce::setVariable(data.forceParticleParams[j*2+1], atomParameters[jj][j]);
+                        ReferenceForce::setVariable(data.particleParams[j*2], atomParameters[ii][j]);
+                        ReferenceForce::setVariable(data.particleParams[j*2+1], atomParameters[jj][j]);
                     }
-                    calculateOneIxn(ii, jj, data, forces, energy, boxSize, invBoxSize);
+                    if (parameterSetValues != NULL)
+                        calculateOneIxnForParameterSets(ii, jj, data, boxSize, invBoxSize);
+                    else
+                        calculateOneIxn(ii, jj, data, forces, energy, boxSize, invBoxSize);
                 }
             }
         }
@@ -249,10 +324,10 @@ void CpuCustomNonbondedForce::calculateOneIxn(int ii, int jj, ThreadData& data,
 
     // accumulate forces
 
-    ReferenceForce::setVariable(data.energyR, r);
-    ReferenceForce::setVariable(data.forceR, r);
-    double dEdR = (includeForce ? data.forceExpression.evaluate()/r : 0.0);
-    double energy = (includeEnergy ? data.energyExpression.evaluate() : 0.0);
+    ReferenceForce::setVariable(data.r, r);
+    data.expression->evaluate();
+    double dEdR = (includeForce ? data.expression->getOutput(data.forceOutput)/r : 0.0);
+    double energy = (includeEnergy ? data.expression->getOutput(data.energyOutput) : 0.0);
     if (useSwitch) {
         if (r > switchingDistance) {
             RealOpenMM t = (r-switchingDistance)/(cutoffDistance-switchingDistance);
@@ -271,6 +346,37 @@ void CpuCustomNonbondedForce::calculateOneIxn(int ii, int jj, ThreadData& data,
     totalEnergy += energy;
 }
 
+void CpuCustomNonbondedForce::calculateOneIxnForParameterSets(int ii, int jj, ThreadData& data, const fvec4& boxSize, const fvec4& invBoxSize) {
+    fvec4 deltaR;
+    fvec4 posI(posq+4*ii);
+    fvec4 posJ(posq+4*jj);
+    float r2;
+    getDeltaR(posI, posJ, deltaR, r2, boxSize, invBoxSize);
+    if (cutoff && r2 >= cutoffDistance*cutoffDistance)
+        return;
+    float r = sqrtf(r2);
+    ReferenceForce::setVariable(data.r, r);
+    RealOpenMM switchValue = 1;
+    if (useSwitch) {
+        if (r > switchingDistance) {
+            RealOpenMM t = (r-switchingDistance)/(cutoffDistance-switchingDistance);
+            switchValue = 1+t*t*t*(-10+t*(15-t*6));
+        }
+    }
+
+    // Everything except the global parameters is the same for all sets, so only the energy
+    // expression needs to be reevaluated for each one.
+
+    int numSets = parameterSetValues->size();
+    int numVaried = data.energyVariedParams.size();
+    for (int i = 0; i < numSets; i++) {
+        const vector<double>& values = (*parameterSetValues)[i];
+        for (int j = 0; j < numVaried; j++)
+            ReferenceForce::setVariable(data.energyVariedParams[j], values[j]);
+        data.parameterSetEnergy[i] += switchValue*data.energyExpression.evaluate();
+    }
+}
+
 void CpuCustomNonbondedForce::getDeltaR(const fvec4& posI, const fvec4& posJ, fvec4& deltaR, float& r2, const fvec4& boxSize, const fvec4& invBoxSize) const {
     deltaR = posJ-posI;
     if (periodic) {
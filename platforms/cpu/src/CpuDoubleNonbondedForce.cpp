@@ -0,0 +1,399 @@
+/* Portions copyright (c) 2006-2015 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <complex>
+
+#include "SimTKOpenMMUtilities.h"
+#include "CpuDoubleNonbondedForce.h"
+#include "ReferenceForce.h"
+#include "ReferencePME.h"
+#include <algorithm>
+
+// In case we're using some primitive version of Visual Studio this will
+// make sure that erf() and erfc() are defined.
+#include "openmm/internal/MSVC_erfc.h"
+
+using namespace std;
+using namespace OpenMM;
+
+const double CpuDoubleNonbondedForce::TWO_OVER_SQRT_PI = 2/sqrt(PI_M);
+
+class CpuDoubleNonbondedForce::ComputeDirectTask : public ThreadPool::Task {
+public:
+    ComputeDirectTask(CpuDoubleNonbondedForce& owner) : owner(owner) {
+    }
+    void execute(ThreadPool& threads, int threadIndex) {
+        owner.threadComputeDirect(threads, threadIndex);
+    }
+    CpuDoubleNonbondedForce& owner;
+};
+
+class CpuDoubleNonbondedForce::ReduceForcesTask : public ThreadPool::Task {
+public:
+    ReduceForcesTask(CpuDoubleNonbondedForce& owner) : owner(owner) {
+    }
+    void execute(ThreadPool& threads, int threadIndex) {
+        owner.threadReduceForces(threads, threadIndex);
+    }
+    CpuDoubleNonbondedForce& owner;
+};
+
+CpuDoubleNonbondedForce::CpuDoubleNonbondedForce() : cutoff(false), useSwitch(false), periodic(false), ewald(false), pme(false), cutoffDistance(0.0), alphaEwald(0.0) {
+}
+
+void CpuDoubleNonbondedForce::setUseCutoff(double distance, const CpuNeighborList& neighbors, double solventDielectric) {
+    cutoff = true;
+    cutoffDistance = distance;
+    neighborList = &neighbors;
+    krf = pow(cutoffDistance, -3.0)*(solventDielectric-1.0)/(2.0*solventDielectric+1.0);
+    crf = (1.0/cutoffDistance)*(3.0*solventDielectric)/(2.0*solventDielectric+1.0);
+}
+
+void CpuDoubleNonbondedForce::setUseSwitchingFunction(double distance) {
+    useSwitch = true;
+    switchingDistance = distance;
+}
+
+void CpuDoubleNonbondedForce::setPeriodic(RealVec* periodicBoxVectors) {
+    assert(cutoff);
+    assert(periodicBoxVectors[0][0] >= 2.0*cutoffDistance);
+    assert(periodicBoxVectors[1][1] >= 2.0*cutoffDistance);
+    assert(periodicBoxVectors[2][2] >= 2.0*cutoffDistance);
+    periodic = true;
+    for (int i = 0; i < 3; i++) {
+        this->periodicBoxVectors[i] = periodicBoxVectors[i];
+        recipBoxSize[i] = 1.0/periodicBoxVectors[i][i];
+    }
+}
+
+void CpuDoubleNonbondedForce::setUseEwald(double alpha, int kmaxx, int kmaxy, int kmaxz) {
+    alphaEwald = alpha;
+    numRx = kmaxx;
+    numRy = kmaxy;
+    numRz = kmaxz;
+    ewald = true;
+}
+
+void CpuDoubleNonbondedForce::setUsePME(double alpha, int meshSize[3]) {
+    alphaEwald = alpha;
+    meshDim[0] = meshSize[0];
+    meshDim[1] = meshSize[1];
+    meshDim[2] = meshSize[2];
+    pme = true;
+}
+
+void CpuDoubleNonbondedForce::calculateReciprocalIxn(int numberOfAtoms, const vector<RealVec>& atomCoordinates, const vector<double>& charges,
+                                                     vector<RealVec>& forces, bool includeForces, double* totalEnergy) const {
+    typedef std::complex<double> d_complex;
+
+    int kmax = (ewald ? max(numRx, max(numRy, numRz)) : 0);
+    double factorEwald = -1/(4*alphaEwald*alphaEwald);
+    double TWO_PI = 2.0*PI_M;
+    double recipCoeff = ONE_4PI_EPS0*4*PI_M/(periodicBoxVectors[0][0]*periodicBoxVectors[1][1]*periodicBoxVectors[2][2]);
+
+    if (pme) {
+        pme_t pmedata;
+        pme_init(&pmedata, alphaEwald, numberOfAtoms, meshDim, 5, 1);
+        RealOpenMM recipEnergy = 0.0;
+        pme_exec(pmedata, atomCoordinates, forces, charges, periodicBoxVectors, &recipEnergy);
+        if (totalEnergy)
+            *totalEnergy += recipEnergy;
+        pme_destroy(pmedata);
+    }
+
+    // Ewald method
+
+    else if (ewald) {
+        double recipBoxSize[3] = {TWO_PI/periodicBoxVectors[0][0], TWO_PI/periodicBoxVectors[1][1], TWO_PI/periodicBoxVectors[2][2]};
+
+        // setup K-vectors
+
+        #define EIR(x, y, z) eir[(x)*numberOfAtoms*3+(y)*3+z]
+        vector<d_complex> eir(kmax*numberOfAtoms*3);
+        vector<d_complex> tab_xy(numberOfAtoms);
+        vector<d_complex> tab_qxyz(numberOfAtoms);
+
+        for (int i = 0; i < numberOfAtoms; i++) {
+            for (int m = 0; m < 3; m++)
+                EIR(0, i, m) = d_complex(1, 0);
+            for (int m = 0; m < 3; m++)
+                EIR(1, i, m) = d_complex(cos(atomCoordinates[i][m]*recipBoxSize[m]), sin(atomCoordinates[i][m]*recipBoxSize[m]));
+            for (int j = 2; j < kmax; j++)
+                for (int m = 0; m < 3; m++)
+                    EIR(j, i, m) = EIR(j-1, i, m)*EIR(1, i, m);
+        }
+
+        // calculate reciprocal space energy and forces
+
+        int lowry = 0;
+        int lowrz = 1;
+        for (int rx = 0; rx < numRx; rx++) {
+            double kx = rx*recipBoxSize[0];
+            for (int ry = lowry; ry < numRy; ry++) {
+                double ky = ry*recipBoxSize[1];
+                if (ry >= 0) {
+                    for (int n = 0; n < numberOfAtoms; n++)
+                        tab_xy[n] = EIR(rx, n, 0)*EIR(ry, n, 1);
+                }
+                else {
+                    for (int n = 0; n < numberOfAtoms; n++)
+                        tab_xy[n] = EIR(rx, n, 0)*conj(EIR(-ry, n, 1));
+                }
+                for (int rz = lowrz; rz < numRz; rz++) {
+                    if (rz >= 0) {
+                        for (int n = 0; n < numberOfAtoms; n++)
+                            tab_qxyz[n] = charges[n]*(tab_xy[n]*EIR(rz, n, 2));
+                    }
+                    else {
+                        for (int n = 0; n < numberOfAtoms; n++)
+                            tab_qxyz[n] = charges[n]*(tab_xy[n]*conj(EIR(-rz, n, 2)));
+                    }
+                    double cs = 0.0;
+                    double ss = 0.0;
+                    for (int n = 0; n < numberOfAtoms; n++) {
+                        cs += tab_qxyz[n].real();
+                        ss += tab_qxyz[n].imag();
+                    }
+                    double kz = rz*recipBoxSize[2];
+                    double k2 = kx*kx + ky*ky + kz*kz;
+                    double ak = exp(k2*factorEwald)/k2;
+                    if (includeForces) {
+                        for (int n = 0; n < numberOfAtoms; n++) {
+                            double force = ak*(cs*tab_qxyz[n].imag() - ss*tab_qxyz[n].real());
+                            forces[n][0] += 2*recipCoeff*force*kx;
+                            forces[n][1] += 2*recipCoeff*force*ky;
+                            forces[n][2] += 2*recipCoeff*force*kz;
+                        }
+                    }
+                    if (totalEnergy)
+                        *totalEnergy += recipCoeff*ak*(cs*cs + ss*ss);
+                    lowrz = 1 - numRz;
+                }
+                lowry = 1 - numRy;
+            }
+        }
+    }
+}
+
+void CpuDoubleNonbondedForce::calculateDirectIxn(int numberOfAtoms, const vector<RealVec>& atomCoordinates, const vector<double>& charges,
+            const vector<pair<double, double> >& atomParameters, const CpuExclusionList& exclusions, vector<RealVec>& forces,
+            bool includeForces, double* totalEnergy, ThreadPool& threads) {
+    // Record the parameters for the threads.
+
+    this->numberOfAtoms = numberOfAtoms;
+    this->atomCoordinates = &atomCoordinates[0];
+    this->charges = &charges[0];
+    this->atomParameters = &atomParameters[0];
+    this->exclusions = &exclusions;
+    this->forces = &forces;
+    this->includeForces = includeForces;
+    includeEnergy = (totalEnergy != NULL);
+    int numThreads = threads.getNumThreads();
+    threadEnergy.resize(numThreads);
+    threadForce.resize(numThreads);
+    for (int i = 0; i < numThreads; i++)
+        threadForce[i].resize(numberOfAtoms);
+
+    // Signal the threads to start running and wait for them to finish.
+
+    ComputeDirectTask task(*this);
+    threads.execute(task);
+    threads.waitForThreads();
+    if (includeForces) {
+        ReduceForcesTask reduceTask(*this);
+        threads.execute(reduceTask);
+        threads.waitForThreads();
+    }
+
+    // Combine the energies from all the threads.
+
+    if (totalEnergy != NULL) {
+        double directEnergy = 0;
+        for (int i = 0; i < numThreads; i++)
+            directEnergy += threadEnergy[i];
+        *totalEnergy += directEnergy;
+    }
+}
+
+void CpuDoubleNonbondedForce::threadComputeDirect(ThreadPool& threads, int threadIndex) {
+    // Each thread processes a fixed subset of the blocks (or atoms), so the order in which contributions
+    // are added up is the same every time for a given number of threads.
+
+    int numThreads = threads.getNumThreads();
+    threadEnergy[threadIndex] = 0;
+    double* energyPtr = (includeEnergy ? &threadEnergy[threadIndex] : NULL);
+    RealVec* threadForces = NULL;
+    if (includeForces) {
+        threadForces = &threadForce[threadIndex][0];
+        for (int i = 0; i < numberOfAtoms; i++)
+            threadForces[i] = RealVec();
+    }
+    if (cutoff) {
+        // Compute the interactions from the neighbor list.  Each block contains the atoms listed in
+        // sortedAtoms, and each bit of a neighbor's exclusion mask marks one atom of the block it should
+        // not interact with.
+
+        const vector<int>& sortedAtoms = neighborList->getSortedAtoms();
+        int numBlocks = neighborList->getNumBlocks();
+        int blockSize = (numBlocks == 0 ? 0 : sortedAtoms.size()/numBlocks);
+        for (int block = threadIndex; block < numBlocks; block += numThreads) {
+            const int* blockAtom = &sortedAtoms[blockSize*block];
+            const vector<int>& neighbors = neighborList->getBlockNeighbors(block);
+            const vector<short>& blockExclusions = neighborList->getBlockExclusions(block);
+            for (int i = 0; i < (int) neighbors.size(); i++) {
+                int atom = neighbors[i];
+                int excl = blockExclusions[i];
+                for (int k = 0; k < blockSize; k++)
+                    if ((excl & (1<<k)) == 0)
+                        calculateOneIxn(blockAtom[k], atom, threadForces, energyPtr);
+            }
+        }
+    }
+    else {
+        // Loop over all atom pairs.  The exclusions are sorted, so step through them in parallel with j.
+
+        for (int i = threadIndex; i < numberOfAtoms; i += numThreads) {
+            const int* excluded = exclusions->getExclusions(i);
+            const int* lastExcluded = excluded+exclusions->getNumExclusions(i);
+            for (int j = i+1; j < numberOfAtoms; j++) {
+                while (excluded != lastExcluded && *excluded < j)
+                    excluded++;
+                if (excluded == lastExcluded || *excluded != j)
+                    calculateOneIxn(i, j, threadForces, energyPtr);
+            }
+        }
+    }
+    if (ewald || pme) {
+        // Now subtract off the exclusions, since they were implicitly included in the reciprocal space sum.
+
+        for (int i = threadIndex; i < numberOfAtoms; i += numThreads) {
+            const int* excluded = exclusions->getExclusions(i);
+            int numExcluded = exclusions->getNumExclusions(i);
+            for (int k = 0; k < numExcluded; k++) {
+                int j = excluded[k];
+                if (j <= i)
+                    continue;
+                RealVec deltaR;
+                double r2;
+                getDeltaR(atomCoordinates[j], atomCoordinates[i], deltaR, r2, false);
+                double r = sqrt(r2);
+                double inverseR = 1/r;
+                double chargeProd = ONE_4PI_EPS0*charges[i]*charges[j];
+                double alphaR = alphaEwald*r;
+                double erfAlphaR = erf(alphaR);
+                if (erfAlphaR > 1e-6) {
+                    if (includeForces) {
+                        double dEdR = chargeProd*inverseR*inverseR*inverseR;
+                        dEdR = dEdR*(erfAlphaR-TWO_OVER_SQRT_PI*alphaR*exp(-alphaR*alphaR));
+                        RealVec result = deltaR*dEdR;
+                        threadForces[i] -= result;
+                        threadForces[j] += result;
+                    }
+                    if (includeEnergy)
+                        threadEnergy[threadIndex] -= chargeProd*inverseR*erfAlphaR;
+                }
+            }
+        }
+    }
+}
+
+void CpuDoubleNonbondedForce::threadReduceForces(ThreadPool& threads, int threadIndex) {
+    // Each thread adds up the forces for a contiguous range of atoms, always in the same order.
+
+    int numThreads = threads.getNumThreads();
+    int start = threadIndex*numberOfAtoms/numThreads;
+    int end = (threadIndex+1)*numberOfAtoms/numThreads;
+    vector<RealVec>& f = *forces;
+    for (int i = start; i < end; i++)
+        for (int j = 0; j < numThreads; j++)
+            f[i] += threadForce[j][i];
+}
+
+void CpuDoubleNonbondedForce::calculateOneIxn(int ii, int jj, RealVec* forces, double* totalEnergy) const {
+    // get deltaR, R2, and R between 2 atoms
+
+    RealVec deltaR;
+    double r2;
+    getDeltaR(atomCoordinates[jj], atomCoordinates[ii], deltaR, r2, periodic);
+    if (cutoff && r2 >= cutoffDistance*cutoffDistance)
+        return;
+    double r = sqrt(r2);
+    double inverseR = 1/r;
+    double switchValue = 1, switchDeriv = 0;
+    if (useSwitch && r > switchingDistance) {
+        double t = (r-switchingDistance)/(cutoffDistance-switchingDistance);
+        switchValue = 1+t*t*t*(-10+t*(15-t*6));
+        switchDeriv = t*t*(-30+t*(60-t*30))/(cutoffDistance-switchingDistance);
+    }
+    double sig = atomParameters[ii].first + atomParameters[jj].first;
+    double sig2 = inverseR*sig;
+    sig2 *= sig2;
+    double sig6 = sig2*sig2*sig2;
+    double eps = atomParameters[ii].second*atomParameters[jj].second;
+    double dEdR = switchValue*eps*(12.0*sig6 - 6.0)*sig6;
+    double chargeProd = ONE_4PI_EPS0*charges[ii]*charges[jj];
+    double coulombEnergy;
+    if (ewald || pme) {
+        double alphaR = alphaEwald*r;
+        double erfcAlphaR = erfc(alphaR);
+        dEdR += chargeProd*inverseR*(erfcAlphaR+TWO_OVER_SQRT_PI*alphaR*exp(-alphaR*alphaR));
+        coulombEnergy = chargeProd*inverseR*erfcAlphaR;
+    }
+    else if (cutoff) {
+        dEdR += chargeProd*(inverseR-2.0*krf*r2);
+        coulombEnergy = chargeProd*(inverseR+krf*r2-crf);
+    }
+    else {
+        dEdR += chargeProd*inverseR;
+        coulombEnergy = chargeProd*inverseR;
+    }
+    dEdR *= inverseR*inverseR;
+    double energy = eps*(sig6-1.0)*sig6;
+    if (useSwitch) {
+        dEdR -= energy*switchDeriv*inverseR;
+        energy *= switchValue;
+    }
+
+    // accumulate energies
+
+    if (totalEnergy)
+        *totalEnergy += energy+coulombEnergy;
+
+    // accumulate forces
+
+    if (forces == NULL)
+        return;
+    RealVec result = deltaR*dEdR;
+    forces[ii] += result;
+    forces[jj] -= result;
+}
+
+void CpuDoubleNonbondedForce::getDeltaR(const RealVec& posI, const RealVec& posJ, RealVec& deltaR, double& r2, bool periodic) const {
+    deltaR = posJ-posI;
+    if (periodic) {
+        deltaR -= periodicBoxVectors[2]*floor(deltaR[2]*recipBoxSize[2]+0.5);
+        deltaR -= periodicBoxVectors[1]*floor(deltaR[1]*recipBoxSize[1]+0.5);
+        deltaR -= periodicBoxVectors[0]*floor(deltaR[0]*recipBoxSize[0]+0.5);
+    }
+    r2 = deltaR.dot(deltaR);
+}
@@ -0,0 +1,85 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2016 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "CpuExclusionList.h"
+#include <algorithm>
+
+using namespace OpenMM;
+using namespace std;
+
+CpuExclusionList::CpuExclusionList() : atomStart(1, 0) {
+}
+
+CpuExclusionList::CpuExclusionList(int numAtoms) : atomStart(numAtoms+1, 0) {
+}
+
+CpuExclusionList::CpuExclusionList(int numAtoms, const vector<pair<int, int> >& excludedPairs) {
+    vector<pair<int, int> > pairs;
+    pairs.reserve(2*excludedPairs.size());
+    for (int i = 0; i < (int) excludedPairs.size(); i++) {
+        pairs.push_back(excludedPairs[i]);
+        pairs.push_back(make_pair(excludedPairs[i].second, excludedPairs[i].first));
+    }
+    initialize(numAtoms, pairs);
+}
+
+CpuExclusionList::CpuExclusionList(const vector<set<int> >& exclusions) {
+    vector<pair<int, int> > pairs;
+    for (int i = 0; i < (int) exclusions.size(); i++)
+        for (set<int>::const_iterator iter = exclusions[i].begin(); iter != exclusions[i].end(); ++iter)
+            pairs.push_back(make_pair(i, *iter));
+    initialize(exclusions.size(), pairs);
+}
+
+void CpuExclusionList::initialize(int numAtoms, vector<pair<int, int> >& pairs) {
+    // Sorting the pairs groups them by the first atom, with the second atoms in increasing order.
+
+    sort(pairs.begin(), pairs.end());
+    pairs.erase(unique(pairs.begin(), pairs.end()), pairs.end());
+    atomStart.resize(numAtoms+1);
+    excludedAtoms.resize(pairs.size());
+    int nextPair = 0;
+    for (int atom = 0; atom < numAtoms; atom++) {
+        atomStart[atom] = nextPair;
+        while (nextPair < (int) pairs.size() && pairs[nextPair].first == atom) {
+            excludedAtoms[nextPair] = pairs[nextPair].second;
+            nextPair++;
+        }
+    }
+    atomStart[numAtoms] = nextPair;
+}
+
+bool CpuExclusionList::isExcluded(int atom1, int atom2) const {
+    const int* first = getExclusions(atom1);
+    const int* last = first+getNumExclusions(atom1);
+    return binary_search(first, last, atom2);
+}
@@ -25,7 +25,6 @@
 #include "CpuGBSAOBCForce.h"
 #include "SimTKOpenMMRealType.h"
 #include "openmm/internal/vectorize.h"
-#include "gmx_atomic.h"
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
@@ -47,7 +46,7 @@ public:
     CpuGBSAOBCForce& owner;
 };
 
-CpuGBSAOBCForce::CpuGBSAOBCForce() : cutoff(false), periodic(false) {
+CpuGBSAOBCForce::CpuGBSAOBCForce(int blockSize) : blockSize(blockSize), cutoff(false), periodic(false), neighborList(NULL) {
     logDX = (TABLE_MAX-TABLE_MIN)/NUM_TABLE_POINTS;
     logDXInv = 1.0f/logDX;
     logTable.resize(NUM_TABLE_POINTS+4);
@@ -57,9 +56,17 @@ CpuGBSAOBCForce::CpuGBSAOBCForce() : cutoff(false), periodic(false) {
     }
 }
 
-void CpuGBSAOBCForce::setUseCutoff(float distance) {
+CpuGBSAOBCForce::~CpuGBSAOBCForce() {
+}
+
+int CpuGBSAOBCForce::getBlockSize() const {
+    return blockSize;
+}
+
+void CpuGBSAOBCForce::setUseCutoff(float distance, const CpuNeighborList& neighbors) {
     cutoff = true;
     cutoffDistance = distance;
+    neighborList = &neighbors;
 }
 
 void CpuGBSAOBCForce::setPeriodic(float* periodicBoxSize) {
@@ -87,8 +94,17 @@ const std::vector<std::pair<float, float> >& CpuGBSAOBCForce::getParticleParamet
 
 void CpuGBSAOBCForce::setParticleParameters(const std::vector<std::pair<float, float> >& params) {
     particleParams = params;
-    bornRadii.resize(params.size()+3);
-    obcChain.resize(params.size()+3);
+    bornRadii.resize(params.size()+blockSize);
+    bornForce.resize(params.size()+blockSize);
+    obcChain.resize(params.size()+blockSize);
+    
+    // When not using a cutoff, each block interacts with all atoms that come before it.  Pad the list
+    // of atoms to fill up the last block.
+    
+    int numBlocks = (params.size()+blockSize-1)/blockSize;
+    allAtoms.resize(numBlocks*blockSize);
+    for (int i = 0; i < (int) allAtoms.size(); i++)
+        allAtoms[i] = (i < (int) params.size() ? i : 0);
 }
 
 void CpuGBSAOBCForce::computeForce(const AlignedArray<float>& posq, vector<AlignedArray<float> >& threadForce, double* totalEnergy, ThreadPool& threads) {
@@ -101,23 +117,25 @@ void CpuGBSAOBCForce::computeForce(const AlignedArray<float>& posq, vector<Align
     threadEnergy.resize(numThreads);
     threadBornForces.resize(numThreads);
     for (int i = 0; i < numThreads; i++)
-        threadBornForces[i].resize(particleParams.size()+3);
-    gmx_atomic_t counter;
-    this->atomicCounter = &counter;
-    
+        threadBornForces[i].resize(particleParams.size()+blockSize);
+    if (!cutoff) {
+        threadExclusions.resize(numThreads);
+        for (int i = 0; i < numThreads; i++)
+            threadExclusions[i].resize(particleParams.size(), 0);
+    }
     // Signal the threads to start running and wait for them to finish.
     
     ComputeTask task(*this);
-    gmx_atomic_set(&counter, 0);
     threads.execute(task);
+    threads.waitForThreads(); // Compute Born sums
+    threads.resumeThreads();
     threads.waitForThreads(); // Compute Born radii
-    gmx_atomic_set(&counter, 0);
     threads.resumeThreads();
     threads.waitForThreads(); // Compute surface area term
-    gmx_atomic_set(&counter, 0);
     threads.resumeThreads();
     threads.waitForThreads(); // First loop
-    gmx_atomic_set(&counter, 0);
+    threads.resumeThreads();
+    threads.waitForThreads(); // Sum Born forces
     threads.resumeThreads();
     threads.waitForThreads(); // Second loop
     
@@ -131,98 +149,112 @@ void CpuGBSAOBCForce::computeForce(const AlignedArray<float>& posq, vector<Align
     }
 }
 
+void CpuGBSAOBCForce::getBlockNeighbors(int blockIndex, int threadIndex, const int*& blockAtom, const int*& neighbors, const short*& exclusions, int& numNeighbors) {
+    if (cutoff) {
+        blockAtom = &neighborList->getSortedAtoms()[blockSize*blockIndex];
+        const vector<int>& blockNeighbors = neighborList->getBlockNeighbors(blockIndex);
+        numNeighbors = blockNeighbors.size();
+        if (numNeighbors > 0) {
+            neighbors = &blockNeighbors[0];
+            exclusions = &neighborList->getBlockExclusions(blockIndex)[0];
+        }
+        return;
+    }
+    
+    // Each pair of atoms within the block is computed once, and padding atoms are excluded from everything.
+    
+    int numParticles = particleParams.size();
+    int firstAtom = blockSize*blockIndex;
+    int atomsInBlock = min(blockSize, numParticles-firstAtom);
+    int blockMask = (1<<blockSize)-1;
+    int paddingMask = blockMask & ~((1<<atomsInBlock)-1);
+    vector<short>& exc = threadExclusions[threadIndex];
+    if (paddingMask != 0)
+        for (int i = 0; i < firstAtom; i++)
+            exc[i] = (short) paddingMask;
+    for (int i = 0; i < atomsInBlock; i++)
+        exc[firstAtom+i] = (short) ((blockMask & (blockMask<<i)) | paddingMask);
+    blockAtom = &allAtoms[firstAtom];
+    neighbors = &allAtoms[0];
+    exclusions = &exc[0];
+    numNeighbors = firstAtom+atomsInBlock;
+}
+
+void CpuGBSAOBCForce::clearBlockExclusions(int blockIndex, int threadIndex) {
+    if (cutoff)
+        return;
+    int numParticles = particleParams.size();
+    int end = min(blockSize*(blockIndex+1), numParticles);
+    int start = (end-blockSize*blockIndex < blockSize ? 0 : blockSize*blockIndex);
+    vector<short>& exc = threadExclusions[threadIndex];
+    for (int i = start; i < end; i++)
+        exc[i] = 0;
+}
+
 void CpuGBSAOBCForce::threadComputeForce(ThreadPool& threads, int threadIndex) {
+    // Work is divided between threads in a fixed pattern rather than handed out dynamically, so each
+    // thread's partial sums, and therefore the results, are the same every time for a given number of threads.
+
     int numParticles = particleParams.size();
     int numThreads = threads.getNumThreads();
+    int numBlocks = (cutoff ? neighborList->getNumBlocks() : (numParticles+blockSize-1)/blockSize);
     const float dielectricOffset = 0.009;
     const float alphaObc = 1.0f;
     const float betaObc = 0.8f;
     const float gammaObc = 4.85f;
     fvec4 boxSize(periodicBoxSize[0], periodicBoxSize[1], periodicBoxSize[2], 0);
     fvec4 invBoxSize((1/periodicBoxSize[0]), (1/periodicBoxSize[1]), (1/periodicBoxSize[2]), 0);
-    int start = (threadIndex*numParticles)/numThreads;
-    int end = ((threadIndex+1)*numParticles)/numThreads;
+    const int* blockAtom;
+    const int* neighbors = NULL;
+    const short* exclusions = NULL;
+    int numNeighbors;
+
+    // Accumulate the sums for the Born radii.  Until they are needed for the Born forces, each thread's
+    // array in threadBornForces holds its contributions to the sums.
+
+    AlignedArray<float>& bornForces = threadBornForces[threadIndex];
+    for (int i = 0; i < numParticles; i++)
+        bornForces[i] = 0.0f;
+    for (int blockIndex = threadIndex; blockIndex < numBlocks; blockIndex += numThreads) {
+        getBlockNeighbors(blockIndex, threadIndex, blockAtom, neighbors, exclusions, numNeighbors);
+        calculateBlockBornSum(blockAtom, neighbors, exclusions, numNeighbors, &bornForces[0], boxSize, invBoxSize);
+        clearBlockExclusions(blockIndex, threadIndex);
+    }
+    threads.syncThreads();
 
     // Calculate Born radii
 
-    while (true) {
-        int blockStart = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 4);
-        if (blockStart >= numParticles)
-            break;
-        int numInBlock = min(4, numParticles-blockStart);
-        ivec4 blockAtomIndex(blockStart, blockStart+1, blockStart+2, blockStart+3);
-        float atomRadius[4], atomx[4], atomy[4], atomz[4];
-        int blockMask[4] = {0, 0, 0, 0};
-        for (int i = 0; i < numInBlock; i++) {
-            int atomIndex = blockStart+i;
-            atomRadius[i] = particleParams[atomIndex].first;
-            atomx[i] = posq[4*atomIndex];
-            atomy[i] = posq[4*atomIndex+1];
-            atomz[i] = posq[4*atomIndex+2];
-            blockMask[i] = 0xFFFFFFFF;
-        }
-        fvec4 offsetRadiusI(atomRadius);
-        fvec4 radiusIInverse = 1.0f/offsetRadiusI;
-        fvec4 x(atomx);
-        fvec4 y(atomy);
-        fvec4 z(atomz);
-        ivec4 mask(blockMask);
-        float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
-        for (int atomJ = 0; atomJ < numParticles; atomJ++) {
-            fvec4 posJ(posq+4*atomJ);
-            fvec4 dx, dy, dz, r2;
-            getDeltaR(posJ, x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
-            ivec4 include = mask & (blockAtomIndex != ivec4(atomJ));
-            if (cutoff)
-                include = include & (r2 < cutoffDistance*cutoffDistance);
-            if (!any(include))
-                continue;
-            fvec4 r = sqrt(r2);
-            float scaledRadiusJ = particleParams[atomJ].second;
-            float scaledRadiusJ2 = scaledRadiusJ*scaledRadiusJ;
-            fvec4 rScaledRadiusJ = r + scaledRadiusJ;
-            include = include & (offsetRadiusI < rScaledRadiusJ);
-            fvec4 l_ij = 1.0f/max(offsetRadiusI, abs(r-scaledRadiusJ));
-            fvec4 u_ij = 1.0f/rScaledRadiusJ;
-            fvec4 l_ij2 = l_ij*l_ij;
-            fvec4 u_ij2 = u_ij*u_ij;
-            fvec4 rInverse = 1.0f/r;
-            fvec4 r2Inverse = rInverse*rInverse;
-            fvec4 logRatio = fastLog(u_ij/l_ij);
-            fvec4 term = l_ij - u_ij + 0.25f*r*(u_ij2 - l_ij2) + (0.5f*rInverse*logRatio) + (0.25f*scaledRadiusJ*scaledRadiusJ*rInverse)*(l_ij2 - u_ij2);
-            for (int j = 0; j < 4; j++) {
-                if (include[j]) {
-                    sum[j] += term[j];
-                    if (offsetRadiusI[j] < scaledRadiusJ-r[j])
-                        sum[j] += 2.0f*(radiusIInverse[j]-l_ij[j]);
-                }
-            }
-        }
-        for (int i = 0; i < numInBlock; i++) {
-            int atomIndex = blockStart+i;
-            sum[i] *= 0.5f*atomRadius[i];
-            float sum2 = sum[i]*sum[i];
-            float sum3 = sum[i]*sum2;
-            float tanhSum = tanh(alphaObc*sum[i] - betaObc*sum2 + gammaObc*sum3);
-            float radiusI = atomRadius[i] + dielectricOffset;
-            bornRadii[atomIndex] = 1.0f/(1.0f/atomRadius[i] - tanhSum/radiusI);
-            obcChain[atomIndex] = atomRadius[i]*(alphaObc - 2.0f*betaObc*sum[i] + 3.0f*gammaObc*sum2);
+    for (int blockStart = 4*threadIndex; blockStart < numParticles; blockStart += 4*numThreads) {
+        int blockEnd = min(blockStart+4, numParticles);
+        for (int atomIndex = blockStart; atomIndex < blockEnd; atomIndex++) {
+            float atomRadius = particleParams[atomIndex].first;
+            float sum = 0.0f;
+            for (int i = 0; i < numThreads; i++)
+                sum += threadBornForces[i][atomIndex];
+            sum *= 0.5f*atomRadius;
+            float sum2 = sum*sum;
+            float sum3 = sum*sum2;
+            float tanhSum = tanh(alphaObc*sum - betaObc*sum2 + gammaObc*sum3);
+            float radiusI = atomRadius + dielectricOffset;
+            bornRadii[atomIndex] = 1.0f/(1.0f/atomRadius - tanhSum/radiusI);
+            obcChain[atomIndex] = atomRadius*(alphaObc - 2.0f*betaObc*sum + 3.0f*gammaObc*sum2);
             obcChain[atomIndex] = (1.0f - tanhSum*tanhSum)*obcChain[atomIndex]/radiusI;
         }
     }
     threads.syncThreads();
 
-    // Calculate ACE surface area term.
+    // Calculate ACE surface area term, and the self interaction term of the Born energy.
 
     const float probeRadius = 0.14f;
     double energy = 0.0;
-    AlignedArray<float>& bornForces = threadBornForces[threadIndex];
     for (int i = 0; i < numParticles; i++)
         bornForces[i] = 0.0f;
-    while (true) {
-        int atomI = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 1);
-        if (atomI >= numParticles)
-            break;
+    float preFactor;
+    if (soluteDielectric != 0.0f && solventDielectric != 0.0f)
+        preFactor = ONE_4PI_EPS0*((1.0f/solventDielectric) - (1.0f/soluteDielectric));
+    else
+        preFactor = 0.0f;
+    for (int atomI = threadIndex; atomI < numParticles; atomI += numThreads) {
         if (bornRadii[atomI] > 0) {
             float radiusI = particleParams[atomI].first + dielectricOffset;
             float r = radiusI + probeRadius;
@@ -231,168 +263,41 @@ void CpuGBSAOBCForce::threadComputeForce(ThreadPool& threads, int threadIndex) {
             energy += saTerm;
             bornForces[atomI] = -6.0f*saTerm/bornRadii[atomI]; 
         }
-        else
-            bornForces[atomI] = 0.0f;
+        float charge = posq[4*atomI+3];
+        float selfGpol = preFactor*charge*charge/bornRadii[atomI];
+        energy += 0.5f*selfGpol;
+        bornForces[atomI] -= 0.5f*selfGpol/bornRadii[atomI];
     }
     threads.syncThreads();
  
     // First loop of Born energy computation.
 
     float* forces = &(*threadForce)[threadIndex][0];
-    float preFactor;
-    if (soluteDielectric != 0.0f && solventDielectric != 0.0f)
-        preFactor = ONE_4PI_EPS0*((1.0f/solventDielectric) - (1.0f/soluteDielectric));
-    else
-        preFactor = 0.0f;
-    while (true) {
-        int blockStart = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 4);
-        if (blockStart >= numParticles)
-            break;
-        int numInBlock = min(4, numParticles-blockStart);
-        ivec4 blockAtomIndex(blockStart, blockStart+1, blockStart+2, blockStart+3);
-        float atomCharge[4], atomx[4], atomy[4], atomz[4];
-        int blockMask[4] = {0, 0, 0, 0};
-        fvec4 blockAtomForceX(0.0f), blockAtomForceY(0.0f), blockAtomForceZ(0.0f), blockAtomBornForce(0.0f);
-        for (int i = 0; i < numInBlock; i++) {
-            int atomIndex = blockStart+i;
-            atomx[i] = posq[4*atomIndex];
-            atomy[i] = posq[4*atomIndex+1];
-            atomz[i] = posq[4*atomIndex+2];
-            atomCharge[i] = preFactor*posq[4*atomIndex+3];
-            blockMask[i] = 0xFFFFFFFF;
-        }
-        fvec4 radii(&bornRadii[blockStart]);
-        fvec4 x(atomx);
-        fvec4 y(atomy);
-        fvec4 z(atomz);
-        fvec4 partialChargeI(atomCharge);
-        ivec4 mask(blockMask);
-        for (int atomJ = blockStart; atomJ < numParticles; atomJ++) {
-            fvec4 posJ(posq+4*atomJ);
-            fvec4 dx, dy, dz, r2;
-            getDeltaR(posJ, x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
-            ivec4 include = mask & (blockAtomIndex <= ivec4(atomJ));
-            if (cutoff)
-                include = include & (r2 < cutoffDistance*cutoffDistance);
-            if (!any(include))
-                continue;
-            fvec4 r = sqrt(r2);
-            fvec4 alpha2_ij = radii*bornRadii[atomJ];
-            fvec4 D_ij = r2/(4.0f*alpha2_ij);
-            fvec4 expTerm(expf(-D_ij[0]), expf(-D_ij[1]), expf(-D_ij[2]), expf(-D_ij[3]));
-            fvec4 denominator2 = r2 + alpha2_ij*expTerm;
-            fvec4 denominator = sqrt(denominator2);
-            fvec4 Gpol = (partialChargeI*posJ[3])/denominator; 
-            fvec4 dGpol_dr = -Gpol*(1.0f - 0.25f*expTerm)/denominator2;  
-            fvec4 dGpol_dalpha2_ij = -0.5f*Gpol*expTerm*(1.0f + D_ij)/denominator2;
-            dGpol_dr = blend(0.0f, dGpol_dr, include);
-            dGpol_dalpha2_ij = blend(0.0f, dGpol_dalpha2_ij, include);
-            fvec4 fx = dx*dGpol_dr;
-            fvec4 fy = dy*dGpol_dr;
-            fvec4 fz = dz*dGpol_dr;
-            blockAtomForceX -= fx;
-            blockAtomForceY -= fy;
-            blockAtomForceZ -= fz;
-            blockAtomBornForce += dGpol_dalpha2_ij*bornRadii[atomJ];
-            float* atomForce = forces+4*atomJ;
-            fvec4 one(1.0f);
-            atomForce[0] += dot4(fx, one);
-            atomForce[1] += dot4(fy, one);
-            atomForce[2] += dot4(fz, one);
-            ivec4 atomJMask = include & (blockAtomIndex != ivec4(atomJ));
-            fvec4 termEnergy = blend(0.0f, Gpol, include);
-            if (cutoff)
-                termEnergy -= blend(0.0f, partialChargeI*posJ[3]/cutoffDistance, atomJMask);
-            termEnergy *= blend(0.5f, 1.0f, atomJMask);
-            energy += dot4(termEnergy, one);
-            bornForces[atomJ] += dot4(blend(0.0f, dGpol_dalpha2_ij, atomJMask), radii);
-        }
-        fvec4 f[4] = {blockAtomForceX, blockAtomForceY, blockAtomForceZ, 0.0f};
-        transpose(f[0], f[1], f[2], f[3]);
-        for (int i = 0; i < numInBlock; i++) {
-            int atomIndex = blockStart+i;
-            (fvec4(forces+4*atomIndex)+f[i]).store(forces+4*atomIndex);
-            bornForces[atomIndex] += blockAtomBornForce[i];
-        }
+    for (int blockIndex = threadIndex; blockIndex < numBlocks; blockIndex += numThreads) {
+        getBlockNeighbors(blockIndex, threadIndex, blockAtom, neighbors, exclusions, numNeighbors);
+        calculateBlockFirstLoop(blockAtom, neighbors, exclusions, numNeighbors, preFactor, forces, &bornForces[0], energy, boxSize, invBoxSize);
+        clearBlockExclusions(blockIndex, threadIndex);
     }
     threads.syncThreads();
 
-    // Second loop of Born energy computation.
+    // Sum the derivatives with respect to the Born radii from all threads.
 
-    while (true) {
-        int blockStart = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 4);
-        if (blockStart >= numParticles)
-            break;
-        fvec4 bornForce(0.0f);
+    for (int blockStart = 4*threadIndex; blockStart < numParticles; blockStart += 4*numThreads) {
+        fvec4 sum(0.0f);
         for (int i = 0; i < numThreads; i++)
-            bornForce += fvec4(&threadBornForces[i][blockStart]);
+            sum += fvec4(&threadBornForces[i][blockStart]);
         fvec4 radii(&bornRadii[blockStart]);
-        bornForce *= radii*radii*fvec4(&obcChain[blockStart]);
-        int numInBlock = min(4, numParticles-blockStart);
-        ivec4 blockAtomIndex(blockStart, blockStart+1, blockStart+2, blockStart+3);
-        float atomRadius[4], atomx[4], atomy[4], atomz[4];
-        int blockMask[4] = {0, 0, 0, 0};
-        fvec4 blockAtomForceX(0.0f), blockAtomForceY(0.0f), blockAtomForceZ(0.0f);
-        for (int i = 0; i < numInBlock; i++) {
-            int atomIndex = blockStart+i;
-            atomRadius[i] = particleParams[atomIndex].first;
-            atomx[i] = posq[4*atomIndex];
-            atomy[i] = posq[4*atomIndex+1];
-            atomz[i] = posq[4*atomIndex+2];
-            blockMask[i] = 0xFFFFFFFF;
-        }
-        for (int i = numInBlock; i < 4; i++) {
-            atomx[i] = 0.0f;
-            atomy[i] = 0.0f;
-            atomz[i] = 0.0f;
-        }
-        fvec4 offsetRadiusI(atomRadius);
-        fvec4 x(atomx);
-        fvec4 y(atomy);
-        fvec4 z(atomz);
-        ivec4 mask(blockMask);
-        for (int atomJ = 0; atomJ < numParticles; atomJ++) {
-            fvec4 posJ(posq+4*atomJ);
-            fvec4 dx, dy, dz, r2;
-            getDeltaR(posJ, x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
-            ivec4 include = mask & (blockAtomIndex != ivec4(atomJ));
-            if (cutoff)
-                include = include & (r2 < cutoffDistance*cutoffDistance);
-            if (!any(include))
-                continue;
-            fvec4 r = sqrt(r2);
-            float scaledRadiusJ = particleParams[atomJ].second;
-            float scaledRadiusJ2 = scaledRadiusJ*scaledRadiusJ;
-            fvec4 rScaledRadiusJ = r + scaledRadiusJ;
-            include = include & (offsetRadiusI < rScaledRadiusJ);
-            fvec4 l_ij = 1.0f/max(offsetRadiusI, abs(r-scaledRadiusJ));
-            fvec4 u_ij = 1.0f/rScaledRadiusJ;
-            fvec4 l_ij2 = l_ij*l_ij;
-            fvec4 u_ij2 = u_ij*u_ij;
-            fvec4 rInverse = 1.0f/r;
-            fvec4 r2Inverse = rInverse*rInverse;
-            fvec4 logRatio = fastLog(u_ij/l_ij);
-            fvec4 t3 = 0.125f*(1.0f + scaledRadiusJ2*r2Inverse)*(l_ij2 - u_ij2) + 0.25f*logRatio*r2Inverse;
-            fvec4 de = bornForce*t3*rInverse;
-            de = blend(0.0f, de, include);
-            fvec4 fx = dx*de;
-            fvec4 fy = dy*de;
-            fvec4 fz = dz*de;
-            blockAtomForceX += fx;
-            blockAtomForceY += fy;
-            blockAtomForceZ += fz;
-            float* atomForce = forces+4*atomJ;
-            fvec4 one(1.0f);
-            atomForce[0] -= dot4(fx, one);
-            atomForce[1] -= dot4(fy, one);
-            atomForce[2] -= dot4(fz, one);
-        }
-        fvec4 f[4] = {blockAtomForceX, blockAtomForceY, blockAtomForceZ, 0.0f};
-        transpose(f[0], f[1], f[2], f[3]);
-        for (int i = 0; i < numInBlock; i++) {
-            int atomIndex = blockStart+i;
-            (fvec4(forces+4*atomIndex)+f[i]).store(forces+4*atomIndex);
-        }
+        sum *= radii*radii*fvec4(&obcChain[blockStart]);
+        sum.store(&bornForce[blockStart]);
+    }
+    threads.syncThreads();
+
+    // Second loop of Born energy computation.
+
+    for (int blockIndex = threadIndex; blockIndex < numBlocks; blockIndex += numThreads) {
+        getBlockNeighbors(blockIndex, threadIndex, blockAtom, neighbors, exclusions, numNeighbors);
+        calculateBlockSecondLoop(blockAtom, neighbors, exclusions, numNeighbors, forces, boxSize, invBoxSize);
+        clearBlockExclusions(blockIndex, threadIndex);
     }
     threadEnergy[threadIndex] = energy;
 }
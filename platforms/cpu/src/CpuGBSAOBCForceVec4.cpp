@@ -0,0 +1,208 @@
+
+/* Portions copyright (c) 2006-2016 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "CpuGBSAOBCForceVec4.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace OpenMM;
+
+/**
+ * Factory method to create a CpuGBSAOBCForceVec4.
+ */
+CpuGBSAOBCForce* createCpuGBSAOBCForceVec4() {
+    return new CpuGBSAOBCForceVec4();
+}
+
+CpuGBSAOBCForceVec4::CpuGBSAOBCForceVec4() : CpuGBSAOBCForce(4) {
+}
+
+void CpuGBSAOBCForceVec4::loadBlockPositions(const int* blockAtom, fvec4& x, fvec4& y, fvec4& z, fvec4& q) const {
+    x = fvec4(posq+4*blockAtom[0]);
+    y = fvec4(posq+4*blockAtom[1]);
+    z = fvec4(posq+4*blockAtom[2]);
+    q = fvec4(posq+4*blockAtom[3]);
+    transpose(x, y, z, q);
+}
+
+ivec4 CpuGBSAOBCForceVec4::getIncludeMask(short exclusions) {
+    if (exclusions == 0)
+        return ivec4(-1);
+    return ivec4(exclusions&1 ? 0 : -1, exclusions&2 ? 0 : -1, exclusions&4 ? 0 : -1, exclusions&8 ? 0 : -1);
+}
+
+fvec4 CpuGBSAOBCForceVec4::computeBornSumTerm(const fvec4& radiusI, const fvec4& scaledRadiusJ, const fvec4& r, const fvec4& rInverse) {
+    fvec4 l_ij = 1.0f/max(radiusI, abs(r-scaledRadiusJ));
+    fvec4 u_ij = 1.0f/(r+scaledRadiusJ);
+    fvec4 l_ij2 = l_ij*l_ij;
+    fvec4 u_ij2 = u_ij*u_ij;
+    fvec4 logRatio = fastLog(u_ij/l_ij);
+    fvec4 term = l_ij - u_ij + 0.25f*r*(u_ij2 - l_ij2) + (0.5f*rInverse*logRatio) + (0.25f*scaledRadiusJ*scaledRadiusJ*rInverse)*(l_ij2 - u_ij2);
+    return term + blend(0.0f, 2.0f*(1.0f/radiusI-l_ij), radiusI < scaledRadiusJ-r);
+}
+
+fvec4 CpuGBSAOBCForceVec4::computeBornForceTerm(const fvec4& radiusI, const fvec4& scaledRadiusJ, const fvec4& r, const fvec4& r2Inverse) {
+    fvec4 l_ij = 1.0f/max(radiusI, abs(r-scaledRadiusJ));
+    fvec4 u_ij = 1.0f/(r+scaledRadiusJ);
+    fvec4 l_ij2 = l_ij*l_ij;
+    fvec4 u_ij2 = u_ij*u_ij;
+    fvec4 logRatio = fastLog(u_ij/l_ij);
+    return 0.125f*(1.0f + scaledRadiusJ*scaledRadiusJ*r2Inverse)*(l_ij2 - u_ij2) + 0.25f*logRatio*r2Inverse;
+}
+
+void CpuGBSAOBCForceVec4::calculateBlockBornSum(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float* bornSum, const fvec4& boxSize, const fvec4& invBoxSize) {
+    fvec4 x, y, z, q;
+    loadBlockPositions(blockAtom, x, y, z, q);
+    fvec4 blockRadius(particleParams[blockAtom[0]].first, particleParams[blockAtom[1]].first, particleParams[blockAtom[2]].first, particleParams[blockAtom[3]].first);
+    fvec4 blockScaledRadius(particleParams[blockAtom[0]].second, particleParams[blockAtom[1]].second, particleParams[blockAtom[2]].second, particleParams[blockAtom[3]].second);
+    fvec4 blockSum(0.0f);
+    fvec4 one(1.0f);
+    for (int i = 0; i < numNeighbors; i++) {
+        int atom = neighbors[i];
+        fvec4 dx, dy, dz, r2;
+        getDeltaR(fvec4(posq+4*atom), x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
+        ivec4 include = getIncludeMask(exclusions[i]);
+        if (cutoff)
+            include = include & (r2 < cutoffDistance*cutoffDistance);
+        if (!any(include))
+            continue;
+        fvec4 r = sqrt(r2);
+        fvec4 rInverse = 1.0f/r;
+        fvec4 atomRadius(particleParams[atom].first);
+        fvec4 atomScaledRadius(particleParams[atom].second);
+
+        // The neighbor contributes to the sums of the block atoms, and the block atoms contribute to the sum of the neighbor.
+
+        fvec4 term = computeBornSumTerm(blockRadius, atomScaledRadius, r, rInverse);
+        blockSum += blend(0.0f, term, include & (blockRadius < r+atomScaledRadius));
+        term = computeBornSumTerm(atomRadius, blockScaledRadius, r, rInverse);
+        bornSum[atom] += dot4(blend(0.0f, term, include & (atomRadius < r+blockScaledRadius)), one);
+    }
+    for (int j = 0; j < 4; j++)
+        bornSum[blockAtom[j]] += blockSum[j];
+}
+
+void CpuGBSAOBCForceVec4::calculateBlockFirstLoop(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float preFactor, float* forces, float* bornForces, double& energy, const fvec4& boxSize, const fvec4& invBoxSize) {
+    fvec4 x, y, z, q;
+    loadBlockPositions(blockAtom, x, y, z, q);
+    fvec4 partialChargeI = preFactor*q;
+    fvec4 radii(bornRadii[blockAtom[0]], bornRadii[blockAtom[1]], bornRadii[blockAtom[2]], bornRadii[blockAtom[3]]);
+    fvec4 blockAtomForceX(0.0f), blockAtomForceY(0.0f), blockAtomForceZ(0.0f), blockAtomBornForce(0.0f);
+    fvec4 one(1.0f);
+    for (int i = 0; i < numNeighbors; i++) {
+        int atom = neighbors[i];
+        fvec4 posJ(posq+4*atom);
+        fvec4 dx, dy, dz, r2;
+        getDeltaR(posJ, x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
+        ivec4 include = getIncludeMask(exclusions[i]);
+        if (cutoff)
+            include = include & (r2 < cutoffDistance*cutoffDistance);
+        if (!any(include))
+            continue;
+        float bornRadiusJ = bornRadii[atom];
+        fvec4 alpha2_ij = radii*bornRadiusJ;
+        fvec4 D_ij = r2/(4.0f*alpha2_ij);
+        fvec4 expTerm(expf(-D_ij[0]), expf(-D_ij[1]), expf(-D_ij[2]), expf(-D_ij[3]));
+        fvec4 denominator2 = r2 + alpha2_ij*expTerm;
+        fvec4 denominator = sqrt(denominator2);
+        fvec4 chargeProd = partialChargeI*posJ[3];
+        fvec4 Gpol = chargeProd/denominator; 
+        fvec4 dGpol_dr = -Gpol*(1.0f - 0.25f*expTerm)/denominator2;  
+        fvec4 dGpol_dalpha2_ij = -0.5f*Gpol*expTerm*(1.0f + D_ij)/denominator2;
+        dGpol_dr = blend(0.0f, dGpol_dr, include);
+        dGpol_dalpha2_ij = blend(0.0f, dGpol_dalpha2_ij, include);
+        fvec4 fx = dx*dGpol_dr;
+        fvec4 fy = dy*dGpol_dr;
+        fvec4 fz = dz*dGpol_dr;
+        blockAtomForceX -= fx;
+        blockAtomForceY -= fy;
+        blockAtomForceZ -= fz;
+        float* atomForce = forces+4*atom;
+        atomForce[0] += dot4(fx, one);
+        atomForce[1] += dot4(fy, one);
+        atomForce[2] += dot4(fz, one);
+        if (includeEnergy) {
+            fvec4 termEnergy = Gpol;
+            if (cutoff)
+                termEnergy -= chargeProd/cutoffDistance;
+            energy += dot4(blend(0.0f, termEnergy, include), one);
+        }
+        blockAtomBornForce += dGpol_dalpha2_ij*bornRadiusJ;
+        bornForces[atom] += dot4(dGpol_dalpha2_ij, radii);
+    }
+    fvec4 f[4] = {blockAtomForceX, blockAtomForceY, blockAtomForceZ, 0.0f};
+    transpose(f[0], f[1], f[2], f[3]);
+    for (int j = 0; j < 4; j++) {
+        (fvec4(forces+4*blockAtom[j])+f[j]).store(forces+4*blockAtom[j]);
+        bornForces[blockAtom[j]] += blockAtomBornForce[j];
+    }
+}
+
+void CpuGBSAOBCForceVec4::calculateBlockSecondLoop(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float* forces, const fvec4& boxSize, const fvec4& invBoxSize) {
+    fvec4 x, y, z, q;
+    loadBlockPositions(blockAtom, x, y, z, q);
+    fvec4 blockRadius(particleParams[blockAtom[0]].first, particleParams[blockAtom[1]].first, particleParams[blockAtom[2]].first, particleParams[blockAtom[3]].first);
+    fvec4 blockScaledRadius(particleParams[blockAtom[0]].second, particleParams[blockAtom[1]].second, particleParams[blockAtom[2]].second, particleParams[blockAtom[3]].second);
+    fvec4 blockBornForce(bornForce[blockAtom[0]], bornForce[blockAtom[1]], bornForce[blockAtom[2]], bornForce[blockAtom[3]]);
+    fvec4 blockAtomForceX(0.0f), blockAtomForceY(0.0f), blockAtomForceZ(0.0f);
+    fvec4 one(1.0f);
+    for (int i = 0; i < numNeighbors; i++) {
+        int atom = neighbors[i];
+        fvec4 dx, dy, dz, r2;
+        getDeltaR(fvec4(posq+4*atom), x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
+        ivec4 include = getIncludeMask(exclusions[i]);
+        if (cutoff)
+            include = include & (r2 < cutoffDistance*cutoffDistance);
+        if (!any(include))
+            continue;
+        fvec4 r = sqrt(r2);
+        fvec4 rInverse = 1.0f/r;
+        fvec4 r2Inverse = rInverse*rInverse;
+        fvec4 atomRadius(particleParams[atom].first);
+        fvec4 atomScaledRadius(particleParams[atom].second);
+
+        // Compute the force from the block atoms' Born radii depending on the neighbor's position, and
+        // from the neighbor's Born radius depending on the block atoms' positions.
+
+        fvec4 t3 = computeBornForceTerm(blockRadius, atomScaledRadius, r, r2Inverse);
+        fvec4 de = blend(0.0f, blockBornForce*t3*rInverse, include & (blockRadius < r+atomScaledRadius));
+        t3 = computeBornForceTerm(atomRadius, blockScaledRadius, r, r2Inverse);
+        de += blend(0.0f, bornForce[atom]*t3*rInverse, include & (atomRadius < r+blockScaledRadius));
+        fvec4 fx = dx*de;
+        fvec4 fy = dy*de;
+        fvec4 fz = dz*de;
+        blockAtomForceX += fx;
+        blockAtomForceY += fy;
+        blockAtomForceZ += fz;
+        float* atomForce = forces+4*atom;
+        atomForce[0] -= dot4(fx, one);
+        atomForce[1] -= dot4(fy, one);
+        atomForce[2] -= dot4(fz, one);
+    }
+    fvec4 f[4] = {blockAtomForceX, blockAtomForceY, blockAtomForceZ, 0.0f};
+    transpose(f[0], f[1], f[2], f[3]);
+    for (int j = 0; j < 4; j++)
+        (fvec4(forces+4*blockAtom[j])+f[j]).store(forces+4*blockAtom[j]);
+}
@@ -0,0 +1,252 @@
+
+/* Portions copyright (c) 2006-2016 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "CpuGBSAOBCForceVec8.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace OpenMM;
+
+#ifdef _MSC_VER
+    // Workaround for a compiler bug in Visual Studio 10. Hopefully we can remove this
+    // once we move to a later version.
+    #undef __AVX__
+#endif
+
+#ifndef __AVX__
+CpuGBSAOBCForce* createCpuGBSAOBCForceVec8() {
+    throw OpenMMException("Internal error: OpenMM was compiled without AVX support");
+}
+#else
+/**
+ * Factory method to create a CpuGBSAOBCForceVec8.
+ */
+CpuGBSAOBCForce* createCpuGBSAOBCForceVec8() {
+    return new CpuGBSAOBCForceVec8();
+}
+
+CpuGBSAOBCForceVec8::CpuGBSAOBCForceVec8() : CpuGBSAOBCForce(8) {
+}
+
+void CpuGBSAOBCForceVec8::loadBlockPositions(const int* blockAtom, fvec8& x, fvec8& y, fvec8& z, fvec8& q) const {
+    fvec4 blockAtomPosq[8];
+    for (int i = 0; i < 8; i++)
+        blockAtomPosq[i] = fvec4(posq+4*blockAtom[i]);
+    transpose(blockAtomPosq[0], blockAtomPosq[1], blockAtomPosq[2], blockAtomPosq[3], blockAtomPosq[4], blockAtomPosq[5], blockAtomPosq[6], blockAtomPosq[7], x, y, z, q);
+}
+
+fvec8 CpuGBSAOBCForceVec8::loadBlockValues(const int* blockAtom, const float* values) {
+    return fvec8(values[blockAtom[0]], values[blockAtom[1]], values[blockAtom[2]], values[blockAtom[3]], values[blockAtom[4]], values[blockAtom[5]], values[blockAtom[6]], values[blockAtom[7]]);
+}
+
+ivec8 CpuGBSAOBCForceVec8::getIncludeMask(short exclusions) {
+    if (exclusions == 0)
+        return ivec8(-1);
+    return ivec8(exclusions&1 ? 0 : -1, exclusions&2 ? 0 : -1, exclusions&4 ? 0 : -1, exclusions&8 ? 0 : -1, exclusions&16 ? 0 : -1, exclusions&32 ? 0 : -1, exclusions&64 ? 0 : -1, exclusions&128 ? 0 : -1);
+}
+
+void CpuGBSAOBCForceVec8::getDeltaR(const fvec4& posI, const fvec8& x, const fvec8& y, const fvec8& z, fvec8& dx, fvec8& dy, fvec8& dz, fvec8& r2, bool periodic, const fvec4& boxSize, const fvec4& invBoxSize) const {
+    dx = x-posI[0];
+    dy = y-posI[1];
+    dz = z-posI[2];
+    if (periodic) {
+        dx -= round(dx*invBoxSize[0])*boxSize[0];
+        dy -= round(dy*invBoxSize[1])*boxSize[1];
+        dz -= round(dz*invBoxSize[2])*boxSize[2];
+    }
+    r2 = dx*dx + dy*dy + dz*dz;
+}
+
+fvec8 CpuGBSAOBCForceVec8::fastLog(const fvec8& x) {
+    fvec4 lower = CpuGBSAOBCForce::fastLog(x.lowerVec());
+    fvec4 upper = CpuGBSAOBCForce::fastLog(x.upperVec());
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lower), upper, 1);
+}
+
+fvec8 CpuGBSAOBCForceVec8::computeBornSumTerm(const fvec8& radiusI, const fvec8& scaledRadiusJ, const fvec8& r, const fvec8& rInverse) {
+    fvec8 l_ij = 1.0f/max(radiusI, abs(r-scaledRadiusJ));
+    fvec8 u_ij = 1.0f/(r+scaledRadiusJ);
+    fvec8 l_ij2 = l_ij*l_ij;
+    fvec8 u_ij2 = u_ij*u_ij;
+    fvec8 logRatio = fastLog(u_ij/l_ij);
+    fvec8 term = l_ij - u_ij + 0.25f*r*(u_ij2 - l_ij2) + (0.5f*rInverse*logRatio) + (0.25f*scaledRadiusJ*scaledRadiusJ*rInverse)*(l_ij2 - u_ij2);
+    return term + blend(0.0f, 2.0f*(1.0f/radiusI-l_ij), radiusI < scaledRadiusJ-r);
+}
+
+fvec8 CpuGBSAOBCForceVec8::computeBornForceTerm(const fvec8& radiusI, const fvec8& scaledRadiusJ, const fvec8& r, const fvec8& r2Inverse) {
+    fvec8 l_ij = 1.0f/max(radiusI, abs(r-scaledRadiusJ));
+    fvec8 u_ij = 1.0f/(r+scaledRadiusJ);
+    fvec8 l_ij2 = l_ij*l_ij;
+    fvec8 u_ij2 = u_ij*u_ij;
+    fvec8 logRatio = fastLog(u_ij/l_ij);
+    return 0.125f*(1.0f + scaledRadiusJ*scaledRadiusJ*r2Inverse)*(l_ij2 - u_ij2) + 0.25f*logRatio*r2Inverse;
+}
+
+void CpuGBSAOBCForceVec8::calculateBlockBornSum(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float* bornSum, const fvec4& boxSize, const fvec4& invBoxSize) {
+    fvec8 x, y, z, q;
+    loadBlockPositions(blockAtom, x, y, z, q);
+    fvec8 blockRadius(particleParams[blockAtom[0]].first, particleParams[blockAtom[1]].first, particleParams[blockAtom[2]].first, particleParams[blockAtom[3]].first,
+                      particleParams[blockAtom[4]].first, particleParams[blockAtom[5]].first, particleParams[blockAtom[6]].first, particleParams[blockAtom[7]].first);
+    fvec8 blockScaledRadius(particleParams[blockAtom[0]].second, particleParams[blockAtom[1]].second, particleParams[blockAtom[2]].second, particleParams[blockAtom[3]].second,
+                            particleParams[blockAtom[4]].second, particleParams[blockAtom[5]].second, particleParams[blockAtom[6]].second, particleParams[blockAtom[7]].second);
+    fvec8 blockSum(0.0f);
+    fvec8 one(1.0f);
+    for (int i = 0; i < numNeighbors; i++) {
+        int atom = neighbors[i];
+        fvec8 dx, dy, dz, r2;
+        getDeltaR(fvec4(posq+4*atom), x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
+        ivec8 include = getIncludeMask(exclusions[i]);
+        if (cutoff)
+            include = include & (r2 < cutoffDistance*cutoffDistance);
+        if (!any(include))
+            continue;
+        fvec8 r = sqrt(r2);
+        fvec8 rInverse = 1.0f/r;
+        fvec8 atomRadius(particleParams[atom].first);
+        fvec8 atomScaledRadius(particleParams[atom].second);
+
+        // The neighbor contributes to the sums of the block atoms, and the block atoms contribute to the sum of the neighbor.
+
+        fvec8 term = computeBornSumTerm(blockRadius, atomScaledRadius, r, rInverse);
+        blockSum += blend(0.0f, term, include & (blockRadius < r+atomScaledRadius));
+        term = computeBornSumTerm(atomRadius, blockScaledRadius, r, rInverse);
+        bornSum[atom] += dot8(blend(0.0f, term, include & (atomRadius < r+blockScaledRadius)), one);
+    }
+    float sum[8];
+    blockSum.store(sum);
+    for (int j = 0; j < 8; j++)
+        bornSum[blockAtom[j]] += sum[j];
+}
+
+void CpuGBSAOBCForceVec8::calculateBlockFirstLoop(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float preFactor, float* forces, float* bornForces, double& energy, const fvec4& boxSize, const fvec4& invBoxSize) {
+    fvec8 x, y, z, q;
+    loadBlockPositions(blockAtom, x, y, z, q);
+    fvec8 partialChargeI = preFactor*q;
+    fvec8 radii = loadBlockValues(blockAtom, &bornRadii[0]);
+    fvec8 blockAtomForceX(0.0f), blockAtomForceY(0.0f), blockAtomForceZ(0.0f), blockAtomBornForce(0.0f);
+    fvec8 one(1.0f);
+    float D[8];
+    for (int i = 0; i < numNeighbors; i++) {
+        int atom = neighbors[i];
+        fvec4 posJ(posq+4*atom);
+        fvec8 dx, dy, dz, r2;
+        getDeltaR(posJ, x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
+        ivec8 include = getIncludeMask(exclusions[i]);
+        if (cutoff)
+            include = include & (r2 < cutoffDistance*cutoffDistance);
+        if (!any(include))
+            continue;
+        float bornRadiusJ = bornRadii[atom];
+        fvec8 alpha2_ij = radii*bornRadiusJ;
+        fvec8 D_ij = r2/(4.0f*alpha2_ij);
+        D_ij.store(D);
+        fvec8 expTerm(expf(-D[0]), expf(-D[1]), expf(-D[2]), expf(-D[3]), expf(-D[4]), expf(-D[5]), expf(-D[6]), expf(-D[7]));
+        fvec8 denominator2 = r2 + alpha2_ij*expTerm;
+        fvec8 denominator = sqrt(denominator2);
+        fvec8 chargeProd = partialChargeI*posJ[3];
+        fvec8 Gpol = chargeProd/denominator; 
+        fvec8 dGpol_dr = -Gpol*(1.0f - 0.25f*expTerm)/denominator2;  
+        fvec8 dGpol_dalpha2_ij = -0.5f*Gpol*expTerm*(1.0f + D_ij)/denominator2;
+        dGpol_dr = blend(0.0f, dGpol_dr, include);
+        dGpol_dalpha2_ij = blend(0.0f, dGpol_dalpha2_ij, include);
+        fvec8 fx = dx*dGpol_dr;
+        fvec8 fy = dy*dGpol_dr;
+        fvec8 fz = dz*dGpol_dr;
+        blockAtomForceX -= fx;
+        blockAtomForceY -= fy;
+        blockAtomForceZ -= fz;
+        float* atomForce = forces+4*atom;
+        atomForce[0] += dot8(fx, one);
+        atomForce[1] += dot8(fy, one);
+        atomForce[2] += dot8(fz, one);
+        if (includeEnergy) {
+            fvec8 termEnergy = Gpol;
+            if (cutoff)
+                termEnergy -= chargeProd/cutoffDistance;
+            energy += dot8(blend(0.0f, termEnergy, include), one);
+        }
+        blockAtomBornForce += dGpol_dalpha2_ij*bornRadiusJ;
+        bornForces[atom] += dot8(dGpol_dalpha2_ij, radii);
+    }
+    fvec4 f[8];
+    transpose(blockAtomForceX, blockAtomForceY, blockAtomForceZ, 0.0f, f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7]);
+    float blockBornForce[8];
+    blockAtomBornForce.store(blockBornForce);
+    for (int j = 0; j < 8; j++) {
+        (fvec4(forces+4*blockAtom[j])+f[j]).store(forces+4*blockAtom[j]);
+        bornForces[blockAtom[j]] += blockBornForce[j];
+    }
+}
+
+void CpuGBSAOBCForceVec8::calculateBlockSecondLoop(const int* blockAtom, const int* neighbors, const short* exclusions, int numNeighbors, float* forces, const fvec4& boxSize, const fvec4& invBoxSize) {
+    fvec8 x, y, z, q;
+    loadBlockPositions(blockAtom, x, y, z, q);
+    fvec8 blockRadius(particleParams[blockAtom[0]].first, particleParams[blockAtom[1]].first, particleParams[blockAtom[2]].first, particleParams[blockAtom[3]].first,
+                      particleParams[blockAtom[4]].first, particleParams[blockAtom[5]].first, particleParams[blockAtom[6]].first, particleParams[blockAtom[7]].first);
+    fvec8 blockScaledRadius(particleParams[blockAtom[0]].second, particleParams[blockAtom[1]].second, particleParams[blockAtom[2]].second, particleParams[blockAtom[3]].second,
+                            particleParams[blockAtom[4]].second, particleParams[blockAtom[5]].second, particleParams[blockAtom[6]].second, particleParams[blockAtom[7]].second);
+    fvec8 blockBornForce = loadBlockValues(blockAtom, &bornForce[0]);
+    fvec8 blockAtomForceX(0.0f), blockAtomForceY(0.0f), blockAtomForceZ(0.0f);
+    fvec8 one(1.0f);
+    for (int i = 0; i < numNeighbors; i++) {
+        int atom = neighbors[i];
+        fvec8 dx, dy, dz, r2;
+        getDeltaR(fvec4(posq+4*atom), x, y, z, dx, dy, dz, r2, periodic, boxSize, invBoxSize);
+        ivec8 include = getIncludeMask(exclusions[i]);
+        if (cutoff)
+            include = include & (r2 < cutoffDistance*cutoffDistance);
+        if (!any(include))
+            continue;
+        fvec8 r = sqrt(r2);
+        fvec8 rInverse = 1.0f/r;
+        fvec8 r2Inverse = rInverse*rInverse;
+        fvec8 atomRadius(particleParams[atom].first);
+        fvec8 atomScaledRadius(particleParams[atom].second);
+
+        // Compute the force from the block atoms' Born radii depending on the neighbor's position, and
+        // from the neighbor's Born radius depending on the block atoms' positions.
+
+        fvec8 t3 = computeBornForceTerm(blockRadius, atomScaledRadius, r, r2Inverse);
+        fvec8 de = blend(0.0f, blockBornForce*t3*rInverse, include & (blockRadius < r+atomScaledRadius));
+        t3 = computeBornForceTerm(atomRadius, blockScaledRadius, r, r2Inverse);
+        de += blend(0.0f, bornForce[atom]*t3*rInverse, include & (atomRadius < r+blockScaledRadius));
+        fvec8 fx = dx*de;
+        fvec8 fy = dy*de;
+        fvec8 fz = dz*de;
+        blockAtomForceX += fx;
+        blockAtomForceY += fy;
+        blockAtomForceZ += fz;
+        float* atomForce = forces+4*atom;
+        atomForce[0] -= dot8(fx, one);
+        atomForce[1] -= dot8(fy, one);
+        atomForce[2] -= dot8(fz, one);
+    }
+    fvec4 f[8];
+    transpose(blockAtomForceX, blockAtomForceY, blockAtomForceZ, 0.0f, f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7]);
+    for (int j = 0; j < 8; j++)
+        (fvec4(forces+4*blockAtom[j])+f[j]).store(forces+4*blockAtom[j]);
+}
+#endif
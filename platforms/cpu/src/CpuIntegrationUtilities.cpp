@@ -0,0 +1,57 @@
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2015 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "CpuIntegrationUtilities.h"
+#include "openmm/internal/vectorize.h"
+#include <cfloat>
+
+using namespace OpenMM;
+
+const int CpuIntegrationUtilities::ErrorBlockSize = 256;
+
+double CpuIntegrationUtilities::computeBlockError(const RealVec* forces, const RealOpenMM* inverseMasses, int start, int end) {
+    fvec4 sum(0.0f);
+    for (int i = start; i < end; i++) {
+        RealOpenMM invMass = inverseMasses[i];
+        fvec4 xerror((float) (invMass*forces[i][0]), (float) (invMass*forces[i][1]), (float) (invMass*forces[i][2]), 0.0f);
+        sum += xerror*xerror;
+    }
+    if (sum[0] <= FLT_MAX && sum[1] <= FLT_MAX && sum[2] <= FLT_MAX)
+        return (double) sum[0]+sum[1]+sum[2];
+    double error = 0.0;
+    for (int i = start; i < end; i++)
+        for (int j = 0; j < 3; j++) {
+            double xerror = inverseMasses[i]*forces[i][j];
+            error += xerror*xerror;
+        }
+    return error;
+}
@@ -32,6 +32,7 @@
 #include "CpuKernelFactory.h"
 #include "CpuKernels.h"
 #include "CpuPlatform.h"
+#include "ReferenceKernelFactory.h"
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/OpenMMException.h"
 
@@ -39,12 +40,32 @@ using namespace OpenMM;
 
 KernelImpl* CpuKernelFactory::createKernelImpl(std::string name, const Platform& platform, ContextImpl& context) const {
     CpuPlatform::PlatformData& data = CpuPlatform::getPlatformData(context);
+    if (data.useDoublePrecision) {
+        // These kernels compute forces in single precision, so use the Reference versions instead.  They are
+        // single threaded and not vectorized.  NonbondedForce is not listed here, since CpuCalcNonbondedForceKernel
+        // has its own threaded double precision implementation.
+
+        if (name == CalcCustomNonbondedForceKernel::Name() ||
+                name == CalcCustomManyParticleForceKernel::Name() || name == CalcGBSAOBCForceKernel::Name() ||
+                name == CalcCustomGBForceKernel::Name() || name == CalcCMAPTorsionForceKernel::Name()) {
+            ReferenceKernelFactory referenceFactory;
+            return referenceFactory.createKernelImpl(name, platform, context);
+        }
+    }
     if (name == CalcForcesAndEnergyKernel::Name())
         return new CpuCalcForcesAndEnergyKernel(name, platform, data, context);
+    if (name == UpdateStateDataKernel::Name())
+        return new CpuUpdateStateDataKernel(name, platform, *static_cast<ReferencePlatform::PlatformData*>(context.getPlatformData()), data);
+    if (name == CalcHarmonicBondForceKernel::Name())
+        return new CpuCalcHarmonicBondForceKernel(name, platform, data);
+    if (name == CalcHarmonicAngleForceKernel::Name())
+        return new CpuCalcHarmonicAngleForceKernel(name, platform, data);
     if (name == CalcPeriodicTorsionForceKernel::Name())
         return new CpuCalcPeriodicTorsionForceKernel(name, platform, data);
     if (name == CalcRBTorsionForceKernel::Name())
         return new CpuCalcRBTorsionForceKernel(name, platform, data);
+    if (name == CalcCMAPTorsionForceKernel::Name())
+        return new CpuCalcCMAPTorsionForceKernel(name, platform, data);
     if (name == CalcNonbondedForceKernel::Name())
         return new CpuCalcNonbondedForceKernel(name, platform, data);
     if (name == CalcCustomNonbondedForceKernel::Name())
@@ -57,5 +78,9 @@ KernelImpl* CpuKernelFactory::createKernelImpl(std::string name, const Platform&
         return new CpuCalcCustomGBForceKernel(name, platform, data);
     if (name == IntegrateLangevinStepKernel::Name())
         return new CpuIntegrateLangevinStepKernel(name, platform, data);
+    if (name == IntegrateVariableLangevinStepKernel::Name())
+        return new CpuIntegrateVariableLangevinStepKernel(name, platform, data);
+    if (name == IntegrateVariableVerletStepKernel::Name())
+        return new CpuIntegrateVariableVerletStepKernel(name, platform, data);
     throw OpenMMException((std::string("Tried to create kernel with illegal kernel name '") + name + "'").c_str());
 }
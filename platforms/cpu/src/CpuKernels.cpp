@@ -40,15 +40,18 @@
 #include "ReferenceTabulatedFunction.h"
 #include "openmm/Context.h"
 #include "openmm/OpenMMException.h"
+#include "openmm/internal/CMAPTorsionForceImpl.h"
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/internal/CustomNonbondedForceImpl.h"
 #include "openmm/internal/NonbondedForceImpl.h"
+#include "openmm/internal/timer.h"
 #include "openmm/internal/vectorize.h"
 #include "RealVec.h"
 #include "lepton/CompiledExpression.h"
 #include "lepton/CustomFunction.h"
 #include "lepton/Parser.h"
 #include "lepton/ParsedExpression.h"
+#include <iostream>
 
 using namespace OpenMM;
 using namespace std;
@@ -83,6 +86,21 @@ static ReferenceConstraints& extractConstraints(ContextImpl& context) {
     return *(ReferenceConstraints*) data->constraints;
 }
 
+/**
+ * Build a neighbor list.  If profiling is enabled, this also records how long it took.
+ */
+static void buildNeighborList(ContextImpl& context, CpuNeighborList& neighborList, int numAtoms, const AlignedArray<float>& posq,
+        const CpuExclusionList& exclusions, const RealVec* boxVectors, bool periodic, float cutoff, ThreadPool& threads) {
+    if (context.getProfilingEnabled()) {
+        double start = getCurrentTime();
+        neighborList.computeNeighborList(numAtoms, posq, exclusions, boxVectors, periodic, cutoff, threads);
+        context.addProfilingData("neighbor_list", getCurrentTime()-start);
+        context.addProfilingData("neighbor_list_builds", 1);
+    }
+    else
+        neighborList.computeNeighborList(numAtoms, posq, exclusions, boxVectors, periodic, cutoff, threads);
+}
+
 /**
  * Compute the kinetic energy of the system, possibly shifting the velocities in time to account
  * for a leapfrog integrator.
@@ -145,7 +163,8 @@ public:
 
 class CpuCalcForcesAndEnergyKernel::InitForceTask : public ThreadPool::Task {
 public:
-    InitForceTask(int numParticles, ContextImpl& context, CpuPlatform::PlatformData& data) : numParticles(numParticles), positionsValid(true), context(context), data(data) {
+    InitForceTask(int numParticles, bool includeForce, ContextImpl& context, CpuPlatform::PlatformData& data) : numParticles(numParticles), includeForce(includeForce),
+            positionsValid(true), context(context), data(data) {
     }
     void execute(ThreadPool& threads, int threadIndex) {
         // Convert the positions to single precision and apply periodic boundary conditions
@@ -195,14 +214,17 @@ public:
             if (posq[i] != posq[i] || posq[i+1] != posq[i+1] || posq[i+2] != posq[i+2])
                 positionsValid = false;
 
-        // Clear the forces.
+        // Clear the forces.  When only computing the energy, the forces are never summed, so there
+        // is no need to clear them.
 
-        fvec4 zero(0.0f);
-        for (int j = 0; j < numParticles; j++)
-            zero.store(&data.threadForce[threadIndex][j*4]);
+        if (includeForce) {
+            fvec4 zero(0.0f);
+            for (int j = 0; j < numParticles; j++)
+                zero.store(&data.threadForce[threadIndex][j*4]);
+        }
     }
     int numParticles;
-    bool positionsValid;
+    bool includeForce, positionsValid;
     ContextImpl& context;
     CpuPlatform::PlatformData& data;
 };
@@ -220,11 +242,14 @@ void CpuCalcForcesAndEnergyKernel::initialize(const System& system) {
 }
 
 void CpuCalcForcesAndEnergyKernel::beginComputation(ContextImpl& context, bool includeForce, bool includeEnergy, int groups) {
+    // Reorder atoms first, so the forces saved by the Reference kernel are in the same order as the positions.
+
+    data.atomReorderer.reorderAtoms(context, includeForce);
     referenceKernel.getAs<ReferenceCalcForcesAndEnergyKernel>().beginComputation(context, includeForce, includeEnergy, groups);
     
     // Convert positions to single precision and clear the forces.
 
-    InitForceTask task(context.getSystem().getNumParticles(), context, data);
+    InitForceTask task(context.getSystem().getNumParticles(), includeForce, context, data);
     data.threads.execute(task);
     data.threads.waitForThreads();
     if (!task.positionsValid)
@@ -234,12 +259,137 @@ void CpuCalcForcesAndEnergyKernel::beginComputation(ContextImpl& context, bool i
 double CpuCalcForcesAndEnergyKernel::finishComputation(ContextImpl& context, bool includeForce, bool includeEnergy, int groups, bool& valid) {
     // Sum the forces from all the threads.
     
-    SumForceTask task(context.getSystem().getNumParticles(), extractForces(context), data);
-    data.threads.execute(task);
-    data.threads.waitForThreads();
+    if (includeForce) {
+        double start = (context.getProfilingEnabled() ? getCurrentTime() : 0.0);
+        SumForceTask task(context.getSystem().getNumParticles(), extractForces(context), data);
+        data.threads.execute(task);
+        data.threads.waitForThreads();
+        if (context.getProfilingEnabled())
+            context.addProfilingData("reduction", getCurrentTime()-start);
+    }
     return referenceKernel.getAs<ReferenceCalcForcesAndEnergyKernel>().finishComputation(context, includeForce, includeEnergy, groups, valid);
 }
 
+void CpuUpdateStateDataKernel::getPositions(ContextImpl& context, vector<Vec3>& positions) {
+    ReferenceUpdateStateDataKernel::getPositions(context, positions);
+    if (data.atomReorderer.getAtomsAreReordered()) {
+        const vector<int>& atomIndex = data.atomReorderer.getAtomIndex();
+        vector<Vec3> stored = positions;
+        for (int i = 0; i < (int) stored.size(); i++)
+            positions[atomIndex[i]] = stored[i];
+    }
+}
+
+void CpuUpdateStateDataKernel::setPositions(ContextImpl& context, const vector<Vec3>& positions) {
+    if (!data.atomReorderer.getAtomsAreReordered()) {
+        ReferenceUpdateStateDataKernel::setPositions(context, positions);
+        return;
+    }
+    const vector<int>& atomIndex = data.atomReorderer.getAtomIndex();
+    vector<Vec3> stored(atomIndex.size());
+    for (int i = 0; i < (int) stored.size(); i++)
+        stored[i] = positions[atomIndex[i]];
+    ReferenceUpdateStateDataKernel::setPositions(context, stored);
+}
+
+void CpuUpdateStateDataKernel::getPositionSubset(ContextImpl& context, const vector<int>& particles, vector<Vec3>& positions) {
+    if (!data.atomReorderer.getAtomsAreReordered()) {
+        ReferenceUpdateStateDataKernel::getPositionSubset(context, particles, positions);
+        return;
+    }
+    const vector<int>& storageIndex = data.atomReorderer.getStorageIndex();
+    vector<int> stored(particles.size());
+    for (int i = 0; i < (int) stored.size(); i++)
+        stored[i] = storageIndex[particles[i]];
+    ReferenceUpdateStateDataKernel::getPositionSubset(context, stored, positions);
+}
+
+void CpuUpdateStateDataKernel::getVelocities(ContextImpl& context, vector<Vec3>& velocities) {
+    ReferenceUpdateStateDataKernel::getVelocities(context, velocities);
+    if (data.atomReorderer.getAtomsAreReordered()) {
+        const vector<int>& atomIndex = data.atomReorderer.getAtomIndex();
+        vector<Vec3> stored = velocities;
+        for (int i = 0; i < (int) stored.size(); i++)
+            velocities[atomIndex[i]] = stored[i];
+    }
+}
+
+void CpuUpdateStateDataKernel::setVelocities(ContextImpl& context, const vector<Vec3>& velocities) {
+    if (!data.atomReorderer.getAtomsAreReordered()) {
+        ReferenceUpdateStateDataKernel::setVelocities(context, velocities);
+        return;
+    }
+    const vector<int>& atomIndex = data.atomReorderer.getAtomIndex();
+    vector<Vec3> stored(atomIndex.size());
+    for (int i = 0; i < (int) stored.size(); i++)
+        stored[i] = velocities[atomIndex[i]];
+    ReferenceUpdateStateDataKernel::setVelocities(context, stored);
+}
+
+void CpuUpdateStateDataKernel::getVelocitySubset(ContextImpl& context, const vector<int>& particles, vector<Vec3>& velocities) {
+    if (!data.atomReorderer.getAtomsAreReordered()) {
+        ReferenceUpdateStateDataKernel::getVelocitySubset(context, particles, velocities);
+        return;
+    }
+    const vector<int>& storageIndex = data.atomReorderer.getStorageIndex();
+    vector<int> stored(particles.size());
+    for (int i = 0; i < (int) stored.size(); i++)
+        stored[i] = storageIndex[particles[i]];
+    ReferenceUpdateStateDataKernel::getVelocitySubset(context, stored, velocities);
+}
+
+void CpuUpdateStateDataKernel::getForces(ContextImpl& context, vector<Vec3>& forces) {
+    ReferenceUpdateStateDataKernel::getForces(context, forces);
+    if (data.atomReorderer.getAtomsAreReordered()) {
+        const vector<int>& atomIndex = data.atomReorderer.getAtomIndex();
+        vector<Vec3> stored = forces;
+        for (int i = 0; i < (int) stored.size(); i++)
+            forces[atomIndex[i]] = stored[i];
+    }
+}
+
+void CpuUpdateStateDataKernel::createCheckpoint(ContextImpl& context, ostream& stream) {
+    // Checkpoints always store particles in their original order, so they can be loaded by any Context.
+
+    data.atomReorderer.restoreOriginalOrder(context);
+    ReferenceUpdateStateDataKernel::createCheckpoint(context, stream);
+
+    // The state of the random number generator follows the data written by the Reference platform,
+    // preceded by its own version number.
+
+    int version = 1;
+    stream.write((char*) &version, sizeof(int));
+    data.random.createCheckpoint(stream);
+}
+
+void CpuUpdateStateDataKernel::loadCheckpoint(ContextImpl& context, istream& stream) {
+    data.atomReorderer.restoreOriginalOrder(context);
+    ReferenceUpdateStateDataKernel::loadCheckpoint(context, stream);
+
+    // Checkpoints from older versions end here.  They do not include the random number generator,
+    // so it is left in its current state.
+
+    if (stream.peek() == char_traits<char>::eof())
+        return;
+    int version;
+    stream.read((char*) &version, sizeof(int));
+    if (!stream)
+        throw OpenMMException("Checkpoint data is truncated");
+    if (version != 1)
+        throw OpenMMException("Checkpoint was created with a different version of OpenMM");
+    data.random.loadCheckpoint(stream);
+}
+
+void CpuCalcHarmonicBondForceKernel::copyParametersToContext(ContextImpl& context, const HarmonicBondForce& force) {
+    data.atomReorderer.invalidateMolecules();
+    ReferenceCalcHarmonicBondForceKernel::copyParametersToContext(context, force);
+}
+
+void CpuCalcHarmonicAngleForceKernel::copyParametersToContext(ContextImpl& context, const HarmonicAngleForce& force) {
+    data.atomReorderer.invalidateMolecules();
+    ReferenceCalcHarmonicAngleForceKernel::copyParametersToContext(context, force);
+}
+
 CpuCalcPeriodicTorsionForceKernel::~CpuCalcPeriodicTorsionForceKernel() {
     if (torsionIndexArray != NULL) {
         for (int i = 0; i < numTorsions; i++) {
@@ -284,6 +434,7 @@ double CpuCalcPeriodicTorsionForceKernel::execute(ContextImpl& context, bool inc
 }
 
 void CpuCalcPeriodicTorsionForceKernel::copyParametersToContext(ContextImpl& context, const PeriodicTorsionForce& force) {
+    data.atomReorderer.invalidateMolecules();
     if (numTorsions != force.getNumTorsions())
         throw OpenMMException("updateParametersInContext: The number of torsions has changed");
 
@@ -348,6 +499,7 @@ double CpuCalcRBTorsionForceKernel::execute(ContextImpl& context, bool includeFo
 }
 
 void CpuCalcRBTorsionForceKernel::copyParametersToContext(ContextImpl& context, const RBTorsionForce& force) {
+    data.atomReorderer.invalidateMolecules();
     if (numTorsions != force.getNumTorsions())
         throw OpenMMException("updateParametersInContext: The number of torsions has changed");
 
@@ -368,6 +520,80 @@ void CpuCalcRBTorsionForceKernel::copyParametersToContext(ContextImpl& context,
     }
 }
 
+void CpuCalcCMAPTorsionForceKernel::computeMapCoefficients(const CMAPTorsionForce& force, vector<vector<vector<double> > >& coeff) {
+    int numMaps = force.getNumMaps();
+    coeff.resize(numMaps);
+    vector<double> energy;
+    for (int i = 0; i < numMaps; i++) {
+        int size;
+        force.getMapParameters(i, size, energy);
+        CMAPTorsionForceImpl::calcMapDerivatives(size, energy, coeff[i]);
+    }
+}
+
+void CpuCalcCMAPTorsionForceKernel::initialize(const System& system, const CMAPTorsionForce& force) {
+    int numMaps = force.getNumMaps();
+    int numTorsions = force.getNumTorsions();
+    mapSizes.resize(numMaps);
+    vector<double> energy;
+    for (int i = 0; i < numMaps; i++)
+        force.getMapParameters(i, mapSizes[i], energy);
+    vector<int> torsionMaps(numTorsions);
+    torsionIndices.resize(numTorsions);
+    for (int i = 0; i < numTorsions; i++) {
+        torsionIndices[i].resize(8);
+        force.getTorsionParameters(i, torsionMaps[i], torsionIndices[i][0], torsionIndices[i][1], torsionIndices[i][2],
+            torsionIndices[i][3], torsionIndices[i][4], torsionIndices[i][5], torsionIndices[i][6], torsionIndices[i][7]);
+    }
+    vector<vector<vector<double> > > coeff;
+    computeMapCoefficients(force, coeff);
+    cmap.initialize(system.getNumParticles(), torsionMaps, torsionIndices, data.threads);
+    cmap.setMapCoefficients(coeff);
+}
+
+double CpuCalcCMAPTorsionForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    vector<RealVec>& posData = extractPositions(context);
+    vector<RealVec>& forceData = extractForces(context);
+    RealOpenMM energy = 0;
+    cmap.calculateForce(posData, forceData, includeEnergy ? &energy : NULL);
+    return energy;
+}
+
+void CpuCalcCMAPTorsionForceKernel::copyParametersToContext(ContextImpl& context, const CMAPTorsionForce& force) {
+    data.atomReorderer.invalidateMolecules();
+    int numMaps = force.getNumMaps();
+    int numTorsions = force.getNumTorsions();
+    if ((int) mapSizes.size() != numMaps)
+        throw OpenMMException("updateParametersInContext: The number of maps has changed");
+    if ((int) torsionIndices.size() != numTorsions)
+        throw OpenMMException("updateParametersInContext: The number of CMAP torsions has changed");
+
+    // Update the maps.
+
+    vector<double> energy;
+    for (int i = 0; i < numMaps; i++) {
+        int size;
+        force.getMapParameters(i, size, energy);
+        if (size != mapSizes[i])
+            throw OpenMMException("updateParametersInContext: The size of a map has changed");
+    }
+    vector<vector<vector<double> > > coeff;
+    computeMapCoefficients(force, coeff);
+    cmap.setMapCoefficients(coeff);
+
+    // Update the indices.
+
+    vector<int> torsionMaps(numTorsions);
+    for (int i = 0; i < numTorsions; i++) {
+        int index[8];
+        force.getTorsionParameters(i, torsionMaps[i], index[0], index[1], index[2], index[3], index[4], index[5], index[6], index[7]);
+        for (int j = 0; j < 8; j++)
+            if (index[j] != torsionIndices[i][j])
+                throw OpenMMException("updateParametersInContext: The set of particles in a CMAP torsion has changed");
+    }
+    cmap.setTorsionMaps(torsionMaps);
+}
+
 class CpuCalcNonbondedForceKernel::PmeIO : public CalcPmeReciprocalForceKernel::IO {
 public:
     PmeIO(float* posq, float* force, int numParticles) : posq(posq), force(force), numParticles(numParticles) {
@@ -389,12 +615,28 @@ private:
 };
 
 bool isVec8Supported();
+bool isVec8FmaSupported();
+bool isVec16Supported();
 CpuNonbondedForce* createCpuNonbondedForceVec4();
 CpuNonbondedForce* createCpuNonbondedForceVec8();
+CpuNonbondedForce* createCpuNonbondedForceVec8Fma();
+CpuNonbondedForce* createCpuNonbondedForceVec16();
 
 CpuCalcNonbondedForceKernel::CpuCalcNonbondedForceKernel(string name, const Platform& platform, CpuPlatform::PlatformData& data) : CalcNonbondedForceKernel(name, platform),
-        data(data), bonded14IndexArray(NULL), bonded14ParamArray(NULL), hasInitializedPme(false), neighborList(NULL), nonbonded(NULL) {
-    if (isVec8Supported()) {
+        data(data), bonded14IndexArray(NULL), bonded14ParamArray(NULL), hasInitializedPme(false), neighborList(NULL), nonbonded(NULL), doubleNonbonded(NULL) {
+    if (data.useDoublePrecision) {
+        neighborList = new CpuNeighborList(4);
+        doubleNonbonded = new CpuDoubleNonbondedForce();
+    }
+    else if (isVec16Supported()) {
+        neighborList = new CpuNeighborList(16);
+        nonbonded = createCpuNonbondedForceVec16();
+    }
+    else if (isVec8FmaSupported()) {
+        neighborList = new CpuNeighborList(8);
+        nonbonded = createCpuNonbondedForceVec8Fma();
+    }
+    else if (isVec8Supported()) {
         neighborList = new CpuNeighborList(8);
         nonbonded = createCpuNonbondedForceVec8();
     }
@@ -415,26 +657,74 @@ CpuCalcNonbondedForceKernel::~CpuCalcNonbondedForceKernel() {
     }
     if (nonbonded != NULL)
         delete nonbonded;
+    if (doubleNonbonded != NULL)
+        delete doubleNonbonded;
     if (neighborList != NULL)
         delete neighborList;
 }
 
+class CpuCalcNonbondedForceKernel::ParticleParamsTask : public ThreadPool::Task {
+public:
+    ParticleParamsTask(const NonbondedForce& force, float* posq, vector<pair<float, float> >& particleParams,
+            vector<pair<double, double> >& doubleParticleParams, vector<double>& charges, int numThreads) :
+            force(force), posq(posq), particleParams(particleParams), doubleParticleParams(doubleParticleParams), charges(charges),
+            threadSumSquaredCharges(numThreads, 0.0) {
+    }
+    void execute(ThreadPool& threads, int threadIndex) {
+        // Each thread copies a contiguous block of particles and accumulates its own sum of squared charges.
+
+        int numParticles = particleParams.size();
+        int numThreads = threads.getNumThreads();
+        int start = threadIndex*numParticles/numThreads;
+        int end = (threadIndex+1)*numParticles/numThreads;
+        double sumSquaredCharges = 0.0;
+        for (int i = start; i < end; i++) {
+            double charge, radius, depth;
+            force.getParticleParameters(i, charge, radius, depth);
+            posq[4*i+3] = (float) charge;
+            particleParams[i] = make_pair((float) (0.5*radius), (float) (2.0*sqrt(depth)));
+            if (!doubleParticleParams.empty()) {
+                doubleParticleParams[i] = make_pair(0.5*radius, 2.0*sqrt(depth));
+                charges[i] = charge;
+            }
+            sumSquaredCharges += charge*charge;
+        }
+        threadSumSquaredCharges[threadIndex] = sumSquaredCharges;
+    }
+    const NonbondedForce& force;
+    float* posq;
+    vector<pair<float, float> >& particleParams;
+    vector<pair<double, double> >& doubleParticleParams;
+    vector<double>& charges;
+    vector<double> threadSumSquaredCharges;
+};
+
+double CpuCalcNonbondedForceKernel::recordParticleParameters(const NonbondedForce& force) {
+    ParticleParamsTask task(force, &data.posq[0], particleParams, doubleParticleParams, charges, data.threads.getNumThreads());
+    data.threads.execute(task);
+    data.threads.waitForThreads();
+    double sumSquaredCharges = 0.0;
+    for (int i = 0; i < (int) task.threadSumSquaredCharges.size(); i++)
+        sumSquaredCharges += task.threadSumSquaredCharges[i];
+    return sumSquaredCharges;
+}
+
 void CpuCalcNonbondedForceKernel::initialize(const System& system, const NonbondedForce& force) {
 
     // Identify which exceptions are 1-4 interactions.
 
     numParticles = force.getNumParticles();
-    exclusions.resize(numParticles);
+    vector<pair<int, int> > excludedPairs;
     vector<int> nb14s;
     for (int i = 0; i < force.getNumExceptions(); i++) {
         int particle1, particle2;
         double chargeProd, sigma, epsilon;
         force.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
-        exclusions[particle1].insert(particle2);
-        exclusions[particle2].insert(particle1);
+        excludedPairs.push_back(make_pair(particle1, particle2));
         if (chargeProd != 0.0 || epsilon != 0.0)
             nb14s.push_back(i);
     }
+    exclusions = CpuExclusionList(numParticles, excludedPairs);
 
     // Record the particle parameters.
 
@@ -446,14 +736,11 @@ void CpuCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
     for (int i = 0; i < num14; i++)
         bonded14ParamArray[i] = new double[3];
     particleParams.resize(numParticles);
-    double sumSquaredCharges = 0.0;
-    for (int i = 0; i < numParticles; ++i) {
-        double charge, radius, depth;
-        force.getParticleParameters(i, charge, radius, depth);
-        data.posq[4*i+3] = (float) charge;
-        particleParams[i] = make_pair((float) (0.5*radius), (float) (2.0*sqrt(depth)));
-        sumSquaredCharges += charge*charge;
+    if (data.useDoublePrecision) {
+        doubleParticleParams.resize(numParticles);
+        charges.resize(numParticles);
     }
+    double sumSquaredCharges = recordParticleParameters(force);
     
     // Recorded exception parameters.
     
@@ -505,8 +792,9 @@ double CpuCalcNonbondedForceKernel::execute(ContextImpl& context, bool includeFo
     if (!hasInitializedPme) {
         hasInitializedPme = true;
         useOptimizedPme = false;
-        if (nonbondedMethod == PME) {
-            // If available, use the optimized PME implementation.
+        if (nonbondedMethod == PME && !data.useDoublePrecision) {
+            // If available, use the optimized PME implementation.  It works in single precision, so it is
+            // not used in double precision mode.
 
             vector<string> kernelNames;
             kernelNames.push_back("CalcPmeReciprocalForce");
@@ -524,6 +812,8 @@ double CpuCalcNonbondedForceKernel::execute(ContextImpl& context, bool includeFo
     double energy = (includeReciprocal ? ewaldSelfEnergy : 0.0);
     bool ewald  = (nonbondedMethod == Ewald);
     bool pme  = (nonbondedMethod == PME);
+    bool profile = context.getProfilingEnabled();
+    double startTime = (profile ? getCurrentTime() : 0.0);
     if (nonbondedMethod != NoCutoff) {
         // Determine whether we need to recompute the neighbor list.
         
@@ -568,34 +858,75 @@ double CpuCalcNonbondedForceKernel::execute(ContextImpl& context, bool includeFo
         if (needRecompute) {
             neighborList->computeNeighborList(numParticles, posq, exclusions, boxVectors, data.isPeriodic, nonbondedCutoff+padding, data.threads);
             lastPositions = posData;
+            if (profile)
+                context.addProfilingData("neighbor_list_builds", 1);
+        }
+        if (doubleNonbonded != NULL)
+            doubleNonbonded->setUseCutoff(nonbondedCutoff, *neighborList, rfDielectric);
+        else
+            nonbonded->setUseCutoff(nonbondedCutoff, *neighborList, rfDielectric);
+        if (profile) {
+            // This includes the time spent deciding whether to rebuild the list, even if it was not rebuilt.
+
+            double time = getCurrentTime();
+            context.addProfilingData("neighbor_list", time-startTime);
+            startTime = time;
         }
-        nonbonded->setUseCutoff(nonbondedCutoff, *neighborList, rfDielectric);
     }
     if (data.isPeriodic) {
         RealVec* boxVectors = extractBoxVectors(context);
         double minAllowedSize = 1.999999*nonbondedCutoff;
         if (boxVectors[0][0] < minAllowedSize || boxVectors[1][1] < minAllowedSize || boxVectors[2][2] < minAllowedSize)
             throw OpenMMException("The periodic box size has decreased to less than twice the nonbonded cutoff.");
-        nonbonded->setPeriodic(boxVectors);
+        if (doubleNonbonded != NULL)
+            doubleNonbonded->setPeriodic(boxVectors);
+        else
+            nonbonded->setPeriodic(boxVectors);
+    }
+    if (doubleNonbonded != NULL) {
+        if (ewald)
+            doubleNonbonded->setUseEwald(ewaldAlpha, kmax[0], kmax[1], kmax[2]);
+        if (pme)
+            doubleNonbonded->setUsePME(ewaldAlpha, gridSize);
+        if (useSwitchingFunction)
+            doubleNonbonded->setUseSwitchingFunction(switchingDistance);
+    }
+    else {
+        if (ewald)
+            nonbonded->setUseEwald(ewaldAlpha, kmax[0], kmax[1], kmax[2]);
+        if (pme)
+            nonbonded->setUsePME(ewaldAlpha, gridSize);
+        if (useSwitchingFunction)
+            nonbonded->setUseSwitchingFunction(switchingDistance);
     }
-    if (ewald)
-        nonbonded->setUseEwald(ewaldAlpha, kmax[0], kmax[1], kmax[2]);
-    if (pme)
-        nonbonded->setUsePME(ewaldAlpha, gridSize);
-    if (useSwitchingFunction)
-        nonbonded->setUseSwitchingFunction(switchingDistance);
     double nonbondedEnergy = 0;
-    if (includeDirect)
-        nonbonded->calculateDirectIxn(numParticles, &posq[0], posData, particleParams, exclusions, data.threadForce, includeEnergy ? &nonbondedEnergy : NULL, data.threads);
+    if (includeDirect) {
+        if (doubleNonbonded != NULL)
+            doubleNonbonded->calculateDirectIxn(numParticles, posData, charges, doubleParticleParams, exclusions, forceData, includeForces, includeEnergy ? &nonbondedEnergy : NULL, data.threads);
+        else
+            nonbonded->calculateDirectIxn(numParticles, &posq[0], posData, particleParams, exclusions, data.threadForce, includeForces, includeEnergy ? &nonbondedEnergy : NULL, data.threads);
+        if (profile) {
+            double time = getCurrentTime();
+            context.addProfilingData("direct", time-startTime);
+            startTime = time;
+        }
+    }
     if (includeReciprocal) {
         if (useOptimizedPme) {
             PmeIO io(&posq[0], &data.threadForce[0][0], numParticles);
             Vec3 periodicBoxVectors[3] = {boxVectors[0], boxVectors[1], boxVectors[2]};
-            optimizedPme.getAs<CalcPmeReciprocalForceKernel>().beginComputation(io, periodicBoxVectors, includeEnergy);
+            optimizedPme.getAs<CalcPmeReciprocalForceKernel>().beginComputation(io, periodicBoxVectors, includeForces, includeEnergy);
             nonbondedEnergy += optimizedPme.getAs<CalcPmeReciprocalForceKernel>().finishComputation(io);
         }
+        else if (doubleNonbonded != NULL)
+            doubleNonbonded->calculateReciprocalIxn(numParticles, posData, charges, forceData, includeForces, includeEnergy ? &nonbondedEnergy : NULL);
         else
-            nonbonded->calculateReciprocalIxn(numParticles, &posq[0], posData, particleParams, exclusions, forceData, includeEnergy ? &nonbondedEnergy : NULL);
+            nonbonded->calculateReciprocalIxn(numParticles, &posq[0], posData, particleParams, exclusions, forceData, includeForces, includeEnergy ? &nonbondedEnergy : NULL);
+        if (profile && (ewald || pme)) {
+            double time = getCurrentTime();
+            context.addProfilingData("reciprocal", time-startTime);
+            startTime = time;
+        }
     }
     energy += nonbondedEnergy;
     if (includeDirect) {
@@ -604,11 +935,14 @@ double CpuCalcNonbondedForceKernel::execute(ContextImpl& context, bool includeFo
         refBondForce.calculateForce(num14, bonded14IndexArray, posData, bonded14ParamArray, forceData, includeEnergy ? &energy : NULL, nonbonded14);
         if (data.isPeriodic)
             energy += dispersionCoefficient/(boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2]);
+        if (profile)
+            context.addProfilingData("direct", getCurrentTime()-startTime);
     }
     return energy;
 }
 
 void CpuCalcNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NonbondedForce& force) {
+    data.atomReorderer.invalidateMolecules();
     if (force.getNumParticles() != numParticles)
         throw OpenMMException("updateParametersInContext: The number of particles has changed");
     vector<int> nb14s;
@@ -624,14 +958,7 @@ void CpuCalcNonbondedForceKernel::copyParametersToContext(ContextImpl& context,
 
     // Record the values.
 
-    double sumSquaredCharges = 0.0;
-    for (int i = 0; i < numParticles; ++i) {
-        double charge, radius, depth;
-        force.getParticleParameters(i, charge, radius, depth);
-        data.posq[4*i+3] = (float) charge;
-        particleParams[i] = make_pair((float) (0.5*radius), (float) (2.0*sqrt(depth)));
-        sumSquaredCharges += charge*charge;
-    }
+    double sumSquaredCharges = recordParticleParameters(force);
     if (nonbondedMethod == Ewald || nonbondedMethod == PME)
         ewaldSelfEnergy = -ONE_4PI_EPS0*ewaldAlpha*sumSquaredCharges/sqrt(M_PI);
     else
@@ -677,13 +1004,13 @@ void CpuCalcCustomNonbondedForceKernel::initialize(const System& system, const C
     // Record the exclusions.
 
     numParticles = force.getNumParticles();
-    exclusions.resize(numParticles);
+    vector<pair<int, int> > excludedPairs;
     for (int i = 0; i < force.getNumExclusions(); i++) {
         int particle1, particle2;
         force.getExclusionParticles(i, particle1, particle2);
-        exclusions[particle1].insert(particle2);
-        exclusions[particle2].insert(particle1);
+        excludedPairs.push_back(make_pair(particle1, particle2));
     }
+    exclusions = CpuExclusionList(numParticles, excludedPairs);
 
     // Build the arrays.
 
@@ -717,7 +1044,12 @@ void CpuCalcCustomNonbondedForceKernel::initialize(const System& system, const C
 
     Lepton::ParsedExpression expression = Lepton::Parser::parse(force.getEnergyFunction(), functions).optimize();
     Lepton::CompiledExpression energyExpression = expression.createCompiledExpression();
-    Lepton::CompiledExpression forceExpression = expression.differentiate("r").createCompiledExpression();
+    Lepton::ParsedExpression forceExpr = expression.differentiate("r").optimize();
+    Lepton::CompiledExpression forceExpression = forceExpr.createCompiledExpression();
+    vector<Lepton::ParsedExpression> energyAndForce;
+    energyAndForce.push_back(expression);
+    energyAndForce.push_back(forceExpr);
+    Lepton::CompiledExpression energyAndForceExpression(energyAndForce);
     for (int i = 0; i < numParameters; i++)
         parameterNames.push_back(force.getPerParticleParameterName(i));
     for (int i = 0; i < force.getNumGlobalParameters(); i++) {
@@ -749,27 +1081,32 @@ void CpuCalcCustomNonbondedForceKernel::initialize(const System& system, const C
         interactionGroups.push_back(make_pair(set1, set2));
     }
     data.isPeriodic = (nonbondedMethod == CutoffPeriodic);
-    nonbonded = new CpuCustomNonbondedForce(energyExpression, forceExpression, parameterNames, exclusions, data.threads);
+    nonbonded = new CpuCustomNonbondedForce(energyExpression, forceExpression, energyAndForceExpression, parameterNames, exclusions, data.threads);
     if (interactionGroups.size() > 0)
         nonbonded->setInteractionGroups(interactionGroups);
 }
 
-double CpuCalcCustomNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
-    vector<RealVec>& posData = extractPositions(context);
-    vector<RealVec>& forceData = extractForces(context);
+void CpuCalcCustomNonbondedForceKernel::prepareInteractions(ContextImpl& context) {
     RealVec* boxVectors = extractBoxVectors(context);
-    double energy = 0;
-    bool periodic = (nonbondedMethod == CutoffPeriodic);
     if (nonbondedMethod != NoCutoff) {
-        neighborList->computeNeighborList(numParticles, data.posq, exclusions, boxVectors, data.isPeriodic, nonbondedCutoff, data.threads);
+        buildNeighborList(context, *neighborList, numParticles, data.posq, exclusions, boxVectors, data.isPeriodic, nonbondedCutoff, data.threads);
         nonbonded->setUseCutoff(nonbondedCutoff, *neighborList);
     }
-    if (periodic) {
+    if (nonbondedMethod == CutoffPeriodic) {
         double minAllowedSize = 2*nonbondedCutoff;
         if (boxVectors[0][0] < minAllowedSize || boxVectors[1][1] < minAllowedSize || boxVectors[2][2] < minAllowedSize)
             throw OpenMMException("The periodic box size has decreased to less than twice the nonbonded cutoff.");
         nonbonded->setPeriodic(boxVectors);
     }
+    if (useSwitchingFunction)
+        nonbonded->setUseSwitchingFunction(switchingDistance);
+}
+
+double CpuCalcCustomNonbondedForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    vector<RealVec>& posData = extractPositions(context);
+    RealVec* boxVectors = extractBoxVectors(context);
+    double energy = 0;
+    prepareInteractions(context);
     bool globalParamsChanged = false;
     for (int i = 0; i < (int) globalParameterNames.size(); i++) {
         double value = context.getParameter(globalParameterNames[i]);
@@ -777,20 +1114,77 @@ double CpuCalcCustomNonbondedForceKernel::execute(ContextImpl& context, bool inc
             globalParamsChanged = true;
         globalParamValues[globalParameterNames[i]] = value;
     }
-    if (useSwitchingFunction)
-        nonbonded->setUseSwitchingFunction(switchingDistance);
     nonbonded->calculatePairIxn(numParticles, &data.posq[0], posData, particleParamArray, 0, globalParamValues, data.threadForce, includeForces, includeEnergy, energy);
     
     // Add in the long range correction.
     
     if (!hasInitializedLongRangeCorrection || (globalParamsChanged && forceCopy != NULL)) {
-        longRangeCoefficient = CustomNonbondedForceImpl::calcLongRangeCorrection(*forceCopy, context.getOwner());
+        if (!hasInitializedLongRangeCorrection)
+            longRangeCorrectionData = CustomNonbondedForceImpl::prepareLongRangeCorrection(*forceCopy);
+        longRangeCoefficient = CustomNonbondedForceImpl::calcLongRangeCorrection(*forceCopy, longRangeCorrectionData, context.getOwner(), data.threads);
         hasInitializedLongRangeCorrection = true;
     }
     energy += longRangeCoefficient/(boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2]);
     return energy;
 }
 
+bool CpuCalcCustomNonbondedForceKernel::computeEnergiesForParameterSets(ContextImpl& context, const vector<map<string, double> >& parameterSets, vector<double>& energies) {
+    vector<RealVec>& posData = extractPositions(context);
+    RealVec* boxVectors = extractBoxVectors(context);
+    prepareInteractions(context);
+
+    // Find which global parameters differ between the sets.  Every other parameter keeps its current value.
+
+    int numSets = parameterSets.size();
+    map<string, double> currentValues;
+    vector<string> variedNames;
+    for (int i = 0; i < (int) globalParameterNames.size(); i++) {
+        const string& name = globalParameterNames[i];
+        currentValues[name] = context.getParameter(name);
+        for (int j = 0; j < numSets; j++)
+            if (parameterSets[j].find(name) != parameterSets[j].end()) {
+                variedNames.push_back(name);
+                break;
+            }
+    }
+    vector<vector<double> > values(numSets, vector<double>(variedNames.size()));
+    for (int i = 0; i < numSets; i++)
+        for (int j = 0; j < (int) variedNames.size(); j++) {
+            map<string, double>::const_iterator value = parameterSets[i].find(variedNames[j]);
+            values[i][j] = (value == parameterSets[i].end() ? currentValues[variedNames[j]] : value->second);
+        }
+    nonbonded->calculatePairIxnForParameterSets(numParticles, &data.posq[0], posData, particleParamArray, currentValues, variedNames, values, data.threadForce, energies);
+
+    // Add in the long range correction, which also depends on the global parameters.
+
+    double volume = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
+    if (forceCopy == NULL) {
+        for (int i = 0; i < numSets; i++)
+            energies[i] += longRangeCoefficient/volume;
+        return true;
+    }
+    if (!hasInitializedLongRangeCorrection) {
+        longRangeCorrectionData = CustomNonbondedForceImpl::prepareLongRangeCorrection(*forceCopy);
+        longRangeCoefficient = CustomNonbondedForceImpl::calcLongRangeCorrection(*forceCopy, longRangeCorrectionData, context.getOwner(), data.threads);
+        hasInitializedLongRangeCorrection = true;
+    }
+    try {
+        for (int i = 0; i < numSets; i++) {
+            for (int j = 0; j < (int) variedNames.size(); j++)
+                context.setParameter(variedNames[j], values[i][j]);
+            energies[i] += CustomNonbondedForceImpl::calcLongRangeCorrection(*forceCopy, longRangeCorrectionData, context.getOwner(), data.threads)/volume;
+        }
+    }
+    catch (...) {
+        for (int j = 0; j < (int) variedNames.size(); j++)
+            context.setParameter(variedNames[j], currentValues[variedNames[j]]);
+        throw;
+    }
+    for (int j = 0; j < (int) variedNames.size(); j++)
+        context.setParameter(variedNames[j], currentValues[variedNames[j]]);
+    return true;
+}
+
 void CpuCalcCustomNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const CustomNonbondedForce& force) {
     if (numParticles != force.getNumParticles())
         throw OpenMMException("updateParametersInContext: The number of particles has changed");
@@ -809,13 +1203,29 @@ void CpuCalcCustomNonbondedForceKernel::copyParametersToContext(ContextImpl& con
     // If necessary, recompute the long range correction.
     
     if (forceCopy != NULL) {
-        longRangeCoefficient = CustomNonbondedForceImpl::calcLongRangeCorrection(force, context.getOwner());
-        hasInitializedLongRangeCorrection = true;
         *forceCopy = force;
+        longRangeCorrectionData = CustomNonbondedForceImpl::prepareLongRangeCorrection(*forceCopy);
+        longRangeCoefficient = CustomNonbondedForceImpl::calcLongRangeCorrection(*forceCopy, longRangeCorrectionData, context.getOwner(), data.threads);
+        hasInitializedLongRangeCorrection = true;
     }
 }
 
+CpuGBSAOBCForce* createCpuGBSAOBCForceVec4();
+CpuGBSAOBCForce* createCpuGBSAOBCForceVec8();
+
+CpuCalcGBSAOBCForceKernel::CpuCalcGBSAOBCForceKernel(string name, const Platform& platform, CpuPlatform::PlatformData& data) : CalcGBSAOBCForceKernel(name, platform),
+        data(data), cutoff(0.0f), neighborList(NULL), obc(NULL) {
+    if (isVec8Supported())
+        obc = createCpuGBSAOBCForceVec8();
+    else
+        obc = createCpuGBSAOBCForceVec4();
+}
+
 CpuCalcGBSAOBCForceKernel::~CpuCalcGBSAOBCForceKernel() {
+    if (obc != NULL)
+        delete obc;
+    if (neighborList != NULL)
+        delete neighborList;
 }
 
 void CpuCalcGBSAOBCForceKernel::initialize(const System& system, const GBSAOBCForce& force) {
@@ -828,12 +1238,16 @@ void CpuCalcGBSAOBCForceKernel::initialize(const System& system, const GBSAOBCFo
         radius -= 0.009;
         particleParams[i] = make_pair((float) radius, (float) (scalingFactor*radius));
     }
-    obc.setParticleParameters(particleParams);
-    obc.setSolventDielectric((float) force.getSolventDielectric());
-    obc.setSoluteDielectric((float) force.getSoluteDielectric());
-    obc.setSurfaceAreaEnergy((float) force.getSurfaceAreaEnergy());
-    if (force.getNonbondedMethod() != GBSAOBCForce::NoCutoff)
-        obc.setUseCutoff((float) force.getCutoffDistance());
+    obc->setParticleParameters(particleParams);
+    obc->setSolventDielectric((float) force.getSolventDielectric());
+    obc->setSoluteDielectric((float) force.getSoluteDielectric());
+    obc->setSurfaceAreaEnergy((float) force.getSurfaceAreaEnergy());
+    if (force.getNonbondedMethod() != GBSAOBCForce::NoCutoff) {
+        cutoff = (float) force.getCutoffDistance();
+        exclusions = CpuExclusionList(numParticles);
+        neighborList = new CpuNeighborList(obc->getBlockSize());
+        obc->setUseCutoff(cutoff, *neighborList);
+    }
     data.isPeriodic = (force.getNonbondedMethod() == GBSAOBCForce::CutoffPeriodic);
 }
 
@@ -841,16 +1255,19 @@ double CpuCalcGBSAOBCForceKernel::execute(ContextImpl& context, bool includeForc
     if (data.isPeriodic) {
         RealVec& boxSize = extractBoxSize(context);
         float floatBoxSize[3] = {(float) boxSize[0], (float) boxSize[1], (float) boxSize[2]};
-        obc.setPeriodic(floatBoxSize);
+        obc->setPeriodic(floatBoxSize);
     }
+    if (neighborList != NULL)
+        buildNeighborList(context, *neighborList, particleParams.size(), data.posq, exclusions, extractBoxVectors(context), data.isPeriodic, cutoff, data.threads);
     double energy = 0.0;
-    obc.computeForce(data.posq, data.threadForce, includeEnergy ? &energy : NULL, data.threads);
+    obc->computeForce(data.posq, data.threadForce, includeEnergy ? &energy : NULL, data.threads);
     return energy;
 }
 
 void CpuCalcGBSAOBCForceKernel::copyParametersToContext(ContextImpl& context, const GBSAOBCForce& force) {
+    data.atomReorderer.invalidateMolecules();
     int numParticles = force.getNumParticles();
-    if (numParticles != obc.getParticleParameters().size())
+    if (numParticles != obc->getParticleParameters().size())
         throw OpenMMException("updateParametersInContext: The number of particles has changed");
 
     // Record the values.
@@ -862,7 +1279,7 @@ void CpuCalcGBSAOBCForceKernel::copyParametersToContext(ContextImpl& context, co
         radius -= 0.009;
         particleParams[i] = make_pair((float) radius, (float) (scalingFactor*radius));
     }
-    obc.setParticleParameters(particleParams);
+    obc->setParticleParameters(particleParams);
 }
 
 CpuCalcCustomGBForceKernel::~CpuCalcCustomGBForceKernel() {
@@ -894,13 +1311,13 @@ void CpuCalcCustomGBForceKernel::initialize(const System& system, const CustomGB
     // Record the exclusions.
 
     numParticles = force.getNumParticles();
-    exclusions.resize(numParticles);
+    vector<pair<int, int> > excludedPairs;
     for (int i = 0; i < force.getNumExclusions(); i++) {
         int particle1, particle2;
         force.getExclusionParticles(i, particle1, particle2);
-        exclusions[particle1].insert(particle2);
-        exclusions[particle2].insert(particle1);
+        excludedPairs.push_back(make_pair(particle1, particle2));
     }
+    exclusions = CpuExclusionList(numParticles, excludedPairs);
 
     // Build the arrays.
 
@@ -931,64 +1348,79 @@ void CpuCalcCustomGBForceKernel::initialize(const System& system, const CustomGB
     for (int i = 0; i < force.getNumFunctions(); i++)
         functions[force.getTabulatedFunctionName(i)] = createReferenceTabulatedFunction(force.getTabulatedFunction(i));
 
-    // Parse the expressions for computed values.
+    // Parse the expressions for computed values.  The first value is evaluated for both orderings of each
+    // pair at once, so build a second copy of it with the particle indices swapped.
 
-    vector<vector<Lepton::CompiledExpression> > valueDerivExpressions(force.getNumComputedValues());
-    vector<vector<Lepton::CompiledExpression> > valueGradientExpressions(force.getNumComputedValues());
+    map<string, string> swapParticles;
+    for (int i = 0; i < numPerParticleParameters; i++) {
+        swapParticles[particleParameterNames[i]+"1"] = particleParameterNames[i]+"2";
+        swapParticles[particleParameterNames[i]+"2"] = particleParameterNames[i]+"1";
+    }
     vector<Lepton::CompiledExpression> valueExpressions;
-    vector<Lepton::CompiledExpression> energyExpressions;
+    vector<Lepton::CompiledExpression> valueDerivExpressions;
     for (int i = 0; i < force.getNumComputedValues(); i++) {
         string name, expression;
         CustomGBForce::ComputationType type;
         force.getComputedValueParameters(i, name, expression, type);
         Lepton::ParsedExpression ex = Lepton::Parser::parse(expression, functions).optimize();
-        valueExpressions.push_back(ex.createCompiledExpression());
         valueTypes.push_back(type);
         valueNames.push_back(name);
-        if (i == 0)
-            valueDerivExpressions[i].push_back(ex.differentiate("r").createCompiledExpression());
+        vector<Lepton::ParsedExpression> derivs;
+        if (i == 0) {
+            Lepton::ParsedExpression swapped = ex.renameVariables(swapParticles);
+            vector<Lepton::ParsedExpression> bothOrders;
+            bothOrders.push_back(ex);
+            bothOrders.push_back(swapped);
+            valueExpressions.push_back(Lepton::CompiledExpression(bothOrders));
+            derivs = bothOrders;
+            derivs.push_back(ex.differentiate("r").optimize());
+            derivs.push_back(swapped.differentiate("r").optimize());
+        }
         else {
-            valueGradientExpressions[i].push_back(ex.differentiate("x").createCompiledExpression());
-            valueGradientExpressions[i].push_back(ex.differentiate("y").createCompiledExpression());
-            valueGradientExpressions[i].push_back(ex.differentiate("z").createCompiledExpression());
+            valueExpressions.push_back(ex.createCompiledExpression());
             for (int j = 0; j < i; j++)
-                valueDerivExpressions[i].push_back(ex.differentiate(valueNames[j]).createCompiledExpression());
+                derivs.push_back(ex.differentiate(valueNames[j]).optimize());
+            derivs.push_back(ex.differentiate("x").optimize());
+            derivs.push_back(ex.differentiate("y").optimize());
+            derivs.push_back(ex.differentiate("z").optimize());
         }
+        valueDerivExpressions.push_back(Lepton::CompiledExpression(derivs));
     }
 
-    // Parse the expressions for energy terms.
+    // Parse the expressions for energy terms.  Each one is compiled together with all its derivatives.
 
-    vector<vector<Lepton::CompiledExpression> > energyDerivExpressions(force.getNumEnergyTerms());
-    vector<vector<Lepton::CompiledExpression> > energyGradientExpressions(force.getNumEnergyTerms());
+    vector<Lepton::CompiledExpression> energyExpressions;
     for (int i = 0; i < force.getNumEnergyTerms(); i++) {
         string expression;
         CustomGBForce::ComputationType type;
         force.getEnergyTermParameters(i, expression, type);
         Lepton::ParsedExpression ex = Lepton::Parser::parse(expression, functions).optimize();
-        energyExpressions.push_back(ex.createCompiledExpression());
         energyTypes.push_back(type);
-        if (type != CustomGBForce::SingleParticle)
-            energyDerivExpressions[i].push_back(ex.differentiate("r").createCompiledExpression());
-        for (int j = 0; j < force.getNumComputedValues(); j++) {
-            if (type == CustomGBForce::SingleParticle) {
-                energyDerivExpressions[i].push_back(ex.differentiate(valueNames[j]).createCompiledExpression());
-                energyGradientExpressions[i].push_back(ex.differentiate("x").createCompiledExpression());
-                energyGradientExpressions[i].push_back(ex.differentiate("y").createCompiledExpression());
-                energyGradientExpressions[i].push_back(ex.differentiate("z").createCompiledExpression());
-            }
-            else {
-                energyDerivExpressions[i].push_back(ex.differentiate(valueNames[j]+"1").createCompiledExpression());
-                energyDerivExpressions[i].push_back(ex.differentiate(valueNames[j]+"2").createCompiledExpression());
+        vector<Lepton::ParsedExpression> terms;
+        terms.push_back(ex);
+        if (type == CustomGBForce::SingleParticle) {
+            for (int j = 0; j < force.getNumComputedValues(); j++)
+                terms.push_back(ex.differentiate(valueNames[j]).optimize());
+            terms.push_back(ex.differentiate("x").optimize());
+            terms.push_back(ex.differentiate("y").optimize());
+            terms.push_back(ex.differentiate("z").optimize());
+        }
+        else {
+            terms.push_back(ex.differentiate("r").optimize());
+            for (int j = 0; j < force.getNumComputedValues(); j++) {
+                terms.push_back(ex.differentiate(valueNames[j]+"1").optimize());
+                terms.push_back(ex.differentiate(valueNames[j]+"2").optimize());
             }
         }
+        energyExpressions.push_back(Lepton::CompiledExpression(terms));
     }
 
     // Delete the custom functions.
 
     for (map<string, Lepton::CustomFunction*>::iterator iter = functions.begin(); iter != functions.end(); iter++)
         delete iter->second;
-    ixn = new CpuCustomGBForce(numParticles, exclusions, valueExpressions, valueDerivExpressions, valueGradientExpressions, valueNames, valueTypes, energyExpressions,
-        energyDerivExpressions, energyGradientExpressions, energyTypes, particleParameterNames, data.threads);
+    ixn = new CpuCustomGBForce(numParticles, exclusions, valueExpressions, valueDerivExpressions, valueNames, valueTypes, energyExpressions,
+        energyTypes, particleParameterNames, data.threads);
     data.isPeriodic = (force.getNonbondedMethod() == CustomGBForce::CutoffPeriodic);
 }
 
@@ -999,8 +1431,7 @@ double CpuCalcCustomGBForceKernel::execute(ContextImpl& context, bool includeFor
     if (data.isPeriodic)
         ixn->setPeriodic(extractBoxSize(context));
     if (nonbondedMethod != NoCutoff) {
-        vector<set<int> > noExclusions(numParticles);
-        neighborList->computeNeighborList(numParticles, data.posq, exclusions, boxVectors, data.isPeriodic, nonbondedCutoff, data.threads);
+        buildNeighborList(context, *neighborList, numParticles, data.posq, exclusions, boxVectors, data.isPeriodic, nonbondedCutoff, data.threads);
         ixn->setUseCutoff(nonbondedCutoff, *neighborList);
     }
     map<string, double> globalParameters;
@@ -1125,7 +1556,22 @@ void CpuIntegrateLangevinStepKernel::execute(ContextImpl& context, const Langevi
         prevFriction = friction;
         prevStepSize = stepSize;
     }
-    dynamics->update(context.getSystem(), posData, velData, forceData, masses, integrator.getConstraintTolerance());
+    ReferenceConstraints& constraints = extractConstraints(context);
+    constraints.setTimingEnabled(context.getProfilingEnabled());
+    if (context.getProfilingEnabled()) {
+        // Report constraints separately from the rest of the integration step.
+
+        double start = getCurrentTime();
+        double startConstraintTime = constraints.getTotalTime();
+        long long startIterations = constraints.getTotalIterations();
+        dynamics->update(context.getSystem(), posData, velData, forceData, masses, integrator.getConstraintTolerance());
+        double constraintTime = constraints.getTotalTime()-startConstraintTime;
+        context.addProfilingData("integration", getCurrentTime()-start-constraintTime);
+        context.addProfilingData("constraints", constraintTime);
+        context.addProfilingData("constraint_iterations", (double) (constraints.getTotalIterations()-startIterations));
+    }
+    else
+        dynamics->update(context.getSystem(), posData, velData, forceData, masses, integrator.getConstraintTolerance());
     ReferencePlatform::PlatformData* refData = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
     refData->time += stepSize;
     refData->stepCount++;
@@ -1134,3 +1580,89 @@ void CpuIntegrateLangevinStepKernel::execute(ContextImpl& context, const Langevi
 double CpuIntegrateLangevinStepKernel::computeKineticEnergy(ContextImpl& context, const LangevinIntegrator& integrator) {
     return computeShiftedKineticEnergy(context, masses, 0.5*integrator.getStepSize());
 }
+
+CpuIntegrateVariableLangevinStepKernel::~CpuIntegrateVariableLangevinStepKernel() {
+    if (dynamics)
+        delete dynamics;
+}
+
+void CpuIntegrateVariableLangevinStepKernel::initialize(const System& system, const VariableLangevinIntegrator& integrator) {
+    int numParticles = system.getNumParticles();
+    masses.resize(numParticles);
+    for (int i = 0; i < numParticles; ++i)
+        masses[i] = static_cast<RealOpenMM>(system.getParticleMass(i));
+    data.random.initialize(integrator.getRandomNumberSeed(), data.threads.getNumThreads());
+}
+
+double CpuIntegrateVariableLangevinStepKernel::execute(ContextImpl& context, const VariableLangevinIntegrator& integrator, double maxTime) {
+    double temperature = integrator.getTemperature();
+    double friction = integrator.getFriction();
+    double errorTol = integrator.getErrorTolerance();
+    vector<RealVec>& posData = extractPositions(context);
+    vector<RealVec>& velData = extractVelocities(context);
+    vector<RealVec>& forceData = extractForces(context);
+    if (dynamics == 0 || temperature != prevTemp || friction != prevFriction || errorTol != prevErrorTol) {
+        // Recreate the computation objects with the new parameters.
+
+        if (dynamics)
+            delete dynamics;
+        RealOpenMM tau = (friction == 0.0 ? 0.0 : 1.0/friction);
+        dynamics = new CpuVariableLangevinDynamics(context.getSystem().getNumParticles(), tau, temperature, errorTol, data.threads, data.random);
+        dynamics->setReferenceConstraintAlgorithm(&extractConstraints(context));
+        prevTemp = temperature;
+        prevFriction = friction;
+        prevErrorTol = errorTol;
+    }
+    ReferencePlatform::PlatformData* refData = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
+    RealOpenMM maxStepSize = (RealOpenMM) (maxTime-refData->time);
+    dynamics->update(context.getSystem(), posData, velData, forceData, masses, maxStepSize, integrator.getConstraintTolerance());
+    refData->time += dynamics->getDeltaT();
+    if (dynamics->getDeltaT() == maxStepSize)
+        refData->time = maxTime; // Avoid round-off error
+    refData->stepCount++;
+    return dynamics->getDeltaT();
+}
+
+double CpuIntegrateVariableLangevinStepKernel::computeKineticEnergy(ContextImpl& context, const VariableLangevinIntegrator& integrator) {
+    return computeShiftedKineticEnergy(context, masses, 0.5*integrator.getStepSize());
+}
+
+CpuIntegrateVariableVerletStepKernel::~CpuIntegrateVariableVerletStepKernel() {
+    if (dynamics)
+        delete dynamics;
+}
+
+void CpuIntegrateVariableVerletStepKernel::initialize(const System& system, const VariableVerletIntegrator& integrator) {
+    int numParticles = system.getNumParticles();
+    masses.resize(numParticles);
+    for (int i = 0; i < numParticles; ++i)
+        masses[i] = static_cast<RealOpenMM>(system.getParticleMass(i));
+}
+
+double CpuIntegrateVariableVerletStepKernel::execute(ContextImpl& context, const VariableVerletIntegrator& integrator, double maxTime) {
+    double errorTol = integrator.getErrorTolerance();
+    vector<RealVec>& posData = extractPositions(context);
+    vector<RealVec>& velData = extractVelocities(context);
+    vector<RealVec>& forceData = extractForces(context);
+    if (dynamics == 0 || errorTol != prevErrorTol) {
+        // Recreate the computation objects with the new parameters.
+
+        if (dynamics)
+            delete dynamics;
+        dynamics = new CpuVariableVerletDynamics(context.getSystem().getNumParticles(), errorTol, data.threads);
+        dynamics->setReferenceConstraintAlgorithm(&extractConstraints(context));
+        prevErrorTol = errorTol;
+    }
+    ReferencePlatform::PlatformData* refData = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
+    RealOpenMM maxStepSize = (RealOpenMM) (maxTime-refData->time);
+    dynamics->update(context.getSystem(), posData, velData, forceData, masses, maxStepSize, integrator.getConstraintTolerance());
+    refData->time += dynamics->getDeltaT();
+    if (dynamics->getDeltaT() == maxStepSize)
+        refData->time = maxTime; // Avoid round-off error
+    refData->stepCount++;
+    return dynamics->getDeltaT();
+}
+
+double CpuIntegrateVariableVerletStepKernel::computeKineticEnergy(ContextImpl& context, const VariableVerletIntegrator& integrator) {
+    return computeShiftedKineticEnergy(context, masses, 0.5*integrator.getStepSize());
+}
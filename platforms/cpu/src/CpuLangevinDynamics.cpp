@@ -51,6 +51,7 @@ public:
 
 CpuLangevinDynamics::CpuLangevinDynamics(int numberOfAtoms, RealOpenMM deltaT, RealOpenMM tau, RealOpenMM temperature, ThreadPool& threads, CpuRandom& random) : 
            ReferenceStochasticDynamics(numberOfAtoms, deltaT, tau, temperature), threads(threads), random(random) {
+    threadNoise.resize(threads.getNumThreads());
 }
 
 CpuLangevinDynamics::~CpuLangevinDynamics() {
@@ -66,6 +67,7 @@ void CpuLangevinDynamics::updatePart1(int numberOfAtoms, vector<RealVec>& atomCo
     this->forces = &forces[0];
     this->inverseMasses = &inverseMasses[0];
     this->xPrime = &xPrime[0];
+    randomCounter = random.getNextCounter();
     
     // Signal the threads to start running and wait for them to finish.
     
@@ -101,10 +103,18 @@ void CpuLangevinDynamics::threadUpdate1(int threadIndex) {
     int start = threadIndex*numberOfAtoms/threads.getNumThreads();
     int end = (threadIndex+1)*numberOfAtoms/threads.getNumThreads();
 
+    // The noise for each atom depends only on the seed, the step, and the atom index, so the
+    // trajectory does not depend on the number of threads.
+
+    vector<float>& noiseValues = threadNoise[threadIndex];
+    noiseValues.resize(4*(end-start));
+    if (end > start)
+        random.getGaussianRandoms(randomCounter, start, end, &noiseValues[0]);
     for (int i = start; i < end; i++) {
         if (inverseMasses[i] != 0.0) {
             RealOpenMM sqrtInvMass = SQRT(inverseMasses[i]);
-            RealVec noise(random.getGaussianRandom(threadIndex), random.getGaussianRandom(threadIndex), random.getGaussianRandom(threadIndex));
+            const float* atomNoise = &noiseValues[4*(i-start)];
+            RealVec noise(atomNoise[0], atomNoise[1], atomNoise[2]);
             velocities[i]  = velocities[i]*vscale + forces[i]*(fscale*inverseMasses[i]) + noise*(noisescale*sqrtInvMass);
         }
    }
@@ -165,7 +165,7 @@ public:
         return VoxelIndex(y, z);
     }
         
-    void getNeighbors(vector<int>& neighbors, int blockIndex, const fvec4& blockCenter, const fvec4& blockWidth, const vector<int>& sortedAtoms, vector<char>& exclusions, float maxDistance, const vector<int>& blockAtoms, const vector<float>& blockAtomX, const vector<float>& blockAtomY, const vector<float>& blockAtomZ, const vector<float>& sortedPositions, const vector<VoxelIndex>& atomVoxelIndex) const {
+    void getNeighbors(vector<int>& neighbors, int blockIndex, const fvec4& blockCenter, const fvec4& blockWidth, const vector<int>& sortedAtoms, vector<short>& exclusions, float maxDistance, const vector<int>& blockAtoms, const vector<float>& blockAtomX, const vector<float>& blockAtomY, const vector<float>& blockAtomZ, const vector<float>& sortedPositions, const vector<VoxelIndex>& atomVoxelIndex) const {
         neighbors.resize(0);
         exclusions.resize(0);
         fvec4 boxSize(periodicBoxSize[0], periodicBoxSize[1], periodicBoxSize[2], 0);
@@ -379,13 +379,17 @@ public:
 CpuNeighborList::CpuNeighborList(int blockSize) : blockSize(blockSize) {
 }
 
-void CpuNeighborList::computeNeighborList(int numAtoms, const AlignedArray<float>& atomLocations, const vector<set<int> >& exclusions,
+void CpuNeighborList::computeNeighborList(int numAtoms, const AlignedArray<float>& atomLocations, const CpuExclusionList& exclusions,
             const RealVec* periodicBoxVectors, bool usePeriodic, float maxDistance, ThreadPool& threads) {
     int numBlocks = (numAtoms+blockSize-1)/blockSize;
     blockNeighbors.resize(numBlocks);
     blockExclusions.resize(numBlocks);
     sortedAtoms.resize(numAtoms);
     sortedPositions.resize(4*numAtoms);
+    threadNeighborIndex.resize(threads.getNumThreads());
+    for (int i = 0; i < (int) threadNeighborIndex.size(); i++)
+        if ((int) threadNeighborIndex[i].size() != numAtoms)
+            threadNeighborIndex[i].assign(numAtoms, -1);
     
     // Record the parameters for the threads.
     
@@ -451,10 +455,11 @@ void CpuNeighborList::computeNeighborList(int numAtoms, const AlignedArray<float
     
     int numPadding = numBlocks*blockSize-numAtoms;
     if (numPadding > 0) {
-        char mask = ((0xFFFF-(1<<blockSize)+1) >> numPadding);
+        int blockMask = (1<<blockSize)-1;
+        short mask = (short) (blockMask & (blockMask<<(blockSize-numPadding)));
         for (int i = 0; i < numPadding; i++)
             sortedAtoms.push_back(0);
-        vector<char>& exc = blockExclusions[blockExclusions.size()-1];
+        vector<short>& exc = blockExclusions[blockExclusions.size()-1];
         for (int i = 0; i < (int) exc.size(); i++)
             exc[i] |= mask;
     }
@@ -472,7 +477,7 @@ const std::vector<int>& CpuNeighborList::getBlockNeighbors(int blockIndex) const
     return blockNeighbors[blockIndex];
 }
 
-const std::vector<char>& CpuNeighborList::getBlockExclusions(int blockIndex) const {
+const std::vector<short>& CpuNeighborList::getBlockExclusions(int blockIndex) const {
     return blockExclusions[blockIndex];
     
 }
@@ -500,6 +505,7 @@ void CpuNeighborList::threadComputeNeighborList(ThreadPool& threads, int threadI
     vector<int> blockAtoms;
     vector<float> blockAtomX(blockSize), blockAtomY(blockSize), blockAtomZ(blockSize);
     vector<VoxelIndex> atomVoxelIndex;
+    vector<int>& neighborIndex = threadNeighborIndex[threadIndex];
     for (int i = threadIndex; i < numBlocks; i += numThreads) {
         // Find the atoms in this block and compute their bounding box.
         
@@ -530,17 +536,27 @@ void CpuNeighborList::threadComputeNeighborList(ThreadPool& threads, int threadI
         }
         voxels->getNeighbors(blockNeighbors[i], i, (maxPos+minPos)*0.5f, (maxPos-minPos)*0.5f, sortedAtoms, blockExclusions[i], maxDistance, blockAtoms, blockAtomX, blockAtomY, blockAtomZ, sortedPositions, atomVoxelIndex);
 
-        // Record the exclusions for this block.
+        // Record the exclusions for this block.  Rather than searching the exclusions for every
+        // neighbor, record where each neighbor appears in the list, then loop over the (much
+        // shorter) lists of excluded atoms.
 
+        const vector<int>& neighbors = blockNeighbors[i];
+        vector<short>& exclusionMasks = blockExclusions[i];
+        for (int k = 0; k < (int) neighbors.size(); k++)
+            neighborIndex[neighbors[k]] = k;
         for (int j = 0; j < atomsInBlock; j++) {
-            const set<int>& atomExclusions = (*exclusions)[sortedAtoms[firstIndex+j]];
-            char mask = 1<<j;
-            for (int k = 0; k < (int) blockNeighbors[i].size(); k++) {
-                int atomIndex = blockNeighbors[i][k];
-                if (atomExclusions.find(atomIndex) != atomExclusions.end())
-                    blockExclusions[i][k] |= mask;
+            int atom = sortedAtoms[firstIndex+j];
+            const int* atomExclusions = exclusions->getExclusions(atom);
+            int numExclusions = exclusions->getNumExclusions(atom);
+            short mask = 1<<j;
+            for (int k = 0; k < numExclusions; k++) {
+                int index = neighborIndex[atomExclusions[k]];
+                if (index != -1)
+                    exclusionMasks[index] |= mask;
             }
         }
+        for (int k = 0; k < (int) neighbors.size(); k++)
+            neighborIndex[neighbors[k]] = -1;
     }
 }
 
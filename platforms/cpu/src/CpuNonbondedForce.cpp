@@ -189,8 +189,8 @@ void CpuNonbondedForce::setUseSwitchingFunction(float distance) {
 }
   
 void CpuNonbondedForce::calculateReciprocalIxn(int numberOfAtoms, float* posq, const vector<RealVec>& atomCoordinates,
-                                             const vector<pair<float, float> >& atomParameters, const vector<set<int> >& exclusions,
-                                             vector<RealVec>& forces, double* totalEnergy) const {
+                                             const vector<pair<float, float> >& atomParameters, const CpuExclusionList& exclusions,
+                                             vector<RealVec>& forces, bool includeForces, double* totalEnergy) const {
     typedef std::complex<float> d_complex;
 
     static const float epsilon     =  1.0;
@@ -281,11 +281,13 @@ void CpuNonbondedForce::calculateReciprocalIxn(int numberOfAtoms, float* posq, c
                     float k2 = kx * kx + ky * ky + kz * kz;
                     float ak = exp(k2*factorEwald) / k2;
 
-                    for (int n = 0; n < numberOfAtoms; n++) {
-                        float force = ak * (cs * tab_qxyz[n].imag() - ss * tab_qxyz[n].real());
-                        forces[n][0] += 2 * recipCoeff * force * kx;
-                        forces[n][1] += 2 * recipCoeff * force * ky;
-                        forces[n][2] += 2 * recipCoeff * force * kz;
+                    if (includeForces) {
+                        for (int n = 0; n < numberOfAtoms; n++) {
+                            float force = ak * (cs * tab_qxyz[n].imag() - ss * tab_qxyz[n].real());
+                            forces[n][0] += 2 * recipCoeff * force * kx;
+                            forces[n][1] += 2 * recipCoeff * force * ky;
+                            forces[n][2] += 2 * recipCoeff * force * kz;
+                        }
                     }
 
                     if (totalEnergy)
@@ -301,15 +303,16 @@ void CpuNonbondedForce::calculateReciprocalIxn(int numberOfAtoms, float* posq, c
 
 
 void CpuNonbondedForce::calculateDirectIxn(int numberOfAtoms, float* posq, const vector<RealVec>& atomCoordinates, const vector<pair<float, float> >& atomParameters,
-                const vector<set<int> >& exclusions, vector<AlignedArray<float> >& threadForce, double* totalEnergy, ThreadPool& threads) {
+                const CpuExclusionList& exclusions, vector<AlignedArray<float> >& threadForce, bool includeForces, double* totalEnergy, ThreadPool& threads) {
     // Record the parameters for the threads.
     
     this->numberOfAtoms = numberOfAtoms;
     this->posq = posq;
     this->atomCoordinates = &atomCoordinates[0];
     this->atomParameters = &atomParameters[0];
-    this->exclusions = &exclusions[0];
+    this->exclusions = &exclusions;
     this->threadForce = &threadForce;
+    this->includeForces = includeForces;
     includeEnergy = (totalEnergy != NULL);
     threadEnergy.resize(threads.getNumThreads());
     gmx_atomic_t counter;
@@ -339,7 +342,7 @@ void CpuNonbondedForce::threadComputeDirect(ThreadPool& threads, int threadIndex
     int numThreads = threads.getNumThreads();
     threadEnergy[threadIndex] = 0;
     double* energyPtr = (includeEnergy ? &threadEnergy[threadIndex] : NULL);
-    float* forces = &(*threadForce)[threadIndex][0];
+    float* forces = (includeForces ? &(*threadForce)[threadIndex][0] : NULL);
     fvec4 boxSize(periodicBoxVectors[0][0], periodicBoxVectors[1][1], periodicBoxVectors[2][2], 0);
     fvec4 invBoxSize(recipBoxSize[0], recipBoxSize[1], recipBoxSize[2], 0);
     if (ewald || pme) {
@@ -356,9 +359,11 @@ void CpuNonbondedForce::threadComputeDirect(ThreadPool& threads, int threadIndex
 
         for (int i = threadIndex; i < numberOfAtoms; i += numThreads) {
             fvec4 posI((float) atomCoordinates[i][0], (float) atomCoordinates[i][1], (float) atomCoordinates[i][2], 0.0f);
-            for (set<int>::const_iterator iter = exclusions[i].begin(); iter != exclusions[i].end(); ++iter) {
-                if (*iter > i) {
-                    int j = *iter;
+            const int* excluded = exclusions->getExclusions(i);
+            int numExcluded = exclusions->getNumExclusions(i);
+            for (int k = 0; k < numExcluded; k++) {
+                if (excluded[k] > i) {
+                    int j = excluded[k];
                     fvec4 deltaR;
                     fvec4 posJ((float) atomCoordinates[j][0], (float) atomCoordinates[j][1], (float) atomCoordinates[j][2], 0.0f);
                     float r2;
@@ -369,11 +374,13 @@ void CpuNonbondedForce::threadComputeDirect(ThreadPool& threads, int threadIndex
                     float alphaR = alphaEwald*r;
                     float erfAlphaR = erf(alphaR);
                     if (erfAlphaR > 1e-6f) {
-                        float dEdR = (float) (chargeProd * inverseR * inverseR * inverseR);
-                        dEdR = (float) (dEdR * (erfAlphaR-TWO_OVER_SQRT_PI*alphaR*exp(-alphaR*alphaR)));
-                        fvec4 result = deltaR*dEdR;
-                        (fvec4(forces+4*i)-result).store(forces+4*i);
-                        (fvec4(forces+4*j)+result).store(forces+4*j);
+                        if (includeForces) {
+                            float dEdR = (float) (chargeProd * inverseR * inverseR * inverseR);
+                            dEdR = (float) (dEdR * (erfAlphaR-TWO_OVER_SQRT_PI*alphaR*exp(-alphaR*alphaR)));
+                            fvec4 result = deltaR*dEdR;
+                            (fvec4(forces+4*i)-result).store(forces+4*i);
+                            (fvec4(forces+4*j)+result).store(forces+4*j);
+                        }
                         if (includeEnergy)
                             threadEnergy[threadIndex] -= chargeProd*inverseR*erfAlphaR;
                     }
@@ -398,9 +405,16 @@ void CpuNonbondedForce::threadComputeDirect(ThreadPool& threads, int threadIndex
             int i = gmx_atomic_fetch_add(reinterpret_cast<gmx_atomic_t*>(atomicCounter), 1);
             if (i >= numberOfAtoms)
                 break;
-            for (int j = i+1; j < numberOfAtoms; j++)
-                if (exclusions[j].find(i) == exclusions[j].end())
+            // The exclusions are sorted, so step through them in parallel with j.
+
+            const int* excluded = exclusions->getExclusions(i);
+            const int* lastExcluded = excluded+exclusions->getNumExclusions(i);
+            for (int j = i+1; j < numberOfAtoms; j++) {
+                while (excluded != lastExcluded && *excluded < j)
+                    excluded++;
+                if (excluded == lastExcluded || *excluded != j)
                     calculateOneIxn(i, j, forces, energyPtr, boxSize, invBoxSize);
+            }
         }
     }
 }
@@ -454,6 +468,8 @@ void CpuNonbondedForce::calculateOneIxn(int ii, int jj, float* forces, double* t
 
     // accumulate forces
 
+    if (forces == NULL)
+        return;
     fvec4 result = deltaR*dEdR;
     (fvec4(forces+4*ii)+result).store(forces+4*ii);
     (fvec4(forces+4*jj)-result).store(forces+4*jj);
@@ -120,7 +120,7 @@ void CpuNonbondedForceVec4::calculateBlockIxnImpl(int blockIndex, float* forces,
     // Loop over neighbors for this block.
     
     const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
-    const vector<char>& exclusions = neighborList->getBlockExclusions(blockIndex);
+    const vector<short>& exclusions = neighborList->getBlockExclusions(blockIndex);
     for (int i = 0; i < (int) neighbors.size(); i++) {
         // Load the next neighbor.
         
@@ -134,7 +134,7 @@ void CpuNonbondedForceVec4::calculateBlockIxnImpl(int blockIndex, float* forces,
             atomPos -= floor((atomPos-blockCenter)*invBoxSize+0.5f)*boxSize;
         getDeltaR<PERIODIC_TYPE>(atomPos, blockAtomX, blockAtomY, blockAtomZ, dx, dy, dz, r2, needPeriodic, boxSize, invBoxSize);
         ivec4 include;
-        char excl = exclusions[i];
+        short excl = exclusions[i];
         if (excl == 0)
             include = -1;
         else
@@ -170,11 +170,6 @@ void CpuNonbondedForceVec4::calculateBlockIxnImpl(int blockIndex, float* forces,
             dEdR = 0.0f;
         }
         fvec4 chargeProd = blockAtomCharge*posq[4*atom+3];
-        if (cutoff)
-            dEdR += chargeProd*(inverseR-2.0f*krf*r2);
-        else
-            dEdR += chargeProd*inverseR;
-        dEdR *= inverseR*inverseR;
 
         // Accumulate energies.
 
@@ -190,6 +185,13 @@ void CpuNonbondedForceVec4::calculateBlockIxnImpl(int blockIndex, float* forces,
 
         // Accumulate forces.
 
+        if (forces == NULL)
+            continue;
+        if (cutoff)
+            dEdR += chargeProd*(inverseR-2.0f*krf*r2);
+        else
+            dEdR += chargeProd*inverseR;
+        dEdR *= inverseR*inverseR;
         dEdR = blend(0.0f, dEdR, include);
         fvec4 fx = dx*dEdR;
         fvec4 fy = dy*dEdR;
@@ -202,7 +204,9 @@ void CpuNonbondedForceVec4::calculateBlockIxnImpl(int blockIndex, float* forces,
         atomForce[1] -= dot4(fy, one);
         atomForce[2] -= dot4(fz, one);
     }
-    
+    if (forces == NULL)
+        return;
+
     // Record the forces on the block atoms.
 
     fvec4 f[4] = {blockAtomForceX, blockAtomForceY, blockAtomForceZ, 0.0f};
@@ -284,7 +288,7 @@ void CpuNonbondedForceVec4::calculateBlockEwaldIxnImpl(int blockIndex, float* fo
     // Loop over neighbors for this block.
     
     const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
-    const vector<char>& exclusions = neighborList->getBlockExclusions(blockIndex);
+    const vector<short>& exclusions = neighborList->getBlockExclusions(blockIndex);
     for (int i = 0; i < (int) neighbors.size(); i++) {
         // Load the next neighbor.
         
@@ -298,7 +302,7 @@ void CpuNonbondedForceVec4::calculateBlockEwaldIxnImpl(int blockIndex, float* fo
             atomPos -= floor((atomPos-blockCenter)*invBoxSize+0.5f)*boxSize;
         getDeltaR<PERIODIC_TYPE>(atomPos, blockAtomX, blockAtomY, blockAtomZ, dx, dy, dz, r2, needPeriodic, boxSize, invBoxSize);
         ivec4 include;
-        char excl = exclusions[i];
+        short excl = exclusions[i];
         if (excl == 0)
             include = -1;
         else
@@ -334,8 +338,6 @@ void CpuNonbondedForceVec4::calculateBlockEwaldIxnImpl(int blockIndex, float* fo
             dEdR = 0.0f;
         }
         fvec4 chargeProd = blockAtomCharge*posq[4*atom+3];
-        dEdR += chargeProd*inverseR*ewaldScaleFunction(r);
-        dEdR *= inverseR*inverseR;        
 
         // Accumulate energies.
 
@@ -348,6 +350,10 @@ void CpuNonbondedForceVec4::calculateBlockEwaldIxnImpl(int blockIndex, float* fo
 
         // Accumulate forces.
 
+        if (forces == NULL)
+            continue;
+        dEdR += chargeProd*inverseR*ewaldScaleFunction(r);
+        dEdR *= inverseR*inverseR;
         dEdR = blend(0.0f, dEdR, include);
         fvec4 fx = dx*dEdR;
         fvec4 fy = dy*dEdR;
@@ -360,7 +366,9 @@ void CpuNonbondedForceVec4::calculateBlockEwaldIxnImpl(int blockIndex, float* fo
         atomForce[1] -= dot4(fy, one);
         atomForce[2] -= dot4(fz, one);
     }
-    
+    if (forces == NULL)
+        return;
+
     // Record the forces on the block atoms.
     
     fvec4 f[4] = {blockAtomForceX, blockAtomForceY, blockAtomForceZ, 0.0f};
@@ -46,6 +46,32 @@ CpuNonbondedForce* createCpuNonbondedForceVec8() {
     throw OpenMMException("Internal error: OpenMM was compiled without AVX support");
 }
 #else
+#ifdef __FMA__
+/**
+ * Check whether the current CPU supports AVX2 and FMA in addition to AVX.  This is only compiled when
+ * this file is included by CpuNonbondedForceVec8Fma.cpp.
+ */
+bool isVec8FmaSupported() {
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0);
+    if (cpuInfo[0] < 7)
+        return false;
+    cpuid(cpuInfo, 1);
+    bool hasAvx = ((cpuInfo[2] & ((int) 1 << 28)) != 0);
+    bool hasFma = ((cpuInfo[2] & ((int) 1 << 12)) != 0);
+    if (!hasAvx || !hasFma)
+        return false;
+    cpuidex(cpuInfo, 7, 0);
+    return ((cpuInfo[1] & ((int) 1 << 5)) != 0);
+}
+
+/**
+ * Factory method to create a CpuNonbondedForceVec8 compiled for AVX2 and FMA.
+ */
+CpuNonbondedForce* createCpuNonbondedForceVec8Fma() {
+    return new CpuNonbondedForceVec8();
+}
+#else
 /**
  * Check whether 8 component vectors are supported with the current CPU.
  */
@@ -67,6 +93,7 @@ bool isVec8Supported() {
 CpuNonbondedForce* createCpuNonbondedForceVec8() {
     return new CpuNonbondedForceVec8();
 }
+#endif
 
 /**---------------------------------------------------------------------------------------
 
@@ -151,7 +178,7 @@ void CpuNonbondedForceVec8::calculateBlockIxnImpl(int blockIndex, float* forces,
     // Loop over neighbors for this block.
     
     const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
-    const vector<char>& exclusions = neighborList->getBlockExclusions(blockIndex);
+    const vector<short>& exclusions = neighborList->getBlockExclusions(blockIndex);
     for (int i = 0; i < (int) neighbors.size(); i++) {
         // Load the next neighbor.
         
@@ -165,7 +192,7 @@ void CpuNonbondedForceVec8::calculateBlockIxnImpl(int blockIndex, float* forces,
             atomPos -= floor((atomPos-blockCenter)*invBoxSize+0.5f)*boxSize;
         getDeltaR<PERIODIC_TYPE>(atomPos, blockAtomX, blockAtomY, blockAtomZ, dx, dy, dz, r2, needPeriodic, boxSize, invBoxSize);
         ivec8 include;
-        char excl = exclusions[i];
+        short excl = exclusions[i];
         if (excl == 0)
             include = -1;
         else
@@ -201,11 +228,6 @@ void CpuNonbondedForceVec8::calculateBlockIxnImpl(int blockIndex, float* forces,
             dEdR = 0.0f;
         }
         fvec8 chargeProd = blockAtomCharge*posq[4*atom+3];
-        if (cutoff)
-            dEdR += chargeProd*(inverseR-2.0f*krf*r2);
-        else
-            dEdR += chargeProd*inverseR;
-        dEdR *= inverseR*inverseR;
 
         // Accumulate energies.
 
@@ -221,6 +243,13 @@ void CpuNonbondedForceVec8::calculateBlockIxnImpl(int blockIndex, float* forces,
 
         // Accumulate forces.
 
+        if (forces == NULL)
+            continue;
+        if (cutoff)
+            dEdR += chargeProd*(inverseR-2.0f*krf*r2);
+        else
+            dEdR += chargeProd*inverseR;
+        dEdR *= inverseR*inverseR;
         dEdR = blend(0.0f, dEdR, include);
         fvec8 fx = dx*dEdR;
         fvec8 fy = dy*dEdR;
@@ -233,7 +262,9 @@ void CpuNonbondedForceVec8::calculateBlockIxnImpl(int blockIndex, float* forces,
         atomForce[1] -= dot8(fy, one);
         atomForce[2] -= dot8(fz, one);
     }
-    
+    if (forces == NULL)
+        return;
+
     // Record the forces on the block atoms.
 
     fvec4 f[8];
@@ -314,7 +345,7 @@ void CpuNonbondedForceVec8::calculateBlockEwaldIxnImpl(int blockIndex, float* fo
     // Loop over neighbors for this block.
     
     const vector<int>& neighbors = neighborList->getBlockNeighbors(blockIndex);
-    const vector<char>& exclusions = neighborList->getBlockExclusions(blockIndex);
+    const vector<short>& exclusions = neighborList->getBlockExclusions(blockIndex);
     for (int i = 0; i < (int) neighbors.size(); i++) {
         // Load the next neighbor.
         
@@ -328,7 +359,7 @@ void CpuNonbondedForceVec8::calculateBlockEwaldIxnImpl(int blockIndex, float* fo
             atomPos -= floor((atomPos-blockCenter)*invBoxSize+0.5f)*boxSize;
         getDeltaR<PERIODIC_TYPE>(atomPos, blockAtomX, blockAtomY, blockAtomZ, dx, dy, dz, r2, needPeriodic, boxSize, invBoxSize);
         ivec8 include;
-        char excl = exclusions[i];
+        short excl = exclusions[i];
         if (excl == 0)
             include = -1;
         else
@@ -364,8 +395,6 @@ void CpuNonbondedForceVec8::calculateBlockEwaldIxnImpl(int blockIndex, float* fo
             dEdR = 0.0f;
         }
         fvec8 chargeProd = blockAtomCharge*posq[4*atom+3];
-        dEdR += chargeProd*inverseR*ewaldScaleFunction(r);
-        dEdR *= inverseR*inverseR;
 
         // Accumulate energies.
 
@@ -378,6 +407,10 @@ void CpuNonbondedForceVec8::calculateBlockEwaldIxnImpl(int blockIndex, float* fo
 
         // Accumulate forces.
 
+        if (forces == NULL)
+            continue;
+        dEdR += chargeProd*inverseR*ewaldScaleFunction(r);
+        dEdR *= inverseR*inverseR;
         dEdR = blend(0.0f, dEdR, include);
         fvec8 fx = dx*dEdR;
         fvec8 fy = dy*dEdR;
@@ -390,7 +423,9 @@ void CpuNonbondedForceVec8::calculateBlockEwaldIxnImpl(int blockIndex, float* fo
         atomForce[1] -= dot8(fy, one);
         atomForce[2] -= dot8(fz, one);
     }
-    
+    if (forces == NULL)
+        return;
+
     // Record the forces on the block atoms.
     
     fvec4 f[8];
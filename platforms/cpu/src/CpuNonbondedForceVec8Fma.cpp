@@ -0,0 +1,50 @@
+/* Portions copyright (c) 2015 Stanford University and Simbios.
+/* Portions copyright (c) 2006-2015 Stanford University and Simbios.
+ * Contributors: Pande Group
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+/**
+ * This compiles CpuNonbondedForceVec8 a second time with AVX2 and FMA enabled, under the name
+ * CpuNonbondedForceVec8Fma.  The source is identical, but the compiler can fuse the many multiply-add
+ * sequences in the kernels into single instructions.
+ */
+
+#if defined(__AVX__) && defined(__FMA__) && !defined(_MSC_VER)
+
+#define CpuNonbondedForceVec8 CpuNonbondedForceVec8Fma
+#include "CpuNonbondedForceVec8.cpp"
+
+#else
+
+#include "CpuNonbondedForce.h"
+#include "openmm/OpenMMException.h"
+
+using namespace OpenMM;
+
+bool isVec8FmaSupported() {
+    return false;
+}
+
+CpuNonbondedForce* createCpuNonbondedForceVec8Fma() {
+    throw OpenMMException("Internal error: OpenMM was compiled without AVX2 and FMA support");
+}
+
+#endif
@@ -34,6 +34,7 @@
 #include "CpuKernels.h"
 #include "CpuSETTLE.h"
 #include "ReferenceConstraints.h"
+#include "openmm/OpenMMException.h"
 #include "openmm/internal/hardware.h"
 #include "openmm/internal/vectorize.h"
 #include <sstream>
@@ -61,15 +62,23 @@ map<const ContextImpl*, CpuPlatform::PlatformData*> CpuPlatform::contextData;
 CpuPlatform::CpuPlatform() {
     CpuKernelFactory* factory = new CpuKernelFactory();
     registerKernelFactory(CalcForcesAndEnergyKernel::Name(), factory);
+    registerKernelFactory(UpdateStateDataKernel::Name(), factory);
+    registerKernelFactory(CalcHarmonicBondForceKernel::Name(), factory);
+    registerKernelFactory(CalcHarmonicAngleForceKernel::Name(), factory);
     registerKernelFactory(CalcPeriodicTorsionForceKernel::Name(), factory);
     registerKernelFactory(CalcRBTorsionForceKernel::Name(), factory);
+    registerKernelFactory(CalcCMAPTorsionForceKernel::Name(), factory);
     registerKernelFactory(CalcNonbondedForceKernel::Name(), factory);
     registerKernelFactory(CalcCustomNonbondedForceKernel::Name(), factory);
     registerKernelFactory(CalcCustomManyParticleForceKernel::Name(), factory);
     registerKernelFactory(CalcGBSAOBCForceKernel::Name(), factory);
     registerKernelFactory(CalcCustomGBForceKernel::Name(), factory);
     registerKernelFactory(IntegrateLangevinStepKernel::Name(), factory);
+    registerKernelFactory(IntegrateVariableLangevinStepKernel::Name(), factory);
+    registerKernelFactory(IntegrateVariableVerletStepKernel::Name(), factory);
     platformProperties.push_back(CpuThreads());
+    platformProperties.push_back(CpuPrecision());
+    platformProperties.push_back(CpuReorderAtoms());
     int threads = getNumProcessors();
     char* threadsEnv = getenv("OPENMM_CPU_THREADS");
     if (threadsEnv != NULL)
@@ -77,6 +86,8 @@ CpuPlatform::CpuPlatform() {
     stringstream defaultThreads;
     defaultThreads << threads;
     setPropertyDefaultValue(CpuThreads(), defaultThreads.str());
+    setPropertyDefaultValue(CpuPrecision(), "mixed");
+    setPropertyDefaultValue(CpuReorderAtoms(), "false");
 }
 
 const string& CpuPlatform::getPropertyValue(const Context& context, const string& property) const {
@@ -100,13 +111,35 @@ bool CpuPlatform::isProcessorSupported() {
     return isVec4Supported();
 }
 
+static bool parsePrecision(const string& precision) {
+    if (precision == "mixed")
+        return false;
+    if (precision == "double")
+        return true;
+    throw OpenMMException("Illegal value for CpuPrecision: "+precision);
+}
+
+static bool parseReorderAtoms(const string& reorderAtoms) {
+    if (reorderAtoms == "true")
+        return true;
+    if (reorderAtoms == "false")
+        return false;
+    throw OpenMMException("Illegal value for CpuReorderAtoms: "+reorderAtoms);
+}
+
 void CpuPlatform::contextCreated(ContextImpl& context, const map<string, string>& properties) const {
-    ReferencePlatform::contextCreated(context, properties);
     const string& threadsPropValue = (properties.find(CpuThreads()) == properties.end() ?
             getPropertyDefaultValue(CpuThreads()) : properties.find(CpuThreads())->second);
+    const string& precisionPropValue = (properties.find(CpuPrecision()) == properties.end() ?
+            getPropertyDefaultValue(CpuPrecision()) : properties.find(CpuPrecision())->second);
+    const string& reorderPropValue = (properties.find(CpuReorderAtoms()) == properties.end() ?
+            getPropertyDefaultValue(CpuReorderAtoms()) : properties.find(CpuReorderAtoms())->second);
     int numThreads;
     stringstream(threadsPropValue) >> numThreads;
-    PlatformData* data = new PlatformData(context.getSystem().getNumParticles(), numThreads);
+    bool useDoublePrecision = parsePrecision(precisionPropValue);
+    bool reorderAtoms = parseReorderAtoms(reorderPropValue);
+    ReferencePlatform::contextCreated(context, properties);
+    PlatformData* data = new PlatformData(context.getSystem().getNumParticles(), numThreads, useDoublePrecision, reorderAtoms);
     contextData[&context] = data;
     ReferenceConstraints& constraints = *(ReferenceConstraints*) reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData())->constraints;
     if (constraints.settle != NULL) {
@@ -130,7 +163,8 @@ const CpuPlatform::PlatformData& CpuPlatform::getPlatformData(const ContextImpl&
     return *contextData[&context];
 }
 
-CpuPlatform::PlatformData::PlatformData(int numParticles, int numThreads) : posq(4*numParticles), threads(numThreads) {
+CpuPlatform::PlatformData::PlatformData(int numParticles, int numThreads, bool useDoublePrecision, bool reorderAtoms) : posq(4*numParticles),
+        threads(numThreads), useDoublePrecision(useDoublePrecision), atomReorderer(numParticles, reorderAtoms && !useDoublePrecision) {
     numThreads = threads.getNumThreads();
     threadForce.resize(numThreads);
     for (int i = 0; i < numThreads; i++)
@@ -139,4 +173,6 @@ CpuPlatform::PlatformData::PlatformData(int numParticles, int numThreads) : posq
     stringstream threadsProperty;
     threadsProperty << numThreads;
     propertyValues[CpuThreads()] = threadsProperty.str();
+    propertyValues[CpuPrecision()] = (useDoublePrecision ? "double" : "mixed");
+    propertyValues[CpuReorderAtoms()] = (reorderAtoms ? "true" : "false");
 }
@@ -25,12 +25,27 @@
 #include "CpuRandom.h"
 #include "openmm/internal/OSRngSeed.h"
 #include "openmm/OpenMMException.h"
+#include <algorithm>
 #include <cmath>
+#include <istream>
+#include <ostream>
+#if !defined(__ANDROID__) && !defined(__PNACL__)
+    #include <emmintrin.h>
+#endif
 
 using namespace std;
 using namespace OpenMM;
 
-CpuRandom::CpuRandom() : hasInitialized(false) {
+// Constants for the Philox4x32-10 generator.
+
+static const unsigned int PHILOX_M0 = 0xD2511F53;
+static const unsigned int PHILOX_M1 = 0xCD9E8D57;
+static const unsigned int PHILOX_W0 = 0x9E3779B9;
+static const unsigned int PHILOX_W1 = 0xBB67AE85;
+static const float HALF_PI = 1.57079632679489662f;
+
+CpuRandom::CpuRandom() : hasInitialized(false), nextCounter(0) {
+    philoxKey[0] = philoxKey[1] = 0;
 }
 
 CpuRandom::~CpuRandom() {
@@ -46,6 +61,7 @@ void CpuRandom::initialize(int seed, int numThreads) {
     }
     randomSeed = seed;
     hasInitialized = true;
+    nextCounter = 0;
     threadRandom.resize(numThreads);
     nextGaussian.resize(numThreads);
     nextGaussianIsValid.resize(numThreads, false);
@@ -57,6 +73,8 @@ void CpuRandom::initialize(int seed, int numThreads) {
     unsigned int r = (unsigned int) seed;
     if (r == 0)
         r = (unsigned int) osrngseed();
+    philoxKey[0] = r;
+    philoxKey[1] = (1103515245*r + 12345) & 0xFFFFFFFF;
     for (int i = 0; i < numThreads; i++) {
         r = (1664525*r + 1013904223) & 0xFFFFFFFF;
         threadRandom[i] = new OpenMM_SFMT::SFMT();
@@ -87,3 +105,217 @@ float CpuRandom::getGaussianRandom(int threadIndex) {
 float CpuRandom::getUniformRandom(int threadIndex) {
     return genrand_real2(*threadRandom[threadIndex]);
 }
+
+unsigned long long CpuRandom::getNextCounter() {
+    return nextCounter++;
+}
+
+void CpuRandom::createCheckpoint(ostream& stream) const {
+    stream.write((char*) &nextCounter, sizeof(nextCounter));
+    stream.write((char*) philoxKey, sizeof(philoxKey));
+}
+
+void CpuRandom::loadCheckpoint(istream& stream) {
+    unsigned long long counter;
+    unsigned int key[2];
+    stream.read((char*) &counter, sizeof(counter));
+    stream.read((char*) key, sizeof(key));
+    if (!stream)
+        throw OpenMMException("Checkpoint data is truncated");
+    nextCounter = counter;
+    philoxKey[0] = key[0];
+    philoxKey[1] = key[1];
+}
+
+void CpuRandom::philox(const unsigned int* counter, const unsigned int* key, unsigned int* result) {
+    unsigned int c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    unsigned int k0 = key[0], k1 = key[1];
+    for (int round = 0; round < 10; round++) {
+        if (round > 0) {
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        unsigned long long product0 = (unsigned long long) PHILOX_M0*c0;
+        unsigned long long product1 = (unsigned long long) PHILOX_M1*c2;
+        unsigned int hi0 = (unsigned int) (product0>>32), lo0 = (unsigned int) product0;
+        unsigned int hi1 = (unsigned int) (product1>>32), lo1 = (unsigned int) product1;
+        c0 = hi1^c1^k0;
+        c1 = lo1;
+        c2 = hi0^c3^k1;
+        c3 = lo0;
+    }
+    result[0] = c0;
+    result[1] = c1;
+    result[2] = c2;
+    result[3] = c3;
+}
+
+/**
+ * Both versions of the Box-Muller transform below use the same steps, so they produce identical results
+ * up to the accuracy of the math functions.  The first 32 bit word is converted to a uniform value in
+ * (0, 1) that sets the radius.  The top two bits of the second word select a quadrant, and the next 23
+ * bits select an angle in (-pi/4, pi/4) within it.
+ */
+#if !defined(__ANDROID__) && !defined(__PNACL__)
+
+/**
+ * Compute the four products a*b and return the high and low 32 bits of each one.
+ */
+static inline void mulhilo(__m128i a, __m128i b, __m128i& hi, __m128i& lo) {
+    __m128i evenProduct = _mm_mul_epu32(a, b);
+    __m128i oddProduct = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(evenProduct, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(oddProduct, _MM_SHUFFLE(0, 0, 2, 0)));
+    hi = _mm_unpacklo_epi32(_mm_shuffle_epi32(evenProduct, _MM_SHUFFLE(0, 0, 3, 1)), _mm_shuffle_epi32(oddProduct, _MM_SHUFFLE(0, 0, 3, 1)));
+}
+
+/**
+ * Compute the natural log of four positive, normalized values.  This uses the same polynomial as the
+ * Cephes library's logf(), and is accurate to a few ulp.
+ */
+static inline __m128 logVec4(__m128 x) {
+    __m128i bits = _mm_castps_si128(x);
+    __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126)));
+    __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F000000)));
+    __m128 mask = _mm_cmplt_ps(m, _mm_set1_ps(0.707106781186547524f));
+    e = _mm_sub_ps(e, _mm_and_ps(mask, _mm_set1_ps(1.0f)));
+    m = _mm_sub_ps(_mm_add_ps(m, _mm_and_ps(mask, m)), _mm_set1_ps(1.0f));
+    __m128 z = _mm_mul_ps(m, m);
+    __m128 y = _mm_set1_ps(7.0376836292e-2f);
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(-1.1514610310e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(1.1676998740e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(-1.2420140846e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(1.4249322787e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(-1.6668057665e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(2.0000714765e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(-2.4999993993e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, m), _mm_set1_ps(3.3333331174e-1f));
+    y = _mm_mul_ps(_mm_mul_ps(y, m), z);
+    y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(-2.12194440e-4f)));
+    y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+    return _mm_add_ps(_mm_add_ps(m, y), _mm_mul_ps(e, _mm_set1_ps(0.693359375f)));
+}
+
+/**
+ * Convert two vectors of random words to two vectors of Gaussian random numbers.
+ */
+static inline void boxMullerVec4(__m128i word1, __m128i word2, __m128& result1, __m128& result2) {
+    const float scale = 1.0f/(1<<23);
+    __m128 u = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(word1, 9)), _mm_set1_ps(scale)), _mm_set1_ps(0.5f*scale));
+    __m128 r = _mm_sqrt_ps(_mm_mul_ps(_mm_set1_ps(-2.0f), logVec4(u)));
+    __m128 f = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(word2, 7), _mm_set1_epi32(0x007FFFFF)));
+    __m128 a = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_mul_ps(f, _mm_set1_ps(scale)), _mm_set1_ps(0.5f*scale)), _mm_set1_ps(0.5f)), _mm_set1_ps(HALF_PI));
+    __m128 a2 = _mm_mul_ps(a, a);
+    __m128 s = _mm_set1_ps(-1.9515295891e-4f);
+    s = _mm_add_ps(_mm_mul_ps(s, a2), _mm_set1_ps(8.3321608736e-3f));
+    s = _mm_add_ps(_mm_mul_ps(s, a2), _mm_set1_ps(-1.6666654611e-1f));
+    s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, a2), a), a);
+    __m128 c = _mm_set1_ps(2.443315711809948e-5f);
+    c = _mm_add_ps(_mm_mul_ps(c, a2), _mm_set1_ps(-1.388731625493765e-3f));
+    c = _mm_add_ps(_mm_mul_ps(c, a2), _mm_set1_ps(4.166664568298827e-2f));
+    c = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_mul_ps(c, a2), a2), _mm_mul_ps(a2, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+
+    // Rotate by the selected quadrant: (cos, sin) becomes (c, s), (-s, c), (-c, -s), or (s, -c).
+
+    __m128i quadrant = _mm_srli_epi32(word2, 30);
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128 x = _mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c));
+    __m128 y = _mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s));
+    __m128 xSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+    __m128 ySign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+    result1 = _mm_mul_ps(r, _mm_xor_ps(x, xSign));
+    result2 = _mm_mul_ps(r, _mm_xor_ps(y, ySign));
+}
+
+void CpuRandom::getGaussianRandoms(unsigned long long counter, int start, int end, float* values) const {
+    const __m128i m0 = _mm_set1_epi32(PHILOX_M0);
+    const __m128i m1 = _mm_set1_epi32(PHILOX_M1);
+    const __m128i counterLow = _mm_set1_epi32((int) (counter&0xFFFFFFFF));
+    const __m128i counterHigh = _mm_set1_epi32((int) (counter>>32));
+    for (int base = start; base < end; base += 4) {
+        // Run the generator on four indices at once.
+
+        __m128i c0 = _mm_add_epi32(_mm_set1_epi32(base), _mm_set_epi32(3, 2, 1, 0));
+        __m128i c1 = counterLow;
+        __m128i c2 = counterHigh;
+        __m128i c3 = _mm_setzero_si128();
+        unsigned int k0 = philoxKey[0], k1 = philoxKey[1];
+        for (int round = 0; round < 10; round++) {
+            if (round > 0) {
+                k0 += PHILOX_W0;
+                k1 += PHILOX_W1;
+            }
+            __m128i hi0, lo0, hi1, lo1;
+            mulhilo(m0, c0, hi0, lo0);
+            mulhilo(m1, c2, hi1, lo1);
+            c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32((int) k0));
+            c1 = lo1;
+            c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32((int) k1));
+            c3 = lo0;
+        }
+
+        // Transform to Gaussians and transpose so each index's values are contiguous.
+
+        __m128 g0, g1, g2, g3;
+        boxMullerVec4(c0, c1, g0, g1);
+        boxMullerVec4(c2, c3, g2, g3);
+        _MM_TRANSPOSE4_PS(g0, g1, g2, g3);
+        float* dest = &values[4*(base-start)];
+        int count = min(4, end-base);
+        if (count == 4) {
+            _mm_storeu_ps(dest, g0);
+            _mm_storeu_ps(dest+4, g1);
+            _mm_storeu_ps(dest+8, g2);
+            _mm_storeu_ps(dest+12, g3);
+        }
+        else {
+            float temp[16];
+            _mm_storeu_ps(temp, g0);
+            _mm_storeu_ps(temp+4, g1);
+            _mm_storeu_ps(temp+8, g2);
+            _mm_storeu_ps(temp+12, g3);
+            for (int i = 0; i < 4*count; i++)
+                dest[i] = temp[i];
+        }
+    }
+}
+
+#else
+
+static inline void boxMuller(unsigned int word1, unsigned int word2, float& result1, float& result2) {
+    const float scale = 1.0f/(1<<23);
+    float u = (word1>>9)*scale + 0.5f*scale;
+    float r = sqrtf(-2.0f*logf(u));
+    float a = (((word2>>7)&0x007FFFFF)*scale + 0.5f*scale - 0.5f)*HALF_PI;
+    float s = sinf(a), c = cosf(a);
+    switch (word2>>30) {
+        case 0:
+            result1 = r*c;
+            result2 = r*s;
+            break;
+        case 1:
+            result1 = -r*s;
+            result2 = r*c;
+            break;
+        case 2:
+            result1 = -r*c;
+            result2 = -r*s;
+            break;
+        default:
+            result1 = r*s;
+            result2 = -r*c;
+    }
+}
+
+void CpuRandom::getGaussianRandoms(unsigned long long counter, int start, int end, float* values) const {
+    unsigned int counterWords[4] = {0, (unsigned int) (counter&0xFFFFFFFF), (unsigned int) (counter>>32), 0};
+    unsigned int words[4];
+    for (int i = start; i < end; i++) {
+        counterWords[0] = (unsigned int) i;
+        philox(counterWords, philoxKey, words);
+        float* dest = &values[4*(i-start)];
+        boxMuller(words[0], words[1], dest[0], dest[1]);
+        boxMuller(words[2], words[3], dest[2], dest[3]);
+    }
+}
+
+#endif
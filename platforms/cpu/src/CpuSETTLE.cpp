@@ -30,79 +30,176 @@
  * -------------------------------------------------------------------------- */
 
 #include "CpuSETTLE.h"
+#include <cmath>
+#if !defined(__ANDROID__) && !defined(__PNACL__)
+    #include <emmintrin.h>
+#endif
 
 using namespace OpenMM;
 using namespace std;
 
+bool isVec8Supported();
+void settlePositionsVec8(const CpuSETTLEClusters& clusters, int startBlock, int endBlock, const RealVec* atomCoordinates, RealVec* atomCoordinatesP);
+void settleVelocitiesVec8(const CpuSETTLEClusters& clusters, int startBlock, int endBlock, const RealVec* atomCoordinates, RealVec* velocities, const RealOpenMM* inverseMasses);
+
+/**
+ * A vector of four doubles, used for processing blocks of four clusters.  It is stored as a pair
+ * of SSE2 registers where they are available.
+ */
+class dvec4 {
+public:
+#if !defined(__ANDROID__) && !defined(__PNACL__)
+    __m128d lo, hi;
+    dvec4(__m128d lo, __m128d hi) : lo(lo), hi(hi) {
+    }
+    dvec4(double v) : lo(_mm_set1_pd(v)), hi(_mm_set1_pd(v)) {
+    }
+    dvec4(const double* v) : lo(_mm_loadu_pd(v)), hi(_mm_loadu_pd(v+2)) {
+    }
+    void store(double* v) const {
+        _mm_storeu_pd(v, lo);
+        _mm_storeu_pd(v+2, hi);
+    }
+    dvec4 operator+(const dvec4& other) const {
+        return dvec4(_mm_add_pd(lo, other.lo), _mm_add_pd(hi, other.hi));
+    }
+    dvec4 operator-(const dvec4& other) const {
+        return dvec4(_mm_sub_pd(lo, other.lo), _mm_sub_pd(hi, other.hi));
+    }
+    dvec4 operator*(const dvec4& other) const {
+        return dvec4(_mm_mul_pd(lo, other.lo), _mm_mul_pd(hi, other.hi));
+    }
+    dvec4 operator/(const dvec4& other) const {
+        return dvec4(_mm_div_pd(lo, other.lo), _mm_div_pd(hi, other.hi));
+    }
+#else
+    double val[4];
+    dvec4(double v) {
+        val[0] = val[1] = val[2] = val[3] = v;
+    }
+    dvec4(const double* v) {
+        val[0] = v[0];
+        val[1] = v[1];
+        val[2] = v[2];
+        val[3] = v[3];
+    }
+    void store(double* v) const {
+        v[0] = val[0];
+        v[1] = val[1];
+        v[2] = val[2];
+        v[3] = val[3];
+    }
+    dvec4 operator+(const dvec4& other) const {
+        double result[4] = {val[0]+other.val[0], val[1]+other.val[1], val[2]+other.val[2], val[3]+other.val[3]};
+        return dvec4(result);
+    }
+    dvec4 operator-(const dvec4& other) const {
+        double result[4] = {val[0]-other.val[0], val[1]-other.val[1], val[2]-other.val[2], val[3]-other.val[3]};
+        return dvec4(result);
+    }
+    dvec4 operator*(const dvec4& other) const {
+        double result[4] = {val[0]*other.val[0], val[1]*other.val[1], val[2]*other.val[2], val[3]*other.val[3]};
+        return dvec4(result);
+    }
+    dvec4 operator/(const dvec4& other) const {
+        double result[4] = {val[0]/other.val[0], val[1]/other.val[1], val[2]/other.val[2], val[3]/other.val[3]};
+        return dvec4(result);
+    }
+#endif
+};
+
+static inline dvec4 sqrt(const dvec4& v) {
+#if !defined(__ANDROID__) && !defined(__PNACL__)
+    return dvec4(_mm_sqrt_pd(v.lo), _mm_sqrt_pd(v.hi));
+#else
+    double result[4] = {std::sqrt(v.val[0]), std::sqrt(v.val[1]), std::sqrt(v.val[2]), std::sqrt(v.val[3])};
+    return dvec4(result);
+#endif
+}
+
 class CpuSETTLE::ApplyToPositionsTask : public ThreadPool::Task {
 public:
-    ApplyToPositionsTask(vector<OpenMM::RealVec>& atomCoordinates, vector<OpenMM::RealVec>& atomCoordinatesP, vector<RealOpenMM>& inverseMasses,
-            RealOpenMM tolerance, vector<ReferenceSETTLEAlgorithm*>& threadSettle) : atomCoordinates(atomCoordinates), atomCoordinatesP(atomCoordinatesP),
-            inverseMasses(inverseMasses), tolerance(tolerance), threadSettle(threadSettle) {
+    ApplyToPositionsTask(vector<OpenMM::RealVec>& atomCoordinates, vector<OpenMM::RealVec>& atomCoordinatesP, const CpuSETTLEClusters& clusters) :
+            atomCoordinates(atomCoordinates), atomCoordinatesP(atomCoordinatesP), clusters(clusters) {
     }
     void execute(ThreadPool& threads, int threadIndex) {
-        if (threadIndex < threadSettle.size()) {
-            threadSettle[threadIndex]->apply(atomCoordinates, atomCoordinatesP, inverseMasses, tolerance);
-        }
+        int numThreads = threads.getNumThreads();
+        int start = threadIndex*clusters.numBlocks/numThreads;
+        int end = (threadIndex+1)*clusters.numBlocks/numThreads;
+        if (start == end)
+            return;
+        if (clusters.blockSize == 8)
+            settlePositionsVec8(clusters, start, end, &atomCoordinates[0], &atomCoordinatesP[0]);
+        else
+            settlePositionsInBlocks<dvec4, 4>(clusters, start, end, &atomCoordinates[0], &atomCoordinatesP[0]);
     }
     vector<OpenMM::RealVec>& atomCoordinates;
     vector<OpenMM::RealVec>& atomCoordinatesP;
-    vector<RealOpenMM>& inverseMasses;
-    RealOpenMM tolerance;
-    vector<ReferenceSETTLEAlgorithm*>& threadSettle;
+    const CpuSETTLEClusters& clusters;
 };
 
 class CpuSETTLE::ApplyToVelocitiesTask : public ThreadPool::Task {
 public:
     ApplyToVelocitiesTask(vector<OpenMM::RealVec>& atomCoordinates, vector<OpenMM::RealVec>& velocities, vector<RealOpenMM>& inverseMasses,
-            RealOpenMM tolerance, vector<ReferenceSETTLEAlgorithm*>& threadSettle) : atomCoordinates(atomCoordinates), velocities(velocities),
-            inverseMasses(inverseMasses), tolerance(tolerance), threadSettle(threadSettle) {
+            const CpuSETTLEClusters& clusters) : atomCoordinates(atomCoordinates), velocities(velocities), inverseMasses(inverseMasses), clusters(clusters) {
     }
     void execute(ThreadPool& threads, int threadIndex) {
-        if (threadIndex < threadSettle.size()) {
-            threadSettle[threadIndex]->applyToVelocities(atomCoordinates, velocities, inverseMasses, tolerance);
-        }
+        int numThreads = threads.getNumThreads();
+        int start = threadIndex*clusters.numBlocks/numThreads;
+        int end = (threadIndex+1)*clusters.numBlocks/numThreads;
+        if (start == end)
+            return;
+        if (clusters.blockSize == 8)
+            settleVelocitiesVec8(clusters, start, end, &atomCoordinates[0], &velocities[0], &inverseMasses[0]);
+        else
+            settleVelocitiesInBlocks<dvec4, 4>(clusters, start, end, &atomCoordinates[0], &velocities[0], &inverseMasses[0]);
     }
     vector<OpenMM::RealVec>& atomCoordinates;
     vector<OpenMM::RealVec>& velocities;
     vector<RealOpenMM>& inverseMasses;
-    RealOpenMM tolerance;
-    vector<ReferenceSETTLEAlgorithm*>& threadSettle;
+    const CpuSETTLEClusters& clusters;
 };
 
-CpuSETTLE::CpuSETTLE(const System& system, const ReferenceSETTLEAlgorithm& settle, ThreadPool& threads) : threads(threads) {
-    int numThreads = threads.getNumThreads();
+CpuSETTLE::CpuSETTLE(const System& system, const ReferenceSETTLEAlgorithm& settle, ThreadPool& threads, bool allowVec8) : threads(threads) {
+    // Record the cluster parameters in structure of arrays form, padding the last block by repeating
+    // the final cluster.
+
     int numClusters = settle.getNumClusters();
-    vector<RealOpenMM> mass(system.getNumParticles());
-    for (int i = 0; i < system.getNumParticles(); i++)
-        mass[i] = system.getParticleMass(i);
-    for (int i = 0; i < numThreads; i++) {
-        int start = i*numClusters/numThreads;
-        int end = (i+1)*numClusters/numThreads;
-        if (start != end) {
-            int numThreadClusters = end-start;
-            vector<int> atom1(numThreadClusters), atom2(numThreadClusters), atom3(numThreadClusters);
-            vector<RealOpenMM> distance1(numThreadClusters), distance2(numThreadClusters);
-            for (int j = 0; j < numThreadClusters; j++)
-                settle.getClusterParameters(start+j, atom1[j], atom2[j], atom3[j], distance1[j], distance2[j]);
-            threadSettle.push_back(new ReferenceSETTLEAlgorithm(atom1, atom2, atom3, distance1, distance2, mass));
-        }
+    int blockSize = (allowVec8 && isVec8Supported() ? 8 : 4);
+    clusters.blockSize = blockSize;
+    clusters.numBlocks = (numClusters+blockSize-1)/blockSize;
+    int paddedSize = clusters.numBlocks*blockSize;
+    clusters.atom1.resize(paddedSize);
+    clusters.atom2.resize(paddedSize);
+    clusters.atom3.resize(paddedSize);
+    clusters.distance1.resize(paddedSize);
+    clusters.distance2.resize(paddedSize);
+    clusters.mass1.resize(paddedSize);
+    clusters.mass2.resize(paddedSize);
+    clusters.mass3.resize(paddedSize);
+    for (int i = 0; i < paddedSize; i++) {
+        int atom1, atom2, atom3;
+        RealOpenMM distance1, distance2;
+        settle.getClusterParameters(min(i, numClusters-1), atom1, atom2, atom3, distance1, distance2);
+        clusters.atom1[i] = atom1;
+        clusters.atom2[i] = atom2;
+        clusters.atom3[i] = atom3;
+        clusters.distance1[i] = distance1;
+        clusters.distance2[i] = distance2;
+        clusters.mass1[i] = system.getParticleMass(atom1);
+        clusters.mass2[i] = system.getParticleMass(atom2);
+        clusters.mass3[i] = system.getParticleMass(atom3);
     }
 }
 
-CpuSETTLE::~CpuSETTLE() {
-    for (int i = 0; i < (int) threadSettle.size(); i++)
-        delete threadSettle[i];
-}
-
 void CpuSETTLE::apply(vector<OpenMM::RealVec>& atomCoordinates, vector<OpenMM::RealVec>& atomCoordinatesP, vector<RealOpenMM>& inverseMasses, RealOpenMM tolerance) {
-    ApplyToPositionsTask task(atomCoordinates, atomCoordinatesP, inverseMasses, tolerance, threadSettle);
+    ApplyToPositionsTask task(atomCoordinates, atomCoordinatesP, clusters);
     threads.execute(task);
     threads.waitForThreads();
 }
 
 void CpuSETTLE::applyToVelocities(vector<OpenMM::RealVec>& atomCoordinates, vector<OpenMM::RealVec>& velocities, vector<RealOpenMM>& inverseMasses, RealOpenMM tolerance) {
-    ApplyToVelocitiesTask task(atomCoordinates, velocities, inverseMasses, tolerance, threadSettle);
+    ApplyToVelocitiesTask task(atomCoordinates, velocities, inverseMasses, clusters);
     threads.execute(task);
     threads.waitForThreads();
 }
@@ -0,0 +1,96 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2015 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "CpuSETTLESolver.h"
+#include "openmm/OpenMMException.h"
+
+using namespace OpenMM;
+
+#ifdef _MSC_VER
+    // Workaround for a compiler bug in Visual Studio 10. Hopefully we can remove this
+    // once we move to a later version.
+    #undef __AVX__
+#endif
+
+#ifndef __AVX__
+void settlePositionsVec8(const CpuSETTLEClusters& clusters, int startBlock, int endBlock, const RealVec* atomCoordinates, RealVec* atomCoordinatesP) {
+    throw OpenMMException("Internal error: OpenMM was compiled without AVX support");
+}
+
+void settleVelocitiesVec8(const CpuSETTLEClusters& clusters, int startBlock, int endBlock, const RealVec* atomCoordinates, RealVec* velocities, const RealOpenMM* inverseMasses) {
+    throw OpenMMException("Internal error: OpenMM was compiled without AVX support");
+}
+#else
+#include <immintrin.h>
+
+/**
+ * A vector of eight doubles, used for processing blocks of eight clusters.  It is stored as a pair
+ * of AVX registers, which gives the processor two independent streams of work for each operation.
+ */
+class dvec8 {
+public:
+    __m256d lo, hi;
+    dvec8(__m256d lo, __m256d hi) : lo(lo), hi(hi) {
+    }
+    dvec8(double v) : lo(_mm256_set1_pd(v)), hi(_mm256_set1_pd(v)) {
+    }
+    dvec8(const double* v) : lo(_mm256_loadu_pd(v)), hi(_mm256_loadu_pd(v+4)) {
+    }
+    void store(double* v) const {
+        _mm256_storeu_pd(v, lo);
+        _mm256_storeu_pd(v+4, hi);
+    }
+    dvec8 operator+(const dvec8& other) const {
+        return dvec8(_mm256_add_pd(lo, other.lo), _mm256_add_pd(hi, other.hi));
+    }
+    dvec8 operator-(const dvec8& other) const {
+        return dvec8(_mm256_sub_pd(lo, other.lo), _mm256_sub_pd(hi, other.hi));
+    }
+    dvec8 operator*(const dvec8& other) const {
+        return dvec8(_mm256_mul_pd(lo, other.lo), _mm256_mul_pd(hi, other.hi));
+    }
+    dvec8 operator/(const dvec8& other) const {
+        return dvec8(_mm256_div_pd(lo, other.lo), _mm256_div_pd(hi, other.hi));
+    }
+};
+
+static inline dvec8 sqrt(const dvec8& v) {
+    return dvec8(_mm256_sqrt_pd(v.lo), _mm256_sqrt_pd(v.hi));
+}
+
+void settlePositionsVec8(const CpuSETTLEClusters& clusters, int startBlock, int endBlock, const RealVec* atomCoordinates, RealVec* atomCoordinatesP) {
+    settlePositionsInBlocks<dvec8, 8>(clusters, startBlock, endBlock, atomCoordinates, atomCoordinatesP);
+}
+
+void settleVelocitiesVec8(const CpuSETTLEClusters& clusters, int startBlock, int endBlock, const RealVec* atomCoordinates, RealVec* velocities, const RealOpenMM* inverseMasses) {
+    settleVelocitiesInBlocks<dvec8, 8>(clusters, startBlock, endBlock, atomCoordinates, velocities, inverseMasses);
+}
+#endif
@@ -0,0 +1,154 @@
+
+/* Portions copyright (c) 2015 Stanford University and Simbios.
+ * Authors: Peter Eastman
+ * Contributors: 
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "SimTKOpenMMUtilities.h"
+#include "CpuVariableVerletDynamics.h"
+#include "CpuIntegrationUtilities.h"
+#include <algorithm>
+
+using namespace OpenMM;
+using namespace std;
+
+class CpuVariableVerletDynamics::Update1Task : public ThreadPool::Task {
+public:
+    Update1Task(CpuVariableVerletDynamics& owner) : owner(owner) {
+    }
+    void execute(ThreadPool& threads, int threadIndex) {
+        owner.threadUpdate1(threadIndex);
+    }
+    CpuVariableVerletDynamics& owner;
+};
+
+class CpuVariableVerletDynamics::Update2Task : public ThreadPool::Task {
+public:
+    Update2Task(CpuVariableVerletDynamics& owner) : owner(owner) {
+    }
+    void execute(ThreadPool& threads, int threadIndex) {
+        owner.threadUpdate2(threadIndex);
+    }
+    CpuVariableVerletDynamics& owner;
+};
+
+CpuVariableVerletDynamics::CpuVariableVerletDynamics(int numberOfAtoms, RealOpenMM accuracy, ThreadPool& threads) : 
+           ReferenceVariableVerletDynamics(numberOfAtoms, accuracy), threads(threads) {
+    const int blockSize = CpuIntegrationUtilities::ErrorBlockSize;
+    blockError.resize((numberOfAtoms+blockSize-1)/blockSize);
+}
+
+CpuVariableVerletDynamics::~CpuVariableVerletDynamics() {
+}
+
+void CpuVariableVerletDynamics::updatePart1(int numberOfAtoms, vector<RealVec>& atomCoordinates, vector<RealVec>& velocities,
+                                            vector<RealVec>& forces, vector<RealOpenMM>& masses, vector<RealOpenMM>& inverseMasses,
+                                            vector<RealVec>& xPrime, RealOpenMM maxStepSize) {
+    if (getTimeStep() == 0) {
+        for (int i = 0; i < numberOfAtoms; i++)
+            inverseMasses[i] = (masses[i] == 0 ? 0 : 1/masses[i]);
+    }
+
+    // Record the parameters for the threads.
+    
+    this->numberOfAtoms = numberOfAtoms;
+    this->atomCoordinates = &atomCoordinates[0];
+    this->velocities = &velocities[0];
+    this->forces = &forces[0];
+    this->inverseMasses = &inverseMasses[0];
+    this->xPrime = &xPrime[0];
+    
+    // Signal the threads to start running and wait for them to compute the error norm.
+    
+    Update1Task task(*this);
+    threads.execute(task);
+    threads.waitForThreads();
+
+    // Select the step size to use.
+
+    double error = 0;
+    for (int i = 0; i < (int) blockError.size(); i++)
+        error += blockError[i];
+    error = SQRT(error/(numberOfAtoms*3));
+    RealOpenMM newStepSize = SQRT(getAccuracy()/error);
+    if (getDeltaT() > 0.0f)
+        newStepSize = min(newStepSize, getDeltaT()*2.0f); // For safety, limit how quickly dt can increase.
+    if (newStepSize > getDeltaT() && newStepSize < 1.2f*getDeltaT())
+        newStepSize = getDeltaT(); // Keeping dt constant between steps improves the behavior of the integrator.
+    if (newStepSize > maxStepSize)
+        newStepSize = maxStepSize;
+    vstep = 0.5f*(newStepSize+getDeltaT()); // The time interval by which to advance the velocities
+    setDeltaT(newStepSize);
+
+    // Let the threads compute the new positions.
+
+    threads.resumeThreads();
+    threads.waitForThreads();
+}
+
+void CpuVariableVerletDynamics::updatePart2(int numberOfAtoms, vector<RealVec>& atomCoordinates, vector<RealVec>& velocities,
+                                            vector<RealOpenMM>& inverseMasses, vector<RealVec>& xPrime) {
+    // Record the parameters for the threads.
+    
+    this->numberOfAtoms = numberOfAtoms;
+    this->atomCoordinates = &atomCoordinates[0];
+    this->velocities = &velocities[0];
+    this->inverseMasses = &inverseMasses[0];
+    this->xPrime = &xPrime[0];
+    
+    // Signal the threads to start running and wait for them to finish.
+    
+    Update2Task task(*this);
+    threads.execute(task);
+    threads.waitForThreads();
+}
+
+void CpuVariableVerletDynamics::threadUpdate1(int threadIndex) {
+    int numThreads = threads.getNumThreads();
+    int numBlocks = blockError.size();
+    int firstBlock = threadIndex*numBlocks/numThreads;
+    int lastBlock = (threadIndex+1)*numBlocks/numThreads;
+    const int blockSize = CpuIntegrationUtilities::ErrorBlockSize;
+    for (int block = firstBlock; block < lastBlock; block++)
+        blockError[block] = CpuIntegrationUtilities::computeBlockError(forces, inverseMasses, block*blockSize, min((block+1)*blockSize, numberOfAtoms));
+
+    // Wait while the main thread selects the step size, then compute the new positions.
+
+    threads.syncThreads();
+    const RealOpenMM dt = getDeltaT();
+    int start = threadIndex*numberOfAtoms/numThreads;
+    int end = (threadIndex+1)*numberOfAtoms/numThreads;
+    for (int i = start; i < end; i++)
+        if (inverseMasses[i] != 0.0)
+            xPrime[i] = atomCoordinates[i] + (velocities[i] + forces[i]*(inverseMasses[i]*vstep))*dt;
+}
+
+void CpuVariableVerletDynamics::threadUpdate2(int threadIndex) {
+    const RealOpenMM velocityScale = 1.0/getDeltaT();
+    int start = threadIndex*numberOfAtoms/threads.getNumThreads();
+    int end = (threadIndex+1)*numberOfAtoms/threads.getNumThreads();
+    for (int i = start; i < end; i++)
+        if (inverseMasses[i] != 0.0) {
+            velocities[i] = (xPrime[i]-atomCoordinates[i])*velocityScale;
+            atomCoordinates[i] = xPrime[i];
+        }
+}
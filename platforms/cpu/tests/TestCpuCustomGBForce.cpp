@@ -459,6 +459,53 @@ void testExclusions() {
     }
 }
 
+void testChainRuleWithExclusions(CustomGBForce::NonbondedMethod method) {
+    // The first value is not symmetric in the two particles, a second value depends on it, and
+    // one pair is excluded.  Check the forces against finite differences of the energy.
+
+    const int numParticles = 5;
+    CpuPlatform platform;
+    System system;
+    VerletIntegrator integrator(0.01);
+    CustomGBForce* force = new CustomGBForce();
+    force->setNonbondedMethod(method);
+    force->setCutoffDistance(3.0);
+    force->addPerParticleParameter("q");
+    force->addComputedValue("a", "q2*exp(-r)", CustomGBForce::ParticlePair);
+    force->addComputedValue("b", "a^2+q*a", CustomGBForce::SingleParticle);
+    force->addEnergyTerm("q*b", CustomGBForce::SingleParticle);
+    force->addEnergyTerm("a1*b2/r", CustomGBForce::ParticlePair);
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<double> params(1);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        params[0] = 0.5+i*0.3;
+        force->addParticle(params);
+        positions[i] = Vec3(2*genrand_real2(sfmt), 2*genrand_real2(sfmt), 2*genrand_real2(sfmt));
+    }
+    force->addExclusion(0, 1);
+    force->addExclusion(2, 4);
+    system.addForce(force);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    State state = context.getState(State::Forces);
+    const double delta = 1e-3;
+    for (int i = 0; i < numParticles; i++) {
+        for (int j = 0; j < 3; j++) {
+            vector<Vec3> offsetPos = positions;
+            offsetPos[i][j] = positions[i][j]-delta;
+            context.setPositions(offsetPos);
+            double e1 = context.getState(State::Energy).getPotentialEnergy();
+            offsetPos[i][j] = positions[i][j]+delta;
+            context.setPositions(offsetPos);
+            double e2 = context.getState(State::Energy).getPotentialEnergy();
+            ASSERT_EQUAL_TOL(state.getForces()[i][j], (e1-e2)/(2*delta), 1e-3);
+        }
+    }
+}
+
 int main() {
     try {
         if (!CpuPlatform::isProcessorSupported()) {
@@ -473,6 +520,8 @@ int main() {
         testMultipleChainRules();
         testPositionDependence();
         testExclusions();
+        testChainRuleWithExclusions(CustomGBForce::NoCutoff);
+        testChainRuleWithExclusions(CustomGBForce::CutoffNonPeriodic);
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
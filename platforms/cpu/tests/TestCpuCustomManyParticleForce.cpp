@@ -46,6 +46,7 @@
 #include "openmm/VerletIntegrator.h"
 #include "sfmt/SFMT.h"
 #include <iostream>
+#include <set>
 #include <vector>
 
 using namespace OpenMM;
@@ -712,6 +713,57 @@ void testCentralParticleModeLargeSystem() {
         ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
 }
 
+void testTypeFiltersLargeSystem(CustomManyParticleForce::PermutationMode mode) {
+    // Use type filters with a triclinic box, so the search has to prune sets by type and find
+    // neighbors across skewed periodic boundaries.
+
+    int gridSize = 8;
+    int numParticles = gridSize*gridSize*gridSize;
+    double boxSize = 2.0;
+    double spacing = boxSize/gridSize;
+    CpuPlatform platform;
+    CustomManyParticleForce* force = new CustomManyParticleForce(3,
+        "c1*(cos(theta1)+1/3)^2*exp(0.3/(r12-0.45))*exp(0.3/(r13-0.45));"
+        "r12 = distance(p1,p2); r13 = distance(p1,p3); theta1 = angle(p3,p1,p2)");
+    force->setPermutationMode(mode);
+    force->addPerParticleParameter("c");
+    force->setNonbondedMethod(CustomManyParticleForce::CutoffPeriodic);
+    force->setCutoffDistance(0.43);
+    set<int> f1, f2;
+    f1.insert(0);
+    f2.insert(1);
+    force->setTypeFilter(0, f1);
+    force->setTypeFilter(1, f2);
+    force->setTypeFilter(2, f2);
+    vector<double> params(1);
+    vector<Vec3> positions;
+    System system;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                params[0] = 1.0+genrand_real2(sfmt);
+                force->addParticle(params, positions.size()%3 == 0 ? 0 : 1);
+                positions.push_back(Vec3((i+0.4*genrand_real2(sfmt))*spacing, (j+0.4*genrand_real2(sfmt))*spacing, (k+0.4*genrand_real2(sfmt))*spacing));
+                system.addParticle(1.0);
+            }
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0.5, boxSize, 0), Vec3(-0.4, 0.6, boxSize));
+    system.addForce(force);
+    VerletIntegrator integrator1(0.001);
+    VerletIntegrator integrator2(0.001);
+    Context context1(system, integrator1, Platform::getPlatformByName("Reference"));
+    Context context2(system, integrator2, platform);
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    State state1 = context1.getState(State::Forces | State::Energy);
+    State state2 = context2.getState(State::Forces | State::Energy);
+    ASSERT(state1.getPotentialEnergy() != 0.0);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-4);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
+}
+
 int main() {
     try {
         if (!CpuPlatform::isProcessorSupported()) {
@@ -731,6 +783,8 @@ int main() {
         testCentralParticleModeNoCutoff();
         testCentralParticleModeCutoff();
         testCentralParticleModeLargeSystem();
+        testTypeFiltersLargeSystem(CustomManyParticleForce::SinglePermutation);
+        testTypeFiltersLargeSystem(CustomManyParticleForce::UniqueCentralParticle);
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
@@ -41,12 +41,14 @@
 #include "openmm/internal/AssertionUtilities.h"
 #include "openmm/Context.h"
 #include "openmm/CustomNonbondedForce.h"
+#include "openmm/HarmonicBondForce.h"
 #include "openmm/NonbondedForce.h"
 #include "openmm/System.h"
 #include "openmm/VerletIntegrator.h"
 #include "sfmt/SFMT.h"
 #include <cmath>
 #include <iostream>
+#include <map>
 #include <set>
 #include <vector>
 
@@ -727,6 +729,58 @@ void testLongRangeCorrection() {
     ASSERT_EQUAL_TOL(standardEnergy1-standardEnergy2, customEnergy1-customEnergy2, 1e-4);
 }
 
+void testLongRangeCorrectionGlobalParameter() {
+    // Create a box of particles belonging to two classes.
+
+    int numParticles = 100;
+    double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    CustomNonbondedForce* nonbonded = new CustomNonbondedForce("scale*c1*c2/r^6");
+    nonbonded->addGlobalParameter("scale", 1.0);
+    nonbonded->addPerParticleParameter("c");
+    vector<Vec3> positions(numParticles);
+    vector<double> params(1);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        params[0] = (i%2 == 0 ? 1.0 : 2.0);
+        nonbonded->addParticle(params);
+        positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+    }
+    nonbonded->setNonbondedMethod(CustomNonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    nonbonded->setUseLongRangeCorrection(true);
+    system.addForce(nonbonded);
+    VerletIntegrator integrator(0.01);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+
+    // The energy, including the correction, is proportional to the global parameter.  Switching
+    // back to a value that was used before should reproduce the original energy.
+
+    double energy1 = context.getState(State::Energy).getPotentialEnergy();
+    context.setParameter("scale", 2.0);
+    double energy2 = context.getState(State::Energy).getPotentialEnergy();
+    context.setParameter("scale", 1.0);
+    double energy3 = context.getState(State::Energy).getPotentialEnergy();
+    ASSERT_EQUAL_TOL(2*energy1, energy2, 1e-5);
+    ASSERT_EQUAL_TOL(energy1, energy3, 1e-6);
+
+    // Changing the per-particle parameters should cause the correction to be recomputed.
+
+    params[0] = 3.0;
+    for (int i = 0; i < numParticles; i += 2)
+        nonbonded->setParticleParameters(i, params);
+    nonbonded->updateParametersInContext(context);
+    double energy4 = context.getState(State::Energy).getPotentialEnergy();
+    VerletIntegrator integrator2(0.01);
+    Context context2(system, integrator2, platform);
+    context2.setPositions(positions);
+    ASSERT_EQUAL_TOL(context2.getState(State::Energy).getPotentialEnergy(), energy4, 1e-5);
+}
+
 void testInteractionGroups() {
     const int numParticles = 6;
     System system;
@@ -956,6 +1010,87 @@ void testMultipleCutoffs() {
     }
 }
 
+void testEnergiesForParameterSets() {
+    // Create a box of particles interacting through a soft-core potential, plus some bonds that
+    // do not depend on the global parameters.
+
+    int numParticles = 200;
+    double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    CustomNonbondedForce* nonbonded = new CustomNonbondedForce("scale*lambda*4*eps*(1/(alpha*(1-lambda)+(r/sigma)^6)^2-1/(alpha*(1-lambda)+(r/sigma)^6)); sigma=0.5*(sigma1+sigma2); eps=sqrt(eps1*eps2)");
+    nonbonded->addGlobalParameter("lambda", 1.0);
+    nonbonded->addGlobalParameter("alpha", 0.5);
+    nonbonded->addGlobalParameter("scale", 1.0);
+    nonbonded->addPerParticleParameter("sigma");
+    nonbonded->addPerParticleParameter("eps");
+    HarmonicBondForce* bonds = new HarmonicBondForce();
+    bonds->setForceGroup(1);
+    vector<Vec3> positions(numParticles);
+    vector<double> params(2);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        params[0] = (i%2 == 0 ? 0.3 : 0.25);
+        params[1] = (i%2 == 0 ? 1.0 : 0.5);
+        nonbonded->addParticle(params);
+        positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+        if (i%2 == 1) {
+            bonds->addBond(i-1, i, 0.2, 1000.0);
+            nonbonded->addExclusion(i-1, i);
+        }
+    }
+    nonbonded->setNonbondedMethod(CustomNonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    nonbonded->setUseSwitchingFunction(true);
+    nonbonded->setSwitchingDistance(0.8);
+    nonbonded->setUseLongRangeCorrection(true);
+    system.addForce(nonbonded);
+    system.addForce(bonds);
+    VerletIntegrator integrator(0.01);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    context.setParameter("scale", 1.5);
+
+    // Compute the energies for several sets of parameters, and compare them to computing each one separately.
+
+    vector<map<string, double> > parameterSets(4);
+    parameterSets[0]["lambda"] = 0.0;
+    parameterSets[1]["lambda"] = 0.3;
+    parameterSets[2]["lambda"] = 0.7;
+    parameterSets[2]["alpha"] = 0.2;
+    parameterSets[3]["lambda"] = 1.0;
+    for (int groups = 1; groups < 4; groups++) {
+        vector<double> energies = context.computePotentialEnergies(parameterSets, groups);
+        ASSERT_EQUAL(parameterSets.size(), energies.size());
+        for (int i = 0; i < (int) parameterSets.size(); i++) {
+            context.setParameter("lambda", parameterSets[i]["lambda"]);
+            context.setParameter("alpha", parameterSets[i].find("alpha") == parameterSets[i].end() ? 0.5 : parameterSets[i]["alpha"]);
+            double expected = context.getState(State::Energy, false, groups).getPotentialEnergy();
+            ASSERT_EQUAL_TOL(expected, energies[i], 1e-5);
+        }
+        context.setParameter("lambda", 1.0);
+        context.setParameter("alpha", 0.5);
+    }
+
+    // The parameters should have been restored, and invalid names should be rejected.
+
+    ASSERT_EQUAL(1.0, context.getParameter("lambda"));
+    ASSERT_EQUAL(0.5, context.getParameter("alpha"));
+    ASSERT_EQUAL(1.5, context.getParameter("scale"));
+    parameterSets[1]["lambda2"] = 0.5;
+    bool threwException = false;
+    try {
+        context.computePotentialEnergies(parameterSets);
+    }
+    catch (const exception& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+    ASSERT_EQUAL(1.0, context.getParameter("lambda"));
+}
+
 int main() {
     try {
         if (!CpuPlatform::isProcessorSupported()) {
@@ -977,10 +1112,12 @@ int main() {
         testCoulombLennardJones();
         testSwitchingFunction();
         testLongRangeCorrection();
+        testLongRangeCorrectionGlobalParameter();
         testInteractionGroups();
         testLargeInteractionGroup();
         testInteractionGroupLongRangeCorrection();
         testMultipleCutoffs();
+        testEnergiesForParameterSets();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
@@ -35,19 +35,26 @@
 
 #include "openmm/internal/AssertionUtilities.h"
 #include "openmm/Context.h"
+#include "CpuGBSAOBCForce.h"
 #include "CpuPlatform.h"
 #include "openmm/GBSAOBCForce.h"
 #include "openmm/System.h"
 #include "openmm/LangevinIntegrator.h"
 #include "openmm/NonbondedForce.h"
+#include "openmm/VerletIntegrator.h"
 #include "SimTKOpenMMRealType.h"
 #include "sfmt/SFMT.h"
 #include <iostream>
+#include <map>
 #include <vector>
 
 using namespace OpenMM;
 using namespace std;
 
+bool isVec8Supported();
+CpuGBSAOBCForce* createCpuGBSAOBCForceVec4();
+CpuGBSAOBCForce* createCpuGBSAOBCForceVec8();
+
 const double TOL = 1e-5;
 
 void testSingleParticle() {
@@ -248,6 +255,122 @@ void testForce(int numParticles, NonbondedForce::NonbondedMethod method, GBSAOBC
     }
 }
 
+/**
+ * Compute the force directly with a CpuGBSAOBCForce of a particular vector width, and compare it to the
+ * Reference platform.  Contexts only ever use the widest width the processor supports, so this makes sure
+ * the narrower ones are tested too.
+ */
+void testVectorWidth(CpuGBSAOBCForce* obc, GBSAOBCForce::NonbondedMethod method) {
+    const int numParticles = 200;
+    const double cutoff = 1.5;
+    const double boxSize = 4.0;
+    ReferencePlatform reference;
+    System system;
+    GBSAOBCForce* gbsa = new GBSAOBCForce();
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        gbsa->addParticle(i%2 == 0 ? -0.5 : 0.5, 0.15+0.05*genrand_real2(sfmt), 0.7+0.2*genrand_real2(sfmt));
+        positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+    }
+    gbsa->setNonbondedMethod(method);
+    gbsa->setCutoffDistance(cutoff);
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    system.addForce(gbsa);
+    LangevinIntegrator integrator(0, 0.1, 0.01);
+    Context context(system, integrator, reference);
+    context.setPositions(positions);
+    State refState = context.getState(State::Forces | State::Energy);
+
+    // Set up the CpuGBSAOBCForce the same way CpuCalcGBSAOBCForceKernel does.
+
+    AlignedArray<float> posq(4*numParticles);
+    vector<pair<float, float> > particleParams(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        double charge, radius, scalingFactor;
+        gbsa->getParticleParameters(i, charge, radius, scalingFactor);
+        posq[4*i] = (float) positions[i][0];
+        posq[4*i+1] = (float) positions[i][1];
+        posq[4*i+2] = (float) positions[i][2];
+        posq[4*i+3] = (float) charge;
+        radius -= 0.009;
+        particleParams[i] = make_pair((float) radius, (float) (scalingFactor*radius));
+    }
+    obc->setParticleParameters(particleParams);
+    obc->setSolventDielectric((float) gbsa->getSolventDielectric());
+    obc->setSoluteDielectric((float) gbsa->getSoluteDielectric());
+    obc->setSurfaceAreaEnergy((float) gbsa->getSurfaceAreaEnergy());
+    ThreadPool threads;
+    CpuNeighborList neighborList(obc->getBlockSize());
+    if (method != GBSAOBCForce::NoCutoff) {
+        bool periodic = (method == GBSAOBCForce::CutoffPeriodic);
+        RealVec boxVectors[3] = {RealVec(boxSize, 0, 0), RealVec(0, boxSize, 0), RealVec(0, 0, boxSize)};
+        neighborList.computeNeighborList(numParticles, posq, CpuExclusionList(numParticles), boxVectors, periodic, (float) cutoff, threads);
+        obc->setUseCutoff((float) cutoff, neighborList);
+        if (periodic) {
+            float floatBoxSize[3] = {(float) boxSize, (float) boxSize, (float) boxSize};
+            obc->setPeriodic(floatBoxSize);
+        }
+    }
+    vector<AlignedArray<float> > threadForce(threads.getNumThreads());
+    for (int i = 0; i < threads.getNumThreads(); i++) {
+        threadForce[i].resize(4*numParticles);
+        for (int j = 0; j < 4*numParticles; j++)
+            threadForce[i][j] = 0.0f;
+    }
+    double energy = 0.0;
+    obc->computeForce(posq, threadForce, &energy, threads);
+
+    // Compare the results.
+
+    ASSERT_EQUAL_TOL(refState.getPotentialEnergy(), energy, 1e-4);
+    for (int i = 0; i < numParticles; i++) {
+        Vec3 force;
+        for (int j = 0; j < threads.getNumThreads(); j++)
+            force += Vec3(threadForce[j][4*i], threadForce[j][4*i+1], threadForce[j][4*i+2]);
+        ASSERT_EQUAL_VEC(refState.getForces()[i], force, 1e-4);
+    }
+    delete obc;
+}
+
+void testReproducible() {
+    // With a fixed number of threads, repeating a calculation should give exactly the same result.
+
+    const int numParticles = 1000;
+    CpuPlatform platform;
+    System system;
+    GBSAOBCForce* gbsa = new GBSAOBCForce();
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        gbsa->addParticle(i%2 == 0 ? -1.0 : 1.0, 0.15, 1.0);
+        positions[i] = Vec3(0.5*(i%10), 0.5*((i/10)%10), 0.5*(i/100));
+        positions[i] += Vec3(0.2*genrand_real2(sfmt), 0.2*genrand_real2(sfmt), 0.2*genrand_real2(sfmt));
+    }
+    system.addForce(gbsa);
+    map<string, string> properties;
+    properties[CpuPlatform::CpuThreads()] = "4";
+    VerletIntegrator integrator1(0.001);
+    VerletIntegrator integrator2(0.001);
+    Context context1(system, integrator1, platform, properties);
+    Context context2(system, integrator2, platform, properties);
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    State state1 = context1.getState(State::Forces | State::Energy);
+    State state2 = context2.getState(State::Forces | State::Energy);
+    State state3 = context1.getState(State::Forces | State::Energy);
+    ASSERT_EQUAL(state1.getPotentialEnergy(), state2.getPotentialEnergy());
+    ASSERT_EQUAL(state1.getPotentialEnergy(), state3.getPotentialEnergy());
+    for (int i = 0; i < numParticles; i++) {
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 0.0);
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state3.getForces()[i], 0.0);
+    }
+}
+
 int main() {
     try {
         if (!CpuPlatform::isProcessorSupported()) {
@@ -257,6 +380,13 @@ int main() {
         testSingleParticle();
         testGlobalSettings();
         testCutoffAndPeriodic();
+        testReproducible();
+        GBSAOBCForce::NonbondedMethod methods[] = {GBSAOBCForce::NoCutoff, GBSAOBCForce::CutoffNonPeriodic, GBSAOBCForce::CutoffPeriodic};
+        for (int i = 0; i < 3; i++) {
+            testVectorWidth(createCpuGBSAOBCForceVec4(), methods[i]);
+            if (isVec8Supported())
+                testVectorWidth(createCpuGBSAOBCForceVec8(), methods[i]);
+        }
         for (int i = 5; i < 11; i++) {
             testForce(i*i*i, NonbondedForce::NoCutoff, GBSAOBCForce::NoCutoff);
             testForce(i*i*i, NonbondedForce::CutoffNonPeriodic, GBSAOBCForce::CutoffNonPeriodic);
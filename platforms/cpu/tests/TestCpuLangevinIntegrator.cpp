@@ -36,13 +36,16 @@
 #include "openmm/internal/AssertionUtilities.h"
 #include "openmm/Context.h"
 #include "CpuPlatform.h"
+#include "CpuRandom.h"
 #include "openmm/HarmonicBondForce.h"
 #include "openmm/NonbondedForce.h"
+#include "openmm/OpenMMException.h"
 #include "openmm/System.h"
 #include "openmm/LangevinIntegrator.h"
 #include "SimTKOpenMMRealType.h"
 #include "sfmt/SFMT.h"
 #include <iostream>
+#include <sstream>
 #include <vector>
 
 using namespace OpenMM;
@@ -262,6 +265,146 @@ void testRandomSeed() {
     }
 }
 
+void testThreadIndependence() {
+    // The trajectory should not depend on the number of threads.
+
+    const int numParticles = 37;
+    CpuPlatform platform;
+    System system;
+    NonbondedForce* forceField = new NonbondedForce();
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; ++i) {
+        system.addParticle(i == 5 ? 0.0 : 2.0);
+        forceField->addParticle((i%2 == 0 ? 0.2 : -0.2), 0.3, 0.5);
+        positions[i] = Vec3(i%4, (i/4)%4, i/16);
+    }
+    system.addForce(forceField);
+    vector<State> states;
+    const char* numThreads[] = {"1", "2", "3"};
+    for (int i = 0; i < 3; i++) {
+        LangevinIntegrator integrator(300.0, 5.0, 0.001);
+        integrator.setRandomNumberSeed(12);
+        map<string, string> props;
+        props[CpuPlatform::CpuThreads()] = numThreads[i];
+        Context context(system, integrator, platform, props);
+        context.setPositions(positions);
+        integrator.step(20);
+        states.push_back(context.getState(State::Positions | State::Velocities));
+    }
+    for (int i = 1; i < 3; i++)
+        for (int j = 0; j < numParticles; j++) {
+            ASSERT_EQUAL_VEC(states[0].getPositions()[j], states[i].getPositions()[j], 1e-6);
+            ASSERT_EQUAL_VEC(states[0].getVelocities()[j], states[i].getVelocities()[j], 1e-6);
+        }
+}
+
+void testCheckpoint() {
+    // Loading a checkpoint should reproduce the same trajectory, including the random forces.
+
+    const int numParticles = 10;
+    CpuPlatform platform;
+    System system;
+    NonbondedForce* forceField = new NonbondedForce();
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; ++i) {
+        system.addParticle(2.0);
+        forceField->addParticle((i%2 == 0 ? 0.2 : -0.2), 0.3, 0.5);
+        positions[i] = Vec3(i%4, (i/4)%4, 0);
+    }
+    system.addForce(forceField);
+    LangevinIntegrator integrator(300.0, 5.0, 0.001);
+    integrator.setRandomNumberSeed(0);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    integrator.step(10);
+    stringstream checkpoint;
+    context.createCheckpoint(checkpoint);
+    State state0 = context.getState(State::Positions);
+    integrator.step(10);
+    State state1 = context.getState(State::Positions | State::Velocities);
+    context.loadCheckpoint(checkpoint);
+    integrator.step(10);
+    State state2 = context.getState(State::Positions | State::Velocities);
+    for (int i = 0; i < numParticles; i++) {
+        ASSERT_EQUAL_VEC(state1.getPositions()[i], state2.getPositions()[i], 1e-6);
+        ASSERT_EQUAL_VEC(state1.getVelocities()[i], state2.getVelocities()[i], 1e-6);
+    }
+
+    // Checkpoints written before the random number generator state was stored should still load.
+    // The last 20 bytes are the version number, counter, and key.
+
+    string data = checkpoint.str();
+    stringstream oldCheckpoint(data.substr(0, data.size()-20));
+    context.loadCheckpoint(oldCheckpoint);
+    State state3 = context.getState(State::Positions);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state0.getPositions()[i], state3.getPositions()[i], 0.0);
+
+    // A truncated checkpoint should be rejected.
+
+    stringstream truncatedCheckpoint(data.substr(0, data.size()-3));
+    bool threwException = false;
+    try {
+        context.loadCheckpoint(truncatedCheckpoint);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testCounterBasedRandom() {
+    // Check the Philox function against the published known answer values.
+
+    unsigned int counter1[] = {0, 0, 0, 0}, key1[] = {0, 0}, expected1[] = {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8};
+    unsigned int counter2[] = {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, key2[] = {0xa4093822, 0x299f31d0}, expected2[] = {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1};
+    unsigned int result[4];
+    CpuRandom::philox(counter1, key1, result);
+    for (int i = 0; i < 4; i++)
+        ASSERT_EQUAL(expected1[i], result[i]);
+    CpuRandom::philox(counter2, key2, result);
+    for (int i = 0; i < 4; i++)
+        ASSERT_EQUAL(expected2[i], result[i]);
+
+    // Any range of indices should give the same values as generating all of them at once.
+
+    CpuRandom random;
+    random.initialize(5, 1);
+    const int numIndices = 50000;
+    vector<float> values(4*numIndices), subset(4*13);
+    unsigned long long step = random.getNextCounter();
+    ASSERT(random.getNextCounter() != step);
+    random.getGaussianRandoms(step, 0, numIndices, &values[0]);
+    random.getGaussianRandoms(step, 7, 20, &subset[0]);
+    for (int i = 0; i < (int) subset.size(); i++)
+        ASSERT_EQUAL(values[4*7+i], subset[i]);
+
+    // Check the moments of the distribution.
+
+    double mean = 0.0, var = 0.0, skew = 0.0, kurtosis = 0.0;
+    for (int i = 0; i < (int) values.size(); i++) {
+        double v = values[i];
+        mean += v;
+        var += v*v;
+        skew += v*v*v;
+        kurtosis += v*v*v*v;
+    }
+    mean /= values.size();
+    var /= values.size();
+    skew /= values.size();
+    kurtosis /= values.size();
+    ASSERT_EQUAL_TOL(0.0, mean, 0.01);
+    ASSERT_EQUAL_TOL(1.0, var, 0.01);
+    ASSERT_EQUAL_TOL(0.0, skew, 0.02);
+    ASSERT_EQUAL_TOL(3.0, kurtosis, 0.02);
+
+    // A different counter should give different values.
+
+    random.getGaussianRandoms(step+1, 7, 20, &subset[0]);
+    for (int i = 0; i < (int) subset.size(); i++)
+        ASSERT(values[4*7+i] != subset[i]);
+}
+
 int main() {
     try {
         if (!CpuPlatform::isProcessorSupported()) {
@@ -273,6 +416,9 @@ int main() {
         testConstraints();
         testConstrainedMasslessParticles();
         testRandomSeed();
+        testThreadIndependence();
+        testCheckpoint();
+        testCounterBasedRandom();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
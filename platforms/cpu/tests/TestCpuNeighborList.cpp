@@ -48,7 +48,7 @@
 using namespace OpenMM;
 using namespace std;
 
-void testNeighborList(bool periodic, bool triclinic) {
+void testNeighborList(bool periodic, bool triclinic, int blockSize) {
     const int numParticles = 500;
     const float cutoff = 2.0f;
     RealVec boxVectors[3];
@@ -63,7 +63,6 @@ void testNeighborList(bool periodic, bool triclinic) {
         boxVectors[2] = RealVec(0, 0, 22);
     }
     const float boxSize[3] = {(float) boxVectors[0][0], (float) boxVectors[1][1], (float) boxVectors[2][2]};
-    const int blockSize = 8;
     OpenMM_SFMT::SFMT sfmt;
     init_gen_rand(0, sfmt);
     AlignedArray<float> positions(4*numParticles);
@@ -80,7 +79,7 @@ void testNeighborList(bool periodic, bool triclinic) {
     }
     ThreadPool threads;
     CpuNeighborList neighborList(blockSize);
-    neighborList.computeNeighborList(numParticles, positions, exclusions, boxVectors, periodic, cutoff, threads);
+    neighborList.computeNeighborList(numParticles, positions, CpuExclusionList(exclusions), boxVectors, periodic, cutoff, threads);
     
     // Convert the neighbor list to a set for faster lookup.
     
@@ -88,7 +87,7 @@ void testNeighborList(bool periodic, bool triclinic) {
     for (int i = 0; i < (int) neighborList.getSortedAtoms().size(); i++) {
         int blockIndex = i/blockSize;
         int indexInBlock = i-blockIndex*blockSize;
-        char mask = 1<<indexInBlock;
+        short mask = 1<<indexInBlock;
         for (int j = 0; j < (int) neighborList.getBlockExclusions(blockIndex).size(); j++) {
             if ((neighborList.getBlockExclusions(blockIndex)[j] & mask) == 0) {
                 int atom1 = neighborList.getSortedAtoms()[i];
@@ -125,9 +124,12 @@ int main() {
             cout << "CPU is not supported.  Exiting." << endl;
             return 0;
         }
-        testNeighborList(false, false);
-        testNeighborList(true, false);
-        testNeighborList(true, true);
+        testNeighborList(false, false, 8);
+        testNeighborList(true, false, 8);
+        testNeighborList(true, true, 8);
+        testNeighborList(false, false, 16);
+        testNeighborList(true, false, 16);
+        testNeighborList(true, true, 16);
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
@@ -35,11 +35,15 @@
 
 #include "openmm/internal/AssertionUtilities.h"
 #include "openmm/Context.h"
+#include "CpuNeighborList.h"
+#include "CpuNonbondedForce.h"
 #include "CpuPlatform.h"
 #include "ReferencePlatform.h"
 #include "openmm/HarmonicBondForce.h"
 #include "openmm/NonbondedForce.h"
+#include "openmm/OpenMMException.h"
 #include "openmm/System.h"
+#include "openmm/BrownianIntegrator.h"
 #include "openmm/LangevinIntegrator.h"
 #include "openmm/VerletIntegrator.h"
 #include "openmm/internal/ContextImpl.h"
@@ -55,6 +59,14 @@ CpuPlatform platform;
 
 const double TOL = 1e-5;
 
+bool isVec8Supported();
+bool isVec8FmaSupported();
+bool isVec16Supported();
+CpuNonbondedForce* createCpuNonbondedForceVec4();
+CpuNonbondedForce* createCpuNonbondedForceVec8();
+CpuNonbondedForce* createCpuNonbondedForceVec8Fma();
+CpuNonbondedForce* createCpuNonbondedForceVec16();
+
 void testCoulomb() {
     System system;
     system.addParticle(1.0);
@@ -684,6 +696,195 @@ void testSwitchingFunction(NonbondedForce::NonbondedMethod method) {
     }
 }
 
+/**
+ * This class gives access to the forces stored in a Context without computing them again.
+ */
+class ForceReader : public NonbondedForce {
+public:
+    void getStoredForces(Context& context, vector<Vec3>& forces) {
+        getContextImpl(context).getForces(forces);
+    }
+};
+
+void testEnergyOnly(NonbondedForce::NonbondedMethod method) {
+    // Compute the energy with and without forces, and make sure they agree.  BrownianIntegrator
+    // does not need forces to compute the kinetic energy, so getState(State::Energy) only computes
+    // the energy.
+
+    const int numParticles = 500;
+    const double boxSize = 4.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(method);
+    nonbonded->setCutoffDistance(1.0);
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? -1.0 : 1.0, 0.2, 0.1);
+        positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+    }
+    for (int i = 0; i < numParticles; i += 2)
+        nonbonded->addException(i, i+1, 0.0, 0.15, 0.0);
+    system.addForce(nonbonded);
+    BrownianIntegrator integrator(300.0, 1.0, 0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    State state1 = context.getState(State::Forces | State::Energy);
+    State state2 = context.getState(State::Energy);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+    
+    // Computing only the energy should not have changed the forces stored in the context.  getState()
+    // would recompute them, so read them directly.
+    
+    vector<Vec3> storedForces;
+    ForceReader().getStoredForces(context, storedForces);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], storedForces[i], 1e-5);
+    State state3 = context.getState(State::Forces);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state3.getForces()[i], 1e-5);
+}
+
+void testDoublePrecision(NonbondedForce::NonbondedMethod method) {
+    // In double precision mode, the results should match the Reference platform to high precision.
+    // Use several threads so the per-thread forces must be combined.
+
+    const int numParticles = 500;
+    const double boxSize = 4.0;
+    ReferencePlatform reference;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(method);
+    nonbonded->setCutoffDistance(1.0);
+    if (method != NonbondedForce::NoCutoff) {
+        nonbonded->setUseSwitchingFunction(true);
+        nonbonded->setSwitchingDistance(0.8);
+    }
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? -1.0 : 1.0, 0.2, 0.1);
+        positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+    }
+    for (int i = 0; i < numParticles; i += 2)
+        nonbonded->addException(i, i+1, 0.0, 0.15, 0.0);
+    system.addForce(nonbonded);
+    VerletIntegrator integrator1(0.001);
+    VerletIntegrator integrator2(0.001);
+    map<string, string> properties;
+    properties[CpuPlatform::CpuPrecision()] = "double";
+    properties[CpuPlatform::CpuThreads()] = "3";
+    Context cpuContext(system, integrator1, platform, properties);
+    Context referenceContext(system, integrator2, reference);
+    ASSERT_EQUAL("double", platform.getPropertyValue(cpuContext, CpuPlatform::CpuPrecision()));
+    cpuContext.setPositions(positions);
+    referenceContext.setPositions(positions);
+    State cpuState = cpuContext.getState(State::Forces | State::Energy);
+    State referenceState = referenceContext.getState(State::Forces | State::Energy);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(referenceState.getForces()[i], cpuState.getForces()[i], 1e-10);
+    ASSERT_EQUAL_TOL(referenceState.getPotentialEnergy(), cpuState.getPotentialEnergy(), 1e-10);
+}
+
+void testIllegalPrecision() {
+    // An illegal value should throw an exception.
+
+    System system;
+    system.addParticle(1.0);
+    map<string, string> properties;
+    properties[CpuPlatform::CpuPrecision()] = "single";
+    bool threwException = false;
+    try {
+        VerletIntegrator integrator3(0.001);
+        Context context(system, integrator3, platform, properties);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testVectorWidth(CpuNonbondedForce* nonbonded, int blockSize) {
+    // Compute the direct space interactions with one particular kernel, and compare them to the Reference platform.
+
+    const int numParticles = 300;
+    const double cutoff = 1.0;
+    const double boxSize = 3.0;
+    const double dielectric = 78.3;
+    const int gridSize = 7;
+    const double spacing = boxSize/gridSize;
+    ReferencePlatform reference;
+    System system;
+    NonbondedForce* force = new NonbondedForce();
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        force->addParticle(i%2 == 0 ? -0.5 : 0.5, 0.2+0.1*genrand_real2(sfmt), 0.5+0.5*genrand_real2(sfmt));
+        positions[i] = Vec3(spacing*(i%gridSize), spacing*((i/gridSize)%gridSize), spacing*(i/(gridSize*gridSize)));
+        positions[i] += Vec3(0.1*genrand_real2(sfmt), 0.1*genrand_real2(sfmt), 0.1*genrand_real2(sfmt));
+    }
+    force->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    force->setCutoffDistance(cutoff);
+    force->setReactionFieldDielectric(dielectric);
+    force->setUseDispersionCorrection(false);
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    system.addForce(force);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, reference);
+    context.setPositions(positions);
+    State refState = context.getState(State::Forces | State::Energy);
+
+    // Set up the CpuNonbondedForce the same way CpuCalcNonbondedForceKernel does.
+
+    AlignedArray<float> posq(4*numParticles);
+    vector<RealVec> posData(numParticles);
+    vector<pair<float, float> > particleParams(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        double charge, sigma, epsilon;
+        force->getParticleParameters(i, charge, sigma, epsilon);
+        posq[4*i] = (float) positions[i][0];
+        posq[4*i+1] = (float) positions[i][1];
+        posq[4*i+2] = (float) positions[i][2];
+        posq[4*i+3] = (float) charge;
+        posData[i] = positions[i];
+        particleParams[i] = make_pair((float) (0.5*sigma), (float) (2.0*sqrt(epsilon)));
+    }
+    ThreadPool threads;
+    CpuExclusionList exclusions(numParticles);
+    CpuNeighborList neighborList(blockSize);
+    RealVec boxVectors[3] = {RealVec(boxSize, 0, 0), RealVec(0, boxSize, 0), RealVec(0, 0, boxSize)};
+    neighborList.computeNeighborList(numParticles, posq, exclusions, boxVectors, true, (float) cutoff, threads);
+    nonbonded->setUseCutoff((float) cutoff, neighborList, (float) dielectric);
+    nonbonded->setPeriodic(boxVectors);
+    vector<AlignedArray<float> > threadForce(threads.getNumThreads());
+    for (int i = 0; i < threads.getNumThreads(); i++) {
+        threadForce[i].resize(4*numParticles);
+        for (int j = 0; j < 4*numParticles; j++)
+            threadForce[i][j] = 0.0f;
+    }
+    double energy = 0.0;
+    nonbonded->calculateDirectIxn(numParticles, &posq[0], posData, particleParams, exclusions, threadForce, true, &energy, threads);
+    delete nonbonded;
+
+    // Compare the results.
+
+    ASSERT_EQUAL_TOL(refState.getPotentialEnergy(), energy, 1e-4);
+    for (int i = 0; i < numParticles; i++) {
+        Vec3 f;
+        for (int j = 0; j < threads.getNumThreads(); j++)
+            f += Vec3(threadForce[j][4*i], threadForce[j][4*i+1], threadForce[j][4*i+2]);
+        ASSERT_EQUAL_VEC(refState.getForces()[i], f, 1e-4);
+    }
+}
+
 int main(int argc, char* argv[]) {
     try {
         if (!CpuPlatform::isProcessorSupported()) {
@@ -702,6 +903,23 @@ int main(int argc, char* argv[]) {
         testChangingParameters();
         testSwitchingFunction(NonbondedForce::CutoffNonPeriodic);
         testSwitchingFunction(NonbondedForce::PME);
+        testEnergyOnly(NonbondedForce::NoCutoff);
+        testEnergyOnly(NonbondedForce::CutoffPeriodic);
+        testEnergyOnly(NonbondedForce::Ewald);
+        testEnergyOnly(NonbondedForce::PME);
+        testDoublePrecision(NonbondedForce::NoCutoff);
+        testDoublePrecision(NonbondedForce::CutoffNonPeriodic);
+        testDoublePrecision(NonbondedForce::CutoffPeriodic);
+        testDoublePrecision(NonbondedForce::Ewald);
+        testDoublePrecision(NonbondedForce::PME);
+        testIllegalPrecision();
+        testVectorWidth(createCpuNonbondedForceVec4(), 4);
+        if (isVec8Supported())
+            testVectorWidth(createCpuNonbondedForceVec8(), 8);
+        if (isVec8FmaSupported())
+            testVectorWidth(createCpuNonbondedForceVec8Fma(), 8);
+        if (isVec16Supported())
+            testVectorWidth(createCpuNonbondedForceVec16(), 16);
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
@@ -0,0 +1,209 @@
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2016 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests collecting profiling data with the CPU platform.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "CpuPlatform.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/LangevinIntegrator.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+double getEntry(const map<string, double>& data, const string& name) {
+    map<string, double>::const_iterator iter = data.find(name);
+    if (iter == data.end())
+        throw OpenMMException("Missing profiling entry: "+name);
+    return iter->second;
+}
+
+void testProfiling() {
+    // Create a box of diatomic molecules, where the atoms in each molecule are constrained.
+
+    const int numMolecules = 200;
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    HarmonicBondForce* bonds = new HarmonicBondForce();
+    system.addForce(bonds);
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    for (int i = 0; i < numMolecules; i++) {
+        system.addParticle(10.0);
+        system.addParticle(10.0);
+        nonbonded->addParticle(0.5, 0.2, 0.5);
+        nonbonded->addParticle(-0.5, 0.2, 0.5);
+        nonbonded->addException(2*i, 2*i+1, 0.0, 1.0, 0.0);
+        system.addConstraint(2*i, 2*i+1, 0.1);
+        if (i%2 == 0)
+            bonds->addBond(2*i, 2*i+2, 0.3, 100.0);
+        Vec3 pos = Vec3(i%6, (i/6)%6, i/36)*(boxSize/6);
+        positions.push_back(pos);
+        positions.push_back(pos+Vec3(0.1, 0, 0));
+    }
+    LangevinIntegrator integrator(300.0, 1.0, 0.002);
+    CpuPlatform platform;
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+
+    // Profiling is disabled by default.  Enable it and make sure the expected entries are present.
+
+    ASSERT(!context.getProfilingEnabled());
+    ASSERT_EQUAL(0, context.getProfilingData().size());
+    context.setProfilingEnabled(true);
+    ASSERT(context.getProfilingEnabled());
+    const int numSteps = 10;
+    integrator.step(numSteps);
+    const map<string, double>& data = context.getProfilingData();
+    ASSERT_EQUAL(numSteps, getEntry(data, "force_evaluations"));
+    ASSERT(getEntry(data, "force.0.CalcHarmonicBondForce") >= 0.0);
+    ASSERT(getEntry(data, "force.1.CalcNonbondedForce") > 0.0);
+    ASSERT(getEntry(data, "neighbor_list") > 0.0);
+    ASSERT(getEntry(data, "neighbor_list_builds") >= 1.0);
+    ASSERT(getEntry(data, "neighbor_list_builds") <= numSteps);
+    ASSERT(getEntry(data, "direct") > 0.0);
+    ASSERT(getEntry(data, "reciprocal") > 0.0);
+    ASSERT(getEntry(data, "reduction") >= 0.0);
+    ASSERT(getEntry(data, "integration") >= 0.0);
+    ASSERT(getEntry(data, "constraints") >= 0.0);
+    ASSERT(getEntry(data, "constraint_iterations") > 0.0);
+
+    // The phases of the nonbonded calculation should not take longer than the whole force.
+
+    double nonbondedTime = getEntry(data, "force.1.CalcNonbondedForce");
+    ASSERT(getEntry(data, "neighbor_list")+getEntry(data, "direct")+getEntry(data, "reciprocal") <= nonbondedTime*1.001);
+
+    // Creating the Context happened while profiling was disabled, so nothing about it should be recorded.
+
+    ASSERT(data.find("startup.create_platform_data") == data.end());
+
+    // Reinitializing the Context should preserve the data and record the time spent initializing it.  Computing
+    // energy is counted as a force evaluation.
+
+    context.reinitialize();
+    context.setPositions(positions);
+    ASSERT(context.getProfilingEnabled());
+    ASSERT_EQUAL(numSteps, getEntry(context.getProfilingData(), "force_evaluations"));
+    ASSERT(getEntry(context.getProfilingData(), "startup.create_platform_data") >= 0.0);
+    ASSERT(getEntry(context.getProfilingData(), "startup.force.1.CalcNonbondedForce") >= 0.0);
+    ASSERT(getEntry(context.getProfilingData(), "startup.initialize_integrator") >= 0.0);
+    context.getState(State::Energy);
+    ASSERT_EQUAL(numSteps+1, getEntry(context.getProfilingData(), "force_evaluations"));
+
+    // Explicitly applying constraints should also be recorded.
+
+    double iterations = getEntry(context.getProfilingData(), "constraint_iterations");
+    for (int i = 0; i < numMolecules; i++)
+        positions[2*i+1] += Vec3(0.01, 0.005, 0);
+    context.setPositions(positions);
+    context.applyConstraints(1e-5);
+    ASSERT(getEntry(context.getProfilingData(), "constraint_iterations") > iterations);
+
+    // Resetting it should clear everything, and nothing more should be recorded once it is disabled.
+
+    context.resetProfilingData();
+    ASSERT_EQUAL(0, context.getProfilingData().size());
+    context.setProfilingEnabled(false);
+    integrator.step(1);
+    ASSERT_EQUAL(0, context.getProfilingData().size());
+}
+
+void testStartupProfiling() {
+    // Setting OPENMM_PROFILE should enable profiling while the Context is being created.
+
+    System system;
+    system.addParticle(1.0);
+    system.addParticle(1.0);
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->addParticle(0.5, 0.2, 0.5);
+    nonbonded->addParticle(-0.5, 0.2, 0.5);
+    system.addForce(nonbonded);
+    LangevinIntegrator integrator(300.0, 1.0, 0.002);
+    CpuPlatform platform;
+#ifdef _MSC_VER
+    _putenv_s("OPENMM_PROFILE", "1");
+#else
+    setenv("OPENMM_PROFILE", "1", 1);
+#endif
+    Context context(system, integrator, platform);
+#ifdef _MSC_VER
+    _putenv_s("OPENMM_PROFILE", "");
+#else
+    unsetenv("OPENMM_PROFILE");
+#endif
+    ASSERT(context.getProfilingEnabled());
+    const map<string, double>& data = context.getProfilingData();
+    ASSERT(getEntry(data, "startup.validate") >= 0.0);
+    ASSERT(getEntry(data, "startup.create_platform_data") >= 0.0);
+    ASSERT(getEntry(data, "startup.force.0.CalcNonbondedForce") >= 0.0);
+    ASSERT(getEntry(data, "startup.initialize_integrator") >= 0.0);
+
+    // Once the variable is cleared, new Contexts should not collect profiling data.
+
+    VerletIntegrator integrator2(0.002);
+    Context context2(system, integrator2, platform);
+    ASSERT(!context2.getProfilingEnabled());
+    ASSERT_EQUAL(0, context2.getProfilingData().size());
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (!CpuPlatform::isProcessorSupported()) {
+            cout << "CPU is not supported.  Exiting." << endl;
+            return 0;
+        }
+        testProfiling();
+        testStartupProfiling();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
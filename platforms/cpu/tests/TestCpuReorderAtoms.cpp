@@ -0,0 +1,252 @@
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2015 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests spatial reordering of atoms on the CPU platform.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "CpuPlatform.h"
+#include "openmm/HarmonicAngleForce.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "sfmt/SFMT.h"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+CpuPlatform platform;
+
+/**
+ * Create a box of flexible water molecules plus a few ions on a lattice, with the molecules listed in random order.
+ */
+System* createSystem(vector<Vec3>& positions) {
+    const int numMolecules = 300;
+    const int numIons = 10;
+    const double boxSize = 2.2;
+    System* system = new System();
+    system->setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    HarmonicBondForce* bonds = new HarmonicBondForce();
+    HarmonicAngleForce* angles = new HarmonicAngleForce();
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(0.9);
+    system->addForce(bonds);
+    system->addForce(angles);
+    system->addForce(nonbonded);
+    const int gridSize = 7;
+    const double spacing = boxSize/gridSize;
+    vector<Vec3> sites;
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++)
+                sites.push_back(Vec3(i*spacing, j*spacing, k*spacing));
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = sites.size()-1; i > 0; i--)
+        swap(sites[i], sites[(int) (genrand_real2(sfmt)*(i+1))]);
+    for (int i = 0; i < numMolecules+numIons; i++) {
+        Vec3 center = sites[i];
+        if (i%31 == 5) {
+            system->addParticle(23.0);
+            nonbonded->addParticle(i%2 == 0 ? 1.0 : -1.0, 0.25, 0.2);
+            positions.push_back(center);
+            continue;
+        }
+        int first = system->getNumParticles();
+        system->addParticle(16.0);
+        system->addParticle(1.0);
+        system->addParticle(1.0);
+        nonbonded->addParticle(-0.82, 0.317, 0.65);
+        nonbonded->addParticle(0.41, 0.2, 0.05);
+        nonbonded->addParticle(0.41, 0.2, 0.05);
+        bonds->addBond(first, first+1, 0.1, 400000.0);
+        bonds->addBond(first, first+2, 0.1, 400000.0);
+        angles->addAngle(first+1, first, first+2, 1.91, 400.0);
+        for (int j = 0; j < 3; j++)
+            for (int k = j+1; k < 3; k++)
+                nonbonded->addException(first+j, first+k, 0.0, 1.0, 0.0);
+        positions.push_back(center);
+        positions.push_back(center+Vec3(0.1, 0, 0));
+        positions.push_back(center+Vec3(-0.033, 0.094, 0));
+    }
+    return system;
+}
+
+map<string, string> getProperties(bool reorder) {
+    map<string, string> properties;
+    properties[CpuPlatform::CpuReorderAtoms()] = (reorder ? "true" : "false");
+    return properties;
+}
+
+/**
+ * This class provides access to the CpuAtomReorderer used by a Context.
+ */
+class ReordererAccessor : public NonbondedForce {
+public:
+    const CpuAtomReorderer& getReorderer(Context& context) {
+        return CpuPlatform::getPlatformData(getContextImpl(context)).atomReorderer;
+    }
+};
+
+/**
+ * Assert that the atoms in a Context are stored in a different order from the System.
+ */
+void assertReordered(Context& context) {
+    const CpuAtomReorderer& reorderer = ReordererAccessor().getReorderer(context);
+    ASSERT(reorderer.getAtomsAreReordered());
+    const vector<int>& atomIndex = reorderer.getAtomIndex();
+    bool isIdentity = true;
+    for (int i = 0; i < (int) atomIndex.size(); i++)
+        if (atomIndex[i] != i)
+            isIdentity = false;
+    ASSERT(!isIdentity);
+}
+
+void assertStatesEqual(const State& state1, const State& state2, double tol) {
+    int numParticles = state1.getPositions().size();
+    for (int i = 0; i < numParticles; i++) {
+        ASSERT_EQUAL_VEC(state1.getPositions()[i], state2.getPositions()[i], tol);
+        ASSERT_EQUAL_VEC(state1.getVelocities()[i], state2.getVelocities()[i], tol);
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], tol);
+    }
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), tol);
+}
+
+void testMatchesOriginalOrder() {
+    // Simulate the system with and without reordering, and make sure the results agree.  The first step
+    // and step 100 both reorder the atoms.
+
+    vector<Vec3> positions;
+    System* system = createSystem(positions);
+    VerletIntegrator integrator1(0.0005);
+    VerletIntegrator integrator2(0.0005);
+    Context context1(*system, integrator1, platform, getProperties(false));
+    Context context2(*system, integrator2, platform, getProperties(true));
+    ASSERT_EQUAL("true", platform.getPropertyValue(context2, CpuPlatform::CpuReorderAtoms()));
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    context1.setVelocitiesToTemperature(300.0);
+    context2.setVelocities(context1.getState(State::Velocities).getVelocities());
+    int types = State::Positions | State::Velocities | State::Forces | State::Energy;
+    assertStatesEqual(context1.getState(types), context2.getState(types), 1e-4);
+    for (int i = 0; i < 5; i++) {
+        integrator1.step(30);
+        integrator2.step(30);
+        ASSERT(!ReordererAccessor().getReorderer(context1).getAtomsAreReordered());
+        assertReordered(context2);
+        assertStatesEqual(context1.getState(types), context2.getState(types), 1e-3);
+    }
+    delete system;
+}
+
+void testChangingParameters() {
+    // After the atoms have been reordered, modify one molecule so it is no longer identical to the others.
+
+    vector<Vec3> positions;
+    System* system = createSystem(positions);
+    VerletIntegrator integrator1(0.0005);
+    VerletIntegrator integrator2(0.0005);
+    Context context1(*system, integrator1, platform, getProperties(false));
+    Context context2(*system, integrator2, platform, getProperties(true));
+    context1.setPositions(positions);
+    context2.setPositions(positions);
+    integrator1.step(10);
+    integrator2.step(10);
+    assertReordered(context2);
+    int types = State::Positions | State::Velocities | State::Forces | State::Energy;
+    HarmonicBondForce& bonds = dynamic_cast<HarmonicBondForce&>(system->getForce(0));
+    NonbondedForce& nonbonded = dynamic_cast<NonbondedForce&>(system->getForce(2));
+    int particle1, particle2;
+    double length, k;
+    bonds.getBondParameters(20, particle1, particle2, length, k);
+    bonds.setBondParameters(20, particle1, particle2, 1.2*length, k);
+    bonds.updateParametersInContext(context1);
+    bonds.updateParametersInContext(context2);
+    assertStatesEqual(context1.getState(types), context2.getState(types), 1e-3);
+    double charge, sigma, epsilon;
+    nonbonded.getParticleParameters(100, charge, sigma, epsilon);
+    nonbonded.setParticleParameters(100, 0.5*charge, sigma, epsilon);
+    nonbonded.updateParametersInContext(context1);
+    nonbonded.updateParametersInContext(context2);
+    ASSERT_EQUAL_TOL(context1.getState(State::Energy).getPotentialEnergy(), context2.getState(State::Energy).getPotentialEnergy(), 1e-4);
+    integrator1.step(150);
+    integrator2.step(150);
+    assertStatesEqual(context1.getState(types), context2.getState(types), 1e-3);
+    delete system;
+}
+
+void testCheckpoint() {
+    // A checkpoint from a Context that has reordered atoms should be loadable by one that has not.
+
+    vector<Vec3> positions;
+    System* system = createSystem(positions);
+    VerletIntegrator integrator1(0.0005);
+    VerletIntegrator integrator2(0.0005);
+    Context context1(*system, integrator1, platform, getProperties(true));
+    Context context2(*system, integrator2, platform, getProperties(false));
+    context1.setPositions(positions);
+    context1.setVelocitiesToTemperature(300.0);
+    integrator1.step(10);
+    assertReordered(context1);
+    State state1 = context1.getState(State::Positions | State::Velocities);
+    stringstream checkpoint;
+    context1.createCheckpoint(checkpoint);
+    context2.loadCheckpoint(checkpoint);
+    State state2 = context2.getState(State::Positions | State::Velocities);
+    for (int i = 0; i < system->getNumParticles(); i++) {
+        ASSERT_EQUAL_VEC(state1.getPositions()[i], state2.getPositions()[i], 1e-10);
+        ASSERT_EQUAL_VEC(state1.getVelocities()[i], state2.getVelocities()[i], 1e-10);
+    }
+    delete system;
+}
+
+int main() {
+    try {
+        testMatchesOriginalOrder();
+        testChangingParameters();
+        testCheckpoint();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -37,6 +37,7 @@
 #include "openmm/internal/AssertionUtilities.h"
 #include "openmm/Context.h"
 #include "CpuPlatform.h"
+#include "CpuSETTLE.h"
 #include "openmm/NonbondedForce.h"
 #include "openmm/System.h"
 #include "openmm/LangevinIntegrator.h"
@@ -103,6 +104,64 @@ void testConstraints() {
     }
 }
 
+void testMatchesReference() {
+    // Create a set of water molecules whose count is not a multiple of the block size.
+
+    const int numMolecules = 37;
+    const int numParticles = 3*numMolecules;
+    System system;
+    vector<int> atom1, atom2, atom3;
+    vector<RealOpenMM> distance1, distance2, masses;
+    vector<RealVec> positions(numParticles), newPositions(numParticles), velocities(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numMolecules; i++) {
+        double hydrogenMass = (i%3 == 0 ? 2.0 : 1.0);
+        system.addParticle(16.0);
+        system.addParticle(hydrogenMass);
+        system.addParticle(hydrogenMass);
+        masses.push_back(16.0);
+        masses.push_back(hydrogenMass);
+        masses.push_back(hydrogenMass);
+        atom1.push_back(3*i);
+        atom2.push_back(3*i+1);
+        atom3.push_back(3*i+2);
+        distance1.push_back(0.1);
+        distance2.push_back(0.163);
+        RealVec center(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt));
+        positions[3*i] = center;
+        positions[3*i+1] = center+RealVec(0.1, 0, 0);
+        positions[3*i+2] = center+RealVec(-0.03333, 0.09428, 0);
+        for (int j = 0; j < 3; j++) {
+            newPositions[3*i+j] = positions[3*i+j]+RealVec(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5)*0.01;
+            velocities[3*i+j] = RealVec(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5);
+        }
+    }
+    vector<RealOpenMM> inverseMasses(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        inverseMasses[i] = 1.0/masses[i];
+    ReferenceSETTLEAlgorithm reference(atom1, atom2, atom3, distance1, distance2, masses);
+    vector<RealVec> expectedPositions = newPositions;
+    vector<RealVec> expectedVelocities = velocities;
+    reference.apply(positions, expectedPositions, inverseMasses, 1e-5);
+    reference.applyToVelocities(positions, expectedVelocities, inverseMasses, 1e-5);
+
+    // Both block sizes should give the same results as the reference implementation.
+
+    ThreadPool threads;
+    for (int allowVec8 = 0; allowVec8 < 2; allowVec8++) {
+        CpuSETTLE settle(system, reference, threads, allowVec8 == 1);
+        vector<RealVec> settledPositions = newPositions;
+        vector<RealVec> settledVelocities = velocities;
+        settle.apply(positions, settledPositions, inverseMasses, 1e-5);
+        settle.applyToVelocities(positions, settledVelocities, inverseMasses, 1e-5);
+        for (int i = 0; i < numParticles; i++) {
+            ASSERT_EQUAL_VEC(expectedPositions[i], settledPositions[i], 1e-12);
+            ASSERT_EQUAL_VEC(expectedVelocities[i], settledVelocities[i], 1e-12);
+        }
+    }
+}
+
 int main(int argc, char* argv[]) {
     try {
         if (!CpuPlatform::isProcessorSupported()) {
@@ -110,6 +169,7 @@ int main(int argc, char* argv[]) {
             return 0;
         }
         testConstraints();
+        testMatchesReference();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
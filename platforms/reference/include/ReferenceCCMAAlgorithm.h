@@ -37,6 +37,7 @@ class OPENMM_EXPORT ReferenceCCMAAlgorithm : public ReferenceConstraintAlgorithm
 protected:
 
     int _maximumNumberOfIterations;
+    long long _totalIterations;
     RealOpenMM _elementCutoff;
 
     int _numberOfConstraints;
@@ -88,6 +89,11 @@ public:
      */
     void setMaximumNumberOfIterations(int maximumNumberOfIterations);
 
+    /**
+     * Get the total number of iterations that have been performed by all calls to apply() and applyToVelocities().
+     */
+    long long getTotalIterations() const;
+
     /**
      * Apply the constraint algorithm.
      * 
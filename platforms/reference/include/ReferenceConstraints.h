@@ -66,8 +66,28 @@ public:
      * @param tolerance        the constraint tolerance
      */
     void applyToVelocities(std::vector<OpenMM::RealVec>& atomCoordinates, std::vector<OpenMM::RealVec>& velocities, std::vector<RealOpenMM>& inverseMasses, RealOpenMM tolerance);
+
+    /**
+     * Get the total number of CCMA iterations performed so far.  SETTLE is not iterative, so it does not
+     * contribute to this.
+     */
+    long long getTotalIterations() const;
+
+    /**
+     * Get the total wall clock time (in seconds) that has been spent applying constraints so far.  Time is
+     * only recorded while timing is enabled.
+     */
+    double getTotalTime() const;
+
+    /**
+     * Set whether to record the time spent applying constraints.  This is disabled by default.
+     */
+    void setTimingEnabled(bool enabled);
     ReferenceConstraintAlgorithm* ccma;
     ReferenceConstraintAlgorithm* settle;
+private:
+    double totalTime;
+    bool timingEnabled;
 };
 
 } // namespace OpenMM
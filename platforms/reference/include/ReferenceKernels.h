@@ -36,6 +36,7 @@
 #include "openmm/kernels.h"
 #include "SimTKOpenMMRealType.h"
 #include "ReferenceNeighborList.h"
+#include "openmm/internal/CustomNonbondedForceImpl.h"
 #include "lepton/CompiledExpression.h"
 #include "lepton/ExpressionProgram.h"
 
@@ -138,6 +139,13 @@ public:
      * @param positions  a vector containg the particle positions
      */
     void setPositions(ContextImpl& context, const std::vector<Vec3>& positions);
+    /**
+     * Get the positions of a subset of particles.
+     *
+     * @param particles  the indices of the particles to retrieve
+     * @param positions  on exit, element i contains the position of particle particles[i]
+     */
+    void getPositionSubset(ContextImpl& context, const std::vector<int>& particles, std::vector<Vec3>& positions);
     /**
      * Get the velocities of all particles.
      *
@@ -150,6 +158,13 @@ public:
      * @param velocities  a vector containg the particle velocities
      */
     void setVelocities(ContextImpl& context, const std::vector<Vec3>& velocities);
+    /**
+     * Get the velocities of a subset of particles.
+     *
+     * @param particles   the indices of the particles to retrieve
+     * @param velocities  on exit, element i contains the velocity of particle particles[i]
+     */
+    void getVelocitySubset(ContextImpl& context, const std::vector<int>& particles, std::vector<Vec3>& velocities);
     /**
      * Get the current forces on all particles.
      *
@@ -626,6 +641,7 @@ private:
     RealOpenMM nonbondedCutoff, switchingDistance, periodicBoxSize[3], longRangeCoefficient;
     bool useSwitchingFunction, hasInitializedLongRangeCorrection;
     CustomNonbondedForce* forceCopy;
+    CustomNonbondedForceImpl::LongRangeCorrectionData longRangeCorrectionData;
     std::map<std::string, double> globalParamValues;
     std::vector<std::set<int> > exclusions;
     Lepton::CompiledExpression energyExpression, forceExpression;
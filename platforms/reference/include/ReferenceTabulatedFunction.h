@@ -45,19 +45,21 @@ namespace OpenMM {
 extern "C" OPENMM_EXPORT Lepton::CustomFunction* createReferenceTabulatedFunction(const TabulatedFunction& function);
 
 /**
- * This class adapts a Continuous1DFunction into a Lepton::CustomFunction.
+ * This class adapts a Continuous1DFunction into a Lepton::CustomFunction.  Because the points are uniformly
+ * spaced, it is exposed as a Lepton::UniformSplineFunction so compiled expressions can evaluate it inline.
  */
-class OPENMM_EXPORT ReferenceContinuous1DFunction : public Lepton::CustomFunction {
+class OPENMM_EXPORT ReferenceContinuous1DFunction : public Lepton::UniformSplineFunction {
 public:
     ReferenceContinuous1DFunction(const Continuous1DFunction& function);
     int getNumArguments() const;
     double evaluate(const double* arguments) const;
     double evaluateDerivative(const double* arguments, const int* derivOrder) const;
     CustomFunction* clone() const;
+    void getSplineParameters(double& min, double& max, std::vector<double>& coeff) const;
 private:
     const Continuous1DFunction& function;
-    double min, max;
-    std::vector<double> x, values, derivs;
+    double min, max, scale;
+    std::vector<double> coeff;
 };
 
 /**
@@ -93,6 +93,40 @@ class ReferenceVariableVerletDynamics : public ReferenceDynamics {
       void update(const OpenMM::System& system, std::vector<OpenMM::RealVec>& atomCoordinates,
                   std::vector<OpenMM::RealVec>& velocities, std::vector<OpenMM::RealVec>& forces, std::vector<RealOpenMM>& masses, RealOpenMM maxStepSize, RealOpenMM tolerance);
 
+      /**---------------------------------------------------------------------------------------
+
+         First update: select the step size and compute the unconstrained positions
+
+         @param numberOfAtoms       number of atoms
+         @param atomCoordinates     atom coordinates
+         @param velocities          velocities
+         @param forces              forces
+         @param masses              atom masses
+         @param inverseMasses       inverse atom masses
+         @param xPrime              xPrime
+         @param maxStepSize         maximum time step
+
+         --------------------------------------------------------------------------------------- */
+
+      virtual void updatePart1(int numberOfAtoms, std::vector<OpenMM::RealVec>& atomCoordinates, std::vector<OpenMM::RealVec>& velocities,
+                       std::vector<OpenMM::RealVec>& forces, std::vector<RealOpenMM>& masses, std::vector<RealOpenMM>& inverseMasses,
+                       std::vector<OpenMM::RealVec>& xPrime, RealOpenMM maxStepSize);
+
+      /**---------------------------------------------------------------------------------------
+
+         Second update: compute the velocities from the constrained positions and store the positions
+
+         @param numberOfAtoms       number of atoms
+         @param atomCoordinates     atom coordinates
+         @param velocities          velocities
+         @param inverseMasses       inverse atom masses
+         @param xPrime              xPrime
+
+         --------------------------------------------------------------------------------------- */
+
+      virtual void updatePart2(int numberOfAtoms, std::vector<OpenMM::RealVec>& atomCoordinates, std::vector<OpenMM::RealVec>& velocities,
+                       std::vector<RealOpenMM>& inverseMasses, std::vector<OpenMM::RealVec>& xPrime);
+
 };
 
 } // namespace OpenMM
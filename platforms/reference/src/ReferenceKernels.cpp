@@ -234,6 +234,16 @@ void ReferenceUpdateStateDataKernel::setPositions(ContextImpl& context, const st
     }
 }
 
+void ReferenceUpdateStateDataKernel::getPositionSubset(ContextImpl& context, const std::vector<int>& particles, std::vector<Vec3>& positions) {
+    vector<RealVec>& posData = extractPositions(context);
+    int numParticles = particles.size();
+    positions.resize(numParticles);
+    for (int i = 0; i < numParticles; ++i) {
+        const RealVec& pos = posData[particles[i]];
+        positions[i] = Vec3(pos[0], pos[1], pos[2]);
+    }
+}
+
 void ReferenceUpdateStateDataKernel::getVelocities(ContextImpl& context, std::vector<Vec3>& velocities) {
     int numParticles = context.getSystem().getNumParticles();
     vector<RealVec>& velData = extractVelocities(context);
@@ -252,6 +262,16 @@ void ReferenceUpdateStateDataKernel::setVelocities(ContextImpl& context, const s
     }
 }
 
+void ReferenceUpdateStateDataKernel::getVelocitySubset(ContextImpl& context, const std::vector<int>& particles, std::vector<Vec3>& velocities) {
+    vector<RealVec>& velData = extractVelocities(context);
+    int numParticles = particles.size();
+    velocities.resize(numParticles);
+    for (int i = 0; i < numParticles; ++i) {
+        const RealVec& vel = velData[particles[i]];
+        velocities[i] = Vec3(vel[0], vel[1], vel[2]);
+    }
+}
+
 void ReferenceUpdateStateDataKernel::getForces(ContextImpl& context, std::vector<Vec3>& forces) {
     int numParticles = context.getSystem().getNumParticles();
     vector<RealVec>& forceData = extractForces(context);
@@ -321,14 +341,30 @@ ReferenceApplyConstraintsKernel::~ReferenceApplyConstraintsKernel() {
 
 void ReferenceApplyConstraintsKernel::apply(ContextImpl& context, double tol) {
     vector<RealVec>& positions = extractPositions(context);
-    extractConstraints(context).apply(positions, positions, inverseMasses, tol);
+    ReferenceConstraints& constraints = extractConstraints(context);
+    constraints.setTimingEnabled(context.getProfilingEnabled());
+    double startTime = constraints.getTotalTime();
+    long long startIterations = constraints.getTotalIterations();
+    constraints.apply(positions, positions, inverseMasses, tol);
     ReferenceVirtualSites::computePositions(context.getSystem(), positions);
+    if (context.getProfilingEnabled()) {
+        context.addProfilingData("constraints", constraints.getTotalTime()-startTime);
+        context.addProfilingData("constraint_iterations", (double) (constraints.getTotalIterations()-startIterations));
+    }
 }
 
 void ReferenceApplyConstraintsKernel::applyToVelocities(ContextImpl& context, double tol) {
     vector<RealVec>& positions = extractPositions(context);
     vector<RealVec>& velocities = extractVelocities(context);
-    extractConstraints(context).applyToVelocities(positions, velocities, inverseMasses, tol);
+    ReferenceConstraints& constraints = extractConstraints(context);
+    constraints.setTimingEnabled(context.getProfilingEnabled());
+    double startTime = constraints.getTotalTime();
+    long long startIterations = constraints.getTotalIterations();
+    constraints.applyToVelocities(positions, velocities, inverseMasses, tol);
+    if (context.getProfilingEnabled()) {
+        context.addProfilingData("constraints", constraints.getTotalTime()-startTime);
+        context.addProfilingData("constraint_iterations", (double) (constraints.getTotalIterations()-startIterations));
+    }
 }
 
 void ReferenceVirtualSitesKernel::initialize(const System& system) {
@@ -1086,7 +1122,9 @@ double ReferenceCalcCustomNonbondedForceKernel::execute(ContextImpl& context, bo
     // Add in the long range correction.
     
     if (!hasInitializedLongRangeCorrection || (globalParamsChanged && forceCopy != NULL)) {
-        longRangeCoefficient = CustomNonbondedForceImpl::calcLongRangeCorrection(*forceCopy, context.getOwner());
+        if (!hasInitializedLongRangeCorrection)
+            longRangeCorrectionData = CustomNonbondedForceImpl::prepareLongRangeCorrection(*forceCopy);
+        longRangeCoefficient = CustomNonbondedForceImpl::calcLongRangeCorrection(*forceCopy, longRangeCorrectionData, context.getOwner());
         hasInitializedLongRangeCorrection = true;
     }
     energy += longRangeCoefficient/(boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2]);
@@ -1111,9 +1149,10 @@ void ReferenceCalcCustomNonbondedForceKernel::copyParametersToContext(ContextImp
     // If necessary, recompute the long range correction.
     
     if (forceCopy != NULL) {
-        longRangeCoefficient = CustomNonbondedForceImpl::calcLongRangeCorrection(force, context.getOwner());
-        hasInitializedLongRangeCorrection = true;
         *forceCopy = force;
+        longRangeCorrectionData = CustomNonbondedForceImpl::prepareLongRangeCorrection(*forceCopy);
+        longRangeCoefficient = CustomNonbondedForceImpl::calcLongRangeCorrection(*forceCopy, longRangeCorrectionData, context.getOwner());
+        hasInitializedLongRangeCorrection = true;
     }
 }
 
@@ -32,6 +32,7 @@
 #include "ReferenceTabulatedFunction.h"
 #include "openmm/OpenMMException.h"
 #include "openmm/internal/SplineFitter.h"
+#include <algorithm>
 
 #ifdef _MSC_VER
 
@@ -72,12 +73,28 @@ extern "C" OPENMM_EXPORT CustomFunction* createReferenceTabulatedFunction(const
 }
 
 ReferenceContinuous1DFunction::ReferenceContinuous1DFunction(const Continuous1DFunction& function) : function(function) {
+    vector<double> values, derivs;
     function.getFunctionParameters(values, min, max);
     int numValues = values.size();
-    x.resize(numValues);
+    vector<double> x(numValues);
     for (int i = 0; i < numValues; i++)
         x[i] = min+i*(max-min)/(numValues-1);
     SplineFitter::createNaturalSpline(x, values, derivs);
+
+    // Convert the spline to a polynomial in the fractional position within each interval.  Since
+    // the points are uniformly spaced, the interval can then be found without a search.
+
+    int numIntervals = numValues-1;
+    double delta = (max-min)/numIntervals;
+    scale = 1.0/delta;
+    coeff.resize(4*numIntervals);
+    for (int i = 0; i < numIntervals; i++) {
+        double d2 = delta*delta/6.0;
+        coeff[4*i] = values[i];
+        coeff[4*i+1] = values[i+1]-values[i]-d2*(2.0*derivs[i]+derivs[i+1]);
+        coeff[4*i+2] = 3.0*d2*derivs[i];
+        coeff[4*i+3] = d2*(derivs[i+1]-derivs[i]);
+    }
 }
 
 int ReferenceContinuous1DFunction::getNumArguments() const {
@@ -88,14 +105,30 @@ double ReferenceContinuous1DFunction::evaluate(const double* arguments) const {
     double t = arguments[0];
     if (t < min || t > max)
         return 0.0;
-    return SplineFitter::evaluateSpline(x, values, derivs, t);
+    int numIntervals = coeff.size()/4;
+    double f = (t-min)*scale;
+    int index = std::min((int) f, numIntervals-1);
+    f -= index;
+    const double* c = &coeff[4*index];
+    return c[0]+f*(c[1]+f*(c[2]+f*c[3]));
 }
 
 double ReferenceContinuous1DFunction::evaluateDerivative(const double* arguments, const int* derivOrder) const {
     double t = arguments[0];
     if (t < min || t > max)
         return 0.0;
-    return SplineFitter::evaluateSplineDerivative(x, values, derivs, t);
+    int numIntervals = coeff.size()/4;
+    double f = (t-min)*scale;
+    int index = std::min((int) f, numIntervals-1);
+    f -= index;
+    const double* c = &coeff[4*index];
+    return (c[1]+f*(2.0*c[2]+f*3.0*c[3]))*scale;
+}
+
+void ReferenceContinuous1DFunction::getSplineParameters(double& min, double& max, vector<double>& coeff) const {
+    min = this->min;
+    max = this->max;
+    coeff = this->coeff;
 }
 
 CustomFunction* ReferenceContinuous1DFunction::clone() const {
@@ -87,6 +87,7 @@ ReferenceCCMAAlgorithm::ReferenceCCMAAlgorithm(int numberOfAtoms,
     _distance = distance;
 
     _maximumNumberOfIterations = 150;
+    _totalIterations = 0;
     _hasInitializedMasses = false;
 
     // work arrays
@@ -232,6 +233,10 @@ void ReferenceCCMAAlgorithm::setMaximumNumberOfIterations(int maximumNumberOfIte
     _maximumNumberOfIterations = maximumNumberOfIterations;
 }
 
+long long ReferenceCCMAAlgorithm::getTotalIterations() const {
+    return _totalIterations;
+}
+
 void ReferenceCCMAAlgorithm::apply(vector<RealVec>& atomCoordinates,
                                          vector<RealVec>& atomCoordinatesP,
                                          vector<RealOpenMM>& inverseMasses, RealOpenMM tolerance) {
@@ -326,6 +331,7 @@ void ReferenceCCMAAlgorithm::applyConstraints(vector<RealVec>& atomCoordinates,
             atomCoordinatesP[atomJ] -= dr*inverseMasses[atomJ];
         }
     }
+    _totalIterations += iterations;
 }
 
 const vector<vector<pair<int, RealOpenMM> > >& ReferenceCCMAAlgorithm::getMatrix() const {
@@ -34,6 +34,7 @@
 #include "ReferenceSETTLEAlgorithm.h"
 #include "openmm/HarmonicAngleForce.h"
 #include "openmm/OpenMMException.h"
+#include "openmm/internal/timer.h"
 #include <map>
 #include <utility>
 #include <vector>
@@ -41,7 +42,7 @@
 using namespace OpenMM;
 using namespace std;
 
-ReferenceConstraints::ReferenceConstraints(const System& system) : ccma(NULL), settle(NULL) {
+ReferenceConstraints::ReferenceConstraints(const System& system) : ccma(NULL), settle(NULL), totalTime(0.0), timingEnabled(false) {
     int numParticles = system.getNumParticles();
     vector<RealOpenMM> masses(numParticles);
     for (int i = 0; i < numParticles; ++i)
@@ -192,15 +193,33 @@ ReferenceConstraints::~ReferenceConstraints() {
 }
 
 void ReferenceConstraints::apply(vector<OpenMM::RealVec>& atomCoordinates, vector<OpenMM::RealVec>& atomCoordinatesP, vector<RealOpenMM>& inverseMasses, RealOpenMM tolerance) {
+    double start = (timingEnabled ? getCurrentTime() : 0.0);
     if (ccma != NULL)
         ccma->apply(atomCoordinates, atomCoordinatesP, inverseMasses, tolerance);
     if (settle != NULL)
         settle->apply(atomCoordinates, atomCoordinatesP, inverseMasses, tolerance);
+    if (timingEnabled)
+        totalTime += getCurrentTime()-start;
 }
 
 void ReferenceConstraints::applyToVelocities(vector<OpenMM::RealVec>& atomCoordinates, vector<OpenMM::RealVec>& velocities, vector<RealOpenMM>& inverseMasses, RealOpenMM tolerance) {
+    double start = (timingEnabled ? getCurrentTime() : 0.0);
     if (ccma != NULL)
         ccma->applyToVelocities(atomCoordinates, velocities, inverseMasses, tolerance);
     if (settle != NULL)
         settle->applyToVelocities(atomCoordinates, velocities, inverseMasses, tolerance);
+    if (timingEnabled)
+        totalTime += getCurrentTime()-start;
+}
+
+long long ReferenceConstraints::getTotalIterations() const {
+    return (ccma == NULL ? 0 : ((ReferenceCCMAAlgorithm*) ccma)->getTotalIterations());
+}
+
+double ReferenceConstraints::getTotalTime() const {
+    return totalTime;
+}
+
+void ReferenceConstraints::setTimingEnabled(bool enabled) {
+    timingEnabled = enabled;
 }
@@ -89,26 +89,26 @@ void ReferenceVariableVerletDynamics::setAccuracy(RealOpenMM accuracy) {
 
 /**---------------------------------------------------------------------------------------
 
-   Update -- driver routine for performing Verlet dynamics update of coordinates
-   and velocities
+   First update: select the step size and compute the unconstrained positions
 
-   @param system              the System to be integrated
+   @param numberOfAtoms       number of atoms
    @param atomCoordinates     atom coordinates
    @param velocities          velocities
    @param forces              forces
    @param masses              atom masses
+   @param inverseMasses       inverse atom masses
+   @param xPrime              xPrime
    @param maxStepSize         maximum time step
 
    --------------------------------------------------------------------------------------- */
 
-void ReferenceVariableVerletDynamics::update(const OpenMM::System& system, vector<RealVec>& atomCoordinates,
-                                          vector<RealVec>& velocities,
-                                          vector<RealVec>& forces, vector<RealOpenMM>& masses, RealOpenMM maxStepSize, RealOpenMM tolerance) {
+void ReferenceVariableVerletDynamics::updatePart1(int numberOfAtoms, vector<RealVec>& atomCoordinates,
+                                              vector<RealVec>& velocities,
+                                              vector<RealVec>& forces, vector<RealOpenMM>& masses, vector<RealOpenMM>& inverseMasses,
+                                              vector<RealVec>& xPrime, RealOpenMM maxStepSize) {
 
     // ---------------------------------------------------------------------------------------
 
-    static const char* methodName      = "\nReferenceVariableVerletDynamics::update";
-
     static const RealOpenMM zero       =  0.0;
     static const RealOpenMM one        =  1.0;
 
@@ -116,7 +116,6 @@ void ReferenceVariableVerletDynamics::update(const OpenMM::System& system, vecto
 
     // first-time-through initialization
 
-    int numberOfAtoms = system.getNumParticles();
     if (getTimeStep() == 0) {
        // invert masses
 
@@ -152,22 +151,59 @@ void ReferenceVariableVerletDynamics::update(const OpenMM::System& system, vecto
                 xPrime[i][j] = atomCoordinates[i][j] + vPrime*getDeltaT();
             }
     }
+}
+
+/**---------------------------------------------------------------------------------------
+
+   Second update: compute the velocities from the constrained positions and store the positions
+
+   @param numberOfAtoms       number of atoms
+   @param atomCoordinates     atom coordinates
+   @param velocities          velocities
+   @param inverseMasses       inverse atom masses
+   @param xPrime              xPrime
+
+   --------------------------------------------------------------------------------------- */
+
+void ReferenceVariableVerletDynamics::updatePart2(int numberOfAtoms, vector<RealVec>& atomCoordinates,
+                                              vector<RealVec>& velocities, vector<RealOpenMM>& inverseMasses,
+                                              vector<RealVec>& xPrime) {
+    RealOpenMM velocityScale = 1.0/getDeltaT();
+    for (int i = 0; i < numberOfAtoms; ++i) {
+        if (inverseMasses[i] != 0.0)
+            for (int j = 0; j < 3; ++j) {
+                velocities[i][j] = velocityScale*(xPrime[i][j] - atomCoordinates[i][j]);
+                atomCoordinates[i][j] = xPrime[i][j];
+            }
+    }
+}
+
+/**---------------------------------------------------------------------------------------
+
+   Update -- driver routine for performing Verlet dynamics update of coordinates
+   and velocities
+
+   @param system              the System to be integrated
+   @param atomCoordinates     atom coordinates
+   @param velocities          velocities
+   @param forces              forces
+   @param masses              atom masses
+   @param maxStepSize         maximum time step
+
+   --------------------------------------------------------------------------------------- */
+
+void ReferenceVariableVerletDynamics::update(const OpenMM::System& system, vector<RealVec>& atomCoordinates,
+                                          vector<RealVec>& velocities,
+                                          vector<RealVec>& forces, vector<RealOpenMM>& masses, RealOpenMM maxStepSize, RealOpenMM tolerance) {
+    int numberOfAtoms = system.getNumParticles();
+    updatePart1(numberOfAtoms, atomCoordinates, velocities, forces, masses, inverseMasses, xPrime, maxStepSize);
     ReferenceConstraintAlgorithm* referenceConstraintAlgorithm = getReferenceConstraintAlgorithm();
     if (referenceConstraintAlgorithm)
         referenceConstraintAlgorithm->apply(atomCoordinates, xPrime, inverseMasses, tolerance);
 
-   // Update the positions and velocities.
-
-   RealOpenMM velocityScale = one/getDeltaT();
-   for (int i = 0; i < numberOfAtoms; ++i) {
-       if (masses[i] != zero)
-           for (int j = 0; j < 3; ++j) {
-               velocities[i][j] = velocityScale*(xPrime[i][j] - atomCoordinates[i][j]);
-               atomCoordinates[i][j] = xPrime[i][j];
-           }
-   }
-   ReferenceVirtualSites::computePositions(system, atomCoordinates);
-   incrementTimeStep();
-}
-
+    // Update the positions and velocities.
 
+    updatePart2(numberOfAtoms, atomCoordinates, velocities, inverseMasses, xPrime);
+    ReferenceVirtualSites::computePositions(system, atomCoordinates);
+    incrementTimeStep();
+}
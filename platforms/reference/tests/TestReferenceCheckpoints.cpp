@@ -38,9 +38,11 @@
 #include "openmm/AndersenThermostat.h"
 #include "openmm/Context.h"
 #include "openmm/NonbondedForce.h"
+#include "openmm/OpenMMException.h"
 #include "openmm/System.h"
 #include "openmm/VerletIntegrator.h"
 #include "sfmt/SFMT.h"
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <vector>
@@ -122,6 +124,101 @@ void testCheckpoint() {
     compareStates(s2, s4);
 }
 
+void testAsyncCheckpoint(bool compress) {
+    const int numParticles = 10;
+    const double boxSize = 3.0;
+    System system;
+    system.addForce(new AndersenThermostat(200.0, 100.0));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    system.addForce(nonbonded);
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? 0.1 : -0.1, 0.2, 0.1);
+        positions[i] = Vec3(boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt), boxSize*genrand_real2(sfmt));
+    }
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    context.setPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    integrator.step(100);
+    
+    // Start writing a checkpoint, and continue the simulation while it is being written.
+    
+    State s1 = context.getState(State::Positions | State::Velocities | State::Parameters);
+    stringstream stream1(ios_base::out | ios_base::in | ios_base::binary);
+    context.createCheckpointAsync(stream1, compress);
+    integrator.step(10);
+    State s2 = context.getState(State::Positions | State::Velocities | State::Parameters);
+    context.waitForCheckpoint();
+    
+    // Restore from the checkpoint and see if everything gets restored correctly.
+    
+    context.loadCheckpoint(stream1);
+    State s3 = context.getState(State::Positions | State::Velocities | State::Parameters);
+    compareStates(s1, s3);
+    integrator.step(10);
+    State s4 = context.getState(State::Positions | State::Velocities | State::Parameters);
+    compareStates(s2, s4);
+}
+
+/**
+ * Try to load a checkpoint, and make sure it is rejected.
+ */
+void assertCheckpointRejected(Context& context, const string& data) {
+    stringstream stream(data, ios_base::in | ios_base::binary);
+    bool threwException = false;
+    try {
+        context.loadCheckpoint(stream);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testCorruptCompressedCheckpoint() {
+    System system;
+    for (int i = 0; i < 10; i++)
+        system.addParticle(1.0);
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    vector<Vec3> positions(10);
+    for (int i = 0; i < 10; i++)
+        positions[i] = Vec3(i, 0.5*i, 0.1*i*i);
+    context.setPositions(positions);
+    stringstream stream(ios_base::out | ios_base::in | ios_base::binary);
+    context.createCheckpointAsync(stream, true);
+    context.waitForCheckpoint();
+    string original = stream.str();
+
+    // The header is the magic bytes, the version, the uncompressed size, and the compressed size.
+
+    const int sizeOffset = sizeof("OpenMM Packed Checkpoint\n")+sizeof(int);
+    long long sizes[] = {-1, 1LL<<60, 8};
+    for (int i = 0; i < 3; i++) {
+        string data = original;
+        memcpy(&data[sizeOffset], &sizes[i], sizeof(long long));
+        assertCheckpointRejected(context, data);
+    }
+    string data = original;
+    long long compressedSize = 1LL<<40;
+    memcpy(&data[sizeOffset+sizeof(long long)], &compressedSize, sizeof(long long));
+    assertCheckpointRejected(context, data);
+    assertCheckpointRejected(context, original.substr(0, original.size()-5));
+
+    // The original checkpoint should still load correctly.
+
+    stringstream stream2(original, ios_base::in | ios_base::binary);
+    context.loadCheckpoint(stream2);
+    State state = context.getState(State::Positions);
+    for (int i = 0; i < 10; i++)
+        ASSERT_EQUAL_VEC(positions[i], state.getPositions()[i], 0.0);
+}
+
 void testSetState() {
     const int numParticles = 10;
     const double boxSize = 3.0;
@@ -179,6 +276,9 @@ void testSetState() {
 int main() {
     try {
         testCheckpoint();
+        testAsyncCheckpoint(false);
+        testAsyncCheckpoint(true);
+        testCorruptCompressedCheckpoint();
         testSetState();
     }
     catch(const exception& e) {
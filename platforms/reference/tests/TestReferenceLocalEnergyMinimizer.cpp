@@ -47,7 +47,7 @@ using namespace std;
 
 ReferencePlatform platform;
 
-void testHarmonicBonds() {
+void testHarmonicBonds(LocalEnergyMinimizer::Algorithm algorithm) {
     const int numParticles = 10;
     System system;
     HarmonicBondForce* bonds = new HarmonicBondForce();
@@ -68,7 +68,7 @@ void testHarmonicBonds() {
     VerletIntegrator integrator(0.01);
     Context context(system, integrator, platform);
     context.setPositions(positions);
-    LocalEnergyMinimizer::minimize(context, 1e-5);
+    LocalEnergyMinimizer::minimize(context, 1e-5, 0, algorithm);
     State state = context.getState(State::Positions);
     for (int i = 1; i < numParticles; i++) {
         Vec3 delta = state.getPositions()[i]-state.getPositions()[i-1];
@@ -76,7 +76,7 @@ void testHarmonicBonds() {
     }
 }
 
-void testLargeSystem() {
+void testLargeSystem(LocalEnergyMinimizer::Algorithm algorithm) {
     const int numMolecules = 25;
     const int numParticles = numMolecules*2;
     const double cutoff = 2.0;
@@ -110,7 +110,7 @@ void testLargeSystem() {
     Context context(system, integrator, platform);
     context.setPositions(positions);
     State initialState = context.getState(State::Forces | State::Energy);
-    LocalEnergyMinimizer::minimize(context, tolerance);
+    LocalEnergyMinimizer::minimize(context, tolerance, 0, algorithm);
     State finalState = context.getState(State::Forces | State::Energy | State::Positions);
     ASSERT(finalState.getPotentialEnergy() < initialState.getPotentialEnergy());
 
@@ -133,7 +133,7 @@ void testLargeSystem() {
     ASSERT(forceNorm < 2*tolerance);
 }
 
-void testVirtualSites() {
+void testVirtualSites(LocalEnergyMinimizer::Algorithm algorithm) {
     const int numMolecules = 25;
     const int numParticles = numMolecules*3;
     const double cutoff = 2.0;
@@ -172,7 +172,7 @@ void testVirtualSites() {
     context.setPositions(positions);
     context.applyConstraints(1e-5);
     State initialState = context.getState(State::Forces | State::Energy);
-    LocalEnergyMinimizer::minimize(context, tolerance);
+    LocalEnergyMinimizer::minimize(context, tolerance, 0, algorithm);
     State finalState = context.getState(State::Forces | State::Energy | State::Positions);
     ASSERT(finalState.getPotentialEnergy() < initialState.getPotentialEnergy());
 
@@ -201,9 +201,12 @@ void testVirtualSites() {
 
 int main() {
     try {
-        testHarmonicBonds();
-        testLargeSystem();
-        testVirtualSites();
+        testHarmonicBonds(LocalEnergyMinimizer::LBFGS);
+        testLargeSystem(LocalEnergyMinimizer::LBFGS);
+        testVirtualSites(LocalEnergyMinimizer::LBFGS);
+        testHarmonicBonds(LocalEnergyMinimizer::FIRE);
+        testLargeSystem(LocalEnergyMinimizer::FIRE);
+        testVirtualSites(LocalEnergyMinimizer::FIRE);
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
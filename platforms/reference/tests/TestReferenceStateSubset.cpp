@@ -0,0 +1,160 @@
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2016 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+/**
+ * This tests retrieving positions and velocities for subsets of particles with the reference platform.
+ */
+
+#include "ReferencePlatform.h"
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "sfmt/SFMT.h"
+#include <iostream>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+ReferencePlatform platform;
+
+void testSubset(int numMolecules) {
+    // Create a System of three particle molecules scattered over several periodic boxes.
+
+    const double boxSize = 3.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    HarmonicBondForce* bonds = new HarmonicBondForce();
+    system.addForce(bonds);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    vector<Vec3> positions, velocities;
+    for (int i = 0; i < numMolecules; i++) {
+        Vec3 center = Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5)*(4*boxSize);
+        for (int j = 0; j < 3; j++) {
+            system.addParticle(1.0);
+            positions.push_back(center+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.2);
+            velocities.push_back(Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt)));
+        }
+        bonds->addBond(3*i, 3*i+1, 0.1, 1.0);
+        bonds->addBond(3*i+1, 3*i+2, 0.1, 1.0);
+    }
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    context.setPositions(positions);
+    context.setVelocities(velocities);
+    State unwrapped = context.getState(State::Positions | State::Velocities, false);
+    State wrapped = context.getState(State::Positions, true);
+
+    // Select a random subset of particles, including some from the same molecule.
+
+    vector<int> particles;
+    for (int i = 0; i < system.getNumParticles(); i++)
+        if (genrand_real2(sfmt) < 0.2)
+            particles.push_back(i);
+    particles.push_back(particles[0]);
+    int numSelected = particles.size();
+
+    // Compare the results to those from getState().
+
+    vector<double> doubleBuffer(3*numSelected);
+    vector<float> floatBuffer(3*numSelected);
+    for (int wrap = 0; wrap < 2; wrap++) {
+        const vector<Vec3>& expected = (wrap ? wrapped.getPositions() : unwrapped.getPositions());
+        context.getPositions(particles, &doubleBuffer[0], wrap == 1);
+        context.getPositions(particles, &floatBuffer[0], wrap == 1);
+        for (int i = 0; i < numSelected; i++) {
+            ASSERT_EQUAL_VEC(expected[particles[i]], Vec3(doubleBuffer[3*i], doubleBuffer[3*i+1], doubleBuffer[3*i+2]), 1e-10);
+            ASSERT_EQUAL_VEC(expected[particles[i]], Vec3(floatBuffer[3*i], floatBuffer[3*i+1], floatBuffer[3*i+2]), 1e-6);
+        }
+    }
+    context.getVelocities(particles, &doubleBuffer[0]);
+    context.getVelocities(particles, &floatBuffer[0]);
+    for (int i = 0; i < numSelected; i++) {
+        const Vec3& expected = unwrapped.getVelocities()[particles[i]];
+        ASSERT_EQUAL_VEC(expected, Vec3(doubleBuffer[3*i], doubleBuffer[3*i+1], doubleBuffer[3*i+2]), 1e-10);
+        ASSERT_EQUAL_VEC(expected, Vec3(floatBuffer[3*i], floatBuffer[3*i+1], floatBuffer[3*i+2]), 1e-6);
+    }
+
+    // An empty list should retrieve every particle.
+
+    vector<double> allPositions(3*system.getNumParticles());
+    vector<float> allVelocities(3*system.getNumParticles());
+    context.getPositions(vector<int>(), &allPositions[0], true);
+    context.getVelocities(vector<int>(), &allVelocities[0]);
+    for (int i = 0; i < system.getNumParticles(); i++) {
+        ASSERT_EQUAL_VEC(wrapped.getPositions()[i], Vec3(allPositions[3*i], allPositions[3*i+1], allPositions[3*i+2]), 1e-10);
+        ASSERT_EQUAL_VEC(unwrapped.getVelocities()[i], Vec3(allVelocities[3*i], allVelocities[3*i+1], allVelocities[3*i+2]), 1e-6);
+    }
+
+    // Every wrapped molecule center should be inside the box.
+
+    for (int i = 0; i < numMolecules; i++) {
+        Vec3 center;
+        for (int j = 0; j < 3; j++)
+            center += Vec3(allPositions[9*i+3*j], allPositions[9*i+3*j+1], allPositions[9*i+3*j+2]);
+        center *= 1.0/3.0;
+        for (int j = 0; j < 3; j++) {
+            ASSERT(center[j] >= 0.0);
+            ASSERT(center[j] < boxSize);
+        }
+    }
+
+    // Illegal indices should be rejected.
+
+    vector<int> illegal(1, system.getNumParticles());
+    bool threwException = false;
+    try {
+        context.getPositions(illegal, &doubleBuffer[0]);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+int main() {
+    try {
+        testSubset(100);
+        testSubset(10000);
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -0,0 +1,123 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2015 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the reference implementation of tabulated functions inside compiled expressions.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/TabulatedFunction.h"
+#include "openmm/internal/SplineFitter.h"
+#include "ReferenceTabulatedFunction.h"
+#include "lepton/CompiledExpression.h"
+#include "lepton/ParsedExpression.h"
+#include "lepton/Parser.h"
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+/**
+ * Evaluate an expression at a range of points, both with a CompiledExpression (which evaluates uniform splines
+ * with inline code) and by interpreting the ParsedExpression (which calls the function's evaluate() method),
+ * and check that they agree with each other and with the expected values.
+ */
+void compareEvaluation(const Lepton::ParsedExpression& expression, const vector<double>& points, const vector<double>& expected) {
+    Lepton::CompiledExpression compiled = expression.createCompiledExpression();
+    map<string, double> variables;
+    for (int i = 0; i < (int) points.size(); i++) {
+        variables["x"] = points[i];
+        if (compiled.getVariables().find("x") != compiled.getVariables().end())
+            compiled.getVariableReference("x") = points[i];
+        double interpreted = expression.evaluate(variables);
+        ASSERT_EQUAL_TOL(expected[i], interpreted, 1e-10);
+        ASSERT_EQUAL_TOL(interpreted, compiled.evaluate(), 1e-10);
+    }
+}
+
+void testContinuous1DFunction() {
+    // Create a tabulated function and an expression that uses it.
+
+    const int numValues = 20;
+    const double min = 0.5, max = 2.5;
+    vector<double> x(numValues), values(numValues);
+    for (int i = 0; i < numValues; i++) {
+        x[i] = min+i*(max-min)/(numValues-1);
+        values[i] = sin(3*x[i])+0.2*x[i]*x[i];
+    }
+    Continuous1DFunction function(values, min, max);
+    ReferenceContinuous1DFunction* referenceFunction = new ReferenceContinuous1DFunction(function);
+    map<string, Lepton::CustomFunction*> functions;
+    functions["f"] = referenceFunction;
+    Lepton::ParsedExpression expression = Lepton::Parser::parse("2*f(x)+x", functions).optimize();
+    Lepton::ParsedExpression derivative = expression.differentiate("x").optimize();
+
+    // Select points inside the range (including the ends and the tabulated points themselves) and outside it,
+    // where the function is zero.
+
+    vector<double> points;
+    points.push_back(min-1.0);
+    points.push_back(min-1e-8);
+    for (int i = 0; i <= 200; i++)
+        points.push_back(min+i*(max-min)/200);
+    points.push_back(max+1e-8);
+    points.push_back(max+1.0);
+
+    // Compute the expected values from the original spline.
+
+    vector<double> deriv;
+    SplineFitter::createNaturalSpline(x, values, deriv);
+    vector<double> expectedValue(points.size()), expectedDerivative(points.size());
+    for (int i = 0; i < (int) points.size(); i++) {
+        double t = points[i];
+        bool inside = (t >= min && t <= max);
+        expectedValue[i] = 2*(inside ? SplineFitter::evaluateSpline(x, values, deriv, t) : 0.0)+t;
+        expectedDerivative[i] = 2*(inside ? SplineFitter::evaluateSplineDerivative(x, values, deriv, t) : 0.0)+1;
+    }
+    compareEvaluation(expression, points, expectedValue);
+    compareEvaluation(derivative, points, expectedDerivative);
+    delete referenceFunction;
+}
+
+int main() {
+    try {
+        testContinuous1DFunction();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
@@ -37,9 +37,15 @@
 #include "openmm/internal/hardware.h"
 #include "openmm/internal/vectorize.h"
 #include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <sstream>
 #include <cstdlib>
+#ifdef WIN32
+  #include <process.h>
+#else
+  #include <unistd.h>
+#endif
 
 using namespace OpenMM;
 using namespace std;
@@ -48,6 +54,68 @@ static const int PME_ORDER = 5;
 
 bool CpuCalcPmeReciprocalForceKernel::hasInitializedThreads = false;
 int CpuCalcPmeReciprocalForceKernel::numThreads = 0;
+bool CpuCalcPmeReciprocalForceKernel::hasImportedWisdom = false;
+
+/**
+ * Get the file in which FFTW wisdom is cached between processes.  Measuring plans for large
+ * grids is slow, so reusing earlier measurements greatly reduces the time to create a Context.
+ * Wisdom is only cached if the OPENMM_CACHE_DIR environment variable specifies a directory
+ * to store it in, just as for the CUDA platform's kernel cache.  Otherwise this returns an
+ * empty string.
+ */
+static string getWisdomFilename() {
+    char* cacheVariable = getenv("OPENMM_CACHE_DIR");
+    if (cacheVariable == NULL || cacheVariable[0] == 0)
+        return "";
+#ifdef WIN32
+    return string(cacheVariable)+"\\openmm-fftwf-wisdom";
+#else
+    return string(cacheVariable)+"/openmm-fftwf-wisdom";
+#endif
+}
+
+/**
+ * Save all wisdom FFTW has accumulated to a file.  It is written to a new temporary file which
+ * is then renamed, so other processes never see a partially written file.
+ */
+static void saveWisdom(const string& filename) {
+    char* wisdom = fftwf_export_wisdom_to_string();
+    if (wisdom == NULL)
+        return;
+    size_t length = strlen(wisdom);
+#ifdef WIN32
+    // Windows cannot rename a file on top of an existing one, so remove the old file first.
+
+    stringstream tempFilename;
+    tempFilename << filename << "." << _getpid() << ".tmp";
+    FILE* file = fopen(tempFilename.str().c_str(), "wb");
+    if (file != NULL) {
+        bool success = (fwrite(wisdom, 1, length, file) == length);
+        success &= (fclose(file) == 0);
+        if (success) {
+            remove(filename.c_str());
+            success = (rename(tempFilename.str().c_str(), filename.c_str()) == 0);
+        }
+        if (!success)
+            remove(tempFilename.str().c_str());
+    }
+#else
+    // mkstemp() creates a new file that only this user can access, and rename() replaces the old
+    // file atomically.
+
+    string tempTemplate = filename+".XXXXXX";
+    vector<char> tempFilename(tempTemplate.begin(), tempTemplate.end());
+    tempFilename.push_back(0);
+    int fd = mkstemp(&tempFilename[0]);
+    if (fd != -1) {
+        bool success = (write(fd, wisdom, length) == (ssize_t) length);
+        success &= (close(fd) == 0);
+        if (!success || rename(&tempFilename[0], filename.c_str()) != 0)
+            unlink(&tempFilename[0]);
+    }
+#endif
+    free(wisdom);
+}
 
 static void spreadCharge(int start, int end, float* posq, float* grid, int gridx, int gridy, int gridz, int numParticles, Vec3* periodicBoxVectors, Vec3* recipBoxVectors) {
     float temp[4];
@@ -391,9 +459,28 @@ void CpuCalcPmeReciprocalForceKernel::initialize(int xsize, int ysize, int zsize
     realGrid = tempGrid[0];
     complexGrid = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex)*gridx*gridy*(gridz/2+1));
     fftwf_plan_with_nthreads(numThreads);
-    forwardFFT = fftwf_plan_dft_r2c_3d(gridx, gridy, gridz, realGrid, complexGrid, FFTW_MEASURE);
-    backwardFFT = fftwf_plan_dft_c2r_3d(gridx, gridy, gridz, complexGrid, realGrid, FFTW_MEASURE);
+    string wisdomFile = getWisdomFilename();
+    if (!hasImportedWisdom && wisdomFile.size() > 0)
+        fftwf_import_wisdom_from_filename(wisdomFile.c_str());
+    hasImportedWisdom = true;
+    
+    // First try to create the plans from existing wisdom.  Only if that fails do we need to measure
+    // them, and then save the new wisdom.
+    
+    forwardFFT = fftwf_plan_dft_r2c_3d(gridx, gridy, gridz, realGrid, complexGrid, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+    backwardFFT = fftwf_plan_dft_c2r_3d(gridx, gridy, gridz, complexGrid, realGrid, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+    bool createdNewPlans = false;
+    if (forwardFFT == NULL) {
+        forwardFFT = fftwf_plan_dft_r2c_3d(gridx, gridy, gridz, realGrid, complexGrid, FFTW_MEASURE);
+        createdNewPlans = true;
+    }
+    if (backwardFFT == NULL) {
+        backwardFFT = fftwf_plan_dft_c2r_3d(gridx, gridy, gridz, complexGrid, realGrid, FFTW_MEASURE);
+        createdNewPlans = true;
+    }
     hasCreatedPlan = true;
+    if (createdNewPlans && wisdomFile.size() > 0)
+        saveWisdom(wisdomFile);
     
     // Initialize the b-spline moduli.
 
@@ -500,11 +587,13 @@ void CpuCalcPmeReciprocalForceKernel::runMainThread() {
             for (int i = 0; i < (int) threadEnergy.size(); i++)
                 energy += threadEnergy[i];
         }
-        threads.resumeThreads(); // Signal threads to perform reciprocal convolution.
-        threads.waitForThreads();
-        fftwf_execute_dft_c2r(backwardFFT, complexGrid, realGrid);
-        threads.resumeThreads(); // Signal threads to interpolate forces.
-        threads.waitForThreads();
+        if (includeForces) {
+            threads.resumeThreads(); // Signal threads to perform reciprocal convolution.
+            threads.waitForThreads();
+            fftwf_execute_dft_c2r(backwardFFT, complexGrid, realGrid);
+            threads.resumeThreads(); // Signal threads to interpolate forces.
+            threads.waitForThreads();
+        }
         isFinished = true;
         lastBoxVectors[0] = periodicBoxVectors[0];
         lastBoxVectors[1] = periodicBoxVectors[1];
@@ -540,16 +629,23 @@ void CpuCalcPmeReciprocalForceKernel::runWorkerThread(ThreadPool& threads, int i
         threadEnergy[index] = reciprocalEnergy(gridxStart, gridxEnd, complexGrid, gridx, gridy, gridz, alpha, bsplineModuli, periodicBoxVectors, recipBoxVectors);
         threads.syncThreads();
     }
+    if (!includeForces)
+        return;
     reciprocalConvolution(gridxStart, gridxEnd, complexGrid, gridx, gridy, gridz, recipEterm);
     threads.syncThreads();
     interpolateForces(particleStart, particleEnd, posq, &force[0], realGrid, gridx, gridy, gridz, numParticles, periodicBoxVectors, recipBoxVectors);
 }
 
 void CpuCalcPmeReciprocalForceKernel::beginComputation(IO& io, const Vec3* periodicBoxVectors, bool includeEnergy) {
+    beginComputation(io, periodicBoxVectors, true, includeEnergy);
+}
+
+void CpuCalcPmeReciprocalForceKernel::beginComputation(IO& io, const Vec3* periodicBoxVectors, bool includeForces, bool includeEnergy) {
     this->io = &io;
     this->periodicBoxVectors[0] = periodicBoxVectors[0];
     this->periodicBoxVectors[1] = periodicBoxVectors[1];
     this->periodicBoxVectors[2] = periodicBoxVectors[2];
+    this->includeForces = includeForces;
     this->includeEnergy = includeEnergy;
     energy = 0.0;
 
@@ -575,7 +671,8 @@ double CpuCalcPmeReciprocalForceKernel::finishComputation(IO& io) {
         pthread_cond_wait(&endCondition, &lock);
     }
     pthread_mutex_unlock(&lock);
-    io.setForce(&force[0]);
+    if (includeForces)
+        io.setForce(&force[0]);
     return energy;
 }
 
@@ -72,6 +72,15 @@ public:
      * @param includeEnergy       true if potential energy should be computed
      */
     void beginComputation(IO& io, const Vec3* periodicBoxVectors, bool includeEnergy);
+    /**
+     * Begin computing the energy, and optionally the force.
+     * 
+     * @param io                  an object that coordinates data transfer
+     * @param periodicBoxVectors  the vectors defining the periodic box (measured in nm)
+     * @param includeForces       true if forces should be computed
+     * @param includeEnergy       true if potential energy should be computed
+     */
+    void beginComputation(IO& io, const Vec3* periodicBoxVectors, bool includeForces, bool includeEnergy);
     /**
      * Finish computing the force and energy.
      * 
@@ -99,6 +108,7 @@ private:
     int findFFTDimension(int minimum, bool isZ);
     static bool hasInitializedThreads;
     static int numThreads;
+    static bool hasImportedWisdom;
     int gridx, gridy, gridz, numParticles;
     double alpha;
     bool hasCreatedPlan, isFinished, isDeleted;
@@ -120,7 +130,7 @@ private:
     float energy;
     float* posq;
     Vec3 periodicBoxVectors[3], recipBoxVectors[3];
-    bool includeEnergy;
+    bool includeForces, includeEnergy;
 };
 
 } // namespace OpenMM
@@ -0,0 +1,136 @@
+#ifndef OPENMM_BINARY_SERIALIZER_H_
+#define OPENMM_BINARY_SERIALIZER_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2016 Stanford University and the Authors.      *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/serialization/SerializationNode.h"
+#include "openmm/serialization/SerializationProxy.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/internal/windowsExport.h"
+#include <iosfwd>
+
+namespace OpenMM {
+
+/**
+ * BinarySerializer is used for serializing objects in a compact binary format, and for reconstructing
+ * them again.  It has the same interface as XmlSerializer and uses the same SerializationProxy classes,
+ * so an object serialized with one and deserialized with the other is reconstructed identically.
+ * Writing and reading binary data is much faster than formatting and parsing XML, which matters for
+ * very large Systems.
+ *
+ * The format stores the names of nodes and properties in a table at the start of the stream, so
+ * data written by one version of a proxy can still be read if properties are later added or removed.
+ * Consecutive child nodes that have the same name and the same set of properties (for example, one
+ * node per particle) are stored together as a table with one column per property.  Array properties
+ * are stored as raw binary values, so they are written and read with a single memory copy.
+ *
+ * The data is independent of the computer that wrote it.  Every int is stored as 4 bytes in two's
+ * complement form, and every double as an 8 byte IEEE 754 value, both in little endian byte order
+ * (the native order of x86 and most ARM processors; other processors convert as they read and write).
+ * A string is stored as an int length followed by its bytes.  The stream consists of:
+ *
+ * <ol>
+ * <li>The magic string "OpenMM Binary Serialization\n", including its terminating zero byte.</li>
+ * <li>The format version (an int, currently 1).</li>
+ * <li>The number of strings in the name table (an int), followed by the strings.  Node and property
+ * names are stored elsewhere as indices into this table.</li>
+ * <li>The root node.</li>
+ * </ol>
+ *
+ * A node is stored as its name index, the number of properties and then (name index, value) for each
+ * one, the number of int array properties and then (name index, array) for each one, the same for
+ * double array properties, and finally the number of child groups followed by the groups.  A value is
+ * a type byte (0 = string, 1 = int, 2 = double) followed by the value, and an array is an int length
+ * followed by the elements.  A child group is a byte that is 0 for a single node, followed by that node,
+ * or 1 for a table, followed by the name index of the rows, the number of rows, the number of
+ * properties, the name index of each property, and then for each property a type byte followed by
+ * that property's value in every row.
+ */
+
+class OPENMM_EXPORT BinarySerializer {
+public:
+    /**
+     * Serialize an object in binary format.
+     *
+     * @param object    the object to serialize
+     * @param rootName  the name to use for the root node
+     * @param stream    an output stream to write the data to.  It should be opened in binary mode.
+     */
+    template <class T>
+    static void serialize(const T* object, const std::string& rootName, std::ostream& stream) {
+        const SerializationProxy& proxy = SerializationProxy::getProxy(typeid(*object));
+        SerializationNode node;
+        node.setName(rootName);
+        proxy.serialize(object, node);
+        if (node.hasProperty("type"))
+            throw OpenMMException(proxy.getTypeName()+" created node with reserved property 'type'");
+        node.setStringProperty("type", proxy.getTypeName());
+        serialize(node, stream);
+    }
+    /**
+     * Reconstruct an object that has been serialized in binary format.
+     *
+     * @param stream    an input stream to read the data from.  It should be opened in binary mode.
+     * @return a pointer to the newly created object.  The caller assumes ownership of the object.
+     */
+    template <class T>
+    static T* deserialize(std::istream& stream) {
+        return reinterpret_cast<T*>(deserializeStream(stream));
+    }
+    /**
+     * Clone an object by first serializing it, then deserializing it again.  This method constructs the
+     * new object directly from the SerializationNodes without first converting them to binary data.
+     */
+    template <class T>
+    static T* clone(const T& object) {
+        const SerializationProxy& proxy = SerializationProxy::getProxy(typeid(object));
+        SerializationNode node;
+        proxy.serialize(&object, node);
+        return reinterpret_cast<T*>(proxy.deserialize(node));
+    }
+    /**
+     * Write a tree of SerializationNodes to a stream in binary format.
+     */
+    static void serialize(const SerializationNode& node, std::ostream& stream);
+    /**
+     * Read a tree of SerializationNodes that was written by serialize().
+     */
+    static void deserialize(std::istream& stream, SerializationNode& node);
+private:
+    class Writer;
+    class Reader;
+    static void* deserializeStream(std::istream& stream);
+};
+
+} // namespace OpenMM
+
+#endif /*OPENMM_BINARY_SERIALIZER_H_*/
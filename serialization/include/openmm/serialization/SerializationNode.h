@@ -62,6 +62,11 @@ namespace OpenMM {
  * property as a string.  Similarly, you can use setStringProperty() to specify a property and then access it
  * using getIntProperty().  This will produce the expected result if the original value was, in fact, the
  * string representation of an int, but if the original string was non-numeric, the result is undefined.
+ *
+ * A node can also store "array properties", each of which is a vector of ints or doubles.  These are much
+ * more efficient than creating a separate child node for every element of a large data set (one node per
+ * particle, for example), and are the preferred way of storing per-particle or per-bond parameters.  Array
+ * properties are stored separately from ordinary properties, and no conversion between types is performed.
  */
 
 class OPENMM_EXPORT SerializationNode {
@@ -196,6 +201,48 @@ public:
      * @param value  the value to set for the property
      */
     SerializationNode& setDoubleProperty(const std::string& name, double value);
+    /**
+     * Get a map containing all of this node's int array properties.
+     */
+    const std::map<std::string, std::vector<int> >& getIntArrayProperties() const;
+    /**
+     * Get a map containing all of this node's double array properties.
+     */
+    const std::map<std::string, std::vector<double> >& getDoubleArrayProperties() const;
+    /**
+     * Determine whether this node has an array property (of either type) with a particular name.
+     *
+     * @param the name of the array property to check for
+     */
+    bool hasArrayProperty(const std::string& name) const;
+    /**
+     * Get the int array property with a particular name.  If there is no int array property with
+     * the specified name, an exception is thrown.
+     *
+     * @param name   the name of the property to get
+     */
+    const std::vector<int>& getIntArrayProperty(const std::string& name) const;
+    /**
+     * Set the value of an int array property.
+     *
+     * @param name    the name of the property to set
+     * @param values  the values to set for the property
+     */
+    SerializationNode& setIntArrayProperty(const std::string& name, const std::vector<int>& values);
+    /**
+     * Get the double array property with a particular name.  If there is no double array property with
+     * the specified name, an exception is thrown.
+     *
+     * @param name   the name of the property to get
+     */
+    const std::vector<double>& getDoubleArrayProperty(const std::string& name) const;
+    /**
+     * Set the value of a double array property.
+     *
+     * @param name    the name of the property to set
+     * @param values  the values to set for the property
+     */
+    SerializationNode& setDoubleArrayProperty(const std::string& name, const std::vector<double>& values);
     /**
      * Create a new child node
      *
@@ -244,6 +291,8 @@ private:
     std::string name;
     std::vector<SerializationNode> children;
     std::map<std::string, std::string> properties;
+    std::map<std::string, std::vector<int> > intArrays;
+    std::map<std::string, std::vector<double> > doubleArrays;
 };
 
 } // namespace OpenMM
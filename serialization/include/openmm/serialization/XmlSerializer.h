@@ -91,6 +91,7 @@ private:
     static void serialize(const SerializationNode& node, std::ostream& stream);
     static void* deserializeStream(std::istream& stream);
     static void encodeNode(const SerializationNode& node, std::ostream& stream, int depth);
+    static void encodeArray(const std::string& element, const std::string& name, const std::string& text, std::ostream& stream, int depth);
 };
 
 } // namespace OpenMM
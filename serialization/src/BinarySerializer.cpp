@@ -0,0 +1,451 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2016 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/serialization/BinarySerializer.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+using namespace OpenMM;
+using namespace std;
+
+extern "C" char* g_fmt(char*, double);
+extern "C" double strtod2(const char* s00, char** se);
+
+const static char MAGIC_BYTES[] = "OpenMM Binary Serialization\n";
+const static int FORMAT_VERSION = 1;
+
+/**
+ * Each group of children begins with one of these values, identifying how it is stored.
+ */
+enum GroupType {SINGLE_NODE = 0, NODE_TABLE = 1};
+
+/**
+ * Each property value (or column of a table) begins with one of these values, identifying how it is stored.
+ * SerializationNode stores all properties as strings, so a value is only stored as an int or double if
+ * converting it back with setIntProperty() or setDoubleProperty() reproduces exactly the same string.
+ */
+enum ValueType {STRING_VALUE = 0, INT_VALUE = 1, DOUBLE_VALUE = 2};
+
+/**
+ * All numbers are stored in little endian byte order, so data can be exchanged between computers.
+ */
+static bool isLittleEndian() {
+    const int one = 1;
+    return (*reinterpret_cast<const char*>(&one) == 1);
+}
+
+/**
+ * Copy an array of values between native and little endian byte order.  On a little endian processor
+ * this is a plain memory copy.  Otherwise the bytes of each value are reversed.
+ */
+static void copyLittleEndian(char* dest, const char* src, size_t numValues, size_t valueSize) {
+    if (isLittleEndian()) {
+        memcpy(dest, src, numValues*valueSize);
+        return;
+    }
+    for (size_t i = 0; i < numValues; i++)
+        for (size_t j = 0; j < valueSize; j++)
+            dest[i*valueSize+j] = src[i*valueSize+valueSize-1-j];
+}
+
+/**
+ * This class writes a tree of SerializationNodes to a stream.
+ */
+class BinarySerializer::Writer {
+public:
+    Writer(ostream& stream) : stream(stream) {
+    }
+    void write(const SerializationNode& root) {
+        collectStrings(root);
+        buffer.append(MAGIC_BYTES, sizeof(MAGIC_BYTES));
+        writeInt(FORMAT_VERSION);
+        writeInt(strings.size());
+        for (int i = 0; i < (int) strings.size(); i++)
+            writeString(strings[i]);
+        writeNode(root);
+        flush();
+        stream.flush();
+    }
+private:
+    /**
+     * Build the table of node and property names.
+     */
+    void collectStrings(const SerializationNode& node) {
+        addString(node.getName());
+        const map<string, string>& properties = node.getProperties();
+        for (map<string, string>::const_iterator iter = properties.begin(); iter != properties.end(); ++iter)
+            addString(iter->first);
+        const map<string, vector<int> >& intArrays = node.getIntArrayProperties();
+        for (map<string, vector<int> >::const_iterator iter = intArrays.begin(); iter != intArrays.end(); ++iter)
+            addString(iter->first);
+        const map<string, vector<double> >& doubleArrays = node.getDoubleArrayProperties();
+        for (map<string, vector<double> >::const_iterator iter = doubleArrays.begin(); iter != doubleArrays.end(); ++iter)
+            addString(iter->first);
+        const vector<SerializationNode>& children = node.getChildren();
+        for (int i = 0; i < (int) children.size(); i++)
+            collectStrings(children[i]);
+    }
+    void addString(const string& str) {
+        if (stringIndex.find(str) == stringIndex.end()) {
+            stringIndex[str] = strings.size();
+            strings.push_back(str);
+        }
+    }
+    /**
+     * Determine whether two nodes can be stored in the same table: neither one has children or array
+     * properties, and they have the same name and the same set of properties.
+     */
+    static bool isSameLayout(const SerializationNode& node1, const SerializationNode& node2) {
+        if (!isLeaf(node1) || !isLeaf(node2) || node1.getName() != node2.getName())
+            return false;
+        const map<string, string>& properties1 = node1.getProperties();
+        const map<string, string>& properties2 = node2.getProperties();
+        if (properties1.size() != properties2.size())
+            return false;
+        for (map<string, string>::const_iterator iter1 = properties1.begin(), iter2 = properties2.begin(); iter1 != properties1.end(); ++iter1, ++iter2)
+            if (iter1->first != iter2->first)
+                return false;
+        return true;
+    }
+    static bool isLeaf(const SerializationNode& node) {
+        return (node.getChildren().size() == 0 && node.getIntArrayProperties().size() == 0 && node.getDoubleArrayProperties().size() == 0);
+    }
+    /**
+     * Determine whether a property value can be stored as an int without changing it.
+     */
+    static bool isIntValue(const string& value, int& intValue) {
+        if (value.size() == 0 || value.size() > 11)
+            return false;
+        char* end;
+        errno = 0;
+        long longValue = strtol(value.c_str(), &end, 10);
+        if (errno != 0 || *end != 0 || longValue != (int) longValue)
+            return false;
+        intValue = (int) longValue;
+        stringstream formatted;
+        formatted << intValue;
+        return (formatted.str() == value);
+    }
+    /**
+     * Determine whether a property value can be stored as a double without changing it.
+     */
+    static bool isDoubleValue(const string& value, double& doubleValue) {
+        if (value.size() == 0 || value.size() > 30)
+            return false;
+        char buffer[32];
+        char* end;
+        doubleValue = strtod2(value.c_str(), &end);
+        return (*end == 0 && value == g_fmt(buffer, doubleValue));
+    }
+    void writeValue(const string& value) {
+        int intValue;
+        double doubleValue;
+        if (isIntValue(value, intValue)) {
+            buffer.push_back((char) INT_VALUE);
+            writeInt(intValue);
+        }
+        else if (isDoubleValue(value, doubleValue)) {
+            buffer.push_back((char) DOUBLE_VALUE);
+            writeDouble(doubleValue);
+        }
+        else {
+            buffer.push_back((char) STRING_VALUE);
+            writeString(value);
+        }
+    }
+    void writeNode(const SerializationNode& node) {
+        writeInt(stringIndex[node.getName()]);
+        const map<string, string>& properties = node.getProperties();
+        writeInt(properties.size());
+        for (map<string, string>::const_iterator iter = properties.begin(); iter != properties.end(); ++iter) {
+            writeInt(stringIndex[iter->first]);
+            writeValue(iter->second);
+        }
+        const map<string, vector<int> >& intArrays = node.getIntArrayProperties();
+        writeInt(intArrays.size());
+        for (map<string, vector<int> >::const_iterator iter = intArrays.begin(); iter != intArrays.end(); ++iter) {
+            writeInt(stringIndex[iter->first]);
+            writeArray(iter->second);
+        }
+        const map<string, vector<double> >& doubleArrays = node.getDoubleArrayProperties();
+        writeInt(doubleArrays.size());
+        for (map<string, vector<double> >::const_iterator iter = doubleArrays.begin(); iter != doubleArrays.end(); ++iter) {
+            writeInt(stringIndex[iter->first]);
+            writeArray(iter->second);
+        }
+        
+        // Divide the children into groups of consecutive nodes with the same layout.
+        
+        const vector<SerializationNode>& children = node.getChildren();
+        vector<int> groupStart;
+        for (int i = 0; i < (int) children.size(); i++)
+            if (i == 0 || !isSameLayout(children[i-1], children[i]))
+                groupStart.push_back(i);
+        groupStart.push_back(children.size());
+        writeInt(groupStart.size()-1);
+        for (int group = 0; group < (int) groupStart.size()-1; group++) {
+            int start = groupStart[group];
+            int numRows = groupStart[group+1]-start;
+            if (numRows == 1) {
+                buffer.push_back((char) SINGLE_NODE);
+                writeNode(children[start]);
+                continue;
+            }
+            
+            // Write the group as a table, storing all values for each property together.  Each column is
+            // stored with the most compact type that can hold every value in it.
+            
+            buffer.push_back((char) NODE_TABLE);
+            writeInt(stringIndex[children[start].getName()]);
+            writeInt(numRows);
+            const map<string, string>& keys = children[start].getProperties();
+            writeInt(keys.size());
+            for (map<string, string>::const_iterator iter = keys.begin(); iter != keys.end(); ++iter)
+                writeInt(stringIndex[iter->first]);
+            vector<map<string, string>::const_iterator> rows(numRows);
+            for (int i = 0; i < numRows; i++)
+                rows[i] = children[start+i].getProperties().begin();
+            vector<int> intValues(numRows);
+            vector<double> doubleValues(numRows);
+            for (int column = 0; column < (int) keys.size(); column++) {
+                ValueType type = INT_VALUE;
+                for (int i = 0; i < numRows && type == INT_VALUE; i++)
+                    if (!isIntValue(rows[i]->second, intValues[i]))
+                        type = DOUBLE_VALUE;
+                for (int i = 0; i < numRows && type == DOUBLE_VALUE; i++)
+                    if (!isDoubleValue(rows[i]->second, doubleValues[i]))
+                        type = STRING_VALUE;
+                buffer.push_back((char) type);
+                for (int i = 0; i < numRows; i++) {
+                    if (type == INT_VALUE)
+                        writeInt(intValues[i]);
+                    else if (type == DOUBLE_VALUE)
+                        writeDouble(doubleValues[i]);
+                    else
+                        writeString(rows[i]->second);
+                    ++rows[i];
+                }
+            }
+        }
+        if (buffer.size() > (1<<20))
+            flush();
+    }
+    void writeInt(int value) {
+        char bytes[sizeof(int)];
+        copyLittleEndian(bytes, (char*) &value, 1, sizeof(int));
+        buffer.append(bytes, sizeof(int));
+    }
+    void writeDouble(double value) {
+        char bytes[sizeof(double)];
+        copyLittleEndian(bytes, (char*) &value, 1, sizeof(double));
+        buffer.append(bytes, sizeof(double));
+    }
+    void writeString(const string& str) {
+        writeInt(str.size());
+        buffer.append(str);
+    }
+    template <class T>
+    void writeArray(const vector<T>& values) {
+        writeInt(values.size());
+        if (values.size() == 0)
+            return;
+        size_t start = buffer.size();
+        buffer.resize(start+values.size()*sizeof(T));
+        copyLittleEndian(&buffer[start], (const char*) &values[0], values.size(), sizeof(T));
+    }
+    void flush() {
+        stream.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+    ostream& stream;
+    string buffer;
+    vector<string> strings;
+    map<string, int> stringIndex;
+};
+
+/**
+ * This class reads a tree of SerializationNodes from a stream.
+ */
+class BinarySerializer::Reader {
+public:
+    Reader(istream& stream) : position(0) {
+        stringstream contents;
+        contents << stream.rdbuf();
+        data = contents.str();
+    }
+    void read(SerializationNode& root) {
+        if (data.size() < sizeof(MAGIC_BYTES) || memcmp(data.data(), MAGIC_BYTES, sizeof(MAGIC_BYTES)) != 0)
+            throw OpenMMException("BinarySerializer: Stream does not contain binary serialized data");
+        position = sizeof(MAGIC_BYTES);
+        if (readInt() != FORMAT_VERSION)
+            throw OpenMMException("BinarySerializer: Data was written with an unsupported version of the format");
+        int numStrings = readInt();
+        strings.resize(numStrings);
+        for (int i = 0; i < numStrings; i++)
+            readString(strings[i]);
+        readNode(root);
+    }
+private:
+    void readNode(SerializationNode& node) {
+        node.setName(lookupString(readInt()));
+        int numProperties = readInt();
+        string value;
+        for (int i = 0; i < numProperties; i++) {
+            const string& key = lookupString(readInt());
+            readValue(node, key, readValueType(), value);
+        }
+        int numIntArrays = readInt();
+        vector<int> intValues;
+        for (int i = 0; i < numIntArrays; i++) {
+            const string& key = lookupString(readInt());
+            readArray(intValues);
+            node.setIntArrayProperty(key, intValues);
+        }
+        int numDoubleArrays = readInt();
+        vector<double> doubleValues;
+        for (int i = 0; i < numDoubleArrays; i++) {
+            const string& key = lookupString(readInt());
+            readArray(doubleValues);
+            node.setDoubleArrayProperty(key, doubleValues);
+        }
+        int numGroups = readInt();
+        for (int group = 0; group < numGroups; group++) {
+            checkAvailable(1);
+            char type = data[position++];
+            if (type == SINGLE_NODE) {
+                SerializationNode& child = node.createChildNode("");
+                readNode(child);
+            }
+            else if (type == NODE_TABLE) {
+                const string& name = lookupString(readInt());
+                int numRows = readInt();
+                int numKeys = readInt();
+                vector<int> keys(numKeys);
+                for (int i = 0; i < numKeys; i++)
+                    keys[i] = readInt();
+                vector<SerializationNode>& children = node.getChildren();
+                int start = children.size();
+                children.resize(start+numRows);
+                for (int i = 0; i < numRows; i++)
+                    children[start+i].setName(name);
+                for (int column = 0; column < numKeys; column++) {
+                    const string& key = lookupString(keys[column]);
+                    ValueType type = readValueType();
+                    for (int i = 0; i < numRows; i++)
+                        readValue(children[start+i], key, type, value);
+                }
+            }
+            else
+                throw OpenMMException("BinarySerializer: Stream contains invalid data");
+        }
+    }
+    ValueType readValueType() {
+        checkAvailable(1);
+        char type = data[position++];
+        if (type != STRING_VALUE && type != INT_VALUE && type != DOUBLE_VALUE)
+            throw OpenMMException("BinarySerializer: Stream contains invalid data");
+        return (ValueType) type;
+    }
+    void readValue(SerializationNode& node, const string& key, ValueType type, string& value) {
+        if (type == INT_VALUE)
+            node.setIntProperty(key, readInt());
+        else if (type == DOUBLE_VALUE)
+            node.setDoubleProperty(key, readDouble());
+        else {
+            readString(value);
+            node.setStringProperty(key, value);
+        }
+    }
+    void checkAvailable(size_t bytes) {
+        if (position+bytes > data.size())
+            throw OpenMMException("BinarySerializer: Unexpected end of stream");
+    }
+    int readInt() {
+        checkAvailable(sizeof(int));
+        int value;
+        copyLittleEndian((char*) &value, &data[position], 1, sizeof(int));
+        position += sizeof(int);
+        return value;
+    }
+    double readDouble() {
+        checkAvailable(sizeof(double));
+        double value;
+        copyLittleEndian((char*) &value, &data[position], 1, sizeof(double));
+        position += sizeof(double);
+        return value;
+    }
+    void readString(string& str) {
+        int length = readInt();
+        if (length < 0)
+            throw OpenMMException("BinarySerializer: Stream contains invalid data");
+        checkAvailable(length);
+        str.assign(data, position, length);
+        position += length;
+    }
+    template <class T>
+    void readArray(vector<T>& values) {
+        int length = readInt();
+        if (length < 0)
+            throw OpenMMException("BinarySerializer: Stream contains invalid data");
+        checkAvailable(length*sizeof(T));
+        values.resize(length);
+        if (length > 0)
+            copyLittleEndian((char*) &values[0], &data[position], length, sizeof(T));
+        position += length*sizeof(T);
+    }
+    const string& lookupString(int index) {
+        if (index < 0 || index >= (int) strings.size())
+            throw OpenMMException("BinarySerializer: Stream contains invalid data");
+        return strings[index];
+    }
+    string data;
+    size_t position;
+    vector<string> strings;
+};
+
+void BinarySerializer::serialize(const SerializationNode& node, ostream& stream) {
+    Writer(stream).write(node);
+}
+
+void BinarySerializer::deserialize(istream& stream, SerializationNode& node) {
+    Reader(stream).read(node);
+}
+
+void* BinarySerializer::deserializeStream(istream& stream) {
+    SerializationNode root;
+    deserialize(stream, root);
+    const SerializationProxy& proxy = SerializationProxy::getProxy(root.getStringProperty("type"));
+    return proxy.deserialize(root);
+}
@@ -42,7 +42,7 @@ NonbondedForceProxy::NonbondedForceProxy() : SerializationProxy("NonbondedForce"
 }
 
 void NonbondedForceProxy::serialize(const void* object, SerializationNode& node) const {
-    node.setIntProperty("version", 1);
+    node.setIntProperty("version", 2);
     const NonbondedForce& force = *reinterpret_cast<const NonbondedForce*>(object);
     node.setIntProperty("forceGroup", force.getForceGroup());
     node.setIntProperty("method", (int) force.getNonbondedMethod());
@@ -60,23 +60,23 @@ void NonbondedForceProxy::serialize(const void* object, SerializationNode& node)
     node.setIntProperty("ny", ny);
     node.setIntProperty("nz", nz);
     node.setIntProperty("recipForceGroup", force.getReciprocalSpaceForceGroup());
-    SerializationNode& particles = node.createChildNode("Particles");
-    for (int i = 0; i < force.getNumParticles(); i++) {
-        double charge, sigma, epsilon;
-        force.getParticleParameters(i, charge, sigma, epsilon);
-        particles.createChildNode("Particle").setDoubleProperty("q", charge).setDoubleProperty("sig", sigma).setDoubleProperty("eps", epsilon);
-    }
-    SerializationNode& exceptions = node.createChildNode("Exceptions");
-    for (int i = 0; i < force.getNumExceptions(); i++) {
-        int particle1, particle2;
-        double chargeProd, sigma, epsilon;
-        force.getExceptionParameters(i, particle1, particle2, chargeProd, sigma, epsilon);
-        exceptions.createChildNode("Exception").setIntProperty("p1", particle1).setIntProperty("p2", particle2).setDoubleProperty("q", chargeProd).setDoubleProperty("sig", sigma).setDoubleProperty("eps", epsilon);
-    }
+    int numParticles = force.getNumParticles();
+    vector<double> charge(numParticles), sigma(numParticles), epsilon(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        force.getParticleParameters(i, charge[i], sigma[i], epsilon[i]);
+    node.createChildNode("Particles").setDoubleArrayProperty("q", charge).setDoubleArrayProperty("sig", sigma).setDoubleArrayProperty("eps", epsilon);
+    int numExceptions = force.getNumExceptions();
+    vector<int> particle1(numExceptions), particle2(numExceptions);
+    vector<double> chargeProd(numExceptions), exceptionSigma(numExceptions), exceptionEpsilon(numExceptions);
+    for (int i = 0; i < numExceptions; i++)
+        force.getExceptionParameters(i, particle1[i], particle2[i], chargeProd[i], exceptionSigma[i], exceptionEpsilon[i]);
+    node.createChildNode("Exceptions").setIntArrayProperty("p1", particle1).setIntArrayProperty("p2", particle2).
+            setDoubleArrayProperty("q", chargeProd).setDoubleArrayProperty("sig", exceptionSigma).setDoubleArrayProperty("eps", exceptionEpsilon);
 }
 
 void* NonbondedForceProxy::deserialize(const SerializationNode& node) const {
-    if (node.getIntProperty("version") != 1)
+    int version = node.getIntProperty("version");
+    if (version < 1 || version > 2)
         throw OpenMMException("Unsupported version number");
     NonbondedForce* force = new NonbondedForce();
     try {
@@ -95,14 +95,35 @@ void* NonbondedForceProxy::deserialize(const SerializationNode& node) const {
         force->setPMEParameters(alpha, nx, ny, nz);
         force->setReciprocalSpaceForceGroup(node.getIntProperty("recipForceGroup", -1));
         const SerializationNode& particles = node.getChildNode("Particles");
-        for (int i = 0; i < (int) particles.getChildren().size(); i++) {
-            const SerializationNode& particle = particles.getChildren()[i];
-            force->addParticle(particle.getDoubleProperty("q"), particle.getDoubleProperty("sig"), particle.getDoubleProperty("eps"));
-        }
         const SerializationNode& exceptions = node.getChildNode("Exceptions");
-        for (int i = 0; i < (int) exceptions.getChildren().size(); i++) {
-            const SerializationNode& exception = exceptions.getChildren()[i];
-            force->addException(exception.getIntProperty("p1"), exception.getIntProperty("p2"), exception.getDoubleProperty("q"), exception.getDoubleProperty("sig"), exception.getDoubleProperty("eps"));
+        if (version == 1) {
+            for (int i = 0; i < (int) particles.getChildren().size(); i++) {
+                const SerializationNode& particle = particles.getChildren()[i];
+                force->addParticle(particle.getDoubleProperty("q"), particle.getDoubleProperty("sig"), particle.getDoubleProperty("eps"));
+            }
+            for (int i = 0; i < (int) exceptions.getChildren().size(); i++) {
+                const SerializationNode& exception = exceptions.getChildren()[i];
+                force->addException(exception.getIntProperty("p1"), exception.getIntProperty("p2"), exception.getDoubleProperty("q"), exception.getDoubleProperty("sig"), exception.getDoubleProperty("eps"));
+            }
+        }
+        else {
+            const vector<double>& charge = particles.getDoubleArrayProperty("q");
+            const vector<double>& sigma = particles.getDoubleArrayProperty("sig");
+            const vector<double>& epsilon = particles.getDoubleArrayProperty("eps");
+            if (sigma.size() != charge.size() || epsilon.size() != charge.size())
+                throw OpenMMException("NonbondedForceProxy: Inconsistent number of particle parameters");
+            for (int i = 0; i < (int) charge.size(); i++)
+                force->addParticle(charge[i], sigma[i], epsilon[i]);
+            const vector<int>& particle1 = exceptions.getIntArrayProperty("p1");
+            const vector<int>& particle2 = exceptions.getIntArrayProperty("p2");
+            const vector<double>& chargeProd = exceptions.getDoubleArrayProperty("q");
+            const vector<double>& exceptionSigma = exceptions.getDoubleArrayProperty("sig");
+            const vector<double>& exceptionEpsilon = exceptions.getDoubleArrayProperty("eps");
+            int numExceptions = particle1.size();
+            if (particle2.size() != particle1.size() || chargeProd.size() != particle1.size() || exceptionSigma.size() != particle1.size() || exceptionEpsilon.size() != particle1.size())
+                throw OpenMMException("NonbondedForceProxy: Inconsistent number of exception parameters");
+            for (int i = 0; i < numExceptions; i++)
+                force->addException(particle1[i], particle2[i], chargeProd[i], exceptionSigma[i], exceptionEpsilon[i]);
         }
     }
     catch (...) {
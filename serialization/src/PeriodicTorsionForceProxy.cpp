@@ -42,29 +42,47 @@ PeriodicTorsionForceProxy::PeriodicTorsionForceProxy() : SerializationProxy("Per
 }
 
 void PeriodicTorsionForceProxy::serialize(const void* object, SerializationNode& node) const {
-    node.setIntProperty("version", 1);
+    node.setIntProperty("version", 2);
     const PeriodicTorsionForce& force = *reinterpret_cast<const PeriodicTorsionForce*>(object);
     node.setIntProperty("forceGroup", force.getForceGroup());
-    SerializationNode& torsions = node.createChildNode("Torsions");
-    for (int i = 0; i < force.getNumTorsions(); i++) {
-        int particle1, particle2, particle3, particle4, periodicity;
-        double phase, k;
-        force.getTorsionParameters(i, particle1, particle2, particle3, particle4, periodicity, phase, k);
-        torsions.createChildNode("Torsion").setIntProperty("p1", particle1).setIntProperty("p2", particle2).setIntProperty("p3", particle3).setIntProperty("p4", particle4).setIntProperty("periodicity", periodicity).setDoubleProperty("phase", phase).setDoubleProperty("k", k);
-    }
+    int numTorsions = force.getNumTorsions();
+    vector<int> particle1(numTorsions), particle2(numTorsions), particle3(numTorsions), particle4(numTorsions), periodicity(numTorsions);
+    vector<double> phase(numTorsions), k(numTorsions);
+    for (int i = 0; i < numTorsions; i++)
+        force.getTorsionParameters(i, particle1[i], particle2[i], particle3[i], particle4[i], periodicity[i], phase[i], k[i]);
+    node.createChildNode("Torsions").setIntArrayProperty("p1", particle1).setIntArrayProperty("p2", particle2).setIntArrayProperty("p3", particle3).setIntArrayProperty("p4", particle4).
+            setIntArrayProperty("periodicity", periodicity).setDoubleArrayProperty("phase", phase).setDoubleArrayProperty("k", k);
 }
 
 void* PeriodicTorsionForceProxy::deserialize(const SerializationNode& node) const {
-    if (node.getIntProperty("version") != 1)
+    int version = node.getIntProperty("version");
+    if (version < 1 || version > 2)
         throw OpenMMException("Unsupported version number");
     PeriodicTorsionForce* force = new PeriodicTorsionForce();
     try {
         force->setForceGroup(node.getIntProperty("forceGroup", 0));
         const SerializationNode& torsions = node.getChildNode("Torsions");
-        for (int i = 0; i < (int) torsions.getChildren().size(); i++) {
-            const SerializationNode& torsion = torsions.getChildren()[i];
-            force->addTorsion(torsion.getIntProperty("p1"), torsion.getIntProperty("p2"), torsion.getIntProperty("p3"), torsion.getIntProperty("p4"),
-                    torsion.getIntProperty("periodicity"), torsion.getDoubleProperty("phase"), torsion.getDoubleProperty("k"));
+        if (version == 1) {
+            for (int i = 0; i < (int) torsions.getChildren().size(); i++) {
+                const SerializationNode& torsion = torsions.getChildren()[i];
+                force->addTorsion(torsion.getIntProperty("p1"), torsion.getIntProperty("p2"), torsion.getIntProperty("p3"), torsion.getIntProperty("p4"),
+                        torsion.getIntProperty("periodicity"), torsion.getDoubleProperty("phase"), torsion.getDoubleProperty("k"));
+            }
+        }
+        else {
+            const vector<int>& particle1 = torsions.getIntArrayProperty("p1");
+            const vector<int>& particle2 = torsions.getIntArrayProperty("p2");
+            const vector<int>& particle3 = torsions.getIntArrayProperty("p3");
+            const vector<int>& particle4 = torsions.getIntArrayProperty("p4");
+            const vector<int>& periodicity = torsions.getIntArrayProperty("periodicity");
+            const vector<double>& phase = torsions.getDoubleArrayProperty("phase");
+            const vector<double>& k = torsions.getDoubleArrayProperty("k");
+            int numTorsions = particle1.size();
+            if (particle2.size() != particle1.size() || particle3.size() != particle1.size() || particle4.size() != particle1.size() ||
+                    periodicity.size() != particle1.size() || phase.size() != particle1.size() || k.size() != particle1.size())
+                throw OpenMMException("PeriodicTorsionForceProxy: Inconsistent number of torsion parameters");
+            for (int i = 0; i < numTorsions; i++)
+                force->addTorsion(particle1[i], particle2[i], particle3[i], particle4[i], periodicity[i], phase[i], k[i]);
         }
     }
     catch (...) {
@@ -42,30 +42,51 @@ RBTorsionForceProxy::RBTorsionForceProxy() : SerializationProxy("RBTorsionForce"
 }
 
 void RBTorsionForceProxy::serialize(const void* object, SerializationNode& node) const {
-    node.setIntProperty("version", 1);
+    node.setIntProperty("version", 2);
     const RBTorsionForce& force = *reinterpret_cast<const RBTorsionForce*>(object);
     node.setIntProperty("forceGroup", force.getForceGroup());
-    SerializationNode& torsions = node.createChildNode("Torsions");
-    for (int i = 0; i < force.getNumTorsions(); i++) {
-        int particle1, particle2, particle3, particle4;
-        double c0, c1, c2, c3, c4, c5;
-        force.getTorsionParameters(i, particle1, particle2, particle3, particle4, c0, c1, c2, c3, c4, c5);
-        torsions.createChildNode("Torsion").setIntProperty("p1", particle1).setIntProperty("p2", particle2).setIntProperty("p3", particle3).setIntProperty("p4", particle4).setDoubleProperty("c0", c0).setDoubleProperty("c1", c1).setDoubleProperty("c2", c2).setDoubleProperty("c3", c3).setDoubleProperty("c4", c4).setDoubleProperty("c5", c5);
-    }
+    int numTorsions = force.getNumTorsions();
+    vector<int> particle1(numTorsions), particle2(numTorsions), particle3(numTorsions), particle4(numTorsions);
+    vector<double> c0(numTorsions), c1(numTorsions), c2(numTorsions), c3(numTorsions), c4(numTorsions), c5(numTorsions);
+    for (int i = 0; i < numTorsions; i++)
+        force.getTorsionParameters(i, particle1[i], particle2[i], particle3[i], particle4[i], c0[i], c1[i], c2[i], c3[i], c4[i], c5[i]);
+    node.createChildNode("Torsions").setIntArrayProperty("p1", particle1).setIntArrayProperty("p2", particle2).setIntArrayProperty("p3", particle3).setIntArrayProperty("p4", particle4).
+            setDoubleArrayProperty("c0", c0).setDoubleArrayProperty("c1", c1).setDoubleArrayProperty("c2", c2).setDoubleArrayProperty("c3", c3).setDoubleArrayProperty("c4", c4).setDoubleArrayProperty("c5", c5);
 }
 
 void* RBTorsionForceProxy::deserialize(const SerializationNode& node) const {
-    if (node.getIntProperty("version") != 1)
+    int version = node.getIntProperty("version");
+    if (version < 1 || version > 2)
         throw OpenMMException("Unsupported version number");
     RBTorsionForce* force = new RBTorsionForce();
     try {
         force->setForceGroup(node.getIntProperty("forceGroup", 0));
         const SerializationNode& torsions = node.getChildNode("Torsions");
-        for (int i = 0; i < (int) torsions.getChildren().size(); i++) {
-            const SerializationNode& torsion = torsions.getChildren()[i];
-            force->addTorsion(torsion.getIntProperty("p1"), torsion.getIntProperty("p2"), torsion.getIntProperty("p3"), torsion.getIntProperty("p4"),
-                    torsion.getDoubleProperty("c0"), torsion.getDoubleProperty("c1"), torsion.getDoubleProperty("c2"),
-                    torsion.getDoubleProperty("c3"), torsion.getDoubleProperty("c4"), torsion.getDoubleProperty("c5"));
+        if (version == 1) {
+            for (int i = 0; i < (int) torsions.getChildren().size(); i++) {
+                const SerializationNode& torsion = torsions.getChildren()[i];
+                force->addTorsion(torsion.getIntProperty("p1"), torsion.getIntProperty("p2"), torsion.getIntProperty("p3"), torsion.getIntProperty("p4"),
+                        torsion.getDoubleProperty("c0"), torsion.getDoubleProperty("c1"), torsion.getDoubleProperty("c2"),
+                        torsion.getDoubleProperty("c3"), torsion.getDoubleProperty("c4"), torsion.getDoubleProperty("c5"));
+            }
+        }
+        else {
+            const vector<int>& particle1 = torsions.getIntArrayProperty("p1");
+            const vector<int>& particle2 = torsions.getIntArrayProperty("p2");
+            const vector<int>& particle3 = torsions.getIntArrayProperty("p3");
+            const vector<int>& particle4 = torsions.getIntArrayProperty("p4");
+            const vector<double>& c0 = torsions.getDoubleArrayProperty("c0");
+            const vector<double>& c1 = torsions.getDoubleArrayProperty("c1");
+            const vector<double>& c2 = torsions.getDoubleArrayProperty("c2");
+            const vector<double>& c3 = torsions.getDoubleArrayProperty("c3");
+            const vector<double>& c4 = torsions.getDoubleArrayProperty("c4");
+            const vector<double>& c5 = torsions.getDoubleArrayProperty("c5");
+            int numTorsions = particle1.size();
+            if (particle2.size() != particle1.size() || particle3.size() != particle1.size() || particle4.size() != particle1.size() || c0.size() != particle1.size() ||
+                    c1.size() != particle1.size() || c2.size() != particle1.size() || c3.size() != particle1.size() || c4.size() != particle1.size() || c5.size() != particle1.size())
+                throw OpenMMException("RBTorsionForceProxy: Inconsistent number of torsion parameters");
+            for (int i = 0; i < numTorsions; i++)
+                force->addTorsion(particle1[i], particle2[i], particle3[i], particle4[i], c0[i], c1[i], c2[i], c3[i], c4[i], c5[i]);
         }
     }
     catch (...) {
@@ -168,6 +168,42 @@ SerializationNode& SerializationNode::setDoubleProperty(const string& name, doub
     return *this;
 }
 
+const map<string, vector<int> >& SerializationNode::getIntArrayProperties() const {
+    return intArrays;
+}
+
+const map<string, vector<double> >& SerializationNode::getDoubleArrayProperties() const {
+    return doubleArrays;
+}
+
+bool SerializationNode::hasArrayProperty(const string& name) const {
+    return (intArrays.find(name) != intArrays.end() || doubleArrays.find(name) != doubleArrays.end());
+}
+
+const vector<int>& SerializationNode::getIntArrayProperty(const string& name) const {
+    map<string, vector<int> >::const_iterator iter = intArrays.find(name);
+    if (iter == intArrays.end())
+        throw OpenMMException("Unknown int array property '"+name+"' in node '"+getName()+"'");
+    return iter->second;
+}
+
+SerializationNode& SerializationNode::setIntArrayProperty(const string& name, const vector<int>& values) {
+    intArrays[name] = values;
+    return *this;
+}
+
+const vector<double>& SerializationNode::getDoubleArrayProperty(const string& name) const {
+    map<string, vector<double> >::const_iterator iter = doubleArrays.find(name);
+    if (iter == doubleArrays.end())
+        throw OpenMMException("Unknown double array property '"+name+"' in node '"+getName()+"'");
+    return iter->second;
+}
+
+SerializationNode& SerializationNode::setDoubleArrayProperty(const string& name, const vector<double>& values) {
+    doubleArrays[name] = values;
+    return *this;
+}
+
 SerializationNode& SerializationNode::createChildNode(const std::string& name) {
     children.push_back(SerializationNode());
     children.back().setName(name);
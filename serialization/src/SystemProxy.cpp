@@ -42,8 +42,59 @@ using namespace std;
 SystemProxy::SystemProxy() : SerializationProxy("System") {
 }
 
+/**
+ * Add a child node to a parent node describing a virtual site.
+ */
+static SerializationNode& serializeVirtualSite(const VirtualSite& vsite, SerializationNode& parent) {
+    if (typeid(vsite) == typeid(TwoParticleAverageSite)) {
+        const TwoParticleAverageSite& site = dynamic_cast<const TwoParticleAverageSite&>(vsite);
+        return parent.createChildNode("TwoParticleAverageSite").setIntProperty("p1", site.getParticle(0)).setIntProperty("p2", site.getParticle(1)).setDoubleProperty("w1", site.getWeight(0)).setDoubleProperty("w2", site.getWeight(1));
+    }
+    if (typeid(vsite) == typeid(ThreeParticleAverageSite)) {
+        const ThreeParticleAverageSite& site = dynamic_cast<const ThreeParticleAverageSite&>(vsite);
+        return parent.createChildNode("ThreeParticleAverageSite").setIntProperty("p1", site.getParticle(0)).setIntProperty("p2", site.getParticle(1)).setIntProperty("p3", site.getParticle(2)).setDoubleProperty("w1", site.getWeight(0)).setDoubleProperty("w2", site.getWeight(1)).setDoubleProperty("w3", site.getWeight(2));
+    }
+    if (typeid(vsite) == typeid(OutOfPlaneSite)) {
+        const OutOfPlaneSite& site = dynamic_cast<const OutOfPlaneSite&>(vsite);
+        return parent.createChildNode("OutOfPlaneSite").setIntProperty("p1", site.getParticle(0)).setIntProperty("p2", site.getParticle(1)).setIntProperty("p3", site.getParticle(2)).setDoubleProperty("w12", site.getWeight12()).setDoubleProperty("w13", site.getWeight13()).setDoubleProperty("wc", site.getWeightCross());
+    }
+    if (typeid(vsite) == typeid(LocalCoordinatesSite)) {
+        const LocalCoordinatesSite& site = dynamic_cast<const LocalCoordinatesSite&>(vsite);
+        Vec3 wo = site.getOriginWeights();
+        Vec3 wx = site.getXWeights();
+        Vec3 wy = site.getYWeights();
+        Vec3 p = site.getLocalPosition();
+        return parent.createChildNode("LocalCoordinatesSite").setIntProperty("p1", site.getParticle(0)).setIntProperty("p2", site.getParticle(1)).setIntProperty("p3", site.getParticle(2)).
+                setDoubleProperty("wo1", wo[0]).setDoubleProperty("wo2", wo[1]).setDoubleProperty("wo3", wo[2]).
+                setDoubleProperty("wx1", wx[0]).setDoubleProperty("wx2", wx[1]).setDoubleProperty("wx3", wx[2]).
+                setDoubleProperty("wy1", wy[0]).setDoubleProperty("wy2", wy[1]).setDoubleProperty("wy3", wy[2]).
+                setDoubleProperty("pos1", p[0]).setDoubleProperty("pos2", p[1]).setDoubleProperty("pos3", p[2]);
+    }
+    throw OpenMMException("Unsupported virtual site type");
+}
+
+/**
+ * Create a virtual site from the node describing it.
+ */
+static VirtualSite* deserializeVirtualSite(const SerializationNode& vsite) {
+    if (vsite.getName() == "TwoParticleAverageSite")
+        return new TwoParticleAverageSite(vsite.getIntProperty("p1"), vsite.getIntProperty("p2"), vsite.getDoubleProperty("w1"), vsite.getDoubleProperty("w2"));
+    if (vsite.getName() == "ThreeParticleAverageSite")
+        return new ThreeParticleAverageSite(vsite.getIntProperty("p1"), vsite.getIntProperty("p2"), vsite.getIntProperty("p3"), vsite.getDoubleProperty("w1"), vsite.getDoubleProperty("w2"), vsite.getDoubleProperty("w3"));
+    if (vsite.getName() == "OutOfPlaneSite")
+        return new OutOfPlaneSite(vsite.getIntProperty("p1"), vsite.getIntProperty("p2"), vsite.getIntProperty("p3"), vsite.getDoubleProperty("w12"), vsite.getDoubleProperty("w13"), vsite.getDoubleProperty("wc"));
+    if (vsite.getName() == "LocalCoordinatesSite") {
+        Vec3 wo(vsite.getDoubleProperty("wo1"), vsite.getDoubleProperty("wo2"), vsite.getDoubleProperty("wo3"));
+        Vec3 wx(vsite.getDoubleProperty("wx1"), vsite.getDoubleProperty("wx2"), vsite.getDoubleProperty("wx3"));
+        Vec3 wy(vsite.getDoubleProperty("wy1"), vsite.getDoubleProperty("wy2"), vsite.getDoubleProperty("wy3"));
+        Vec3 p(vsite.getDoubleProperty("pos1"), vsite.getDoubleProperty("pos2"), vsite.getDoubleProperty("pos3"));
+        return new LocalCoordinatesSite(vsite.getIntProperty("p1"), vsite.getIntProperty("p2"), vsite.getIntProperty("p3"), wo, wx, wy, p);
+    }
+    throw OpenMMException("Unknown virtual site type: "+vsite.getName());
+}
+
 void SystemProxy::serialize(const void* object, SerializationNode& node) const {
-    node.setIntProperty("version", 1);
+    node.setIntProperty("version", 2);
     const System& system = *reinterpret_cast<const System*>(object);
     Vec3 a, b, c;
     system.getDefaultPeriodicBoxVectors(a, b, c);
@@ -52,49 +103,27 @@ void SystemProxy::serialize(const void* object, SerializationNode& node) const {
     box.createChildNode("B").setDoubleProperty("x", b[0]).setDoubleProperty("y", b[1]).setDoubleProperty("z", b[2]);
     box.createChildNode("C").setDoubleProperty("x", c[0]).setDoubleProperty("y", c[1]).setDoubleProperty("z", c[2]);
     SerializationNode& particles = node.createChildNode("Particles");
+    vector<double> mass(system.getNumParticles());
     for (int i = 0; i < system.getNumParticles(); i++) {
-        SerializationNode& particle = particles.createChildNode("Particle").setDoubleProperty("mass", system.getParticleMass(i));
-        if (system.isVirtualSite(i)) {
-            if (typeid(system.getVirtualSite(i)) == typeid(TwoParticleAverageSite)) {
-                const TwoParticleAverageSite& site = dynamic_cast<const TwoParticleAverageSite&>(system.getVirtualSite(i));
-                particle.createChildNode("TwoParticleAverageSite").setIntProperty("p1", site.getParticle(0)).setIntProperty("p2", site.getParticle(1)).setDoubleProperty("w1", site.getWeight(0)).setDoubleProperty("w2", site.getWeight(1));
-            }
-            else if (typeid(system.getVirtualSite(i)) == typeid(ThreeParticleAverageSite)) {
-                const ThreeParticleAverageSite& site = dynamic_cast<const ThreeParticleAverageSite&>(system.getVirtualSite(i));
-                particle.createChildNode("ThreeParticleAverageSite").setIntProperty("p1", site.getParticle(0)).setIntProperty("p2", site.getParticle(1)).setIntProperty("p3", site.getParticle(2)).setDoubleProperty("w1", site.getWeight(0)).setDoubleProperty("w2", site.getWeight(1)).setDoubleProperty("w3", site.getWeight(2));
-            }
-            else if (typeid(system.getVirtualSite(i)) == typeid(OutOfPlaneSite)) {
-                const OutOfPlaneSite& site = dynamic_cast<const OutOfPlaneSite&>(system.getVirtualSite(i));
-                particle.createChildNode("OutOfPlaneSite").setIntProperty("p1", site.getParticle(0)).setIntProperty("p2", site.getParticle(1)).setIntProperty("p3", site.getParticle(2)).setDoubleProperty("w12", site.getWeight12()).setDoubleProperty("w13", site.getWeight13()).setDoubleProperty("wc", site.getWeightCross());
-            }
-            else if (typeid(system.getVirtualSite(i)) == typeid(LocalCoordinatesSite)) {
-                const LocalCoordinatesSite& site = dynamic_cast<const LocalCoordinatesSite&>(system.getVirtualSite(i));
-                Vec3 wo = site.getOriginWeights();
-                Vec3 wx = site.getXWeights();
-                Vec3 wy = site.getYWeights();
-                Vec3 p = site.getLocalPosition();
-                particle.createChildNode("LocalCoordinatesSite").setIntProperty("p1", site.getParticle(0)).setIntProperty("p2", site.getParticle(1)).setIntProperty("p3", site.getParticle(2)).
-                        setDoubleProperty("wo1", wo[0]).setDoubleProperty("wo2", wo[1]).setDoubleProperty("wo3", wo[2]).
-                        setDoubleProperty("wx1", wx[0]).setDoubleProperty("wx2", wx[1]).setDoubleProperty("wx3", wx[2]).
-                        setDoubleProperty("wy1", wy[0]).setDoubleProperty("wy2", wy[1]).setDoubleProperty("wy3", wy[2]).
-                        setDoubleProperty("pos1", p[0]).setDoubleProperty("pos2", p[1]).setDoubleProperty("pos3", p[2]);
-            }
-        }
+        mass[i] = system.getParticleMass(i);
+        if (system.isVirtualSite(i))
+            serializeVirtualSite(system.getVirtualSite(i), particles).setIntProperty("index", i);
     }
+    particles.setDoubleArrayProperty("mass", mass);
     SerializationNode& constraints = node.createChildNode("Constraints");
-    for (int i = 0; i < system.getNumConstraints(); i++) {
-        int particle1, particle2;
-        double distance;
-        system.getConstraintParameters(i, particle1, particle2, distance);
-        constraints.createChildNode("Constraint").setIntProperty("p1", particle1).setIntProperty("p2", particle2).setDoubleProperty("d", distance);
-    }
+    vector<int> p1(system.getNumConstraints()), p2(system.getNumConstraints());
+    vector<double> d(system.getNumConstraints());
+    for (int i = 0; i < system.getNumConstraints(); i++)
+        system.getConstraintParameters(i, p1[i], p2[i], d[i]);
+    constraints.setIntArrayProperty("p1", p1).setIntArrayProperty("p2", p2).setDoubleArrayProperty("d", d);
     SerializationNode& forces = node.createChildNode("Forces");
     for (int i = 0; i < system.getNumForces(); i++)
         forces.createChildNode("Force", &system.getForce(i));
 }
 
 void* SystemProxy::deserialize(const SerializationNode& node) const {
-    if (node.getIntProperty("version") != 1)
+    int version = node.getIntProperty("version");
+    if (version < 1 || version > 2)
         throw OpenMMException("Unsupported version number");
     System* system = new System();
     try {
@@ -107,29 +136,35 @@ void* SystemProxy::deserialize(const SerializationNode& node) const {
         Vec3 c(boxc.getDoubleProperty("x"), boxc.getDoubleProperty("y"), boxc.getDoubleProperty("z"));
         system->setDefaultPeriodicBoxVectors(a, b, c);
         const SerializationNode& particles = node.getChildNode("Particles");
-        for (int i = 0; i < (int) particles.getChildren().size(); i++) {
-            system->addParticle(particles.getChildren()[i].getDoubleProperty("mass"));
-            if (particles.getChildren()[i].getChildren().size() > 0) {
-                const SerializationNode& vsite = particles.getChildren()[i].getChildren()[0];
-                if (vsite.getName() == "TwoParticleAverageSite")
-                    system->setVirtualSite(i, new TwoParticleAverageSite(vsite.getIntProperty("p1"), vsite.getIntProperty("p2"), vsite.getDoubleProperty("w1"), vsite.getDoubleProperty("w2")));
-                else if (vsite.getName() == "ThreeParticleAverageSite")
-                    system->setVirtualSite(i, new ThreeParticleAverageSite(vsite.getIntProperty("p1"), vsite.getIntProperty("p2"), vsite.getIntProperty("p3"), vsite.getDoubleProperty("w1"), vsite.getDoubleProperty("w2"), vsite.getDoubleProperty("w3")));
-                else if (vsite.getName() == "OutOfPlaneSite")
-                    system->setVirtualSite(i, new OutOfPlaneSite(vsite.getIntProperty("p1"), vsite.getIntProperty("p2"), vsite.getIntProperty("p3"), vsite.getDoubleProperty("w12"), vsite.getDoubleProperty("w13"), vsite.getDoubleProperty("wc")));
-                else if (vsite.getName() == "LocalCoordinatesSite") {
-                    Vec3 wo(vsite.getDoubleProperty("wo1"), vsite.getDoubleProperty("wo2"), vsite.getDoubleProperty("wo3"));
-                    Vec3 wx(vsite.getDoubleProperty("wx1"), vsite.getDoubleProperty("wx2"), vsite.getDoubleProperty("wx3"));
-                    Vec3 wy(vsite.getDoubleProperty("wy1"), vsite.getDoubleProperty("wy2"), vsite.getDoubleProperty("wy3"));
-                    Vec3 p(vsite.getDoubleProperty("pos1"), vsite.getDoubleProperty("pos2"), vsite.getDoubleProperty("pos3"));
-                    system->setVirtualSite(i, new LocalCoordinatesSite(vsite.getIntProperty("p1"), vsite.getIntProperty("p2"), vsite.getIntProperty("p3"), wo, wx, wy, p));
-                }
+        const SerializationNode& constraints = node.getChildNode("Constraints");
+        if (version == 1) {
+            // Older versions stored a separate node for every particle and constraint.
+
+            for (int i = 0; i < (int) particles.getChildren().size(); i++) {
+                system->addParticle(particles.getChildren()[i].getDoubleProperty("mass"));
+                if (particles.getChildren()[i].getChildren().size() > 0)
+                    system->setVirtualSite(i, deserializeVirtualSite(particles.getChildren()[i].getChildren()[0]));
+            }
+            for (int i = 0; i < (int) constraints.getChildren().size(); i++) {
+                const SerializationNode& constraint = constraints.getChildren()[i];
+                system->addConstraint(constraint.getIntProperty("p1"), constraint.getIntProperty("p2"), constraint.getDoubleProperty("d"));
             }
         }
-        const SerializationNode& constraints = node.getChildNode("Constraints");
-        for (int i = 0; i < (int) constraints.getChildren().size(); i++) {
-            const SerializationNode& constraint = constraints.getChildren()[i];
-            system->addConstraint(constraint.getIntProperty("p1"), constraint.getIntProperty("p2"), constraint.getDoubleProperty("d"));
+        else {
+            const vector<double>& mass = particles.getDoubleArrayProperty("mass");
+            for (int i = 0; i < (int) mass.size(); i++)
+                system->addParticle(mass[i]);
+            for (int i = 0; i < (int) particles.getChildren().size(); i++) {
+                const SerializationNode& vsite = particles.getChildren()[i];
+                system->setVirtualSite(vsite.getIntProperty("index"), deserializeVirtualSite(vsite));
+            }
+            const vector<int>& p1 = constraints.getIntArrayProperty("p1");
+            const vector<int>& p2 = constraints.getIntArrayProperty("p2");
+            const vector<double>& d = constraints.getDoubleArrayProperty("d");
+            if (p2.size() != p1.size() || d.size() != p1.size())
+                throw OpenMMException("SystemProxy: Inconsistent number of constraint parameters");
+            for (int i = 0; i < (int) p1.size(); i++)
+                system->addConstraint(p1[i], p2[i], d[i]);
         }
         const SerializationNode& forces = node.getChildNode("Forces");
         for (int i = 0; i < (int) forces.getChildren().size(); i++) {
@@ -141,4 +176,4 @@ void* SystemProxy::deserialize(const SerializationNode& node) const {
         throw;
     }
     return system;
-}
\ No newline at end of file
+}
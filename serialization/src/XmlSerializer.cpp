@@ -31,6 +31,7 @@
 
 #include "openmm/serialization/XmlSerializer.h"
 #include "irrXML.h"
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <map>
@@ -40,6 +41,16 @@ using namespace std;
 using namespace irr;
 using namespace io;
 
+extern "C" char* g_fmt(char*, double);
+extern "C" double strtod2(const char* s00, char** se);
+
+/**
+ * Array properties are written as child elements with these names.  The element's "name" attribute
+ * holds the property name, and its text holds the values separated by spaces.
+ */
+static const char* INT_ARRAY_ELEMENT = "IntArray";
+static const char* DOUBLE_ARRAY_ELEMENT = "DoubleArray";
+
 /**
  * Apply XML encoding to a string.  This is adapted from TinyXML (written by Lee Thomason).
  */
@@ -123,10 +134,33 @@ void XmlSerializer::encodeNode(const SerializationNode& node, std::ostream& stre
         stream << ' ' << name << "=\"" << value << '\"';
     }
     const vector<SerializationNode>& children = node.getChildren();
-    if (children.size() == 0)
+    const map<string, vector<int> >& intArrays = node.getIntArrayProperties();
+    const map<string, vector<double> >& doubleArrays = node.getDoubleArrayProperties();
+    if (children.size() == 0 && intArrays.size() == 0 && doubleArrays.size() == 0)
         stream << "/>\n";
     else {
         stream << ">\n";
+        for (map<string, vector<int> >::const_iterator iter = intArrays.begin(); iter != intArrays.end(); ++iter) {
+            string text;
+            char buffer[32];
+            const vector<int>& values = iter->second;
+            for (int i = 0; i < (int) values.size(); i++) {
+                sprintf(buffer, i == 0 ? "%d" : " %d", values[i]);
+                text.append(buffer);
+            }
+            encodeArray(INT_ARRAY_ELEMENT, iter->first, text, stream, depth+1);
+        }
+        for (map<string, vector<double> >::const_iterator iter = doubleArrays.begin(); iter != doubleArrays.end(); ++iter) {
+            string text;
+            char buffer[32];
+            const vector<double>& values = iter->second;
+            for (int i = 0; i < (int) values.size(); i++) {
+                if (i > 0)
+                    text += ' ';
+                text.append(g_fmt(buffer, values[i]));
+            }
+            encodeArray(DOUBLE_ARRAY_ELEMENT, iter->first, text, stream, depth+1);
+        }
         for (int i = 0; i < (int) children.size(); i++)
             encodeNode(children[i], stream, depth+1);
         for (int i = 0; i < depth; i++)
@@ -135,6 +169,14 @@ void XmlSerializer::encodeNode(const SerializationNode& node, std::ostream& stre
     }
 }
 
+void XmlSerializer::encodeArray(const string& element, const string& name, const string& text, ostream& stream, int depth) {
+    string encodedName;
+    encodeString(name, &encodedName);
+    for (int i = 0; i < depth; i++)
+        stream << '\t';
+    stream << '<' << element << " name=\"" << encodedName << "\">" << text << "</" << element << ">\n";
+}
+
 /**
  * Adapter class to let irrXML read a C++ stream.
  */
@@ -157,6 +199,51 @@ private:
     int size;
 };
 
+/**
+ * Process an XML element representing an array property, and return the text it contains.
+ */
+static string decodeArrayText(IrrXMLReader& xml, string& name) {
+    const char* nameAttribute = xml.getAttributeValue("name");
+    if (nameAttribute == NULL)
+        throw OpenMMException("XmlSerializer: Array element is missing the 'name' attribute");
+    name = nameAttribute;
+    string text;
+    if (xml.isEmptyElement())
+        return text;
+    while (xml.read() && xml.getNodeType() != EXN_ELEMENT_END)
+        if (xml.getNodeType() == EXN_TEXT)
+            text += xml.getNodeData();
+    return text;
+}
+
+static int parseValue(const char* start, char** end, int) {
+    return (int) strtol(start, end, 10);
+}
+
+static double parseValue(const char* start, char** end, double) {
+    return strtod2(start, end);
+}
+
+/**
+ * Parse the space separated values of an array property.
+ */
+template <class T>
+static void parseArray(const string& text, const string& name, vector<T>& values) {
+    const char* start = text.c_str();
+    char* end;
+    while (true) {
+        while (*start == ' ' || *start == '\t' || *start == '\n' || *start == '\r')
+            start++;
+        if (*start == 0)
+            break;
+        T value = parseValue(start, &end, T());
+        if (end == start)
+            throw OpenMMException("XmlSerializer: Illegal value in array property '"+name+"'");
+        values.push_back(value);
+        start = end;
+    }
+}
+
 /**
  * Process an XML node, storing its content into a SerializationNode.
  */
@@ -169,6 +256,23 @@ static void decodeNode(SerializationNode& node, IrrXMLReader& xml) {
         switch (xml.getNodeType()) {
             case EXN_ELEMENT:
             {
+                string elementName = xml.getNodeName();
+                if (elementName == INT_ARRAY_ELEMENT) {
+                    string name;
+                    string text = decodeArrayText(xml, name);
+                    vector<int> values;
+                    parseArray(text, name, values);
+                    node.setIntArrayProperty(name, values);
+                    break;
+                }
+                if (elementName == DOUBLE_ARRAY_ELEMENT) {
+                    string name;
+                    string text = decodeArrayText(xml, name);
+                    vector<double> values;
+                    parseArray(text, name, values);
+                    node.setDoubleArrayProperty(name, values);
+                    break;
+                }
                 SerializationNode& childNode = node.createChildNode(xml.getNodeName());
                 decodeNode(childNode, xml);
                 break;
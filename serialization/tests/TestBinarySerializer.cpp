@@ -0,0 +1,194 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2016 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/System.h"
+#include "openmm/serialization/BinarySerializer.h"
+#include "openmm/serialization/XmlSerializer.h"
+#include <iostream>
+#include <sstream>
+
+using namespace OpenMM;
+using namespace std;
+
+void compareNodes(const SerializationNode& node1, const SerializationNode& node2) {
+    ASSERT_EQUAL(node1.getName(), node2.getName());
+    ASSERT(node1.getProperties() == node2.getProperties());
+    ASSERT(node1.getIntArrayProperties() == node2.getIntArrayProperties());
+    ASSERT(node1.getDoubleArrayProperties() == node2.getDoubleArrayProperties());
+    ASSERT_EQUAL(node1.getChildren().size(), node2.getChildren().size());
+    for (int i = 0; i < (int) node1.getChildren().size(); i++)
+        compareNodes(node1.getChildren()[i], node2.getChildren()[i]);
+}
+
+void testNodes() {
+    // Build a tree that mixes single nodes with runs of nodes that can be stored as tables.
+
+    SerializationNode root;
+    root.setName("Root");
+    root.setIntProperty("version", 2);
+    root.setStringProperty("empty", "");
+    root.setStringProperty("text", string("contains\0null", 13));
+    root.setStringProperty("padded", "007").setStringProperty("trailingZero", "1.50").setStringProperty("exponent", "1e5");
+    root.setIntProperty("minInt", -2147483647-1).setDoubleProperty("large", 1.234e300).setDoubleProperty("small", -5e-310);
+    SerializationNode& list = root.createChildNode("List");
+    for (int i = 0; i < 10; i++)
+        list.createChildNode("Item").setIntProperty("a", i).setDoubleProperty("b", 0.1*i);
+    list.createChildNode("Item").setIntProperty("a", 10);
+    for (int i = 0; i < 3; i++)
+        list.createChildNode("Other").setIntProperty("a", i).setStringProperty("b", i == 1 ? "1.0" : "2").setDoubleProperty("c", 1.0/(i+1));
+    list.createChildNode("Item").createChildNode("Nested").setStringProperty("c", "x");
+    vector<int> ints(100);
+    vector<double> doubles(50);
+    for (int i = 0; i < (int) ints.size(); i++)
+        ints[i] = 3*i-7;
+    for (int i = 0; i < (int) doubles.size(); i++)
+        doubles[i] = 1.0/(i+1);
+    list.createChildNode("Item").setIntArrayProperty("ints", ints).setDoubleArrayProperty("doubles", doubles).setIntArrayProperty("none", vector<int>());
+    root.createChildNode("Empty");
+    root.createChildNode("Empty");
+
+    // Write it out and read it back, and make sure nothing has changed.
+
+    stringstream buffer;
+    BinarySerializer::serialize(root, buffer);
+    SerializationNode copy;
+    BinarySerializer::deserialize(buffer, copy);
+    compareNodes(root, copy);
+}
+
+void testSystem() {
+    // Create a System.
+
+    int numParticles = 1000;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(5, 0, 0), Vec3(0, 4, 0), Vec3(0, 0, 3));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    HarmonicBondForce* bonds = new HarmonicBondForce();
+    system.addForce(nonbonded);
+    system.addForce(bonds);
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0+0.01*i);
+        nonbonded->addParticle((i%2 == 0 ? 0.1 : -0.1)*(i%7), 0.3+0.001*i, 1.0/(i+1));
+    }
+    for (int i = 1; i < numParticles; i++) {
+        bonds->addBond(i-1, i, 0.1*(i%10), 1000.0/i);
+        nonbonded->addException(i-1, i, 0.0, 1.0, 0.0);
+    }
+    system.addConstraint(0, 1, 0.12);
+
+    // Serialize it in binary format and deserialize it.  Converting both copies to XML should produce
+    // identical results.
+
+    stringstream binary;
+    BinarySerializer::serialize<System>(&system, "System", binary);
+    System* copy = BinarySerializer::deserialize<System>(binary);
+    stringstream xml1, xml2;
+    XmlSerializer::serialize<System>(&system, "System", xml1);
+    XmlSerializer::serialize<System>(copy, "System", xml2);
+    ASSERT_EQUAL(xml1.str(), xml2.str());
+    ASSERT(binary.str().size() < xml1.str().size());
+    delete copy;
+}
+
+void testInvalidData() {
+    // Data that is not in the binary format should be rejected.
+
+    stringstream buffer("<System></System>");
+    SerializationNode node;
+    bool threwException = false;
+    try {
+        BinarySerializer::deserialize(buffer, node);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+
+    // So should truncated data.
+
+    System system;
+    system.addParticle(1.0);
+    stringstream binary;
+    BinarySerializer::serialize<System>(&system, "System", binary);
+    string data = binary.str();
+    stringstream truncated(data.substr(0, data.size()-5));
+    threwException = false;
+    try {
+        SerializationNode node2;
+        BinarySerializer::deserialize(truncated, node2);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testByteOrder() {
+    // The data should be little endian regardless of the computer it is written on.
+
+    SerializationNode node;
+    node.setName("a");
+    node.setIntArrayProperty("b", vector<int>(1, 0x01020304));
+    node.setDoubleArrayProperty("c", vector<double>(1, 1.0));
+    stringstream binary;
+    BinarySerializer::serialize(node, binary);
+    const char expected[] = "OpenMM Binary Serialization\n\0"
+            "\1\0\0\0"                                // format version
+            "\3\0\0\0"                                // number of strings
+            "\1\0\0\0" "a" "\1\0\0\0" "b" "\1\0\0\0" "c"  // the strings
+            "\0\0\0\0" "\0\0\0\0"                      // node name and number of properties
+            "\1\0\0\0" "\1\0\0\0" "\1\0\0\0" "\4\3\2\1"      // int array property
+            "\1\0\0\0" "\2\0\0\0" "\1\0\0\0" "\0\0\0\0\0\0\360\77"  // double array property
+            "\0\0\0\0";                               // number of child groups
+    ASSERT_EQUAL(string(expected, sizeof(expected)-1), binary.str());
+    SerializationNode copy;
+    BinarySerializer::deserialize(binary, copy);
+    compareNodes(node, copy);
+}
+
+int main() {
+    try {
+        testNodes();
+        testSystem();
+        testInvalidData();
+        testByteOrder();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
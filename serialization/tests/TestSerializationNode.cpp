@@ -75,9 +75,43 @@ void testProperties() {
     ASSERT_EQUAL(false, node.hasProperty("prop2"));
 }
 
+void testArrayProperties() {
+    SerializationNode node;
+    node.setName("node");
+    ASSERT_EQUAL(false, node.hasArrayProperty("prop1"));
+    bool exists = false;
+    try {
+        node.getIntArrayProperty("prop1");
+        exists = true;
+    }
+    catch (const exception& ex) {
+    }
+    ASSERT_EQUAL(false, exists);
+    vector<int> ints;
+    vector<double> doubles;
+    for (int i = 0; i < 10; i++) {
+        ints.push_back(i*i-20);
+        doubles.push_back(1.0/(i+1));
+    }
+    node.setIntArrayProperty("prop1", ints).setDoubleArrayProperty("prop2", doubles);
+    ASSERT_EQUAL(true, node.hasArrayProperty("prop1"));
+    ASSERT_EQUAL(true, node.hasArrayProperty("prop2"));
+    ASSERT_EQUAL(false, node.hasProperty("prop1"));
+    ASSERT(ints == node.getIntArrayProperty("prop1"));
+    ASSERT(doubles == node.getDoubleArrayProperty("prop2"));
+    try {
+        node.getDoubleArrayProperty("prop1");
+        exists = true;
+    }
+    catch (const exception& ex) {
+    }
+    ASSERT_EQUAL(false, exists);
+}
+
 int main() {
     try {
         testProperties();
+        testArrayProperties();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
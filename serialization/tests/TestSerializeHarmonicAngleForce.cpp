@@ -72,9 +72,36 @@ void testSerialization() {
     }
 }
 
+void testReadVersion1() {
+    // Older versions of the proxy stored a separate node for every angle.  Make sure they can still be read.
+
+    string xml =
+        "<?xml version=\"1.0\" ?>\n"
+        "<Force forceGroup=\"3\" type=\"HarmonicAngleForce\" version=\"1\">\n"
+        "\t<Angles>\n"
+        "\t\t<Angle a=\"1\" k=\"2\" p1=\"0\" p2=\"1\" p3=\"3\"/>\n"
+        "\t\t<Angle a=\"2.5\" k=\"2.1\" p1=\"5\" p2=\"2\" p3=\"4\"/>\n"
+        "\t</Angles>\n"
+        "</Force>\n";
+    stringstream buffer(xml);
+    HarmonicAngleForce* force = XmlSerializer::deserialize<HarmonicAngleForce>(buffer);
+    ASSERT_EQUAL(3, force->getForceGroup());
+    ASSERT_EQUAL(2, force->getNumAngles());
+    int p1, p2, p3;
+    double angle, k;
+    force->getAngleParameters(1, p1, p2, p3, angle, k);
+    ASSERT_EQUAL(5, p1);
+    ASSERT_EQUAL(2, p2);
+    ASSERT_EQUAL(4, p3);
+    ASSERT_EQUAL(2.5, angle);
+    ASSERT_EQUAL(2.1, k);
+    delete force;
+}
+
 int main() {
     try {
         testSerialization();
+        testReadVersion1();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
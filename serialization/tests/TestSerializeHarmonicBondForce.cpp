@@ -71,9 +71,35 @@ void testSerialization() {
     }
 }
 
+void testReadVersion1() {
+    // Older versions of the proxy stored a separate node for every bond.  Make sure they can still be read.
+
+    string xml =
+        "<?xml version=\"1.0\" ?>\n"
+        "<Force forceGroup=\"3\" type=\"HarmonicBondForce\" version=\"1\">\n"
+        "\t<Bonds>\n"
+        "\t\t<Bond d=\"1\" k=\"2\" p1=\"0\" p2=\"1\"/>\n"
+        "\t\t<Bond d=\"2.5\" k=\"2.1\" p1=\"5\" p2=\"2\"/>\n"
+        "\t</Bonds>\n"
+        "</Force>\n";
+    stringstream buffer(xml);
+    HarmonicBondForce* force = XmlSerializer::deserialize<HarmonicBondForce>(buffer);
+    ASSERT_EQUAL(3, force->getForceGroup());
+    ASSERT_EQUAL(2, force->getNumBonds());
+    int p1, p2;
+    double d, k;
+    force->getBondParameters(1, p1, p2, d, k);
+    ASSERT_EQUAL(5, p1);
+    ASSERT_EQUAL(2, p2);
+    ASSERT_EQUAL(2.5, d);
+    ASSERT_EQUAL(2.1, k);
+    delete force;
+}
+
 int main() {
     try {
         testSerialization();
+        testReadVersion1();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
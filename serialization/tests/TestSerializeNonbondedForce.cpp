@@ -108,9 +108,52 @@ void testSerialization() {
     }
 }
 
+void testReadVersion1() {
+    // Older versions of the proxy stored a separate node for every particle and exception.  Make sure they
+    // can still be read.
+
+    string xml =
+        "<?xml version=\"1.0\" ?>\n"
+        "<Force alpha=\".5\" cutoff=\"2\" dispersionCorrection=\"0\" ewaldTolerance=\".001\" forceGroup=\"3\" method=\"2\" nx=\"3\" ny=\"5\" nz=\"7\" recipForceGroup=\"-1\" rfDielectric=\"50\" switchingDistance=\"1.5\" type=\"NonbondedForce\" useSwitchingFunction=\"1\" version=\"1\">\n"
+        "\t<Particles>\n"
+        "\t\t<Particle eps=\".01\" q=\"1\" sig=\".1\"/>\n"
+        "\t\t<Particle eps=\".02\" q=\".5\" sig=\".2\"/>\n"
+        "\t\t<Particle eps=\".03\" q=\"-.5\" sig=\".3\"/>\n"
+        "\t</Particles>\n"
+        "\t<Exceptions>\n"
+        "\t\t<Exception eps=\".1\" p1=\"0\" p2=\"1\" q=\"2\" sig=\".5\"/>\n"
+        "\t\t<Exception eps=\".2\" p1=\"1\" p2=\"2\" q=\".2\" sig=\".4\"/>\n"
+        "\t</Exceptions>\n"
+        "</Force>\n";
+    stringstream buffer(xml);
+    NonbondedForce* force = XmlSerializer::deserialize<NonbondedForce>(buffer);
+    ASSERT_EQUAL(3, force->getForceGroup());
+    ASSERT_EQUAL(NonbondedForce::CutoffPeriodic, force->getNonbondedMethod());
+    ASSERT_EQUAL(2.0, force->getCutoffDistance());
+    ASSERT(force->getUseSwitchingFunction());
+    ASSERT(!force->getUseDispersionCorrection());
+    ASSERT_EQUAL(3, force->getNumParticles());
+    double charge, sigma, epsilon;
+    force->getParticleParameters(2, charge, sigma, epsilon);
+    ASSERT_EQUAL(-0.5, charge);
+    ASSERT_EQUAL(0.3, sigma);
+    ASSERT_EQUAL(0.03, epsilon);
+    ASSERT_EQUAL(2, force->getNumExceptions());
+    int p1, p2;
+    double chargeProd;
+    force->getExceptionParameters(1, p1, p2, chargeProd, sigma, epsilon);
+    ASSERT_EQUAL(1, p1);
+    ASSERT_EQUAL(2, p2);
+    ASSERT_EQUAL(0.2, chargeProd);
+    ASSERT_EQUAL(0.4, sigma);
+    ASSERT_EQUAL(0.2, epsilon);
+    delete force;
+}
+
 int main() {
     try {
         testSerialization();
+        testReadVersion1();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
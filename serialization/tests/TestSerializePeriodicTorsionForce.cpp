@@ -74,9 +74,38 @@ void testSerialization() {
     }
 }
 
+void testReadVersion1() {
+    // Older versions of the proxy stored a separate node for every torsion.  Make sure they can still be read.
+
+    string xml =
+        "<?xml version=\"1.0\" ?>\n"
+        "<Force forceGroup=\"3\" type=\"PeriodicTorsionForce\" version=\"1\">\n"
+        "\t<Torsions>\n"
+        "\t\t<Torsion k=\"2\" p1=\"0\" p2=\"1\" p3=\"3\" p4=\"4\" periodicity=\"1\" phase=\"1\"/>\n"
+        "\t\t<Torsion k=\"2.1\" p1=\"5\" p2=\"2\" p3=\"4\" p4=\"6\" periodicity=\"3\" phase=\"2.5\"/>\n"
+        "\t</Torsions>\n"
+        "</Force>\n";
+    stringstream buffer(xml);
+    PeriodicTorsionForce* force = XmlSerializer::deserialize<PeriodicTorsionForce>(buffer);
+    ASSERT_EQUAL(3, force->getForceGroup());
+    ASSERT_EQUAL(2, force->getNumTorsions());
+    int p1, p2, p3, p4, periodicity;
+    double phase, k;
+    force->getTorsionParameters(1, p1, p2, p3, p4, periodicity, phase, k);
+    ASSERT_EQUAL(5, p1);
+    ASSERT_EQUAL(2, p2);
+    ASSERT_EQUAL(4, p3);
+    ASSERT_EQUAL(6, p4);
+    ASSERT_EQUAL(3, periodicity);
+    ASSERT_EQUAL(2.5, phase);
+    ASSERT_EQUAL(2.1, k);
+    delete force;
+}
+
 int main() {
     try {
         testSerialization();
+        testReadVersion1();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
@@ -76,9 +76,41 @@ void testSerialization() {
     }
 }
 
+void testReadVersion1() {
+    // Older versions of the proxy stored a separate node for every torsion.  Make sure they can still be read.
+
+    string xml =
+        "<?xml version=\"1.0\" ?>\n"
+        "<Force forceGroup=\"3\" type=\"RBTorsionForce\" version=\"1\">\n"
+        "\t<Torsions>\n"
+        "\t\t<Torsion c0=\"1\" c1=\"2\" c2=\"3\" c3=\"4\" c4=\"5\" c5=\"6\" p1=\"0\" p2=\"1\" p3=\"3\" p4=\"4\"/>\n"
+        "\t\t<Torsion c0=\"0.5\" c1=\"-1.5\" c2=\"2.5\" c3=\"-3.5\" c4=\"4.5\" c5=\"-5.5\" p1=\"5\" p2=\"2\" p3=\"4\" p4=\"6\"/>\n"
+        "\t</Torsions>\n"
+        "</Force>\n";
+    stringstream buffer(xml);
+    RBTorsionForce* force = XmlSerializer::deserialize<RBTorsionForce>(buffer);
+    ASSERT_EQUAL(3, force->getForceGroup());
+    ASSERT_EQUAL(2, force->getNumTorsions());
+    int p1, p2, p3, p4;
+    double c0, c1, c2, c3, c4, c5;
+    force->getTorsionParameters(1, p1, p2, p3, p4, c0, c1, c2, c3, c4, c5);
+    ASSERT_EQUAL(5, p1);
+    ASSERT_EQUAL(2, p2);
+    ASSERT_EQUAL(4, p3);
+    ASSERT_EQUAL(6, p4);
+    ASSERT_EQUAL(0.5, c0);
+    ASSERT_EQUAL(-1.5, c1);
+    ASSERT_EQUAL(2.5, c2);
+    ASSERT_EQUAL(-3.5, c3);
+    ASSERT_EQUAL(4.5, c4);
+    ASSERT_EQUAL(-5.5, c5);
+    delete force;
+}
+
 int main() {
     try {
         testSerialization();
+        testReadVersion1();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
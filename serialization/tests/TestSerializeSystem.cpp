@@ -119,9 +119,56 @@ void testSerialization() {
     delete copy;
 }
 
+void testReadVersion1() {
+    // Older versions of the proxy stored a separate node for every particle and constraint.  Make sure
+    // they can still be read.
+
+    string xml =
+        "<?xml version=\"1.0\" ?>\n"
+        "<System type=\"System\" version=\"1\">\n"
+        "\t<PeriodicBoxVectors>\n"
+        "\t\t<A x=\"2\" y=\"0\" z=\"0\"/>\n"
+        "\t\t<B x=\"0\" y=\"3\" z=\"0\"/>\n"
+        "\t\t<C x=\"0\" y=\"0\" z=\"4\"/>\n"
+        "\t</PeriodicBoxVectors>\n"
+        "\t<Particles>\n"
+        "\t\t<Particle mass=\"1.5\"/>\n"
+        "\t\t<Particle mass=\"2.5\"/>\n"
+        "\t\t<Particle mass=\"0\">\n"
+        "\t\t\t<TwoParticleAverageSite p1=\"0\" p2=\"1\" w1=\".4\" w2=\".6\"/>\n"
+        "\t\t</Particle>\n"
+        "\t</Particles>\n"
+        "\t<Constraints>\n"
+        "\t\t<Constraint d=\"1.25\" p1=\"0\" p2=\"1\"/>\n"
+        "\t</Constraints>\n"
+        "\t<Forces/>\n"
+        "</System>\n";
+    stringstream buffer(xml);
+    System* system = XmlSerializer::deserialize<System>(buffer);
+    ASSERT_EQUAL(3, system->getNumParticles());
+    ASSERT_EQUAL(1.5, system->getParticleMass(0));
+    ASSERT_EQUAL(2.5, system->getParticleMass(1));
+    ASSERT(!system->isVirtualSite(1));
+    ASSERT(system->isVirtualSite(2));
+    const TwoParticleAverageSite& site = dynamic_cast<const TwoParticleAverageSite&>(system->getVirtualSite(2));
+    ASSERT_EQUAL(0.6, site.getWeight(1));
+    ASSERT_EQUAL(1, system->getNumConstraints());
+    int p1, p2;
+    double d;
+    system->getConstraintParameters(0, p1, p2, d);
+    ASSERT_EQUAL(0, p1);
+    ASSERT_EQUAL(1, p2);
+    ASSERT_EQUAL(1.25, d);
+    Vec3 a, b, c;
+    system->getDefaultPeriodicBoxVectors(a, b, c);
+    ASSERT_EQUAL_VEC(Vec3(0, 0, 4), c, 0);
+    delete system;
+}
+
 int main() {
     try {
         testSerialization();
+        testReadVersion1();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
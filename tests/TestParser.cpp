@@ -210,6 +210,64 @@ void testCustomFunction(const string& expression, const string& equivalent) {
     verifySameValue(deriv3, deriv4, 2.0, -3.0);
 }
 
+void testMultipleOutputs() {
+    // Compile several expressions together, including ones that share subexpressions, a bare variable, and a constant.
+
+    const char* expressions[] = {"x^2+y", "sin(x^2)*(x^2+y)", "y", "3", "exp(-x^2)/(x^2+y)"};
+    const int numExpressions = 5;
+    vector<ParsedExpression> parsed;
+    for (int i = 0; i < numExpressions; i++)
+        parsed.push_back(Parser::parse(expressions[i]));
+    CompiledExpression multi(parsed);
+    assertNumbersEqual(numExpressions, multi.getNumOutputs());
+    CompiledExpression copy = multi;
+    double& x = multi.getVariableReference("x");
+    double& y = multi.getVariableReference("y");
+    double& xcopy = copy.getVariableReference("x");
+    double& ycopy = copy.getVariableReference("y");
+    for (int trial = 0; trial < 3; trial++) {
+        map<string, double> variables;
+        variables["x"] = x = xcopy = 0.5+trial;
+        variables["y"] = y = ycopy = 2.0-trial;
+        double first = multi.evaluate();
+        copy.evaluate();
+        assertNumbersEqual(first, parsed[0].evaluate(variables));
+        for (int i = 0; i < numExpressions; i++) {
+            double expected = parsed[i].evaluate(variables);
+            assertNumbersEqual(expected, multi.getOutput(i));
+            assertNumbersEqual(expected, copy.getOutput(i));
+        }
+    }
+}
+
+void testSharedCode() {
+    // Identical expressions may share generated code, but each one must still have its own variables.
+
+    ParsedExpression parsed = Parser::parse("x^2+sin(y)*x");
+    CompiledExpression* first = new CompiledExpression(parsed.createCompiledExpression());
+    CompiledExpression second = Parser::parse("x^2+sin(y)*x").createCompiledExpression();
+    CompiledExpression third = second;
+    first->getVariableReference("x") = 1.0;
+    first->getVariableReference("y") = 2.0;
+    second.getVariableReference("x") = 3.0;
+    second.getVariableReference("y") = 4.0;
+    third.getVariableReference("x") = 5.0;
+    third.getVariableReference("y") = 6.0;
+    assertNumbersEqual(1.0+std::sin(2.0), first->evaluate());
+    assertNumbersEqual(9.0+3.0*std::sin(4.0), second.evaluate());
+    assertNumbersEqual(25.0+5.0*std::sin(6.0), third.evaluate());
+
+    // Deleting one of them should not affect the others.
+
+    delete first;
+    assertNumbersEqual(9.0+3.0*std::sin(4.0), second.evaluate());
+    third = Parser::parse("x^2+sin(y)*x").createCompiledExpression();
+    third.getVariableReference("x") = 1.0;
+    third.getVariableReference("y") = 2.0;
+    assertNumbersEqual(1.0+std::sin(2.0), third.evaluate());
+    assertNumbersEqual(9.0+3.0*std::sin(4.0), second.evaluate());
+}
+
 int main() {
     try {
         verifyEvaluation("5", 5.0);
@@ -289,6 +347,8 @@ int main() {
         verifyDerivative("select(x, x^2, 3*x)", "select(x, 2*x, 3)");
         testCustomFunction("custom(x, y)/2", "x*y");
         testCustomFunction("custom(x^2, 1)+custom(2, y-1)", "2*x^2+4*(y-1)");
+        testMultipleOutputs();
+        testSharedCode();
         cout << Parser::parse("x*x").optimize() << endl;
         cout << Parser::parse("x*(x*x)").optimize() << endl;
         cout << Parser::parse("(x*x)*x").optimize() << endl;
@@ -0,0 +1,276 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2016 Stanford University and the Authors.           *
+ * Authors: Robert T. McGibbon                                                *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests vectorized operations.
+ */
+
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/internal/hardware.h"
+#include "openmm/internal/vectorize16.h"
+#include <iostream>
+
+#ifndef __AVX512F__
+bool isVec16Supported() {
+    return false;
+}
+#else
+/**
+ * Check whether 16 component vectors are supported with the current CPU.
+ */
+bool isVec16Supported() {
+    // Make sure the CPU supports AVX-512F, AVX2, and FMA, and that the operating system saves
+    // the AVX-512 registers.
+
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0);
+    if (cpuInfo[0] < 7)
+        return false;
+    cpuid(cpuInfo, 1);
+    bool hasFma = ((cpuInfo[2] & ((int) 1 << 12)) != 0);
+    bool hasOsxsave = ((cpuInfo[2] & ((int) 1 << 27)) != 0);
+    if (!hasFma || !hasOsxsave)
+        return false;
+    if ((getEnabledRegisterStates() & 0xE6) != 0xE6)
+        return false;
+    cpuidex(cpuInfo, 7, 0);
+    bool hasAvx2 = ((cpuInfo[1] & ((int) 1 << 5)) != 0);
+    bool hasAvx512f = ((cpuInfo[1] & ((int) 1 << 16)) != 0);
+    return (hasAvx2 && hasAvx512f);
+}
+#endif
+
+using namespace OpenMM;
+using namespace std;
+
+void assertVec16Equal(const fvec16& found, const float* expected, double tol=1e-6) {
+    float values[16];
+    found.store(values);
+    for (int i = 0; i < 16; i++)
+        ASSERT_EQUAL_TOL(expected[i], values[i], tol);
+}
+
+void assertVec16EqualInt(const ivec16& found, const int* expected) {
+    int values[16];
+    found.store(values);
+    for (int i = 0; i < 16; i++)
+        ASSERT_EQUAL(expected[i], values[i]);
+}
+
+void testLoadStore() {
+    float f[16], expected[16];
+    int ints[16];
+    for (int i = 0; i < 16; i++) {
+        f[i] = 0.5f*i-2.0f;
+        ints[i] = 3*i-7;
+    }
+    fvec16 f1(f);
+    ivec16 i1(ints);
+    assertVec16Equal(f1, f);
+    assertVec16EqualInt(i1, ints);
+    fvec16 f2(f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7], f[8], f[9], f[10], f[11], f[12], f[13], f[14], f[15]);
+    ivec16 i2(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], ints[6], ints[7], ints[8], ints[9], ints[10], ints[11], ints[12], ints[13], ints[14], ints[15]);
+    assertVec16Equal(f2, f);
+    assertVec16EqualInt(i2, ints);
+    for (int i = 0; i < 16; i++)
+        expected[i] = 2.0f;
+    assertVec16Equal(fvec16(2.0f), expected);
+    fvec8 lower = f1.lowerVec(), upper = f1.upperVec();
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQUAL(f[i], lower.lowerVec()[i]);
+        ASSERT_EQUAL(f[i+4], lower.upperVec()[i]);
+        ASSERT_EQUAL(f[i+8], upper.lowerVec()[i]);
+        ASSERT_EQUAL(f[i+12], upper.upperVec()[i]);
+    }
+}
+
+void testArithmetic() {
+    float a[16], b[16], expected[16];
+    for (int i = 0; i < 16; i++) {
+        a[i] = 0.5f*(i+1);
+        b[i] = i+1;
+    }
+    fvec16 f1(a), f2(b);
+    for (int i = 0; i < 16; i++)
+        expected[i] = a[i]+b[i];
+    assertVec16Equal(f1+f2, expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = a[i]-b[i];
+    assertVec16Equal(f1-f2, expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = a[i]*b[i];
+    assertVec16Equal(f1*f2, expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = a[i]/b[i];
+    assertVec16Equal(f1/f2, expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = a[i]*b[i]+a[i];
+    assertVec16Equal(fma(f1, f2, f1), expected);
+    fvec16 f3 = f1;
+    f3 += f2;
+    f3 *= f2;
+    for (int i = 0; i < 16; i++)
+        expected[i] = (a[i]+b[i])*b[i];
+    assertVec16Equal(f3, expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = -a[i];
+    assertVec16Equal(-f1, expected);
+    float sum = 0;
+    for (int i = 0; i < 16; i++)
+        sum += a[i];
+    ASSERT_EQUAL_TOL(sum, reduceAdd(f1), 1e-6);
+}
+
+void testComparisons() {
+    float a[16], b[16], expected[16];
+    for (int i = 0; i < 16; i++) {
+        a[i] = i%3;
+        b[i] = 1;
+    }
+    fvec16 v1(a), v2(b), zero(0.0f), one(1.0f);
+    for (int i = 0; i < 16; i++)
+        expected[i] = (a[i] < b[i] ? 1 : 0);
+    assertVec16Equal(blend(zero, one, v1 < v2), expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = (a[i] > b[i] ? 1 : 0);
+    assertVec16Equal(blend(zero, one, v1 > v2), expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = (a[i] == b[i] ? 1 : 0);
+    assertVec16Equal(blend(zero, one, v1 == v2), expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = (a[i] != b[i] ? 1 : 0);
+    assertVec16Equal(blend(zero, one, v1 != v2), expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = (a[i] <= b[i] ? a[i] : 0);
+    assertVec16Equal(v1 & (v1 <= v2), expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = (a[i] >= b[i] ? a[i] : 0);
+    assertVec16Equal(v1 & (v1 >= v2), expected);
+    ASSERT(any(v1 > 1.5f));
+    ASSERT(!any(v1 > 2.5f));
+    int mask = 0x8421;
+    for (int i = 0; i < 16; i++)
+        expected[i] = ((mask>>i)&1 ? 1 : 0);
+    assertVec16Equal(blend(zero, one, expandBitMask(mask)), expected);
+}
+
+void testMathFunctions() {
+    float a[16], b[16], expected[16];
+    for (int i = 0; i < 16; i++) {
+        a[i] = 0.7f*i-5.13f;
+        b[i] = 0.3f*i+0.1f;
+    }
+    fvec16 f1(a), f2(b);
+    for (int i = 0; i < 16; i++)
+        expected[i] = std::floor(a[i]);
+    assertVec16Equal(floor(f1), expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = std::ceil(a[i]);
+    assertVec16Equal(ceil(f1), expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = std::floor(a[i]+0.5f);
+    assertVec16Equal(round(f1), expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = std::abs(a[i]);
+    assertVec16Equal(abs(f1), expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = std::min(a[i], b[i]);
+    assertVec16Equal(min(f1, f2), expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = std::max(a[i], b[i]);
+    assertVec16Equal(max(f1, f2), expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = std::sqrt(b[i]);
+    assertVec16Equal(sqrt(f2), expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = 1/std::sqrt(b[i]);
+    assertVec16Equal(rsqrt(f2), expected, 1e-5);
+    float dot = 0;
+    for (int i = 0; i < 16; i++)
+        dot += a[i]*b[i];
+    ASSERT_EQUAL_TOL(dot, dot16(f1, f2), 1e-5);
+    int truncated[16];
+    for (int i = 0; i < 16; i++)
+        truncated[i] = (int) a[i];
+    assertVec16EqualInt(ivec16(f1), truncated);
+}
+
+void testGatherAndTranspose() {
+    float table[32];
+    for (int i = 0; i < 32; i++)
+        table[i] = 2.0f*i;
+    int index[16], expectedInt[16];
+    float expected[16];
+    for (int i = 0; i < 16; i++) {
+        index[i] = (7*i)%31;
+        expected[i] = table[index[i]];
+    }
+    assertVec16Equal(gather(table, ivec16(index)), expected);
+    fvec4 in[16];
+    for (int i = 0; i < 16; i++)
+        in[i] = fvec4(10.0f*i, 10.0f*i+1, 10.0f*i+2, 10.0f*i+3);
+    fvec16 o1, o2, o3, o4;
+    transpose(in, o1, o2, o3, o4);
+    for (int i = 0; i < 16; i++)
+        expected[i] = 10.0f*i;
+    assertVec16Equal(o1, expected);
+    for (int i = 0; i < 16; i++)
+        expected[i] = 10.0f*i+3;
+    assertVec16Equal(o4, expected);
+    fvec4 out[16];
+    transpose(o1, o2, o3, o4, out);
+    for (int i = 0; i < 16; i++)
+        for (int j = 0; j < 4; j++)
+            ASSERT_EQUAL(in[i][j], out[i][j]);
+    for (int i = 0; i < 16; i++)
+        expectedInt[i] = index[i]+1;
+    assertVec16EqualInt(ivec16(index)+1, expectedInt);
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (!isVec16Supported()) {
+            cout << "CPU is not supported.  Exiting." << endl;
+            return 0;
+        }
+        testLoadStore();
+        testArithmetic();
+        testComparisons();
+        testMathFunctions();
+        testGatherAndTranspose();
+    }
+    catch(const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    cout << "Done" << endl;
+    return 0;
+}
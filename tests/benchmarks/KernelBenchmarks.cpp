@@ -0,0 +1,469 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2016 Stanford University and the Authors.           *
+ * Authors: Robert T. McGibbon                                                *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+/**
+ * This program benchmarks the individual pieces of a simulation on a single Platform.  It builds a set of
+ * standard test systems, then measures the time for each force group, for applying constraints, and for
+ * complete integration steps.  The results are written to stdout as one JSON object per benchmark, so they
+ * can be collected by scripts and compared between releases.  The "profile" entry contains the profiling data
+ * collected by the Context while taking the timed steps (see Context::getProfilingData()).
+ *
+ * Usage: KernelBenchmarks [--platform=name] [--benchmark=name] [--steps=n] [--repeats=n] [--plugins=dir]
+ *                         [--property=name=value]
+ *
+ * --benchmark and --property may be given more than once.  If no benchmark is specified, all of them are run.
+ */
+
+#include "openmm/Context.h"
+#include "openmm/CustomNonbondedForce.h"
+#include "openmm/GBSAOBCForce.h"
+#include "openmm/HarmonicAngleForce.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/LangevinIntegrator.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/PeriodicTorsionForce.h"
+#include "openmm/Platform.h"
+#include "openmm/System.h"
+#include "openmm/internal/timer.h"
+#include "sfmt/SFMT.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace OpenMM;
+using namespace std;
+
+/**
+ * Forces are placed into these groups so each kind of calculation can be timed separately.
+ */
+enum ForceGroup {BondedGroup = 0, DirectGroup = 1, ReciprocalGroup = 2, ImplicitSolventGroup = 3, CustomGroup = 4, NumGroups = 5};
+static const char* groupNames[] = {"bonded", "nonbonded_direct", "pme_reciprocal", "implicit_solvent", "custom_nonbonded"};
+
+static const double WaterSpacing = 0.3104; // Lattice spacing giving a density of 1 g/cm^3
+static const double ChainSpacing = 0.22;
+
+/**
+ * A System to benchmark, along with its initial coordinates.
+ */
+struct BenchmarkSystem {
+    BenchmarkSystem() : system(NULL) {
+    }
+    System* system;
+    vector<Vec3> positions;
+};
+
+/**
+ * Add a rigid TIP3P water molecule with its oxygen at the specified position and a random orientation.
+ */
+static void addWater(System& system, NonbondedForce& nonbonded, vector<Vec3>& positions, Vec3 center, OpenMM_SFMT::SFMT& sfmt) {
+    const double bondLength = 0.09572;
+    const double angle = 104.52*M_PI/180.0;
+    int oxygen = system.addParticle(15.999);
+    system.addParticle(1.008);
+    system.addParticle(1.008);
+    nonbonded.addParticle(-0.834, 0.315061, 0.636386);
+    nonbonded.addParticle(0.417, 1.0, 0.0);
+    nonbonded.addParticle(0.417, 1.0, 0.0);
+    nonbonded.addException(oxygen, oxygen+1, 0.0, 1.0, 0.0);
+    nonbonded.addException(oxygen, oxygen+2, 0.0, 1.0, 0.0);
+    nonbonded.addException(oxygen+1, oxygen+2, 0.0, 1.0, 0.0);
+    system.addConstraint(oxygen, oxygen+1, bondLength);
+    system.addConstraint(oxygen, oxygen+2, bondLength);
+    system.addConstraint(oxygen+1, oxygen+2, 2*bondLength*sin(0.5*angle));
+
+    // Pick two random perpendicular axes to define the plane of the molecule.
+
+    Vec3 axis1, axis2;
+    do {
+        axis1 = Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5);
+    } while (axis1.dot(axis1) < 0.01);
+    axis1 /= sqrt(axis1.dot(axis1));
+    do {
+        axis2 = Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5);
+        axis2 -= axis1*axis1.dot(axis2);
+    } while (axis2.dot(axis2) < 0.01);
+    axis2 /= sqrt(axis2.dot(axis2));
+    positions.push_back(center);
+    positions.push_back(center+(axis1*cos(0.5*angle)+axis2*sin(0.5*angle))*bondLength);
+    positions.push_back(center+(axis1*cos(0.5*angle)-axis2*sin(0.5*angle))*bondLength);
+}
+
+/**
+ * Add a compact chain of bonded atoms, folded back and forth on a cubic lattice, to represent a protein.
+ */
+static void addChain(System& system, NonbondedForce& nonbonded, vector<Vec3>& positions, int atomsPerEdge, Vec3 origin, vector<pair<int, int> >& bonds) {
+    int firstAtom = system.getNumParticles();
+    int numAtoms = atomsPerEdge*atomsPerEdge*atomsPerEdge;
+    for (int i = 0; i < numAtoms; i++) {
+        // Follow a path that reverses direction at the end of every row and every layer, so consecutive atoms
+        // are always lattice neighbors.
+
+        int layer = i/(atomsPerEdge*atomsPerEdge);
+        int row = (i/atomsPerEdge)%atomsPerEdge;
+        int column = i%atomsPerEdge;
+        if (layer%2 == 1)
+            row = atomsPerEdge-1-row;
+        if ((i/atomsPerEdge)%2 == 1)
+            column = atomsPerEdge-1-column;
+        system.addParticle(12.0);
+        nonbonded.addParticle(i%2 == 0 ? 0.3 : -0.3, 0.2, 0.4);
+        positions.push_back(origin+Vec3(column, row, layer)*ChainSpacing);
+    }
+    HarmonicBondForce* bondForce = new HarmonicBondForce();
+    HarmonicAngleForce* angleForce = new HarmonicAngleForce();
+    PeriodicTorsionForce* torsionForce = new PeriodicTorsionForce();
+    bondForce->setForceGroup(BondedGroup);
+    angleForce->setForceGroup(BondedGroup);
+    torsionForce->setForceGroup(BondedGroup);
+    system.addForce(bondForce);
+    system.addForce(angleForce);
+    system.addForce(torsionForce);
+    for (int i = firstAtom; i < firstAtom+numAtoms-1; i++) {
+        bondForce->addBond(i, i+1, ChainSpacing, 2e5);
+        bonds.push_back(make_pair(i, i+1));
+    }
+    vector<bool> isStraight(numAtoms, false);
+    for (int i = firstAtom; i < firstAtom+numAtoms-2; i++) {
+        Vec3 d1 = positions[i]-positions[i+1];
+        Vec3 d2 = positions[i+2]-positions[i+1];
+        double theta = acos(max(-1.0, min(1.0, d1.dot(d2)/(ChainSpacing*ChainSpacing))));
+        angleForce->addAngle(i, i+1, i+2, theta, 400.0);
+        isStraight[i-firstAtom] = (theta > 0.9*M_PI);
+    }
+
+    // A torsion is undefined when three of its atoms are collinear, so only add them at corners.
+
+    for (int i = firstAtom; i < firstAtom+numAtoms-3; i++)
+        if (!isStraight[i-firstAtom] && !isStraight[i-firstAtom+1])
+            torsionForce->addTorsion(i, i+1, i+2, i+3, 3, 0.0, 1.0);
+}
+
+/**
+ * Fill a periodic box with water, skipping any lattice sites that are too close to existing atoms.
+ */
+static void addSolvent(System& system, NonbondedForce& nonbonded, vector<Vec3>& positions, int watersPerEdge, OpenMM_SFMT::SFMT& sfmt) {
+    const double minDistance = 0.3;
+    int numSolute = positions.size();
+    Vec3 soluteMin(1e10, 1e10, 1e10), soluteMax(-1e10, -1e10, -1e10);
+    for (int i = 0; i < numSolute; i++)
+        for (int j = 0; j < 3; j++) {
+            soluteMin[j] = min(soluteMin[j], positions[i][j]);
+            soluteMax[j] = max(soluteMax[j], positions[i][j]);
+        }
+    for (int i = 0; i < watersPerEdge; i++)
+        for (int j = 0; j < watersPerEdge; j++)
+            for (int k = 0; k < watersPerEdge; k++) {
+                Vec3 pos = Vec3(i+0.5, j+0.5, k+0.5)*WaterSpacing;
+                bool overlaps = false;
+                if (pos[0] > soluteMin[0]-minDistance && pos[0] < soluteMax[0]+minDistance &&
+                        pos[1] > soluteMin[1]-minDistance && pos[1] < soluteMax[1]+minDistance &&
+                        pos[2] > soluteMin[2]-minDistance && pos[2] < soluteMax[2]+minDistance) {
+                    for (int m = 0; m < numSolute && !overlaps; m++) {
+                        Vec3 delta = pos-positions[m];
+                        overlaps = (delta.dot(delta) < minDistance*minDistance);
+                    }
+                }
+                if (!overlaps)
+                    addWater(system, nonbonded, positions, pos, sfmt);
+            }
+    double boxSize = watersPerEdge*WaterSpacing;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+}
+
+static NonbondedForce* createPmeForce(System& system) {
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(0.9);
+    nonbonded->setEwaldErrorTolerance(5e-4);
+    nonbonded->setForceGroup(DirectGroup);
+    nonbonded->setReciprocalSpaceForceGroup(ReciprocalGroup);
+    system.addForce(nonbonded);
+    return nonbonded;
+}
+
+/**
+ * A box of water molecules with PME.
+ */
+static void createWaterBox(int watersPerEdge, BenchmarkSystem& result) {
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    result.system = new System();
+    NonbondedForce* nonbonded = createPmeForce(*result.system);
+    addSolvent(*result.system, *nonbonded, result.positions, watersPerEdge, sfmt);
+}
+
+/**
+ * A protein-sized chain in a water box with PME, of similar size to the standard DHFR benchmark.
+ */
+static void createSolvatedChain(BenchmarkSystem& result) {
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    result.system = new System();
+    NonbondedForce* nonbonded = createPmeForce(*result.system);
+    vector<pair<int, int> > bonds;
+    const int atomsPerEdge = 14;
+    const int watersPerEdge = 20;
+    double offset = 0.5*(watersPerEdge*WaterSpacing-(atomsPerEdge-1)*ChainSpacing);
+    addChain(*result.system, *nonbonded, result.positions, atomsPerEdge, Vec3(offset, offset, offset), bonds);
+    nonbonded->createExceptionsFromBonds(bonds, 0.8333, 0.5);
+    addSolvent(*result.system, *nonbonded, result.positions, watersPerEdge, sfmt);
+}
+
+/**
+ * A protein-sized chain in implicit solvent.
+ */
+static void createImplicitChain(BenchmarkSystem& result) {
+    result.system = new System();
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffNonPeriodic);
+    nonbonded->setCutoffDistance(2.0);
+    nonbonded->setForceGroup(DirectGroup);
+    result.system->addForce(nonbonded);
+    vector<pair<int, int> > bonds;
+    addChain(*result.system, *nonbonded, result.positions, 14, Vec3(0, 0, 0), bonds);
+    nonbonded->createExceptionsFromBonds(bonds, 0.8333, 0.5);
+    GBSAOBCForce* gbsa = new GBSAOBCForce();
+    gbsa->setNonbondedMethod(GBSAOBCForce::CutoffNonPeriodic);
+    gbsa->setCutoffDistance(2.0);
+    gbsa->setForceGroup(ImplicitSolventGroup);
+    result.system->addForce(gbsa);
+    for (int i = 0; i < result.system->getNumParticles(); i++) {
+        double charge, sigma, epsilon;
+        nonbonded->getParticleParameters(i, charge, sigma, epsilon);
+        gbsa->addParticle(charge, 0.15, 0.8);
+    }
+}
+
+/**
+ * A water box in which a group of solute molecules interacts with the solvent through a soft-core
+ * Lennard-Jones potential, as in an alchemical free energy calculation.
+ */
+static void createSoftcoreBox(BenchmarkSystem& result) {
+    const int numSoluteWaters = 50;
+    createWaterBox(16, result);
+    NonbondedForce* nonbonded = dynamic_cast<NonbondedForce*>(&result.system->getForce(0));
+    CustomNonbondedForce* softcore = new CustomNonbondedForce("4*epsilon*lambda*(1/x^2-1/x); x=alpha*(1-lambda)+(r/sigma)^6;"
+            "sigma=0.5*(sigma1+sigma2); epsilon=sqrt(epsilon1*epsilon2)");
+    softcore->addGlobalParameter("lambda", 0.5);
+    softcore->addGlobalParameter("alpha", 0.5);
+    softcore->addPerParticleParameter("sigma");
+    softcore->addPerParticleParameter("epsilon");
+    softcore->setNonbondedMethod(CustomNonbondedForce::CutoffPeriodic);
+    softcore->setCutoffDistance(0.9);
+    softcore->setForceGroup(CustomGroup);
+    set<int> solute, solvent;
+    for (int i = 0; i < result.system->getNumParticles(); i++) {
+        double charge, sigma, epsilon;
+        nonbonded->getParticleParameters(i, charge, sigma, epsilon);
+        vector<double> params(2);
+        params[0] = sigma;
+        params[1] = epsilon;
+        softcore->addParticle(params);
+        if (i < 3*numSoluteWaters) {
+            solute.insert(i);
+            nonbonded->setParticleParameters(i, charge, sigma, 0.0);
+        }
+        else
+            solvent.insert(i);
+    }
+    softcore->addInteractionGroup(solute, solvent);
+    for (int i = 0; i < nonbonded->getNumExceptions(); i++) {
+        int p1, p2;
+        double chargeProd, sigma, epsilon;
+        nonbonded->getExceptionParameters(i, p1, p2, chargeProd, sigma, epsilon);
+        softcore->addExclusion(p1, p2);
+    }
+    result.system->addForce(softcore);
+}
+
+static bool createSystem(const string& name, BenchmarkSystem& result) {
+    if (name == "water3k")
+        createWaterBox(10, result);
+    else if (name == "water12k")
+        createWaterBox(16, result);
+    else if (name == "water47k")
+        createWaterBox(25, result);
+    else if (name == "chain_pme")
+        createSolvatedChain(result);
+    else if (name == "chain_gbsa")
+        createImplicitChain(result);
+    else if (name == "softcore")
+        createSoftcoreBox(result);
+    else
+        return false;
+    return true;
+}
+
+/**
+ * Compute the average time in milliseconds to evaluate the forces in a set of force groups.
+ */
+static double timeForceGroups(Context& context, int groups, int repeats) {
+    context.getState(State::Forces, false, groups);
+    double start = getCurrentTime();
+    for (int i = 0; i < repeats; i++)
+        context.getState(State::Forces, false, groups);
+    return 1000*(getCurrentTime()-start)/repeats;
+}
+
+/**
+ * Compute the average time in milliseconds to apply constraints to slightly perturbed coordinates.
+ */
+static double timeConstraints(Context& context, int repeats) {
+    vector<Vec3> positions = context.getState(State::Positions).getPositions();
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(1, sfmt);
+    double elapsed = 0.0;
+    for (int i = 0; i < repeats; i++) {
+        vector<Vec3> perturbed = positions;
+        for (int j = 0; j < (int) perturbed.size(); j++)
+            perturbed[j] += Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5)*1e-3;
+        context.setPositions(perturbed);
+        double start = getCurrentTime();
+        context.applyConstraints(1e-5);
+        elapsed += getCurrentTime()-start;
+    }
+    context.setPositions(positions);
+    return 1000*elapsed/repeats;
+}
+
+static void runBenchmark(const string& name, Platform& platform, const map<string, string>& properties, int steps, int repeats) {
+    BenchmarkSystem benchmark;
+    createSystem(name, benchmark);
+    System& system = *benchmark.system;
+    const double stepSize = (system.getNumConstraints() > 0 ? 0.002 : 0.001);
+    LangevinIntegrator integrator(300.0, 1.0, stepSize);
+    integrator.setConstraintTolerance(1e-5);
+    double start = getCurrentTime();
+    Context context(system, integrator, platform, properties);
+    context.setPositions(benchmark.positions);
+    context.applyConstraints(1e-5);
+    double setupTime = getCurrentTime()-start;
+
+    // Time each force group that is present in the System.
+
+    vector<bool> hasGroup(NumGroups, false);
+    for (int i = 0; i < system.getNumForces(); i++) {
+        hasGroup[system.getForce(i).getForceGroup()] = true;
+        NonbondedForce* nonbonded = dynamic_cast<NonbondedForce*>(&system.getForce(i));
+        if (nonbonded != NULL && nonbonded->getNonbondedMethod() == NonbondedForce::PME)
+            hasGroup[nonbonded->getReciprocalSpaceForceGroup()] = true;
+    }
+    stringstream kernels;
+    kernels.precision(4);
+    for (int i = 0; i < NumGroups; i++)
+        if (hasGroup[i])
+            kernels << "\"" << groupNames[i] << "\": " << timeForceGroups(context, 1<<i, repeats) << ", ";
+    kernels << "\"all_forces\": " << timeForceGroups(context, -1, repeats);
+    if (system.getNumConstraints() > 0)
+        kernels << ", \"constraints\": " << timeConstraints(context, repeats);
+
+    // Time complete integration steps, collecting profiling data to show where the time goes.
+
+    integrator.step(10);
+    context.getState(State::Energy);
+    context.setProfilingEnabled(true);
+    start = getCurrentTime();
+    integrator.step(steps);
+    double elapsed = getCurrentTime()-start;
+    context.setProfilingEnabled(false);
+    const map<string, double>& profile = context.getProfilingData();
+    stringstream profileEntries;
+    profileEntries.precision(4);
+    for (map<string, double>::const_iterator iter = profile.begin(); iter != profile.end(); ++iter)
+        profileEntries << (iter == profile.begin() ? "" : ", ") << "\"" << iter->first << "\": " << iter->second;
+    double nsPerDay = 86400.0*steps*stepSize*1e-3/elapsed;
+    cout.precision(6);
+    cout << "{\"benchmark\": \"" << name << "\", \"platform\": \"" << platform.getName() << "\", \"atoms\": " << system.getNumParticles();
+    cout << ", \"steps\": " << steps << ", \"setup_ms\": " << 1000*setupTime << ", \"step_ms\": " << 1000*elapsed/steps;
+    cout << ", \"ns_per_day\": " << nsPerDay << ", \"kernels_ms\": {" << kernels.str() << "}";
+    cout << ", \"profile\": {" << profileEntries.str() << "}}" << endl;
+    delete benchmark.system;
+}
+
+int main(int argc, char* argv[]) {
+    const char* allBenchmarks[] = {"water3k", "water12k", "water47k", "chain_pme", "chain_gbsa", "softcore"};
+    string platformName = "CPU";
+    string pluginDir = Platform::getDefaultPluginsDirectory();
+    vector<string> benchmarks;
+    map<string, string> properties;
+    int steps = 100, repeats = 10;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        size_t equals = arg.find('=');
+        string option = arg.substr(0, equals);
+        string value = (equals == string::npos ? "" : arg.substr(equals+1));
+        if (option == "--platform")
+            platformName = value;
+        else if (option == "--benchmark")
+            benchmarks.push_back(value);
+        else if (option == "--steps")
+            steps = atoi(value.c_str());
+        else if (option == "--repeats")
+            repeats = atoi(value.c_str());
+        else if (option == "--plugins")
+            pluginDir = value;
+        else if (option == "--property" && value.find('=') != string::npos)
+            properties[value.substr(0, value.find('='))] = value.substr(value.find('=')+1);
+        else {
+            cerr << "Unknown argument: " << arg << endl;
+            return 1;
+        }
+    }
+    if (benchmarks.size() == 0)
+        benchmarks.assign(allBenchmarks, allBenchmarks+sizeof(allBenchmarks)/sizeof(allBenchmarks[0]));
+    try {
+        Platform::loadPluginsFromDirectory(pluginDir);
+        Platform& platform = Platform::getPlatformByName(platformName);
+        for (int i = 0; i < (int) benchmarks.size(); i++) {
+            BenchmarkSystem test;
+            if (!createSystem(benchmarks[i], test)) {
+                cerr << "Unknown benchmark: " << benchmarks[i] << endl;
+                return 1;
+            }
+            delete test.system;
+            runBenchmark(benchmarks[i], platform, properties, steps, repeats);
+        }
+    }
+    catch (const exception& e) {
+        cerr << "exception: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
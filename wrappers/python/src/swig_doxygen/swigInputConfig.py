@@ -92,6 +92,10 @@ SKIP_METHODS = [('State',),
                 ('Context',  'setState'),
                 ('Context',  'createCheckpoint'),
                 ('Context',  'loadCheckpoint'),
+                ('Context',  'createCheckpointAsync'),
+                ('Context',  'getPositions'),
+                ('Context',  'getVelocities'),
+                ('Context',  'computePotentialEnergies'),
                 ('CudaPlatform',),
                 ('Force',    'Force'),
                 ('ParticleParameterInfo',),